@@ -0,0 +1,70 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+ChaCha20 keystream generator with fast key erasure
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#ifndef CHACHA20_RNG_H
+#define CHACHA20_RNG_H
+
+#include <inttypes.h>
+
+/*
+ * Fast key erasure (D. J. Bernstein, 2017): every generate call runs ChaCha20 with the current key,
+ * nonce 0 and block counter starting at 0. The first 32 bytes of the keystream replace the key,
+ * the following bytes are returned. The key used for the output is gone when generate returns.
+ *
+ * Entropy input, personalization string and additional input are mixed into the key by SHA-256:
+ *   instantiate: key = SHA-256(entropy_input || personalization_string)
+ *   reseed:      key = SHA-256(key || entropy_input || additional_input)
+ *   generate:    key = SHA-256(key || additional_input), only when additional input is given
+ *
+ * This is not a NIST SP 800-90A mechanism.
+ */
+
+#define CHACHA20_KEY_BYTES            32
+#define CHACHA20_BLOCK_BYTES          64
+#define CHACHA20_SECURITY_STRENGTH_BYTES CHACHA20_KEY_BYTES
+#define CHACHA20_RNG_RESEED_INTERVAL  (1ULL<<48)
+//Same limit as CTR_DRBG, so the buffering and reseed schedule of csprng.c does not change
+#define CHACHA20_RNG_MAX_NUMBER_OF_BYTES_PER_REQUEST ( (1ULL<<19) / 8 )
+
+typedef struct {
+  uint64_t reseed_counter;
+  uint32_t key[CHACHA20_KEY_BYTES / 4];
+} CHACHA20_RNG;
+
+/*
+ * Same interface as nist_ctr_drbg_*. Functions returning int return 0 on success.
+ * Personalization string and additional input are optional (NULL or length 0).
+ */
+CHACHA20_RNG* chacha20_rng_instantiate(
+    const void* entropy_input, int entropy_input_length,
+    const void* personalization_string, int personalization_string_length);
+int chacha20_rng_reseed(CHACHA20_RNG* rng,
+    const void* entropy_input, int entropy_input_length,
+    const void* additional_input, int additional_input_length);
+int chacha20_rng_generate(CHACHA20_RNG* rng,
+    void* output_string, int output_string_length,
+    const void* additional_input, int additional_input_length);
+int chacha20_rng_destroy(CHACHA20_RNG* rng);
+
+#endif
@@ -0,0 +1,98 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Runtime CPU feature detection and kernel dispatch
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#ifndef CSPRNG_CPU_DISPATCH_H
+#define CSPRNG_CPU_DISPATCH_H
+
+/*
+ * CPU features are probed once (first call of csprng_cpu_dispatch_initialize,
+ * done by csprng_initialize) and the fastest variant of each hot kernel is bound.
+ *
+ * Environment variable CSPRNG_CPU_TIER=generic|sse2|avx2|avx512|vaes
+ * limits the tier. It cannot raise the tier above what the CPU supports.
+ */
+#define CSPRNG_CPU_TIER_ENV "CSPRNG_CPU_TIER"
+
+typedef enum {
+  CSPRNG_CPU_TIER_GENERIC = 0,    //Portable C code
+  CSPRNG_CPU_TIER_SSE2,           //SSE2, plus AES-NI and SHA extensions when present
+  CSPRNG_CPU_TIER_AVX2,           //AVX2, plus 256-bit VAES when present
+  CSPRNG_CPU_TIER_AVX512,         //AVX-512F and AVX-512BW
+  CSPRNG_CPU_TIER_VAES,           //AVX-512 with 512-bit VAES
+  CSPRNG_CPU_TIER_COUNT
+} csprng_cpu_tier_type;
+
+typedef enum {
+  CSPRNG_KERNEL_AES_CTR = 0,      //CTR_DRBG bulk generation
+  CSPRNG_KERNEL_FIPS,             //FIPS 140-2 statistical tests
+  CSPRNG_KERNEL_SHA1_RNG,         //SHA1_RNG hash
+  CSPRNG_KERNEL_MEMT,             //MEMT19937 buffer fill
+  CSPRNG_KERNEL_SHA256,           //SHA-256 compression for Hash_DRBG and HMAC_DRBG
+  CSPRNG_KERNEL_SHA256_MB,        //Multi-buffer SHA-256 for Hash_DRBG generate
+  CSPRNG_KERNEL_SHA512_MB,        //Multi-buffer SHA-512 for Hash_DRBG generate
+  CSPRNG_KERNEL_CHACHA20,         //ChaCha20 keystream
+  CSPRNG_KERNEL_AES_CTR_LANES,    //Multi-lane CTR_DRBG generation
+  CSPRNG_KERNEL_TYPED,            //Conversion to bounded integers, floats and booleans
+  CSPRNG_KERNEL_COUNT
+} csprng_kernel_type;
+
+typedef struct {
+  int sse2;
+  int ssse3;
+  int sse41;
+  int popcnt;
+  int aesni;
+  int sha;
+  int avx2;
+  int avx512f;
+  int avx512bw;
+  int vaes;
+} csprng_cpu_features_type;
+
+extern const char* const csprng_cpu_tier_names[CSPRNG_CPU_TIER_COUNT];
+extern const char* const csprng_kernel_names[CSPRNG_KERNEL_COUNT];
+
+/* Probe the CPU and bind kernels. Can be called any number of times, work is done only once.
+ * Returns 0 on success */
+int csprng_cpu_dispatch_initialize(void);
+
+/* Rebind all kernels for the tier, e.g. to test each variant in turn. The AES cipher is kept,
+ * returns 1 when the CPU or the cipher does not support the tier. Not safe while other threads generate */
+int csprng_cpu_select_tier(csprng_cpu_tier_type tier);
+
+/* Tier in use (after CSPRNG_CPU_TIER override) */
+csprng_cpu_tier_type csprng_cpu_tier(void);
+
+/* Highest tier supported by the CPU */
+csprng_cpu_tier_type csprng_cpu_detected_tier(void);
+
+const csprng_cpu_features_type* csprng_cpu_features(void);
+
+/* Name of the variant bound for the kernel, e.g. "aesni-8x" for CSPRNG_KERNEL_AES_CTR */
+const char* csprng_cpu_kernel_name(csprng_kernel_type kernel);
+
+/* Human readable summary of the detected features, tier and bound kernels. Uses static buffer */
+const char* dump_csprng_cpu_dispatch(void);
+
+#endif
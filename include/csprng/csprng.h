@@ -24,16 +24,28 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 #define CSPRNG_H
 
 #include <inttypes.h>
+#include <sys/uio.h>
+#include <pthread.h>
 #include <csprng/havege.h>
 #include <csprng/nist_ctr_drbg.h>
+#include <csprng/nist_hash_drbg.h>
+#include <csprng/chacha20_rng.h>
 #include <csprng/memt19937ar-JH.h>
 #include <csprng/sha1_rng.h>
 #include <csprng/http_rng.h>
 #include <csprng/fips.h>
+#include <csprng/health_tests.h>
 
 //How long wait for HTTP source?
 #define HTTP_TIMEOUT_IN_SECONDS 45
 
+//Failed FIPS blocks left in place before the validated data are compacted
+#define FIPS_MAX_FAILED_BLOCKS 8
+
+//Size of one buffer of the background producer and maximum number of the buffers
+#define CSPRNG_PRODUCER_BUFFER_SIZE 65536
+#define CSPRNG_PRODUCER_MAX_BUFFERS 1024
+
 typedef enum {NONE, HAVEGE, SHA1_RNG, MT_RNG, HTTP_RNG, STDIN, EXTERNAL, SOURCES_COUNT} rand_source_type;
 // HAVEGE = HAVEGE RNG
 // SHA1_RNG = SHA-1 GENERATOR
@@ -44,18 +56,46 @@ typedef enum {NONE, HAVEGE, SHA1_RNG, MT_RNG, HTTP_RNG, STDIN, EXTERNAL, SOURCES
 // SOURCES_COUNT => STOP POINT
 extern const char* const source_names[SOURCES_COUNT];
 
+typedef enum {DRBG_CTR, DRBG_HASH, DRBG_HMAC, DRBG_CHACHA20, DRBG_AUTO, DRBG_MECHANISMS_COUNT} drbg_mechanism_type;
+// DRBG_CTR = NIST SP 800-90A CTR_DRBG (AES)
+// DRBG_HASH = NIST SP 800-90A Hash_DRBG (SHA-256 or SHA-512)
+// DRBG_HMAC = NIST SP 800-90A HMAC_DRBG (SHA-256 or SHA-512)
+// DRBG_CHACHA20 = ChaCha20 with fast key erasure. Not a NIST SP 800-90A mechanism
+// DRBG_AUTO = the fastest of the NIST mechanisms on this CPU. Resolved by csprng_initialize
+// DRBG_MECHANISMS_COUNT => STOP POINT
+extern const char* const drbg_mechanism_names[DRBG_MECHANISMS_COUNT];
+
+typedef enum {HEALTH_WARN, HEALTH_DROP, HEALTH_FAIL, HEALTH_ACTIONS_COUNT} health_action_type;
+// What a refill does when its data from the source fail the SP 800-90B health tests
+// HEALTH_WARN = the failures are reported, the data are used
+// HEALTH_DROP = the data are wiped and read again. The refill fails after HEALTH_DROP_MAX_BATCHES failing reads in a row
+// HEALTH_FAIL = the data are wiped, the refill fails and the source is not read any more
+// HEALTH_ACTIONS_COUNT => STOP POINT
+#define HEALTH_DROP_MAX_BATCHES 4
+extern const char* const health_action_names[HEALTH_ACTIONS_COUNT];
+
 
 typedef union {
   memt_type* memt;           //Describes Mersenne Twister state
   SHA1_state* sha;           //Describes SHA-1 state
   http_random_state_t* http; //Describes HTTP state
+  havege_type* havege;       //Describes HAVEGE state
 } rng_state_type; 
 
+/* Background refill of rng_buf_type, see mode_of_operation_type.prefetch_watermark */
+typedef struct rng_prefetch_type rng_prefetch_type;
+
+/*
+ * Ring buffer. When ring == 1, buf is mapped twice back to back (buf[i] and buf[i + total_size] are the same byte):
+ * valid data starting at buf_start and the free space after it are always contiguous, refill and read only advance
+ * buf_start and valid_data_size. When the double mapping is not available, valid data is moved to buf before refill.
+ */
 typedef struct {
   unsigned char* buf;               //Buffer to pass values from RNG to CTR_DRBG
   unsigned int total_size;          //Total size of buffer
-  unsigned char* buf_start;         //Start of valid data
+  unsigned char* buf_start;         //Start of valid data, always in the first mapping
   unsigned int valid_data_size;     //Size of valid data
+  char ring;                        //Is buf mapped twice? 0=> False, 1=>True
   char* filename;                   //FILENAME connected with fd
   FILE* fd;                         //Read data from fd. Use NULL if not used
   int eof;                          //EOF detected?
@@ -65,10 +105,29 @@ typedef struct {
   char* buffer_name;                //NAME OF THE BUFFER for debugging purposes
   uint64_t bytes_in;                //Total of bytes received
   uint64_t bytes_out;               //Total of bytes sent out 
+  rng_prefetch_type* prefetch;      //Thread refilling the buffer ahead of demand. NULL => refilled by the reader
+  pthread_mutex_t* source_mutex;    //Serializes refills from a source state shared with other buffers. NULL => not shared
+  uint64_t refills;                 //Number of refills from the source
+  uint64_t refill_ns;               //Total time of the refills in nanoseconds
+  uint64_t refill_max_ns;           //Longest refill in nanoseconds
+  uint64_t stalls;                  //Number of reads which had to wait for a refill
+  uint64_t stall_ns;                //Total time the reads waited in nanoseconds
+  uint64_t stall_max_ns;            //Longest wait in nanoseconds
+  int zero_rounds;                  //HTTP_RNG: how many refills in row got no bytes
+  health_test_ctx_t* health;        //SP 800-90B health tests of the data from the source. NULL => not tested. Shared with the prefetch buffer
+  health_test_statistics_type health_statistics; //health->statistics as of the last refill
+  health_action_type health_action; //What a refill does when the health tests fail
+  uint64_t health_dropped;          //Bytes wiped because they failed the health tests
 } rng_buf_type;
 
 typedef struct {
   int use_df;                                         //Use deriavation function? 0=> False, 1=>True
+  int aes_key_length;                                 //AES key length of CTR_DRBG in bits: 128, 192 or 256. 0 => NIST_BLOCK_KEYLEN
+  drbg_mechanism_type drbg_mechanism;                 //DRBG mechanism. 0 => DRBG_CTR
+  nist_hash_type drbg_hash;                           //Hash function of Hash_DRBG and HMAC_DRBG. 0 => NIST_HASH_SHA256
+  int generate_threads;                               //Threads sharing one large CTR_DRBG generate request. 0 or 1 => calling thread only
+  int ctr_drbg_lanes;                                 //Independent CTR_DRBG instances interleaved block by block. 0 or 1 => one instance
+  int fips_threads;                                   //Threads sharing the FIPS tests of each refill of raw_buf. 0 or 1 => calling thread only
   int havege_debug_flags;                             //HAVEGE debug flags
   int havege_status_flag;                             //HAVEGE status flag
   int havege_instruction_cache_size;                  //HAVEGE - CPU instruction cache size in kB
@@ -84,6 +143,14 @@ typedef struct {
                                                       //if ( max_number_of_csprng_generated_bytes > NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST) => multiple generate calls are needed
   unsigned int max_number_of_csprng_blocks;           // max_number_of_csprng_generated_bytes = INTEGER * max_number_of_csprng_blocks
   int random_length_of_csprng_generated_bytes;        // 0 => disabled, 1 => enabled
+  int prefetch_watermark;                             //Entropy and additional input buffers are refilled by background threads
+                                                      //whenever less than prefetch_watermark % of the buffer is valid. 0 => disabled
+  unsigned int raw_buf_size;                          //Size of fips_state->raw_buf in bytes. 0 or less than needed => derived from max_number_of_csprng_blocks
+  unsigned int source_buf_size;                       //Size of the entropy and additional input buffers in bytes. 0 or less than needed => derived
+                                                      //from the input lengths. Not used for HTTP_RNG and when both inputs read the same file
+  double health_min_entropy;                          //Claimed min-entropy of HAVEGE, HTTP_RNG, STDIN and EXTERNAL in bits per byte, (0, 8]. Data from
+                                                      //these sources go through the SP 800-90B health tests before they are buffered. 0 => disabled
+  health_action_type health_action;                   //What happens with data failing the health tests. 0 => HEALTH_WARN
 } mode_of_operation_type;
 
 typedef struct {
@@ -100,26 +167,47 @@ typedef struct {
   rng_buf_type* add_input_buf;                        //Additional input buffer between havege/FILE and CTR_DRBG
   rng_buf_type* random_length_buf;                    //Buffer of random numbers to derive random_length_of_csprng_generated_bytes
   NIST_CTR_DRBG* ctr_drbg ;                           //Internal state of CTR_DRBG
-  int HAVEGE_initialized;                             //Was HAVEGE initialized?
+  NIST_CTR_DRBG* ctr_drbg_lane[NIST_CTR_DRBG_MAX_LANES]; //Lanes of multi-lane CTR_DRBG. ctr_drbg_lane[0] == ctr_drbg
+  NIST_HASH_DRBG* hash_drbg;                          //Internal state of Hash_DRBG
+  NIST_HMAC_DRBG* hmac_drbg;                          //Internal state of HMAC_DRBG
+  CHACHA20_RNG* chacha20;                             //Internal state of ChaCha20 generator
+  havege_type* havege;                                //Internal state of HAVEGE. NULL => HAVEGE is not used
   SHA1_state* sha;                                    //internal state of SHA-1 RNG
   memt_type* memt;                                    //Internal state of Mersenne Twister RNG
   http_random_state_t* http;                          //Internal state of the HTTP (internet based) RNG
+  pthread_mutex_t source_mutex;                       //Guards the source states shared by several prefetched buffers
+  unsigned int fork_count;                            //Number of forks of the creating process at creation, see below
   mode_of_operation_type mode;                        //Mode of operation
 } csprng_state_type;
 
+/* Background producer thread, see fips_approved_csprng_start_producer */
+typedef struct csprng_producer_type csprng_producer_type;
+
 typedef struct {
   csprng_state_type* csprng_state;                    //State of csprng RNG
   rng_buf_type* raw_buf;                              //Size of this buffer in Bytes is 
-                                                      //max_number_of_csprng_generated_bytes + max_bytes_to_get_from_raw_buf
-  rng_buf_type* out_buf;                              //Output buffer
+                                                      //max_number_of_csprng_generated_bytes + 2 * max_bytes_to_get_from_raw_buf
   int perform_fips_test;                              // 0=> FIPS tests are disabled. 1=>FIPS tests are enabled
-  int max_bytes_to_get_from_raw_buf;                  //Safe value for get_data_from_csprng_buffer. Size of raw_buf in bytes is
-                                                      // max_number_of_csprng_generated_bytes + max_bytes_to_get_from_raw_buf
+  int max_bytes_to_get_from_raw_buf;                  //Largest min argument of csprng_borrow
+  unsigned int tested_bytes;                          //Bytes at raw_buf->buf_start which went through the FIPS test,
+                                                      //including the failed blocks. Not used when FIPS tests are disabled
+  unsigned int failed_blocks;                         //Number of failed blocks inside tested_bytes
+  unsigned int failed_block_offset[FIPS_MAX_FAILED_BLOCKS]; //Offsets of the failed blocks from raw_buf->buf_start, ascending
+  unsigned int borrowed_bytes;                        //Bytes at raw_buf->buf_start lent by csprng_borrow. 0 => nothing is borrowed
+  csprng_producer_type* producer;                     //Background producer. NULL => data are generated in the calling thread
+  fips_pool_type* fips_pool;                          //Threads running the FIPS tests. NULL => blocks are tested in the calling thread
+  unsigned long int remaining_bytes_to_reseed;        //Bytes fill_buffer_using_csprng can generate before the next reseed
   fips_ctx_t  fips_ctx;                               //FIPS context data 
 } fips_state_type;
 
 
 
+/*
+ * A csprng_state_type or fips_state_type created before fork() can't be used in the child process.
+ * Its buffers are not inherited, so that the child never repeats the output of the parent, and its
+ * background threads don't exist there. All functions called with it in the child print an error and
+ * fail, csprng_destroy and fips_approved_csprng_destroy included. The child creates a new generator.
+ */
 int csprng_destroy(csprng_state_type *csprng_state);
 int csprng_generate(csprng_state_type *csprng_state,unsigned char *output_buffer, unsigned int output_size, uint8_t reseed);
 csprng_state_type* csprng_initialize( const mode_of_operation_type* mode_of_operation);
@@ -131,6 +219,86 @@ int fips_approved_csprng_destroy (fips_state_type *fips_state);
 int fips_approved_csprng_generate (fips_state_type *fips_state, unsigned char *output_buffer, unsigned int output_size);
 int fips_approved_csprng_statistics (fips_state_type *fips_state) ;
 fips_state_type* fips_approved_csprng_initialize(int perform_fips_test, int track_fips_CPU_time, const mode_of_operation_type* mode_of_operation);
+/* Returns 0 on success, 1 on error. fips_state stays allocated on error, call fips_approved_csprng_destroy */
 int fips_approved_csprng_instantiate( fips_state_type* fips_state);
+
+/*
+ * Zero-copy access to the FIPS approved data. csprng_borrow returns in *ptr, *len a read-only view
+ * of min <= *len <= max bytes inside raw_buf, min <= max_bytes_to_get_from_raw_buf.
+ * csprng_borrow_iov returns the same data in up to iovcnt segments, skipping the blocks which have
+ * failed the FIPS test instead of moving the data around them. It returns the number of segments, -1 on error.
+ * csprng_borrow returns 0 on success, 1 on error. Only one borrow can be outstanding.
+ * csprng_release wipes the borrowed bytes and gives them back.
+ * fips_approved_csprng_generate must not be called while data are borrowed.
+ */
+int csprng_borrow (fips_state_type *fips_state, unsigned int min, unsigned int max, const unsigned char **ptr, unsigned int *len);
+int csprng_borrow_iov (fips_state_type *fips_state, unsigned int min, unsigned int max, struct iovec *iov, int iovcnt);
+int csprng_release (fips_state_type *fips_state);
+
+/*
+ * Many small outputs, e.g. nonces and tokens, in one call: the n buffers of reqs are filled in
+ * order from as few borrowed regions as possible, so the data are the same as from calling
+ * fips_approved_csprng_generate for each buffer. Returns the number of buffers filled, less than
+ * n on error. The buffer being filled when the error occurred is zeroed.
+ */
+int csprng_generate_batch (fips_state_type *fips_state, struct iovec *reqs, int n);
+
+/*
+ * Typed output converted straight from the FIPS approved data, count values per call.
+ * csprng_uniform_uint32/64 return integers in [0, bound) without modulo bias, bound >= 1.
+ * csprng_uniform_float/double return multiples of 2^-24 and 2^-53 in [0, 1).
+ * csprng_bernoulli returns 1 with probability p, rounded down to a multiple of 2^-32, otherwise 0.
+ * All return 0 on success, 1 on error. Data must not be borrowed when they are called.
+ */
+int csprng_uniform_uint32 (fips_state_type *fips_state, uint32_t *output, unsigned int count, uint32_t bound);
+int csprng_uniform_uint64 (fips_state_type *fips_state, uint64_t *output, unsigned int count, uint64_t bound);
+int csprng_uniform_float (fips_state_type *fips_state, float *output, unsigned int count);
+int csprng_uniform_double (fips_state_type *fips_state, double *output, unsigned int count);
+int csprng_bernoulli (fips_state_type *fips_state, unsigned char *output, unsigned int count, double p);
+
+/*
+ * Background producer: a thread generates and FIPS tests buffers of CSPRNG_PRODUCER_BUFFER_SIZE bytes
+ * ahead of the consumer. It pauses when high_watermark buffers are ready and resumes when the consumer
+ * has drained them to low_watermark, 0 <= low_watermark < high_watermark <= buffers, or is waiting
+ * for the next buffer.
+ * While it runs, fips_approved_csprng_generate and csprng_borrow* only take the ready buffers, and
+ * csprng_state, raw_buf and fips_ctx belong to the thread. The output is the same as without the producer.
+ * Stopping the producer wipes the buffers which were not consumed. Both return 0 on success, 1 on error.
+ */
+int fips_approved_csprng_start_producer (fips_state_type *fips_state, int buffers, int low_watermark, int high_watermark);
+int fips_approved_csprng_stop_producer (fips_state_type *fips_state);
+
+/*
+ * Thread-local generators for many-threaded programs. csprng_tls_initialize creates a shared root
+ * fips_state_type. Each thread calling csprng_tls_generate gets its own CTR_DRBG (key length and
+ * derivation function of the root) seeded from the root, which keeps a buffer of CSPRNG_TLS_BUFFER_SIZE
+ * bytes, FIPS tested when perform_fips_test is set. Requests served from the buffer take no locks.
+ * The root is locked only to seed a thread, and to reseed it after every max_number_of_csprng_blocks blocks.
+ * Instances are freed when their thread exits. After fork the child wipes the inherited buffer and seeds
+ * again from a new root. csprng_tls_destroy frees the root and the instance of the calling thread. Other
+ * threads may call csprng_tls_generate at the same time: a call which has passed the check of its instance
+ * is still served from its buffer, later calls free the instance and fail until csprng_tls_initialize
+ * is called again, then they get a new instance. Threads which don't call the API any more free their
+ * instances when they exit.
+ * csprng_tls_generate returns the number of bytes written, the others 0 on success, 1 on error.
+ */
+#define CSPRNG_TLS_BUFFER_SIZE (4 * FIPS_RNG_BUFFER_SIZE)
+int csprng_tls_initialize (int perform_fips_test, const mode_of_operation_type* mode_of_operation);
+int csprng_tls_generate (unsigned char *output_buffer, unsigned int output_size);
+int csprng_tls_destroy (void);
+
+/*
+ * Buffer geometry for this host. csprng_autotune runs the generator of mode for about CSPRNG_AUTOTUNE_MS
+ * milliseconds, writing into a pipe drained by a thread, with raw and source buffers of several sizes
+ * which fit into the L2 cache and the share of L3 cache of one CPU. It sets mode->raw_buf_size and
+ * mode->source_buf_size to the fastest ones, or to the sizes stored in profile by an earlier run on the
+ * same host with the same mode. The measured sizes are appended to profile. profile NULL => always measure.
+ * Files, STDIN and HTTP_RNG are never read, MT_RNG stands in for them during the measurement.
+ * When sink_fd >= 0 is a pipe, its capacity is raised to the raw buffer size if the system allows it.
+ * The chosen geometry is printed to stderr. Returns 0 on success, 1 on error and mode is left unchanged.
+ */
+#define CSPRNG_AUTOTUNE_MS 300
+#define CSPRNG_MAX_BUFFER_SIZE (64 * 1024 * 1024)
+int csprng_autotune (mode_of_operation_type* mode_of_operation, int perform_fips_test, const char* profile, int sink_fd);
 #endif
 
@@ -29,6 +29,7 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 /*  Size of a FIPS test buffer, do not change this */
 #define FIPS_RNG_BUFFER_SIZE 2500
 
+#include <stddef.h>
 #include <inttypes.h>
 #include <time.h>
 
@@ -63,9 +64,15 @@ typedef struct fips_ctx {
 	int poker[16], runs[12];
 	int ones, rlength, current_bit, last_bit, longrun;
 	unsigned int last32;
+  int block_bytes;                          //Bytes of the current block consumed by fips_update
+  unsigned int partial32;                   //Bytes of the incomplete continuous run test word
+  int rng_test;                             //Failed tests of the current block
   fips_statistics_type fips_statistics;
 } fips_ctx_t;
 
+/* Threads testing consecutive blocks in parallel, see src/fips_pool.h */
+typedef struct fips_pool_type fips_pool_type;
+
 
 
 /* Initializes the context for FIPS tests.  last32 contains
@@ -89,6 +96,44 @@ extern void fips_init(fips_ctx_t *ctx, unsigned int last32, int track_CPU_time);
  */
 int fips_run_rng_test(fips_ctx_t *ctx, const void *buf);
 
+/*
+ *  Incremental form of fips_run_rng_test. Data of a block can be
+ *  passed in any number of chunks of any size.
+ *
+ *  fips_update consumes bytes from buf up to the end of the current
+ *  block and returns the number of bytes consumed. Once a block is
+ *  complete, it consumes nothing until the verdict is collected by
+ *  fips_block_ready. It returns -1 if ctx is NULL or buf is NULL
+ *  with len > 0.
+ *
+ *  fips_block_ready returns -1 while the current block is incomplete.
+ *  Otherwise it returns the result of the completed block, the same
+ *  value fips_run_rng_test would return for it, and starts a new block.
+ *
+ *  fips_run_rng_test must not be called while a block is fed
+ *  by fips_update, it returns -1 in that case.
+ */
+int fips_update(fips_ctx_t *ctx, const void *buf, size_t len);
+int fips_block_ready(fips_ctx_t *ctx);
+
+/*
+ *  Hand over the state carried from one block to the next: the
+ *  last 32-bit word for the continuous run test and the last bit
+ *  for the runs test are taken from the FIPS_RNG_BUFFER_SIZE block
+ *  at block, as if ctx had just tested it. This way blocks of one
+ *  stream can be tested by several contexts with the results
+ *  of a single context.
+ *
+ *  It returns 0 on success and -1 if either ctx or block is NULL
+ *  or ctx is in the middle of a block.
+ */
+int fips_continue_after(fips_ctx_t *ctx, const void *block);
+
+/*
+ *  Adds the counters and the CPU time of from to to and clears them in from.
+ */
+void fips_merge_statistics(fips_statistics_type *to, fips_statistics_type *from);
+
 char* dump_fips_statistics ( fips_statistics_type *fips_statistics);
 
 #endif /* FIPS__H */
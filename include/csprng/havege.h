@@ -64,7 +64,7 @@ typedef int64_t LONG_DATA_TYPE;
 /**
  * Debugging definitions
  */
-#define DEBUG_ENABLED(a) (info.havege_opts & a)!=0
+#define DEBUG_ENABLED(info, a) ((info)->havege_opts & a)!=0
 #define DEBUG_OUT(...)        fprintf( stdout, __VA_ARGS__)
 /**
  * Capture environment in an aggregate.
@@ -88,16 +88,20 @@ struct hinfo {
 };
 typedef struct hinfo *H_PTR;
 typedef const struct hinfo *H_RDR;
+/**
+ * Collector instance. Instances are independent and can be used from different threads
+ */
+typedef struct havege_type havege_type;
 /**
  * Public prototypes
  */
-void           havege_debug(char ** cpts, DATA_TYPE * pts);
-int            havege_init(int icache, int dcache, int flags);
-H_RDR          havege_state(void);
-void           havege_status(char *buf, const int buf_size);
-void           havege_destroy();
-DATA_TYPE      ndrand();
-const DATA_TYPE*     ndrand_remaining_buffer(unsigned int *size);
-const DATA_TYPE*     ndrand_full_buffer();
-size_t generate_words_using_havege (DATA_TYPE* output_buffer, size_t output_size);
+void           havege_debug(H_RDR info, char ** cpts, DATA_TYPE * pts);
+havege_type*   havege_init(int icache, int dcache, int flags);
+H_RDR          havege_state(const havege_type* h);
+void           havege_status(const havege_type* h, char *buf, const int buf_size);
+void           havege_destroy(havege_type* h);
+DATA_TYPE      ndrand(havege_type* h);
+const DATA_TYPE*     ndrand_remaining_buffer(havege_type* h, unsigned int *size);
+const DATA_TYPE*     ndrand_full_buffer(havege_type* h);
+size_t generate_words_using_havege (havege_type* h, DATA_TYPE* output_buffer, size_t output_size);
 #endif
@@ -0,0 +1,84 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+health_tests.h -- NIST SP 800-90B continuous health tests of the noise sources
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#ifndef HEALTH_TESTS_H
+#define HEALTH_TESTS_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+ * Repetition Count Test (SP 800-90B 4.4.1) and Adaptive Proportion Test (4.4.2)
+ * on byte samples. The cutoffs are derived from the claimed min-entropy H per byte
+ * and the false positive probability 2^-alpha_log2 per sample (RCT) or window (APT).
+ * SP 800-90B recommends 20 <= alpha_log2 <= 40.
+ */
+#define HEALTH_TEST_APT_WINDOW 512
+#define HEALTH_TEST_ALPHA_LOG2 40
+
+/* Health test statistics */
+typedef struct {
+  uint64_t samples;                         //Bytes tested
+  uint64_t rct_failures;                    //Runs of rct_cutoff or more identical bytes
+  uint64_t apt_failures;                    //Windows with apt_cutoff or more copies of their first byte
+} health_test_statistics_type;
+
+/* Context for running the health tests on one stream */
+typedef struct {
+  double min_entropy;                       //Claimed min-entropy in bits per byte
+  unsigned int rct_cutoff;
+  unsigned int apt_cutoff;
+  unsigned int rct_count;                   //Length of the current run, 0 => no sample yet
+  unsigned int apt_count;                   //Copies of apt_value in the current window
+  unsigned int apt_index;                   //Samples of the current window, 0 => window not started
+  unsigned char rct_value;
+  unsigned char apt_value;
+  health_test_statistics_type statistics;
+} health_test_ctx_t;
+
+/*
+ *  Computes the cutoffs for min-entropy min_entropy, 0 < min_entropy <= 8,
+ *  and false positive probability 2^-alpha_log2, 1 <= alpha_log2 <= 64.
+ *  RCT: 1 + ceil(alpha_log2 / H). APT: 1 + CRITBINOM(W, 2^-H, 1 - 2^-alpha_log2).
+ *  An APT cutoff above HEALTH_TEST_APT_WINDOW means that the test can not fail.
+ *
+ *  It returns 0 on success and 1 if an argument is out of range.
+ */
+int health_test_cutoffs(double min_entropy, int alpha_log2, unsigned int *rct_cutoff, unsigned int *apt_cutoff);
+
+/*
+ *  Initializes ctx with the cutoffs of health_test_cutoffs. Returns 0 on success, 1 on error.
+ */
+int health_test_init(health_test_ctx_t *ctx, double min_entropy, int alpha_log2);
+
+/*
+ *  Runs both tests on len bytes of buf, which continue the stream of the
+ *  previous call. The data can be split in any way, the counters are the same.
+ *  Each run and each window fails at most once.
+ *
+ *  It returns the number of failures found in buf.
+ */
+unsigned int health_test_run(health_test_ctx_t *ctx, const unsigned char *buf, size_t len);
+
+#endif /* HEALTH_TESTS_H */
@@ -37,6 +37,7 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 #define MASK_QRBG 8
 
 
+#include <pthread.h>
 #include <csprng/fips.h>
 
 typedef enum {HOTBITS_RNG, RANDOM_ORG_RNG, RANDOMNUMBERS_INFO_RNG, QRBG_RNG, HTTP_COUNT } http_random_source_t;
@@ -48,6 +49,19 @@ typedef enum { STATE_NOT_STARTED, STATE_RUNNING, STATE_WAITING_FOR_BUFFER_TO_BE_
                STATE_SLEEPING, STATE_FINISHED, STATE_COUNT } http_random_thread_state_t;
 
 typedef struct {
+  char* name;
+  size_t size;
+  uint8_t mlocked;
+} string_with_mlock;
+
+struct http_random_state;
+
+typedef struct {
+  http_random_source_t source;
+  struct http_random_state* state;
+} http_random_thread_arg_t;
+
+typedef struct http_random_state {
   char source;                               //bitmask describing which sources to use. All sources ( MASK_HOTBITS | MASK_RANDOM_ORG | MASK_RANDOMNUMBERS_INFO | MASK_QRBG )
   uint8_t* buf;                              //buffer to exchange data between multiple producers and one consumer
   uint8_t* buf_start;                        //pointer to start of the valid data
@@ -63,6 +77,15 @@ typedef struct {
   size_t max_fips_fails_in_row;              //max FIPS fails in row
   fips_ctx_t fips_ctx;                       //FIPS validation of the data
   char verbosity;                            //verbosity level
+  pthread_t thread[HTTP_COUNT];              //0=> HOTBITS, 1=>RANDOM_ORG, 2=>RANDOMNUMBERS_INFO, 3=>QRBG
+  http_random_thread_arg_t input[HTTP_COUNT];//Arguments of the threads
+  pthread_cond_t empty, fill;                //Signals to control multiple producers/ one consumer
+  pthread_mutex_t mutex;                     //Guards access control to the buffer and statistics above
+  pthread_mutex_t state_mutex;               //Guards acces control to thread_running array
+  pthread_cond_t state_cond;                 //Signal that thread state has changed
+  http_random_thread_state_t thread_running[HTTP_COUNT];
+  string_with_mlock QRBG_RNG_user;           //Credentials for QRBG_RNG, deleted once the thread has logged in
+  string_with_mlock QRBG_RNG_passwd;
 } http_random_state_t;
 
 http_random_state_t* http_random_init(char source, size_t size, char verbosity, const char* QRBG_RNG_user_input, const char* QRBG_RNG_passwd_input);
@@ -4,10 +4,10 @@
 
 Header file of Block Cipher Based CTR_DRBG
 DRBG =  deterministic random bit generator
-CTR =   Counter (CTR) mode of operation of the block cipher (AES-128 in this case)
+CTR =   Counter (CTR) mode of operation of the block cipher (AES-128, AES-192 or AES-256)
 
 SP 800-90 random number generator
-This code implements the CTR_DRBG algorithm defined in section 10.2, based on AES-128 with DF.
+This code implements the CTR_DRBG algorithm defined in section 10.2, based on AES-128, AES-192 or AES-256 with or without DF.
 
 Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
 Copyright (C) 2010 Yair Elharrar (compacted and adapted for OpenSSL)
@@ -46,19 +46,51 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 #include <arpa/inet.h>
 
 
-/* Choose AES-128 as the underlying block cipher */
+/* AES-128 is the default block cipher. AES-192 and AES-256 can be selected per DRBG instance */
 #define NIST_BLOCK_KEYLEN		(128)
 #define NIST_BLOCK_KEYLEN_BYTES	(NIST_BLOCK_KEYLEN / 8)
 #define NIST_BLOCK_KEYLEN_INTS	(NIST_BLOCK_KEYLEN_BYTES / sizeof(int))
 
+#define NIST_BLOCK_KEYLEN_MAX		(256)
+#define NIST_BLOCK_KEYLEN_MAX_BYTES	(NIST_BLOCK_KEYLEN_MAX / 8)
+#define NIST_BLOCK_KEYLEN_MAX_INTS	(NIST_BLOCK_KEYLEN_MAX_BYTES / sizeof(int))
+
+//Number of supported key lengths: 128, 192 and 256 bits
+#define NIST_KEYLEN_COUNT	3
+#define NIST_KEYLEN_VALID(keylen) ( (keylen) == 128 || (keylen) == 192 || (keylen) == 256 )
+#define NIST_KEYLEN_INDEX(keylen) ( ( (keylen) - 128 ) / 64 )
+
 #define NIST_BLOCK_OUTLEN		(128)
 #define NIST_BLOCK_OUTLEN_BYTES	(NIST_BLOCK_OUTLEN / 8)
 #define NIST_BLOCK_OUTLEN_INTS	(NIST_BLOCK_OUTLEN_BYTES / sizeof(int))
 
 typedef struct { 
 	AES_KEY key;
+	//Round keys in the layout expected by the AES-NI instructions.
+	//Valid only when nist_ctr_drbg_aesni_enabled() returns 1
+	uint64_t rd_key_ni[(AES_MAXNR + 1) * 2] __attribute__ ((aligned (16)));
+	//Bitsliced round keys. Valid only when the bitsliced cipher is selected
+	uint64_t rd_key_ct[(AES_MAXNR + 1) * 8];
+	int rounds;
 } NIST_Key;
 
+/*
+ * Implementation of the block cipher. NIST_CIPHER_AUTO selects AES-NI when
+ * the CPU supports it and the constant-time bitsliced AES otherwise.
+ * Environment variable CSPRNG_AES_CIPHER=auto|openssl|bitsliced|aesni sets the default.
+ */
+#define NIST_CIPHER_ENV "CSPRNG_AES_CIPHER"
+
+typedef enum {
+	NIST_CIPHER_AUTO = 0,
+	NIST_CIPHER_OPENSSL,       //OpenSSL AES_encrypt (lookup tables)
+	NIST_CIPHER_BITSLICED,     //Constant-time bitsliced AES, 8 blocks in parallel
+	NIST_CIPHER_AESNI,         //AES-NI/VAES
+	NIST_CIPHER_COUNT
+} nist_cipher_type;
+
+extern const char* const nist_cipher_names[NIST_CIPHER_COUNT];
+
 
 #define NIST_NTOHL ntohl
 #define NIST_HTONL htonl
@@ -79,22 +111,42 @@ typedef struct {
 #define NIST_CTR_DRBG_MAX_NUMBER_OF_BITS_PER_REQUEST (1ULL<<19)
 #define NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST (NIST_CTR_DRBG_MAX_NUMBER_OF_BITS_PER_REQUEST / 8)
 
+//Maximum number of independent instances served by one nist_ctr_drbg_generate_lanes call
+#define NIST_CTR_DRBG_MAX_LANES 8
+
 
 #define NIST_BLOCK_SEEDLEN			(NIST_BLOCK_KEYLEN + NIST_BLOCK_OUTLEN)
 #define NIST_BLOCK_SEEDLEN_BYTES	(NIST_BLOCK_SEEDLEN / 8)
 #define NIST_BLOCK_SEEDLEN_INTS		(NIST_BLOCK_SEEDLEN_BYTES / sizeof(int))
 
-#define Block_Encrypt(ctx, src, dst) AES_encrypt((unsigned char *)(src), (unsigned char *)(dst), &(ctx)->key)
-#define Block_Schedule_Encryption(xx, yy) AES_set_encrypt_key((unsigned char *)(yy), NIST_BLOCK_KEYLEN, &(xx)->key)
+#define NIST_BLOCK_SEEDLEN_MAX			(NIST_BLOCK_KEYLEN_MAX + NIST_BLOCK_OUTLEN)
+#define NIST_BLOCK_SEEDLEN_MAX_BYTES	(NIST_BLOCK_SEEDLEN_MAX / 8)
+#define NIST_BLOCK_SEEDLEN_MAX_INTS		(NIST_BLOCK_SEEDLEN_MAX_BYTES / sizeof(int))
+
+//seedlen = keylen + outlen for the given key length in bits
+#define NIST_SEEDLEN_BYTES(keylen)	( ( (keylen) + NIST_BLOCK_OUTLEN ) / 8 )
+//Number of outlen blocks needed to cover seedlen bits: 2 for AES-128, 3 for AES-192 and AES-256
+#define NIST_SEEDLEN_BLOCKS(keylen)	( ( (keylen) + 2 * NIST_BLOCK_OUTLEN - 1 ) / NIST_BLOCK_OUTLEN )
+#define NIST_SEEDLEN_MAX_BLOCKS		NIST_SEEDLEN_BLOCKS(NIST_BLOCK_KEYLEN_MAX)
+
+#define Block_Encrypt(ctx, src, dst) nist_block_encrypt((ctx), (const unsigned char *)(src), (unsigned char *)(dst))
+#define Block_Schedule_Encryption(xx, yy, keylen) nist_block_schedule_encryption((xx), (const unsigned char *)(yy), (keylen))
 #define nist_zeroize(buf, len) memset((buf), 0, (len))
 
+/* Worker threads sharing one large generate request, see nist_ctr_drbg_set_threads */
+typedef struct nist_ctr_drbg_pool_type nist_ctr_drbg_pool_type;
+
 typedef struct {
 	uint64_t reseed_counter;
 	NIST_Key ctx;
 	unsigned int V[NIST_BLOCK_OUTLEN_INTS];
+	//AES key length in bits: 128, 192 or 256
+	int keylen;
         //Infrastructure
         //derive function (0=false, 1=true)
 	int derive_function;
+	//NULL when generate runs in the calling thread only
+	nist_ctr_drbg_pool_type* pool;
         //prediction resistance (0=false, 1=true)
         //int prediction_resistance;
 } NIST_CTR_DRBG;
@@ -106,7 +158,7 @@ extern NIST_CTR_DRBG*
                 const void* entropy_input, int entropy_input_length,
 		const void* nonce, int nonce_length,
 		const void* personalization_string, int personalization_string_length,
-                int derive_function);
+                int derive_function, int keylen);
 extern int
 	nist_ctr_drbg_reseed(NIST_CTR_DRBG* drbg,
 		const void* entropy_input, int entropy_input_length,
@@ -115,10 +167,30 @@ extern int
 	nist_ctr_drbg_generate(NIST_CTR_DRBG* drbg,
 		void* output_string, int output_string_length,
 		const void* additional_input, int additional_input_length);
+/* Generate for lanes instances at once, block i of the output comes from drbg[i % lanes].
+ * All lanes must have the same key length. Up to lanes * NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST bytes. */
+extern int
+	nist_ctr_drbg_generate_lanes(NIST_CTR_DRBG* const* drbg, int lanes,
+		void* output_string, int output_string_length,
+		const void* additional_input, int additional_input_length);
+/* Split the counter blocks of large generate requests between threads. Output is the same
+ * for any number of threads. threads <= 1 switches back to the calling thread only. */
+extern int
+	nist_ctr_drbg_set_threads(NIST_CTR_DRBG* drbg, int threads);
 extern int
 	nist_ctr_initialize();
 extern int
 	nist_ctr_drbg_destroy(NIST_CTR_DRBG* drbg);
+extern int
+	nist_block_schedule_encryption(NIST_Key* ctx, const unsigned char* key, int keylen);
+extern void
+	nist_block_encrypt(const NIST_Key* ctx, const unsigned char* input, unsigned char* output);
+/* Select the block cipher implementation. Has to be called before any DRBG is instantiated.
+ * Returns 1 when the CPU does not support the requested implementation. */
+extern int
+	nist_ctr_drbg_select_cipher(nist_cipher_type cipher);
+extern int
+	nist_ctr_drbg_aesni_enabled();
 
 extern void
 dump_hex_byte_string (const unsigned char* data, const unsigned int size, const char* message);
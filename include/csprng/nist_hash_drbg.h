@@ -0,0 +1,107 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+NIST SP 800-90A Hash_DRBG and HMAC_DRBG with SHA-256 and SHA-512
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#ifndef NIST_HASH_DRBG_H
+#define NIST_HASH_DRBG_H
+
+#include <inttypes.h>
+
+typedef enum {
+  NIST_HASH_SHA256 = 0,
+  NIST_HASH_SHA512,
+  NIST_HASH_COUNT
+} nist_hash_type;
+
+extern const char* const nist_hash_names[NIST_HASH_COUNT];
+
+/*
+ * NIST SP 800-90A, Table 2: both SHA-256 and SHA-512 support security strength of 256 bits.
+ * seedlen is 440 bits for SHA-256 and 888 bits for SHA-512.
+ */
+#define NIST_HASH_SECURITY_STRENGTH_BYTES 32
+#define NIST_HASH_OUTLEN_BYTES(hash)      ( (hash) == NIST_HASH_SHA256 ? 32 : 64 )
+#define NIST_HASH_SEEDLEN_BYTES(hash)     ( (hash) == NIST_HASH_SHA256 ? 55 : 111 )
+#define NIST_HASH_OUTLEN_MAX_BYTES        64
+#define NIST_HASH_SEEDLEN_MAX_BYTES       111
+
+#define NIST_HASH_DRBG_RESEED_INTERVAL    (1ULL<<48)
+//2^19 bits is max_number_of_bits_per_request in Table 2, same as for CTR_DRBG
+#define NIST_HASH_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST ( (1ULL<<19) / 8 )
+
+typedef struct {
+  uint64_t reseed_counter;
+  nist_hash_type hash;
+  int seedlen;                                        //seedlen in bytes
+  unsigned char V[NIST_HASH_SEEDLEN_MAX_BYTES];
+  unsigned char C[NIST_HASH_SEEDLEN_MAX_BYTES];
+} NIST_HASH_DRBG;
+
+typedef union {
+  uint32_t sha256[8];
+  uint64_t sha512[8];
+} nist_hash_chaining_value_type;
+
+typedef struct {
+  uint64_t reseed_counter;
+  nist_hash_type hash;
+  int outlen;                                         //outlen in bytes
+  unsigned char K[NIST_HASH_OUTLEN_MAX_BYTES];
+  unsigned char V[NIST_HASH_OUTLEN_MAX_BYTES];
+  //Chaining values after hashing K XOR ipad and K XOR opad. Computed once per Key,
+  //each HMAC(Key, V) then costs two compressions
+  nist_hash_chaining_value_type ipad_state;
+  nist_hash_chaining_value_type opad_state;
+} NIST_HMAC_DRBG;
+
+/*
+ * Same interface as nist_ctr_drbg_*. Functions returning int return 0 on success.
+ * Personalization string and additional input are optional (NULL or length 0).
+ */
+NIST_HASH_DRBG* nist_hash_drbg_instantiate(
+    const void* entropy_input, int entropy_input_length,
+    const void* nonce, int nonce_length,
+    const void* personalization_string, int personalization_string_length,
+    nist_hash_type hash);
+int nist_hash_drbg_reseed(NIST_HASH_DRBG* drbg,
+    const void* entropy_input, int entropy_input_length,
+    const void* additional_input, int additional_input_length);
+int nist_hash_drbg_generate(NIST_HASH_DRBG* drbg,
+    void* output_string, int output_string_length,
+    const void* additional_input, int additional_input_length);
+int nist_hash_drbg_destroy(NIST_HASH_DRBG* drbg);
+
+NIST_HMAC_DRBG* nist_hmac_drbg_instantiate(
+    const void* entropy_input, int entropy_input_length,
+    const void* nonce, int nonce_length,
+    const void* personalization_string, int personalization_string_length,
+    nist_hash_type hash);
+int nist_hmac_drbg_reseed(NIST_HMAC_DRBG* drbg,
+    const void* entropy_input, int entropy_input_length,
+    const void* additional_input, int additional_input_length);
+int nist_hmac_drbg_generate(NIST_HMAC_DRBG* drbg,
+    void* output_string, int output_string_length,
+    const void* additional_input, int additional_input_length);
+int nist_hmac_drbg_destroy(NIST_HMAC_DRBG* drbg);
+
+#endif
@@ -0,0 +1,475 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Constant-time bitsliced AES encryption
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+/*
+ * Bitsliced AES following the "ct64" representation used by BearSSL (Thomas Pornin):
+ * 4 blocks are spread over 8 64-bit words, word i holding bit i of every byte.
+ * The S-box is the 113 gate circuit of Boyar and Peralta, so there are no
+ * table lookups and no data dependent branches.
+ *
+ * Each word is a 2 x 64-bit GCC vector. This gives 8 blocks per pass using
+ * SSE2 on x86 and NEON on ARM; on other CPUs the compiler splits it into scalars.
+ */
+
+#include <string.h>
+
+#include "aes_ct.h"
+
+typedef uint64_t aes_ct_vec __attribute__ ((vector_size (16)));
+
+//{{{ static void aes_ct_sbox(aes_ct_vec *q)
+static void aes_ct_sbox(aes_ct_vec *q)
+{
+  aes_ct_vec x0, x1, x2, x3, x4, x5, x6, x7;
+  aes_ct_vec y1, y2, y3, y4, y5, y6, y7, y8, y9;
+  aes_ct_vec y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+  aes_ct_vec y20, y21;
+  aes_ct_vec z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+  aes_ct_vec z10, z11, z12, z13, z14, z15, z16, z17;
+  aes_ct_vec t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+  aes_ct_vec t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+  aes_ct_vec t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+  aes_ct_vec t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+  aes_ct_vec t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+  aes_ct_vec t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+  aes_ct_vec t60, t61, t62, t63, t64, t65, t66, t67;
+  aes_ct_vec s0, s1, s2, s3, s4, s5, s6, s7;
+
+  x0 = q[7];
+  x1 = q[6];
+  x2 = q[5];
+  x3 = q[4];
+  x4 = q[3];
+  x5 = q[2];
+  x6 = q[1];
+  x7 = q[0];
+
+  /* Top linear transformation */
+  y14 = x3 ^ x5;
+  y13 = x0 ^ x6;
+  y9 = x0 ^ x3;
+  y8 = x0 ^ x5;
+  t0 = x1 ^ x2;
+  y1 = t0 ^ x7;
+  y4 = y1 ^ x3;
+  y12 = y13 ^ y14;
+  y2 = y1 ^ x0;
+  y5 = y1 ^ x6;
+  y3 = y5 ^ y8;
+  t1 = x4 ^ y12;
+  y15 = t1 ^ x5;
+  y20 = t1 ^ x1;
+  y6 = y15 ^ x7;
+  y10 = y15 ^ t0;
+  y11 = y20 ^ y9;
+  y7 = x7 ^ y11;
+  y17 = y10 ^ y11;
+  y19 = y10 ^ y8;
+  y16 = t0 ^ y11;
+  y21 = y13 ^ y16;
+  y18 = x0 ^ y16;
+
+  /* Non-linear section */
+  t2 = y12 & y15;
+  t3 = y3 & y6;
+  t4 = t3 ^ t2;
+  t5 = y4 & x7;
+  t6 = t5 ^ t2;
+  t7 = y13 & y16;
+  t8 = y5 & y1;
+  t9 = t8 ^ t7;
+  t10 = y2 & y7;
+  t11 = t10 ^ t7;
+  t12 = y9 & y11;
+  t13 = y14 & y17;
+  t14 = t13 ^ t12;
+  t15 = y8 & y10;
+  t16 = t15 ^ t12;
+  t17 = t4 ^ t14;
+  t18 = t6 ^ t16;
+  t19 = t9 ^ t14;
+  t20 = t11 ^ t16;
+  t21 = t17 ^ y20;
+  t22 = t18 ^ y19;
+  t23 = t19 ^ y21;
+  t24 = t20 ^ y18;
+
+  t25 = t21 ^ t22;
+  t26 = t21 & t23;
+  t27 = t24 ^ t26;
+  t28 = t25 & t27;
+  t29 = t28 ^ t22;
+  t30 = t23 ^ t24;
+  t31 = t22 ^ t26;
+  t32 = t31 & t30;
+  t33 = t32 ^ t24;
+  t34 = t23 ^ t33;
+  t35 = t27 ^ t33;
+  t36 = t24 & t35;
+  t37 = t36 ^ t34;
+  t38 = t27 ^ t36;
+  t39 = t29 & t38;
+  t40 = t25 ^ t39;
+
+  t41 = t40 ^ t37;
+  t42 = t29 ^ t33;
+  t43 = t29 ^ t40;
+  t44 = t33 ^ t37;
+  t45 = t42 ^ t41;
+  z0 = t44 & y15;
+  z1 = t37 & y6;
+  z2 = t33 & x7;
+  z3 = t43 & y16;
+  z4 = t40 & y1;
+  z5 = t29 & y7;
+  z6 = t42 & y11;
+  z7 = t45 & y17;
+  z8 = t41 & y10;
+  z9 = t44 & y12;
+  z10 = t37 & y3;
+  z11 = t33 & y4;
+  z12 = t43 & y13;
+  z13 = t40 & y5;
+  z14 = t29 & y2;
+  z15 = t42 & y9;
+  z16 = t45 & y14;
+  z17 = t41 & y8;
+
+  /* Bottom linear transformation */
+  t46 = z15 ^ z16;
+  t47 = z10 ^ z11;
+  t48 = z5 ^ z13;
+  t49 = z9 ^ z10;
+  t50 = z2 ^ z12;
+  t51 = z2 ^ z5;
+  t52 = z7 ^ z8;
+  t53 = z0 ^ z3;
+  t54 = z6 ^ z7;
+  t55 = z16 ^ z17;
+  t56 = z12 ^ t48;
+  t57 = t50 ^ t53;
+  t58 = z4 ^ t46;
+  t59 = z3 ^ t54;
+  t60 = t46 ^ t57;
+  t61 = z14 ^ t57;
+  t62 = t52 ^ t58;
+  t63 = t49 ^ t58;
+  t64 = z4 ^ t59;
+  t65 = t61 ^ t62;
+  t66 = z1 ^ t63;
+  s0 = t59 ^ t63;
+  s6 = t56 ^ ~t62;
+  s7 = t48 ^ ~t60;
+  t67 = t64 ^ t65;
+  s3 = t53 ^ t66;
+  s4 = t51 ^ t66;
+  s5 = t47 ^ t65;
+  s1 = t64 ^ ~s3;
+  s2 = t55 ^ ~t67;
+
+  q[7] = s0;
+  q[6] = s1;
+  q[5] = s2;
+  q[4] = s3;
+  q[3] = s4;
+  q[2] = s5;
+  q[1] = s6;
+  q[0] = s7;
+}
+//}}}
+
+//{{{ static void aes_ct_ortho(aes_ct_vec *q)
+/*
+ * Transpose between the byte-interleaved layout and the bitsliced layout (involution)
+ */
+#define AES_CT_SWAPN(cl, ch, s, x, y) do {              \
+    aes_ct_vec a, b;                                    \
+    a = (x);                                            \
+    b = (y);                                            \
+    (x) = ( a & (cl) ) | ( ( b & (cl) ) << (s) );       \
+    (y) = ( ( a & (ch) ) >> (s) ) | ( b & (ch) );       \
+  } while (0)
+
+#define AES_CT_SWAP2(x, y) AES_CT_SWAPN(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, x, y)
+#define AES_CT_SWAP4(x, y) AES_CT_SWAPN(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, x, y)
+#define AES_CT_SWAP8(x, y) AES_CT_SWAPN(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, x, y)
+
+static void aes_ct_ortho(aes_ct_vec *q)
+{
+  AES_CT_SWAP2(q[0], q[1]);
+  AES_CT_SWAP2(q[2], q[3]);
+  AES_CT_SWAP2(q[4], q[5]);
+  AES_CT_SWAP2(q[6], q[7]);
+
+  AES_CT_SWAP4(q[0], q[2]);
+  AES_CT_SWAP4(q[1], q[3]);
+  AES_CT_SWAP4(q[4], q[6]);
+  AES_CT_SWAP4(q[5], q[7]);
+
+  AES_CT_SWAP8(q[0], q[4]);
+  AES_CT_SWAP8(q[1], q[5]);
+  AES_CT_SWAP8(q[2], q[6]);
+  AES_CT_SWAP8(q[3], q[7]);
+}
+//}}}
+
+//{{{ Conversion between 32-bit words of one block and the interleaved layout
+static inline uint32_t aes_ct_dec32le(const unsigned char *p)
+{
+  return (uint32_t) p[0] | ( (uint32_t) p[1] << 8 ) | ( (uint32_t) p[2] << 16 ) | ( (uint32_t) p[3] << 24 );
+}
+
+static inline void aes_ct_enc32le(unsigned char *p, uint32_t x)
+{
+  p[0] = (unsigned char) x;
+  p[1] = (unsigned char) ( x >> 8 );
+  p[2] = (unsigned char) ( x >> 16 );
+  p[3] = (unsigned char) ( x >> 24 );
+}
+
+static void aes_ct_interleave_in(uint64_t *q0, uint64_t *q1, const uint32_t *w)
+{
+  uint64_t x0, x1, x2, x3;
+
+  x0 = w[0];
+  x1 = w[1];
+  x2 = w[2];
+  x3 = w[3];
+  x0 |= ( x0 << 16 );
+  x1 |= ( x1 << 16 );
+  x2 |= ( x2 << 16 );
+  x3 |= ( x3 << 16 );
+  x0 &= 0x0000FFFF0000FFFFULL;
+  x1 &= 0x0000FFFF0000FFFFULL;
+  x2 &= 0x0000FFFF0000FFFFULL;
+  x3 &= 0x0000FFFF0000FFFFULL;
+  x0 |= ( x0 << 8 );
+  x1 |= ( x1 << 8 );
+  x2 |= ( x2 << 8 );
+  x3 |= ( x3 << 8 );
+  x0 &= 0x00FF00FF00FF00FFULL;
+  x1 &= 0x00FF00FF00FF00FFULL;
+  x2 &= 0x00FF00FF00FF00FFULL;
+  x3 &= 0x00FF00FF00FF00FFULL;
+  *q0 = x0 | ( x2 << 8 );
+  *q1 = x1 | ( x3 << 8 );
+}
+
+static void aes_ct_interleave_out(uint32_t *w, uint64_t q0, uint64_t q1)
+{
+  uint64_t x0, x1, x2, x3;
+
+  x0 = q0 & 0x00FF00FF00FF00FFULL;
+  x1 = q1 & 0x00FF00FF00FF00FFULL;
+  x2 = ( q0 >> 8 ) & 0x00FF00FF00FF00FFULL;
+  x3 = ( q1 >> 8 ) & 0x00FF00FF00FF00FFULL;
+  x0 |= ( x0 >> 8 );
+  x1 |= ( x1 >> 8 );
+  x2 |= ( x2 >> 8 );
+  x3 |= ( x3 >> 8 );
+  x0 &= 0x0000FFFF0000FFFFULL;
+  x1 &= 0x0000FFFF0000FFFFULL;
+  x2 &= 0x0000FFFF0000FFFFULL;
+  x3 &= 0x0000FFFF0000FFFFULL;
+  w[0] = (uint32_t) x0 | (uint32_t) ( x0 >> 16 );
+  w[1] = (uint32_t) x1 | (uint32_t) ( x1 >> 16 );
+  w[2] = (uint32_t) x2 | (uint32_t) ( x2 >> 16 );
+  w[3] = (uint32_t) x3 | (uint32_t) ( x3 >> 16 );
+}
+//}}}
+
+//{{{ Round functions
+static inline void aes_ct_add_round_key(aes_ct_vec *q, const uint64_t *sk)
+{
+  int i;
+
+  for ( i = 0; i < 8; ++i ) q[i] ^= sk[i];
+}
+
+static inline void aes_ct_shift_rows(aes_ct_vec *q)
+{
+  int i;
+  aes_ct_vec x;
+
+  for ( i = 0; i < 8; ++i ) {
+    x = q[i];
+    q[i] = ( x & 0x000000000000FFFFULL )
+      | ( ( x & 0x00000000FFF00000ULL ) >> 4 )
+      | ( ( x & 0x00000000000F0000ULL ) << 12 )
+      | ( ( x & 0x0000FF0000000000ULL ) >> 8 )
+      | ( ( x & 0x000000FF00000000ULL ) << 8 )
+      | ( ( x & 0xF000000000000000ULL ) >> 12 )
+      | ( ( x & 0x0FFF000000000000ULL ) << 4 );
+  }
+}
+
+static inline aes_ct_vec aes_ct_rotr32(aes_ct_vec x)
+{
+  return ( x << 32 ) | ( x >> 32 );
+}
+
+static inline void aes_ct_mix_columns(aes_ct_vec *q)
+{
+  aes_ct_vec q0, q1, q2, q3, q4, q5, q6, q7;
+  aes_ct_vec r0, r1, r2, r3, r4, r5, r6, r7;
+
+  q0 = q[0];
+  q1 = q[1];
+  q2 = q[2];
+  q3 = q[3];
+  q4 = q[4];
+  q5 = q[5];
+  q6 = q[6];
+  q7 = q[7];
+  r0 = ( q0 >> 16 ) | ( q0 << 48 );
+  r1 = ( q1 >> 16 ) | ( q1 << 48 );
+  r2 = ( q2 >> 16 ) | ( q2 << 48 );
+  r3 = ( q3 >> 16 ) | ( q3 << 48 );
+  r4 = ( q4 >> 16 ) | ( q4 << 48 );
+  r5 = ( q5 >> 16 ) | ( q5 << 48 );
+  r6 = ( q6 >> 16 ) | ( q6 << 48 );
+  r7 = ( q7 >> 16 ) | ( q7 << 48 );
+
+  q[0] = q7 ^ r7 ^ r0 ^ aes_ct_rotr32(q0 ^ r0);
+  q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ aes_ct_rotr32(q1 ^ r1);
+  q[2] = q1 ^ r1 ^ r2 ^ aes_ct_rotr32(q2 ^ r2);
+  q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ aes_ct_rotr32(q3 ^ r3);
+  q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ aes_ct_rotr32(q4 ^ r4);
+  q[5] = q4 ^ r4 ^ r5 ^ aes_ct_rotr32(q5 ^ r5);
+  q[6] = q5 ^ r5 ^ r6 ^ aes_ct_rotr32(q6 ^ r6);
+  q[7] = q6 ^ r6 ^ r7 ^ aes_ct_rotr32(q7 ^ r7);
+}
+//}}}
+
+//{{{ int aes_ct_keysched(uint64_t* skey, const unsigned char* key, int key_bytes)
+static uint32_t aes_ct_sub_word(uint32_t x)
+{
+  aes_ct_vec q[8];
+
+  memset(q, 0, sizeof(q));
+  q[0][0] = x;
+  aes_ct_ortho(q);
+  aes_ct_sbox(q);
+  aes_ct_ortho(q);
+  return (uint32_t) q[0][0];
+}
+
+int aes_ct_keysched(uint64_t* skey, const unsigned char* key, int key_bytes)
+{
+  static const unsigned char rcon[] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36 };
+  uint32_t w[60];
+  uint32_t tmp;
+  int rounds, nk, nkf, i, j, k;
+
+  switch ( key_bytes ) {
+    case 16: rounds = 10; break;
+    case 24: rounds = 12; break;
+    case 32: rounds = 14; break;
+    default: return 0;
+  }
+
+  nk = key_bytes / 4;
+  nkf = 4 * ( rounds + 1 );
+  for ( i = 0; i < nk; ++i ) w[i] = aes_ct_dec32le(key + 4 * i);
+
+  tmp = w[nk - 1];
+  for ( i = nk, j = 0, k = 0; i < nkf; ++i ) {
+    if ( j == 0 ) {
+      tmp = ( tmp << 24 ) | ( tmp >> 8 );
+      tmp = aes_ct_sub_word(tmp) ^ rcon[k];
+    } else if ( nk > 6 && j == 4 ) {
+      tmp = aes_ct_sub_word(tmp);
+    }
+    tmp ^= w[i - nk];
+    w[i] = tmp;
+    if ( ++j == nk ) {
+      j = 0;
+      ++k;
+    }
+  }
+
+  //Bitslice each round key: every 64-bit word of the round key is shared by the 4 blocks of a lane
+  for ( i = 0; i < nkf; i += 4 ) {
+    uint64_t q0, q1;
+    aes_ct_vec q[8];
+    int u;
+
+    aes_ct_interleave_in(&q0, &q1, w + i);
+    for ( u = 0; u < 4; ++u ) {
+      q[u][0] = q0;
+      q[u][1] = q0;
+      q[u + 4][0] = q1;
+      q[u + 4][1] = q1;
+    }
+    aes_ct_ortho(q);
+    for ( u = 0; u < 8; ++u ) skey[2 * i + u] = q[u][0];
+  }
+
+  memset(w, 0, sizeof(w));
+  return rounds;
+}
+//}}}
+
+//{{{ void aes_ct_encrypt_blocks(const uint64_t* skey, int rounds, const unsigned char* in, unsigned char* out, int blocks)
+void aes_ct_encrypt_blocks(const uint64_t* skey, int rounds, const unsigned char* in, unsigned char* out, int blocks)
+{
+  uint32_t w[4 * AES_CT_BLOCKS];
+  uint64_t qa[8], qb[8];
+  aes_ct_vec q[8];
+  int i, r;
+
+  memset(w, 0, sizeof(w));
+  for ( i = 0; i < 4 * blocks; ++i ) w[i] = aes_ct_dec32le(in + 4 * i);
+
+  //Blocks 0-3 go to lane 0, blocks 4-7 to lane 1
+  for ( i = 0; i < 4; ++i ) {
+    aes_ct_interleave_in(&qa[i], &qa[i + 4], w + 4 * i);
+    aes_ct_interleave_in(&qb[i], &qb[i + 4], w + 16 + 4 * i);
+  }
+  for ( i = 0; i < 8; ++i ) {
+    q[i][0] = qa[i];
+    q[i][1] = qb[i];
+  }
+  aes_ct_ortho(q);
+
+  aes_ct_add_round_key(q, skey);
+  for ( r = 1; r < rounds; ++r ) {
+    aes_ct_sbox(q);
+    aes_ct_shift_rows(q);
+    aes_ct_mix_columns(q);
+    aes_ct_add_round_key(q, skey + 8 * r);
+  }
+  aes_ct_sbox(q);
+  aes_ct_shift_rows(q);
+  aes_ct_add_round_key(q, skey + 8 * rounds);
+
+  aes_ct_ortho(q);
+  for ( i = 0; i < 4; ++i ) {
+    aes_ct_interleave_out(w + 4 * i, q[i][0], q[i + 4][0]);
+    aes_ct_interleave_out(w + 16 + 4 * i, q[i][1], q[i + 4][1]);
+  }
+
+  for ( i = 0; i < 4 * blocks; ++i ) aes_ct_enc32le(out + 4 * i, w[i]);
+}
+//}}}
@@ -0,0 +1,49 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Constant-time bitsliced AES encryption. Internal to libcsprng.
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#ifndef AES_CT_H
+#define AES_CT_H
+
+#include <inttypes.h>
+
+//Number of blocks encrypted by one call of aes_ct_encrypt_blocks
+#define AES_CT_BLOCKS 8
+
+//Size of the expanded key schedule in uint64_t words
+#define AES_CT_SKEY_WORDS(rounds) ( 8 * ( (rounds) + 1 ) )
+
+/*
+ * Compute the bitsliced key schedule. key_bytes is 16, 24 or 32.
+ * skey must hold AES_CT_SKEY_WORDS(14) words.
+ * Returns the number of rounds or 0 on unsupported key length.
+ */
+int aes_ct_keysched(uint64_t* skey, const unsigned char* key, int key_bytes);
+
+/*
+ * Encrypt up to AES_CT_BLOCKS blocks of 16 bytes. Running time does not depend
+ * on key or data. in and out may be the same buffer.
+ */
+void aes_ct_encrypt_blocks(const uint64_t* skey, int rounds, const unsigned char* in, unsigned char* out, int blocks);
+
+#endif
@@ -0,0 +1,111 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+ChaCha20 keystream. Included by chacha20_rng.c once for each SIMD width
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+/*
+ * Expects CHACHA20_KERNEL_NAME, CHACHA20_KERNEL_TARGET and CHACHA20_KERNEL_LANES to be defined.
+ * CHACHA20_KERNEL_BYTE_SHUFFLE may be defined when the target shuffles bytes across the full vector.
+ *
+ * Lane j of the vectors computes block counter + i + j, so CHACHA20_KERNEL_LANES blocks are produced
+ * by one pass of the rounds. The last pass may compute more blocks than requested, only the
+ * requested ones are written out.
+ */
+
+#define CHACHA20_VROTL(x, n)  ( ( (x) << (n) ) | ( (x) >> ( 32 - (n) ) ) )
+#ifdef CHACHA20_KERNEL_BYTE_SHUFFLE
+//Rotations by whole bytes are a single byte shuffle when the target has one for the full vector width
+#define CHACHA20_VROTB(x, mask, n) ( (vec_t) __builtin_shuffle( (bvec_t) (x), mask ) )
+#else
+#define CHACHA20_VROTB(x, mask, n) CHACHA20_VROTL(x, n)
+#endif
+#define CHACHA20_VQR(a, b, c, d)                                          \
+  a += b; d ^= a; d = CHACHA20_VROTB(d, rot16, 16);                       \
+  c += d; b ^= c; b = CHACHA20_VROTL(b, 12);                              \
+  a += b; d ^= a; d = CHACHA20_VROTB(d, rot8, 8);                         \
+  c += d; b ^= c; b = CHACHA20_VROTL(b,  7)
+
+CHACHA20_KERNEL_TARGET void CHACHA20_KERNEL_NAME (const uint32_t* key, uint64_t counter, unsigned char* output, int blocks)
+{
+  typedef uint32_t vec_t __attribute__ ((vector_size (4 * CHACHA20_KERNEL_LANES)));
+  uint32_t lane[CHACHA20_KERNEL_LANES];
+  vec_t s[16], x[16], zero = { 0 };
+  int i, j, t, lanes;
+#ifdef CHACHA20_KERNEL_BYTE_SHUFFLE
+  typedef unsigned char bvec_t __attribute__ ((vector_size (4 * CHACHA20_KERNEL_LANES)));
+  unsigned char mask[2][4 * CHACHA20_KERNEL_LANES];
+  bvec_t rot16, rot8;
+
+  for ( j = 0; j < 4 * CHACHA20_KERNEL_LANES; ++j ) {
+    mask[0][j] = ( j & ~3 ) | ( ( j + 2 ) & 3 );
+    mask[1][j] = ( j & ~3 ) | ( ( j + 3 ) & 3 );
+  }
+  memcpy(&rot16, mask[0], sizeof(bvec_t));
+  memcpy(&rot8, mask[1], sizeof(bvec_t));
+#endif
+
+  for ( t = 0; t < 4; ++t ) s[t] = zero + chacha20_constants[t];
+  for ( t = 0; t < 8; ++t ) s[4 + t] = zero + key[t];
+  s[14] = zero;
+  s[15] = zero;
+
+  for ( i = 0; i < blocks; i += CHACHA20_KERNEL_LANES ) {
+    lanes = ( blocks - i < CHACHA20_KERNEL_LANES ) ? blocks - i : CHACHA20_KERNEL_LANES;
+
+    for ( j = 0; j < CHACHA20_KERNEL_LANES; ++j ) lane[j] = (uint32_t) ( counter + i + j );
+    memcpy(&s[12], lane, sizeof(vec_t));
+    for ( j = 0; j < CHACHA20_KERNEL_LANES; ++j ) lane[j] = (uint32_t) ( ( counter + i + j ) >> 32 );
+    memcpy(&s[13], lane, sizeof(vec_t));
+
+    for ( t = 0; t < 16; ++t ) x[t] = s[t];
+    for ( t = 0; t < 10; ++t ) {
+      CHACHA20_VQR(x[0], x[4], x[ 8], x[12]);
+      CHACHA20_VQR(x[1], x[5], x[ 9], x[13]);
+      CHACHA20_VQR(x[2], x[6], x[10], x[14]);
+      CHACHA20_VQR(x[3], x[7], x[11], x[15]);
+      CHACHA20_VQR(x[0], x[5], x[10], x[15]);
+      CHACHA20_VQR(x[1], x[6], x[11], x[12]);
+      CHACHA20_VQR(x[2], x[7], x[ 8], x[13]);
+      CHACHA20_VQR(x[3], x[4], x[ 9], x[14]);
+    }
+
+    //Transpose: word t of block j is lane j of x[t]
+    for ( t = 0; t < 16; ++t ) {
+      x[t] += s[t];
+      memcpy(lane, &x[t], sizeof(vec_t));
+      for ( j = 0; j < lanes; ++j )
+        chacha20_store32_le(output + ( i + j ) * CHACHA20_BLOCK_BYTES + t * 4, lane[j]);
+    }
+  }
+
+  memset(s, 0, sizeof(s));
+  memset(x, 0, sizeof(x));
+  memset(lane, 0, sizeof(lane));
+}
+
+#undef CHACHA20_VROTL
+#undef CHACHA20_VROTB
+#undef CHACHA20_VQR
+#undef CHACHA20_KERNEL_NAME
+#undef CHACHA20_KERNEL_TARGET
+#undef CHACHA20_KERNEL_LANES
+#undef CHACHA20_KERNEL_BYTE_SHUFFLE
@@ -0,0 +1,239 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+ChaCha20 keystream generator with fast key erasure
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <csprng/chacha20_rng.h>
+#include "sha2.h"
+#include "cpu_kernels.h"
+#include "secure_arena.h"
+
+//"expand 32-byte k"
+static const uint32_t chacha20_constants[4] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+
+static inline uint32_t chacha20_load32_le(const unsigned char* p)
+{
+  return (uint32_t) p[0] | ( (uint32_t) p[1] << 8 ) | ( (uint32_t) p[2] << 16 ) | ( (uint32_t) p[3] << 24 );
+}
+
+static inline void chacha20_store32_le(unsigned char* p, uint32_t x)
+{
+  p[0] = x & 0xff;
+  p[1] = ( x >> 8 ) & 0xff;
+  p[2] = ( x >> 16 ) & 0xff;
+  p[3] = x >> 24;
+}
+
+//{{{ Keystream kernels
+#define CHACHA20_ROTL(x, n)  ( ( (x) << (n) ) | ( (x) >> ( 32 - (n) ) ) )
+#define CHACHA20_QR(a, b, c, d)                                           \
+  a += b; d ^= a; d = CHACHA20_ROTL(d, 16);                               \
+  c += d; b ^= c; b = CHACHA20_ROTL(b, 12);                               \
+  a += b; d ^= a; d = CHACHA20_ROTL(d,  8);                               \
+  c += d; b ^= c; b = CHACHA20_ROTL(b,  7)
+
+/*
+ * Original ChaCha20 layout: 64-bit block counter in words 12-13, 64-bit nonce in words 14-15.
+ * The nonce is always 0, every key is used for one request only.
+ */
+void chacha20_blocks_generic(const uint32_t* key, uint64_t counter, unsigned char* output, int blocks)
+{
+  uint32_t s[16], x[16];
+  int i, t;
+
+  memcpy(s, chacha20_constants, sizeof(chacha20_constants));
+  memcpy(s + 4, key, CHACHA20_KEY_BYTES);
+  s[14] = 0;
+  s[15] = 0;
+
+  for ( i = 0; i < blocks; ++i, ++counter ) {
+    s[12] = (uint32_t) counter;
+    s[13] = (uint32_t) ( counter >> 32 );
+    memcpy(x, s, sizeof(s));
+    for ( t = 0; t < 10; ++t ) {
+      CHACHA20_QR(x[0], x[4], x[ 8], x[12]);
+      CHACHA20_QR(x[1], x[5], x[ 9], x[13]);
+      CHACHA20_QR(x[2], x[6], x[10], x[14]);
+      CHACHA20_QR(x[3], x[7], x[11], x[15]);
+      CHACHA20_QR(x[0], x[5], x[10], x[15]);
+      CHACHA20_QR(x[1], x[6], x[11], x[12]);
+      CHACHA20_QR(x[2], x[7], x[ 8], x[13]);
+      CHACHA20_QR(x[3], x[4], x[ 9], x[14]);
+    }
+    for ( t = 0; t < 16; ++t ) chacha20_store32_le(output + i * CHACHA20_BLOCK_BYTES + t * 4, x[t] + s[t]);
+  }
+
+  memset(s, 0, sizeof(s));
+  memset(x, 0, sizeof(x));
+}
+
+#undef CHACHA20_ROTL
+#undef CHACHA20_QR
+
+#ifdef CSPRNG_HAVE_X86_KERNELS
+#define CHACHA20_KERNEL_NAME   chacha20_blocks_sse2
+#define CHACHA20_KERNEL_TARGET __attribute__ ((target ("sse2")))
+#define CHACHA20_KERNEL_LANES  4
+#include "chacha20_kernel.h"
+
+#define CHACHA20_KERNEL_NAME   chacha20_blocks_avx2
+#define CHACHA20_KERNEL_TARGET __attribute__ ((target ("avx2")))
+#define CHACHA20_KERNEL_LANES  8
+#define CHACHA20_KERNEL_BYTE_SHUFFLE
+#include "chacha20_kernel.h"
+
+#define CHACHA20_KERNEL_NAME   chacha20_blocks_avx512
+#define CHACHA20_KERNEL_TARGET __attribute__ ((target ("avx512f")))
+#define CHACHA20_KERNEL_LANES  16
+#include "chacha20_kernel.h"
+#endif
+//}}}
+
+//{{{ Key mixing
+/*
+ * key = SHA-256(key || a || b). The old key is left out when use_key is 0 (instantiate)
+ */
+static void chacha20_rng_mix(CHACHA20_RNG* rng, int use_key, const void* a, int a_length, const void* b, int b_length)
+{
+  sha256_ctx_type ctx;
+  unsigned char buf[SHA256_DIGEST_BYTES];
+  int t;
+
+  sha256_init(&ctx);
+  if ( use_key ) {
+    for ( t = 0; t < 8; ++t ) chacha20_store32_le(buf + 4 * t, rng->key[t]);
+    sha256_update(&ctx, buf, CHACHA20_KEY_BYTES);
+  }
+  if ( a != NULL && a_length > 0 ) sha256_update(&ctx, a, a_length);
+  if ( b != NULL && b_length > 0 ) sha256_update(&ctx, b, b_length);
+  sha256_final(&ctx, buf);
+
+  for ( t = 0; t < 8; ++t ) rng->key[t] = chacha20_load32_le(buf + 4 * t);
+  memset(buf, 0, sizeof(buf));
+}
+//}}}
+
+//{{{ Public API
+CHACHA20_RNG* chacha20_rng_instantiate(
+    const void* entropy_input, int entropy_input_length,
+    const void* personalization_string, int personalization_string_length)
+{
+  CHACHA20_RNG* rng;
+
+  if ( entropy_input_length < CHACHA20_SECURITY_STRENGTH_BYTES ) {
+    fprintf(stderr, "chacha20_rng_instantiate: entropy_input_length has to be at least %d bytes, got %d bytes\n",
+        CHACHA20_SECURITY_STRENGTH_BYTES, entropy_input_length);
+    return NULL;
+  }
+
+  rng = secure_alloc(sizeof(CHACHA20_RNG));
+  if ( rng == NULL ) {
+    fprintf(stderr, "chacha20_rng_instantiate: Dynamic memory allocation failed\n");
+    return rng;
+  }
+
+  chacha20_rng_mix(rng, 0, entropy_input, entropy_input_length, personalization_string, personalization_string_length);
+  rng->reseed_counter = 1;
+
+  return rng;
+}
+
+int chacha20_rng_reseed(CHACHA20_RNG* rng,
+    const void* entropy_input, int entropy_input_length,
+    const void* additional_input, int additional_input_length)
+{
+  if ( entropy_input_length < CHACHA20_SECURITY_STRENGTH_BYTES ) {
+    fprintf(stderr, "chacha20_rng_reseed: entropy_input_length has to be at least %d bytes, got %d bytes\n",
+        CHACHA20_SECURITY_STRENGTH_BYTES, entropy_input_length);
+    return 1;
+  }
+
+  chacha20_rng_mix(rng, 1, entropy_input, entropy_input_length, additional_input, additional_input_length);
+  rng->reseed_counter = 1;
+
+  return 0;
+}
+
+/*
+ * Keystream block 0 holds the next key and the first 32 output bytes. Whole blocks after it are written
+ * straight into output_string, only the tail goes through a local buffer.
+ */
+int chacha20_rng_generate(CHACHA20_RNG* rng,
+    void* output_string, int output_string_length,
+    const void* additional_input, int additional_input_length)
+{
+  const csprng_kernel_table_type* k = csprng_cpu_kernels();
+  unsigned char* output = output_string;
+  unsigned char block[CHACHA20_BLOCK_BYTES];
+  int first, blocks, tail;
+  int t;
+
+  if ( output_string_length < 1 || output_string_length > (int) CHACHA20_RNG_MAX_NUMBER_OF_BYTES_PER_REQUEST ) {
+    fprintf(stderr, "chacha20_rng_generate: output_string_length has to be in range 1 - %d bytes, requested was %d bytes\n",
+        (int) CHACHA20_RNG_MAX_NUMBER_OF_BYTES_PER_REQUEST, output_string_length);
+    return 1;
+  }
+  if ( rng->reseed_counter > CHACHA20_RNG_RESEED_INTERVAL ) {
+    fprintf(stderr, "chacha20_rng_generate: reseed required. reseed_counter %" PRIu64 " has reached the limit\n",
+        rng->reseed_counter);
+    return 1;
+  }
+
+  if ( additional_input != NULL && additional_input_length > 0 )
+    chacha20_rng_mix(rng, 1, additional_input, additional_input_length, NULL, 0);
+
+  first = output_string_length < CHACHA20_BLOCK_BYTES - CHACHA20_KEY_BYTES ? output_string_length : CHACHA20_BLOCK_BYTES - CHACHA20_KEY_BYTES;
+  blocks = ( output_string_length - first ) / CHACHA20_BLOCK_BYTES;
+  tail = output_string_length - first - blocks * CHACHA20_BLOCK_BYTES;
+
+  if ( blocks ) k->chacha20_blocks(rng->key, 1, output + first, blocks);
+  if ( tail ) {
+    k->chacha20_blocks(rng->key, 1 + blocks, block, 1);
+    memcpy(output + output_string_length - tail, block, tail);
+  }
+
+  //Block 0 last: it overwrites the key
+  k->chacha20_blocks(rng->key, 0, block, 1);
+  for ( t = 0; t < 8; ++t ) rng->key[t] = chacha20_load32_le(block + 4 * t);
+  memcpy(output, block + CHACHA20_KEY_BYTES, first);
+
+  memset(block, 0, sizeof(block));
+  ++rng->reseed_counter;
+  return 0;
+}
+
+int chacha20_rng_destroy(CHACHA20_RNG* rng)
+{
+  if ( rng != NULL ) {
+    memset(rng, 0, sizeof(*rng));
+    rng->reseed_counter = ~0ULL;
+    secure_free(rng, sizeof(CHACHA20_RNG));
+  }
+
+  return 0;
+}
+//}}}
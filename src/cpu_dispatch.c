@@ -0,0 +1,454 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Runtime CPU feature detection and kernel dispatch
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cpu_kernels.h"
+
+#ifdef CSPRNG_HAVE_X86_KERNELS
+#include <cpuid.h>
+#endif
+
+const char* const csprng_cpu_tier_names[CSPRNG_CPU_TIER_COUNT] = {
+  "generic",
+  "sse2",
+  "avx2",
+  "avx512",
+  "vaes"
+};
+
+const char* const csprng_kernel_names[CSPRNG_KERNEL_COUNT] = {
+  "AES CTR",
+  "FIPS 140-2",
+  "SHA1_RNG",
+  "MEMT19937",
+  "SHA-256",
+  "SHA-256 MULTI-BUFFER",
+  "SHA-512 MULTI-BUFFER",
+  "CHACHA20",
+  "AES CTR MULTI-LANE",
+  "TYPED OUTPUT"
+};
+
+static pthread_once_t dispatch_once = PTHREAD_ONCE_INIT;
+static csprng_cpu_features_type features;
+static csprng_cpu_tier_type detected_tier = CSPRNG_CPU_TIER_GENERIC;
+static csprng_cpu_tier_type active_tier = CSPRNG_CPU_TIER_GENERIC;
+static csprng_kernel_table_type kernels;
+static pthread_mutex_t select_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//{{{ static void probe_cpu_features(csprng_cpu_features_type* f)
+#ifdef CSPRNG_HAVE_X86_KERNELS
+static uint64_t read_xcr0(void)
+{
+  uint32_t eax, edx;
+  __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+  return ( (uint64_t) edx << 32 ) | eax;
+}
+#endif
+
+static void probe_cpu_features(csprng_cpu_features_type* f)
+{
+  memset(f, 0, sizeof(csprng_cpu_features_type));
+#ifdef CSPRNG_HAVE_X86_KERNELS
+  unsigned int eax, ebx, ecx, edx, max_leaf;
+  uint64_t xcr0 = 0;
+  int os_ymm = 0, os_zmm = 0;
+
+  max_leaf = __get_cpuid_max(0, NULL);
+  if ( max_leaf < 1 ) return;
+
+  __cpuid(1, eax, ebx, ecx, edx);
+  f->sse2   = ( edx >> 26 ) & 1;
+  f->ssse3  = ( ecx >>  9 ) & 1;
+  f->sse41  = ( ecx >> 19 ) & 1;
+  f->popcnt = ( ecx >> 23 ) & 1;
+  f->aesni  = ( ecx >> 25 ) & 1;
+
+  //OSXSAVE: the OS saves the wide registers on context switch
+  if ( ( ecx >> 27 ) & 1 ) {
+    xcr0 = read_xcr0();
+    os_ymm = ( xcr0 & 0x06 ) == 0x06;
+    os_zmm = os_ymm && ( xcr0 & 0xe0 ) == 0xe0;
+  }
+
+  if ( max_leaf < 7 ) return;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  f->sha      = ( ebx >> 29 ) & 1;
+  f->avx2     = os_ymm && ( ( ebx >>  5 ) & 1 );
+  f->avx512f  = os_zmm && ( ( ebx >> 16 ) & 1 );
+  f->avx512bw = os_zmm && ( ( ebx >> 30 ) & 1 );
+  f->vaes     = os_ymm && ( ( ecx >>  9 ) & 1 ) && f->aesni;
+#endif
+}
+//}}}
+
+//{{{ static csprng_cpu_tier_type tier_from_features(const csprng_cpu_features_type* f)
+static csprng_cpu_tier_type tier_from_features(const csprng_cpu_features_type* f)
+{
+  if ( !f->sse2 ) return CSPRNG_CPU_TIER_GENERIC;
+  if ( !f->avx2 ) return CSPRNG_CPU_TIER_SSE2;
+  if ( !f->avx512f || !f->avx512bw ) return CSPRNG_CPU_TIER_AVX2;
+  if ( !f->vaes ) return CSPRNG_CPU_TIER_AVX512;
+  return CSPRNG_CPU_TIER_VAES;
+}
+//}}}
+
+//{{{ static int bind_aes_kernels(csprng_kernel_table_type* k, nist_cipher_type cipher, csprng_cpu_tier_type tier, const csprng_cpu_features_type* f)
+/*
+ * Returns 1 when the cipher is not supported by the CPU or by the active tier
+ */
+static int bind_aes_kernels(csprng_kernel_table_type* k, nist_cipher_type cipher, csprng_cpu_tier_type tier, const csprng_cpu_features_type* f)
+{
+  int have_aesni = 0;
+
+#ifdef CSPRNG_HAVE_X86_KERNELS
+  have_aesni = ( tier >= CSPRNG_CPU_TIER_SSE2 && f->aesni );
+#else
+  (void) tier;
+  (void) f;
+#endif
+
+  if ( cipher == NIST_CIPHER_AUTO ) cipher = have_aesni ? NIST_CIPHER_AESNI : NIST_CIPHER_BITSLICED;
+  k->cipher = cipher;
+
+  switch ( cipher ) {
+    case NIST_CIPHER_OPENSSL:
+      k->name[CSPRNG_KERNEL_AES_CTR] = "openssl";
+      k->aes_schedule = nist_ctr_drbg_schedule_generic;
+      k->aes_encrypt = nist_ctr_drbg_encrypt_generic;
+      k->aes_ctr = nist_ctr_drbg_ctr_generic;
+      k->aes_bcc = nist_ctr_drbg_bcc_generic;
+      k->name[CSPRNG_KERNEL_AES_CTR_LANES] = "generic";
+      k->aes_ctr_lanes = nist_ctr_drbg_ctr_lanes_generic;
+      return 0;
+    case NIST_CIPHER_BITSLICED:
+      k->name[CSPRNG_KERNEL_AES_CTR] = "bitsliced-8x";
+      k->aes_schedule = nist_ctr_drbg_schedule_bitsliced;
+      k->aes_encrypt = nist_ctr_drbg_encrypt_bitsliced;
+      k->aes_ctr = nist_ctr_drbg_ctr_bitsliced;
+      k->aes_bcc = nist_ctr_drbg_bcc_bitsliced;
+      //Each lane has its own bitsliced key schedule, the lanes are run one after another
+      k->name[CSPRNG_KERNEL_AES_CTR_LANES] = "generic";
+      k->aes_ctr_lanes = nist_ctr_drbg_ctr_lanes_generic;
+      return 0;
+    case NIST_CIPHER_AESNI:
+      if ( !have_aesni ) return 1;
+#ifdef CSPRNG_HAVE_X86_KERNELS
+      k->name[CSPRNG_KERNEL_AES_CTR] = "aesni-8x";
+      k->aes_schedule = nist_ctr_drbg_schedule_aesni;
+      k->aes_encrypt = nist_ctr_drbg_encrypt_aesni;
+      k->aes_ctr = nist_ctr_drbg_ctr_aesni;
+      k->aes_bcc = nist_ctr_drbg_bcc_aesni;
+      k->name[CSPRNG_KERNEL_AES_CTR_LANES] = "aesni-8x";
+      k->aes_ctr_lanes = nist_ctr_drbg_ctr_lanes_aesni;
+#endif
+#ifdef CSPRNG_HAVE_VAES_KERNELS
+      if ( tier >= CSPRNG_CPU_TIER_VAES ) {
+        k->name[CSPRNG_KERNEL_AES_CTR] = "vaes512-32x";
+        k->aes_ctr = nist_ctr_drbg_ctr_vaes512;
+        k->name[CSPRNG_KERNEL_AES_CTR_LANES] = "vaes512-32x";
+        k->aes_ctr_lanes = nist_ctr_drbg_ctr_lanes_vaes512;
+      } else if ( tier >= CSPRNG_CPU_TIER_AVX2 && f->vaes ) {
+        k->name[CSPRNG_KERNEL_AES_CTR] = "vaes256-16x";
+        k->aes_ctr = nist_ctr_drbg_ctr_vaes256;
+      }
+#endif
+      return 0;
+    default:
+      return 1;
+  }
+}
+//}}}
+
+//{{{ static void bind_kernels(csprng_kernel_table_type* k, csprng_cpu_tier_type tier, const csprng_cpu_features_type* f)
+static void bind_kernels(csprng_kernel_table_type* k, csprng_cpu_tier_type tier, const csprng_cpu_features_type* f)
+{
+  k->name[CSPRNG_KERNEL_FIPS] = "generic";
+  k->fips_scan = fips_scan_generic;
+  k->fips_repeats = fips_repeats_generic;
+
+  k->name[CSPRNG_KERNEL_SHA1_RNG] = "openssl";
+  k->sha1_rng = sha1_rng_generic;
+
+  k->name[CSPRNG_KERNEL_MEMT] = "generic";
+  k->memt_fill = MEMT_fill_buffer_generic;
+
+  k->name[CSPRNG_KERNEL_SHA256] = "generic";
+  k->sha256_blocks = sha256_blocks_generic;
+  k->sha512_blocks = sha512_blocks_generic;
+
+  k->name[CSPRNG_KERNEL_SHA256_MB] = "generic";
+  k->sha256_multi = sha256_multi_generic;
+
+  k->name[CSPRNG_KERNEL_SHA512_MB] = "generic";
+  k->sha512_multi = sha512_multi_generic;
+
+  k->name[CSPRNG_KERNEL_CHACHA20] = "generic";
+  k->chacha20_blocks = chacha20_blocks_generic;
+
+  k->name[CSPRNG_KERNEL_TYPED] = "generic";
+  k->typed_bounded32 = typed_bounded32_generic;
+  k->typed_float = typed_float_generic;
+  k->typed_double = typed_double_generic;
+  k->typed_bool = typed_bool_generic;
+
+#ifdef CSPRNG_HAVE_X86_KERNELS
+  if ( tier >= CSPRNG_CPU_TIER_SSE2 ) {
+    if ( f->sha && f->ssse3 && f->sse41 ) {
+      k->name[CSPRNG_KERNEL_SHA1_RNG] = "sha-ni";
+      k->sha1_rng = sha1_rng_shani;
+      k->name[CSPRNG_KERNEL_SHA256] = "sha-ni";
+      k->sha256_blocks = sha256_blocks_shani;
+    }
+    k->name[CSPRNG_KERNEL_FIPS] = "sse2-2x";
+    k->fips_scan = fips_scan_sse2;
+    k->fips_repeats = fips_repeats_sse2;
+    k->name[CSPRNG_KERNEL_MEMT] = "sse2-4x";
+    k->memt_fill = MEMT_fill_buffer_sse2;
+    if ( f->sha && f->ssse3 && f->sse41 ) {
+      k->name[CSPRNG_KERNEL_SHA256_MB] = "sha-ni-2x";
+      k->sha256_multi = sha256_multi_shani;
+    } else {
+      k->name[CSPRNG_KERNEL_SHA256_MB] = "sse2-4x";
+      k->sha256_multi = sha256_multi_sse2;
+    }
+    k->name[CSPRNG_KERNEL_SHA512_MB] = "sse2-2x";
+    k->sha512_multi = sha512_multi_sse2;
+    k->name[CSPRNG_KERNEL_CHACHA20] = "sse2-4x";
+    k->chacha20_blocks = chacha20_blocks_sse2;
+    k->name[CSPRNG_KERNEL_TYPED] = "sse2-4x";
+    k->typed_bounded32 = typed_bounded32_sse2;
+    k->typed_float = typed_float_sse2;
+    k->typed_double = typed_double_sse2;
+    k->typed_bool = typed_bool_sse2;
+  }
+
+  if ( tier >= CSPRNG_CPU_TIER_AVX2 ) {
+    k->name[CSPRNG_KERNEL_FIPS] = "avx2-4x";
+    k->fips_scan = fips_scan_avx2;
+    k->fips_repeats = fips_repeats_avx2;
+    k->name[CSPRNG_KERNEL_MEMT] = "avx2-8x";
+    k->memt_fill = MEMT_fill_buffer_avx2;
+    //Two interleaved SHA-NI chains are about twice as fast as 8 AVX2 lanes
+    if ( k->sha256_multi != sha256_multi_shani ) {
+      k->name[CSPRNG_KERNEL_SHA256_MB] = "avx2-8x";
+      k->sha256_multi = sha256_multi_avx2;
+    }
+    k->name[CSPRNG_KERNEL_SHA512_MB] = "avx2-4x";
+    k->sha512_multi = sha512_multi_avx2;
+    k->name[CSPRNG_KERNEL_CHACHA20] = "avx2-8x";
+    k->chacha20_blocks = chacha20_blocks_avx2;
+    k->name[CSPRNG_KERNEL_TYPED] = "avx2-8x";
+    k->typed_bounded32 = typed_bounded32_avx2;
+    k->typed_float = typed_float_avx2;
+    k->typed_double = typed_double_avx2;
+    k->typed_bool = typed_bool_avx2;
+  }
+
+  if ( tier >= CSPRNG_CPU_TIER_AVX512 ) {
+    k->name[CSPRNG_KERNEL_FIPS] = "avx512-8x";
+    k->fips_scan = fips_scan_avx512;
+    k->fips_repeats = fips_repeats_avx512;
+    k->name[CSPRNG_KERNEL_MEMT] = "avx512-16x";
+    k->memt_fill = MEMT_fill_buffer_avx512;
+    k->name[CSPRNG_KERNEL_SHA256_MB] = "avx512-16x";
+    k->sha256_multi = sha256_multi_avx512;
+    k->name[CSPRNG_KERNEL_SHA512_MB] = "avx512-8x";
+    k->sha512_multi = sha512_multi_avx512;
+    k->name[CSPRNG_KERNEL_CHACHA20] = "avx512-16x";
+    k->chacha20_blocks = chacha20_blocks_avx512;
+    k->name[CSPRNG_KERNEL_TYPED] = "avx512-16x";
+    k->typed_bounded32 = typed_bounded32_avx512;
+    k->typed_float = typed_float_avx512;
+    k->typed_double = typed_double_avx512;
+    k->typed_bool = typed_bool_avx512;
+  }
+#else
+  (void) tier;
+  (void) f;
+#endif
+}
+//}}}
+
+//{{{ static void dispatch_initialize(void)
+static void dispatch_initialize(void)
+{
+  const char* env;
+  nist_cipher_type cipher;
+  int i;
+
+  probe_cpu_features(&features);
+  detected_tier = tier_from_features(&features);
+  active_tier = detected_tier;
+
+  env = getenv(CSPRNG_CPU_TIER_ENV);
+  if ( env != NULL && env[0] != '\0' ) {
+    for ( i = 0; i < CSPRNG_CPU_TIER_COUNT; ++i ) {
+      if ( strcmp(env, csprng_cpu_tier_names[i]) == 0 ) break;
+    }
+    if ( i == CSPRNG_CPU_TIER_COUNT ) {
+      fprintf(stderr, "WARNING: %s=%s is not supported. Supported values are generic, sse2, avx2, avx512 and vaes. "
+          "Using detected tier %s.\n", CSPRNG_CPU_TIER_ENV, env, csprng_cpu_tier_names[detected_tier]);
+    } else if ( (csprng_cpu_tier_type) i > detected_tier ) {
+      fprintf(stderr, "WARNING: %s=%s is not supported by this CPU. Using detected tier %s.\n",
+          CSPRNG_CPU_TIER_ENV, env, csprng_cpu_tier_names[detected_tier]);
+    } else {
+      active_tier = (csprng_cpu_tier_type) i;
+    }
+  }
+
+  bind_kernels(&kernels, active_tier, &features);
+
+  env = getenv(NIST_CIPHER_ENV);
+  cipher = NIST_CIPHER_AUTO;
+  if ( env != NULL && env[0] != '\0' ) {
+    for ( i = 0; i < NIST_CIPHER_COUNT; ++i ) {
+      if ( strcmp(env, nist_cipher_names[i]) == 0 ) break;
+    }
+    if ( i == NIST_CIPHER_COUNT ) {
+      fprintf(stderr, "WARNING: %s=%s is not supported. Supported values are auto, openssl, bitsliced and aesni.\n",
+          NIST_CIPHER_ENV, env);
+    } else {
+      cipher = (nist_cipher_type) i;
+    }
+  }
+  if ( bind_aes_kernels(&kernels, cipher, active_tier, &features) ) {
+    fprintf(stderr, "WARNING: %s=%s is not supported with CPU tier %s. Using %s.\n", NIST_CIPHER_ENV, env,
+        csprng_cpu_tier_names[active_tier], nist_cipher_names[NIST_CIPHER_AUTO]);
+    bind_aes_kernels(&kernels, NIST_CIPHER_AUTO, active_tier, &features);
+  }
+}
+//}}}
+
+//{{{ Public API
+int csprng_cpu_dispatch_initialize(void)
+{
+  return pthread_once(&dispatch_once, dispatch_initialize);
+}
+
+const csprng_kernel_table_type* csprng_cpu_kernels(void)
+{
+  pthread_once(&dispatch_once, dispatch_initialize);
+  return &kernels;
+}
+
+int csprng_cpu_select_cipher(nist_cipher_type cipher)
+{
+  csprng_kernel_table_type k;
+  int ret;
+
+  pthread_once(&dispatch_once, dispatch_initialize);
+  pthread_mutex_lock(&select_mutex);
+  k = kernels;
+  ret = bind_aes_kernels(&k, cipher, active_tier, &features);
+  if ( ret == 0 ) kernels = k;
+  pthread_mutex_unlock(&select_mutex);
+  return ret;
+}
+
+int csprng_cpu_select_tier(csprng_cpu_tier_type tier)
+{
+  csprng_kernel_table_type k;
+  int ret = 1;
+
+  pthread_once(&dispatch_once, dispatch_initialize);
+  if ( tier >= CSPRNG_CPU_TIER_COUNT || tier > detected_tier ) return 1;
+
+  pthread_mutex_lock(&select_mutex);
+  k = kernels;
+  bind_kernels(&k, tier, &features);
+  //Same cipher as before so that the existing key schedules stay valid
+  if ( bind_aes_kernels(&k, kernels.cipher, tier, &features) == 0 ) {
+    kernels = k;
+    active_tier = tier;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&select_mutex);
+  return ret;
+}
+
+csprng_cpu_tier_type csprng_cpu_tier(void)
+{
+  pthread_once(&dispatch_once, dispatch_initialize);
+  return active_tier;
+}
+
+csprng_cpu_tier_type csprng_cpu_detected_tier(void)
+{
+  pthread_once(&dispatch_once, dispatch_initialize);
+  return detected_tier;
+}
+
+const csprng_cpu_features_type* csprng_cpu_features(void)
+{
+  pthread_once(&dispatch_once, dispatch_initialize);
+  return &features;
+}
+
+const char* csprng_cpu_kernel_name(csprng_kernel_type kernel)
+{
+  if ( kernel >= CSPRNG_KERNEL_COUNT ) return NULL;
+  pthread_once(&dispatch_once, dispatch_initialize);
+  return kernels.name[kernel];
+}
+
+const char* dump_csprng_cpu_dispatch(void)
+{
+  static __thread char buf[1024];
+  char *p = buf;
+  int remaining_size = sizeof(buf);
+  int ret, i;
+
+  pthread_once(&dispatch_once, dispatch_initialize);
+
+  ret = snprintf(p, remaining_size, "CPU FEATURES =%s%s%s%s%s%s%s%s%s%s\nCPU TIER = %s (detected %s)\n",
+      features.sse2     ? " sse2"     : "",
+      features.ssse3    ? " ssse3"    : "",
+      features.sse41    ? " sse4.1"   : "",
+      features.popcnt   ? " popcnt"   : "",
+      features.aesni    ? " aes"      : "",
+      features.sha      ? " sha"      : "",
+      features.avx2     ? " avx2"     : "",
+      features.avx512f  ? " avx512f"  : "",
+      features.avx512bw ? " avx512bw" : "",
+      features.vaes     ? " vaes"     : "",
+      csprng_cpu_tier_names[active_tier], csprng_cpu_tier_names[detected_tier]);
+  if ( ret < 1 || ret >= remaining_size ) return NULL;
+  p += ret;
+  remaining_size -= ret;
+
+  for ( i = 0; i < CSPRNG_KERNEL_COUNT; ++i ) {
+    ret = snprintf(p, remaining_size, "%s KERNEL = %s\n", csprng_kernel_names[i], kernels.name[i]);
+    if ( ret < 1 || ret >= remaining_size ) return NULL;
+    p += ret;
+    remaining_size -= ret;
+  }
+
+  return buf;
+}
+//}}}
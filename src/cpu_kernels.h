@@ -0,0 +1,252 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Function pointer table of the hot kernels. Internal to libcsprng.
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#ifndef CSPRNG_CPU_KERNELS_H
+#define CSPRNG_CPU_KERNELS_H
+
+#include <csprng/cpu_dispatch.h>
+#include <csprng/nist_ctr_drbg.h>
+#include <csprng/fips.h>
+#include <csprng/memt19937ar-JH.h>
+
+/*
+ * Which instruction set extensions can the compiler emit through the target attribute?
+ */
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#if __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 )
+#define CSPRNG_HAVE_X86_KERNELS
+#endif
+#if __GNUC__ >= 8
+#define CSPRNG_HAVE_VAES_KERNELS
+#endif
+#endif
+
+/*
+ * Compute round keys into ctx and set ctx->rounds. keylen is 128, 192 or 256 bits. Returns 0 on success
+ */
+typedef int (*aes_schedule_kernel_type)(NIST_Key* ctx, const unsigned char* key, int keylen);
+
+/*
+ * Encrypt one block
+ */
+typedef void (*aes_encrypt_kernel_type)(const NIST_Key* ctx, const unsigned char* input, unsigned char* output);
+
+/*
+ * Encrypt counter blocks V+1 ... V+blocks and write them to output. V is updated to V+blocks.
+ */
+typedef void (*aes_ctr_kernel_type)(const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks);
+
+/*
+ * Multi-lane CTR: block i of output is the next counter block of lane i mod lanes, encrypted with ctx[i mod lanes].
+ * Every V[l] is updated. All lanes have the same key length, lanes <= NIST_CTR_DRBG_MAX_LANES
+ */
+typedef void (*aes_ctr_lanes_kernel_type)(const NIST_Key* const* ctx, unsigned int* const* V, int lanes, unsigned char* output, int blocks);
+
+/*
+ * BCC (CBC-MAC) of blocks input blocks, computed for chains chaining values at once.
+ * chaining_value holds chains consecutive blocks and is updated in place. chains <= NIST_SEEDLEN_MAX_BLOCKS
+ */
+typedef void (*aes_bcc_kernel_type)(const NIST_Key* ctx, unsigned char* chaining_value, int chains, const unsigned char* input, int blocks);
+
+/*
+ * Run-boundary scan of the FIPS test, see fips.c. Bits are taken MSB first. A transition is a bit
+ * that differs from the bit before it. longer[k] counts the transitions with no other transition
+ * in the k bits before them, longer_ones[k] those of them where the new bit is 1.
+ * last_bit and last_e (transitions at the last 5 bits, bit 0 = the last bit) carry the stream over
+ * two calls, transitions in front of the first call are not seen. run_candidate is set when two
+ * consecutive bytes are both 0x00 or both 0xff, which every run of 26 or more bits contains
+ */
+typedef struct {
+  unsigned int last_bit;
+  unsigned int last_e;
+  int run_candidate;
+  uint64_t ones;
+  uint64_t longer[6];
+  uint64_t longer_ones[6];
+  uint64_t poker[16];
+} fips_scan_type;
+
+typedef void (*fips_scan_kernel_type)(fips_scan_type* s, const unsigned char* buf, int len);
+
+/*
+ * Continuous run test: number of the 32-bit words at buf equal to the word before them,
+ * the word before the first one is last32
+ */
+typedef int (*fips_repeats_kernel_type)(const unsigned char* buf, int words, uint32_t last32);
+
+/*
+ * SHA-1 of SHA1_VECTOR_LENGTH_IN_BYTES bytes long vector
+ */
+typedef void (*sha1_rng_kernel_type)(const unsigned char* V, unsigned char* digest);
+
+/*
+ * SHA-256/SHA-512 compression of blocks consecutive blocks into the chaining value state
+ */
+typedef void (*sha256_blocks_kernel_type)(uint32_t* state, const unsigned char* data, int blocks);
+typedef void (*sha512_blocks_kernel_type)(uint64_t* state, const unsigned char* data, int blocks);
+
+/*
+ * Hash n independent messages, each of them exactly one padded block, from the initial state.
+ * Writes n consecutive digests
+ */
+typedef void (*sha2_multi_kernel_type)(const unsigned char* blocks, int n, unsigned char* digests);
+
+/*
+ * ChaCha20 keystream blocks counter ... counter+blocks-1 of key, nonce 0
+ */
+typedef void (*chacha20_blocks_kernel_type)(const uint32_t* key, uint64_t counter, unsigned char* output, int blocks);
+
+/*
+ * MEMT_fill_buffer
+ */
+typedef int (*memt_fill_kernel_type)(memt_type* state, uint32_t* output_buffer, int output_size);
+
+/*
+ * Typed output from words of random bytes, see csprng_typed.c. typed_bounded32 converts words words
+ * to integers in [0, bound) and skips the rejected ones, it returns the number of integers written
+ */
+typedef int (*typed_bounded32_kernel_type)(const unsigned char* input, int words, uint32_t bound, uint32_t threshold, uint32_t* output);
+typedef void (*typed_float_kernel_type)(const unsigned char* input, float* output, int n);
+typedef void (*typed_double_kernel_type)(const unsigned char* input, double* output, int n);
+typedef void (*typed_bool_kernel_type)(const unsigned char* input, uint32_t threshold, unsigned char* output, int n);
+
+typedef struct {
+  const char*               name[CSPRNG_KERNEL_COUNT];
+  nist_cipher_type          cipher;                   //Cipher of the bound AES kernels, never NIST_CIPHER_AUTO
+  aes_schedule_kernel_type  aes_schedule;
+  aes_encrypt_kernel_type   aes_encrypt;
+  aes_ctr_kernel_type       aes_ctr;
+  aes_ctr_lanes_kernel_type aes_ctr_lanes;
+  aes_bcc_kernel_type       aes_bcc;
+  fips_scan_kernel_type     fips_scan;
+  fips_repeats_kernel_type  fips_repeats;
+  sha1_rng_kernel_type      sha1_rng;
+  sha256_blocks_kernel_type sha256_blocks;
+  sha2_multi_kernel_type    sha256_multi;
+  sha512_blocks_kernel_type sha512_blocks;
+  sha2_multi_kernel_type    sha512_multi;
+  chacha20_blocks_kernel_type chacha20_blocks;
+  memt_fill_kernel_type     memt_fill;
+  typed_bounded32_kernel_type typed_bounded32;
+  typed_float_kernel_type   typed_float;
+  typed_double_kernel_type  typed_double;
+  typed_bool_kernel_type    typed_bool;
+} csprng_kernel_table_type;
+
+/* Bound kernels. Initializes the dispatch layer on first use */
+const csprng_kernel_table_type* csprng_cpu_kernels(void);
+
+/* Rebind the AES kernels. Returns 1 when the cipher is not supported */
+int csprng_cpu_select_cipher(nist_cipher_type cipher);
+
+/*
+ * Kernel variants
+ */
+int nist_ctr_drbg_schedule_generic(NIST_Key* ctx, const unsigned char* key, int keylen);
+void nist_ctr_drbg_encrypt_generic(const NIST_Key* ctx, const unsigned char* input, unsigned char* output);
+void nist_ctr_drbg_ctr_generic(const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks);
+void nist_ctr_drbg_ctr_lanes_generic(const NIST_Key* const* ctx, unsigned int* const* V, int lanes, unsigned char* output, int blocks);
+void nist_ctr_drbg_bcc_generic(const NIST_Key* ctx, unsigned char* chaining_value, int chains, const unsigned char* input, int blocks);
+int nist_ctr_drbg_schedule_bitsliced(NIST_Key* ctx, const unsigned char* key, int keylen);
+void nist_ctr_drbg_encrypt_bitsliced(const NIST_Key* ctx, const unsigned char* input, unsigned char* output);
+void nist_ctr_drbg_ctr_bitsliced(const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks);
+void nist_ctr_drbg_bcc_bitsliced(const NIST_Key* ctx, unsigned char* chaining_value, int chains, const unsigned char* input, int blocks);
+#ifdef CSPRNG_HAVE_X86_KERNELS
+int nist_ctr_drbg_schedule_aesni(NIST_Key* ctx, const unsigned char* key, int keylen);
+void nist_ctr_drbg_encrypt_aesni(const NIST_Key* ctx, const unsigned char* input, unsigned char* output);
+void nist_ctr_drbg_ctr_aesni(const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks);
+void nist_ctr_drbg_ctr_lanes_aesni(const NIST_Key* const* ctx, unsigned int* const* V, int lanes, unsigned char* output, int blocks);
+void nist_ctr_drbg_bcc_aesni(const NIST_Key* ctx, unsigned char* chaining_value, int chains, const unsigned char* input, int blocks);
+#endif
+#ifdef CSPRNG_HAVE_VAES_KERNELS
+void nist_ctr_drbg_ctr_vaes256(const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks);
+void nist_ctr_drbg_ctr_vaes512(const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks);
+void nist_ctr_drbg_ctr_lanes_vaes512(const NIST_Key* const* ctx, unsigned int* const* V, int lanes, unsigned char* output, int blocks);
+#endif
+
+void fips_scan_generic(fips_scan_type* s, const unsigned char* buf, int len);
+int fips_repeats_generic(const unsigned char* buf, int words, uint32_t last32);
+#ifdef CSPRNG_HAVE_X86_KERNELS
+void fips_scan_sse2(fips_scan_type* s, const unsigned char* buf, int len);
+void fips_scan_avx2(fips_scan_type* s, const unsigned char* buf, int len);
+void fips_scan_avx512(fips_scan_type* s, const unsigned char* buf, int len);
+int fips_repeats_sse2(const unsigned char* buf, int words, uint32_t last32);
+int fips_repeats_avx2(const unsigned char* buf, int words, uint32_t last32);
+int fips_repeats_avx512(const unsigned char* buf, int words, uint32_t last32);
+#endif
+
+void sha1_rng_generic(const unsigned char* V, unsigned char* digest);
+#ifdef CSPRNG_HAVE_X86_KERNELS
+void sha1_rng_shani(const unsigned char* V, unsigned char* digest);
+#endif
+
+void sha256_blocks_generic(uint32_t* state, const unsigned char* data, int blocks);
+void sha512_blocks_generic(uint64_t* state, const unsigned char* data, int blocks);
+void sha256_multi_generic(const unsigned char* blocks, int n, unsigned char* digests);
+void sha512_multi_generic(const unsigned char* blocks, int n, unsigned char* digests);
+#ifdef CSPRNG_HAVE_X86_KERNELS
+void sha256_blocks_shani(uint32_t* state, const unsigned char* data, int blocks);
+void sha256_multi_shani(const unsigned char* blocks, int n, unsigned char* digests);
+void sha256_multi_sse2(const unsigned char* blocks, int n, unsigned char* digests);
+void sha256_multi_avx2(const unsigned char* blocks, int n, unsigned char* digests);
+void sha256_multi_avx512(const unsigned char* blocks, int n, unsigned char* digests);
+void sha512_multi_sse2(const unsigned char* blocks, int n, unsigned char* digests);
+void sha512_multi_avx2(const unsigned char* blocks, int n, unsigned char* digests);
+void sha512_multi_avx512(const unsigned char* blocks, int n, unsigned char* digests);
+#endif
+
+void chacha20_blocks_generic(const uint32_t* key, uint64_t counter, unsigned char* output, int blocks);
+#ifdef CSPRNG_HAVE_X86_KERNELS
+void chacha20_blocks_sse2(const uint32_t* key, uint64_t counter, unsigned char* output, int blocks);
+void chacha20_blocks_avx2(const uint32_t* key, uint64_t counter, unsigned char* output, int blocks);
+void chacha20_blocks_avx512(const uint32_t* key, uint64_t counter, unsigned char* output, int blocks);
+#endif
+
+int MEMT_fill_buffer_generic(memt_type* state, uint32_t* output_buffer, int output_size);
+#ifdef CSPRNG_HAVE_X86_KERNELS
+int MEMT_fill_buffer_sse2(memt_type* state, uint32_t* output_buffer, int output_size);
+int MEMT_fill_buffer_avx2(memt_type* state, uint32_t* output_buffer, int output_size);
+int MEMT_fill_buffer_avx512(memt_type* state, uint32_t* output_buffer, int output_size);
+#endif
+
+int typed_bounded32_generic(const unsigned char* input, int words, uint32_t bound, uint32_t threshold, uint32_t* output);
+void typed_float_generic(const unsigned char* input, float* output, int n);
+void typed_double_generic(const unsigned char* input, double* output, int n);
+void typed_bool_generic(const unsigned char* input, uint32_t threshold, unsigned char* output, int n);
+#ifdef CSPRNG_HAVE_X86_KERNELS
+int typed_bounded32_sse2(const unsigned char* input, int words, uint32_t bound, uint32_t threshold, uint32_t* output);
+void typed_float_sse2(const unsigned char* input, float* output, int n);
+void typed_double_sse2(const unsigned char* input, double* output, int n);
+void typed_bool_sse2(const unsigned char* input, uint32_t threshold, unsigned char* output, int n);
+int typed_bounded32_avx2(const unsigned char* input, int words, uint32_t bound, uint32_t threshold, uint32_t* output);
+void typed_float_avx2(const unsigned char* input, float* output, int n);
+void typed_double_avx2(const unsigned char* input, double* output, int n);
+void typed_bool_avx2(const unsigned char* input, uint32_t threshold, unsigned char* output, int n);
+int typed_bounded32_avx512(const unsigned char* input, int words, uint32_t bound, uint32_t threshold, uint32_t* output);
+void typed_float_avx512(const unsigned char* input, float* output, int n);
+void typed_double_avx512(const unsigned char* input, double* output, int n);
+void typed_bool_avx512(const unsigned char* input, uint32_t threshold, unsigned char* output, int n);
+#endif
+
+#endif
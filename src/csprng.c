@@ -28,19 +28,31 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 #include <assert.h>
 #include <sys/mman.h>
 #include <inttypes.h>
+#include <limits.h>       //UINT_MAX
 #include <sys/types.h>  //fstat
 #include <sys/stat.h>   //fstat
 #include <unistd.h>
+#include <sys/syscall.h>  //memfd_create
+#include <pthread.h>
+#include <signal.h>       //pthread_sigmask
 #include <math.h>
+#include <time.h>         //clock_gettime
 
 #include <csprng/helper_utils.h>
 #include <csprng/havege.h>
 #include <csprng/nist_ctr_drbg.h>
+#include <csprng/nist_hash_drbg.h>
+#include <csprng/chacha20_rng.h>
 #include <csprng/memt19937ar-JH.h>
 #include <csprng/sha1_rng.h>
 #include <csprng/http_rng.h>
 #include <csprng/csprng.h>
 #include <csprng/fips.h>
+#include <csprng/health_tests.h>
+#include <csprng/cpu_dispatch.h>
+#include "cpu_kernels.h"
+#include "fips_pool.h"
+#include "secure_arena.h"
 
 #if 0
 //See function increment_block_BN
@@ -52,10 +64,6 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 #include <arpa/inet.h>
 #include <openssl/rand.h>
 
-//getrlimit
-#include <sys/time.h>
-#include <sys/resource.h>
-
 
 #define BYTES_PRODUCED_BY_SHA1 20
 #define HTTP_RNG_BUFFER_SIZE 16384
@@ -65,17 +73,128 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 
 #define DETAIL_DEBUG
 #define MIN_BUFFER_SIZE 4096 
+//csprng_generate_batch reads this many bytes ahead of the copy
+#define CSPRNG_BATCH_PREFETCH 256
 
 //#define STRINGIFY(x) #x
 //#define TOSTRING(x) STRINGIFY(x)
 //#define AT "LINE NUMBER: " TOSTRING(__LINE__) " "
 
 const char* const source_names[SOURCES_COUNT] = { "NONE", "HAVEGE", "SHA1_RNG", "MT_RNG", "HTTP_RNG", "STDIN", "EXTERNAL" };
+const char* const drbg_mechanism_names[DRBG_MECHANISMS_COUNT] = { "CTR_DRBG", "Hash_DRBG", "HMAC_DRBG", "ChaCha20", "AUTO" };
+const char* const health_action_names[HEALTH_ACTIONS_COUNT] = { "warn", "drop", "fail" };
 
 // }}}
 
-//{{{ static rng_buf_type* init_buffer ( rand_source_type source, rng_state_type rng_state, const char* filename, FILE* fd, const unsigned int size)
-static rng_buf_type* init_buffer ( rand_source_type source, rng_state_type rng_state, const char* filename, FILE* fd, const unsigned int size, const char* buffer_name)
+//{{{ static unsigned char* map_ring ( unsigned int size )
+/*
+ * Map the same size bytes of memory twice, back to back. size must be multiple of the page size.
+ * Returns NULL when the double mapping is not supported, the caller falls back to a linear buffer.
+ */
+static unsigned char* map_ring ( unsigned int size )
+{
+#if defined(SYS_memfd_create)
+  unsigned char* base;
+  int fd;
+
+  fd = syscall(SYS_memfd_create, "csprng_ring", 1U); //MFD_CLOEXEC
+  if ( fd < 0 ) return NULL;
+  if ( ftruncate(fd, size) != 0 ) {
+    close(fd);
+    return NULL;
+  }
+
+  //Reserve 2 * size of address space, then put both views of the file into it
+  base = mmap(NULL, 2 * (size_t) size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if ( base == MAP_FAILED ) {
+    close(fd);
+    return NULL;
+  }
+  if ( mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+      mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ) {
+    munmap(base, 2 * (size_t) size);
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+
+  //Shared pages would be shared with a forked child as well. The child must not produce the same random bytes,
+  //so the pages are not inherited at all, see csprng_forked. MADV_WIPEONFORK works only for private anonymous memory
+#ifdef MADV_DONTFORK
+  madvise(base, 2 * (size_t) size, MADV_DONTFORK);
+#endif
+  return base;
+#else
+  (void) size;
+  return NULL;
+#endif
+}
+//}}}
+
+//{{{ Fork detection
+/*
+ * The buffers of map_ring are missing in a child process. Each generator records csprng_fork_count
+ * when it is created, the child handler increments it, so the child can tell the inherited generators.
+ */
+static unsigned int csprng_fork_count = 0;
+static pthread_once_t csprng_fork_once = PTHREAD_ONCE_INIT;
+
+static void csprng_atfork_child ( void )
+{
+  ++csprng_fork_count;
+}
+
+static void csprng_register_atfork ( void )
+{
+  if ( pthread_atfork(NULL, NULL, csprng_atfork_child) ) {
+    fprintf(stderr, "WARNING: pthread_atfork has failed. A child process must not use the generators of its parent.\n");
+  }
+}
+
+/* Returns 1 when csprng_state was created by the parent process, 0 otherwise */
+static int csprng_forked ( const csprng_state_type* csprng_state, const char* caller )
+{
+  if ( csprng_state->fork_count == csprng_fork_count ) return 0;
+  fprintf(stderr, "ERROR: %s: The generator was created before fork and can't be used in the child process. "
+      "Create a new one.\n", caller);
+  return 1;
+}
+//}}}
+
+//{{{ static void rewind_buffer ( rng_buf_type* data )
+/*
+ * Prepare buffer for refill: after this call total_size - valid_data_size bytes starting at
+ * buf_start + valid_data_size can be written. Ring buffer is not moved at all.
+ */
+static void rewind_buffer ( rng_buf_type* data )
+{
+  if ( data->valid_data_size == 0 ) {
+    data->buf_start = data->buf;
+  } else if ( data->ring == 0 ) {
+    memmove(data->buf, data->buf_start, data->valid_data_size);
+    data->buf_start = data->buf;
+  }
+}
+//}}}
+
+//{{{ static unsigned char* consume_buffer ( rng_buf_type* data, unsigned int size )
+/*
+ * Take size <= valid_data_size bytes. The returned pointer is valid until the next refill
+ */
+static unsigned char* consume_buffer ( rng_buf_type* data, unsigned int size )
+{
+  unsigned char* temp = data->buf_start;
+
+  data->valid_data_size -= size;
+  data->bytes_out += size;
+  data->buf_start += size;
+  if ( data->ring && data->buf_start >= data->buf + data->total_size ) data->buf_start -= data->total_size;
+  return temp;
+}
+//}}}
+
+//{{{ static rng_buf_type* init_buffer ( rand_source_type source, rng_state_type rng_state, const char* filename, FILE* fd, const unsigned int requested_size)
+static rng_buf_type* init_buffer ( rand_source_type source, rng_state_type rng_state, const char* filename, FILE* fd, const unsigned int requested_size, const char* buffer_name)
 {
   if ( source == EXTERNAL ) assert ( filename != NULL);
   if ( filename != NULL )   assert ( source == EXTERNAL);
@@ -83,8 +202,8 @@ static rng_buf_type* init_buffer ( rand_source_type source, rng_state_type rng_s
 
   //fprintf ( stderr, "\nTrying to allocate buffer %s of size %u Bytes\n", buffer_name, size);
   rng_buf_type* data;
-  struct rlimit rlim;
-  unsigned int mlock_limit;
+  unsigned int size = requested_size;
+  long page_size;
 
   data = (rng_buf_type*) calloc( 1, sizeof(rng_buf_type));
   if ( data ==NULL ) {
@@ -92,33 +211,28 @@ static rng_buf_type* init_buffer ( rand_source_type source, rng_state_type rng_s
     return NULL;
   }
 
-  data->buf	= (unsigned char*) calloc ( 1, size );
-  if ( data->buf ==NULL ) {
-    fprintf(stderr, "ERROR: Dynamic memory allocation has failed for buffer of size %u. Reported error: %s\n", size, strerror(errno));
-    return NULL;
-  }
-
-  errno = 0;
-  data->locked = 0;
-
-  //{{{ getrlimit
-  if ( getrlimit(RLIMIT_MEMLOCK, &rlim) == 0 ) {
-    mlock_limit = rlim.rlim_cur;
-    //fprintf(stderr, "INFO:  getrlimit(RLIMIT_MEMLOCK, rlim) reports: current limit %d, maximum (ceiling) %d.\n", rlim.rlim_cur, rlim.rlim_max);
-    mlock_limit /= 4;
+  //Ring buffer is mapped in whole pages, the extra space is used
+  page_size = sysconf(_SC_PAGESIZE);
+  if ( page_size > 0 ) size = ( ( requested_size + page_size - 1 ) / page_size ) * page_size;
+  data->buf = ( size > 0 ) ? map_ring(size) : NULL;
+  if ( data->buf != NULL ) {
+    data->ring = 1;
   } else {
-    mlock_limit = 16384;
-    fprintf (stderr, "\nWARNING: Function init_buffer: getrlimit(RLIMIT_MEMLOCK, rlim) has failed. Using %d as default limit. Reported error: %s\n", mlock_limit,  strerror (errno) );
+    //Linear buffer comes from the secure arena, which is locked as a whole
+    size = requested_size;
+    data->ring = 0;
+    data->buf	= (unsigned char*) secure_alloc ( size );
+    if ( data->buf ==NULL ) {
+      free(data);
+      return NULL;
+    }
   }
-  //}}}
 
-  if ( size <= mlock_limit ) {
-    if ( mlock(data->buf, size ) == 0 ) {
-      data->locked = 1;
-    } else {
-      fprintf (stderr, "\nWARNING: Function init_buffer: cannot lock buffer to RAM (preventing that memory from being paged to the swap area)\n"
-          "\tSize of buffer is %u Bytes. Reported error: \"%s\". See man -S2 mlock for the interpretation.\n", size, strerror (errno) );
-    }
+  //Both views of the ring buffer share the pages, locking the first one is enough. The process-wide budget decides
+  data->locked = 0;
+  if ( data->ring ) {
+    secure_dontdump(data->buf, 2 * (size_t) size);
+    data->locked = secure_lock(data->buf, size);
   }
 
   data->total_size = size;
@@ -160,20 +274,48 @@ static void destroy_buffer ( rng_buf_type* data )
     free(data->filename);
   }
 
-  memset(data->buf, 0, data->total_size );
-  if ( data->locked == 1 ) {
-    if ( munlock(data->buf, data->total_size ) != 0) {
-      fprintf (stderr, "\nWARNING: Function destroy_buffer: cannot unlock buffer from RAM (lock prevents memory from being paged to the swap area).\n"
-          "Size of buffer is %u Bytes. Reported error: %s\n", data->total_size, strerror (errno) );
-    }
+  if ( data->health != NULL ) {
+    memset(data->health, 0, sizeof(health_test_ctx_t));
+    free(data->health);
   }
 
-  free (data->buf);
+  if ( data->ring ) {
+    memset(data->buf, 0, data->total_size );
+    if ( data->locked == 1 ) secure_unlock(data->buf, data->total_size);
+    munmap(data->buf, 2 * (size_t) data->total_size);
+  } else {
+    secure_free(data->buf, data->total_size);
+  }
   memset(data, 0, sizeof(rng_buf_type) );
   free (data);
 }		/* -----  end of static function destroy_buffer  ----- */
 //}}}
 
+//{{{ static int start_health_tests ( rng_buf_type* data, double min_entropy, health_action_type action )
+/*
+ * Run the SP 800-90B health tests on the data of noise sources. Deterministic sources and min_entropy 0
+ * are skipped. Returns 0 on success, 1 on error
+ */
+static int start_health_tests ( rng_buf_type* data, double min_entropy, health_action_type action )
+{
+  if ( min_entropy == 0.0 ) return 0;
+  if ( data->source != HAVEGE && data->source != HTTP_RNG && data->source != STDIN && data->source != EXTERNAL ) return 0;
+
+  data->health = (health_test_ctx_t*) calloc(1, sizeof(health_test_ctx_t));
+  if ( data->health == NULL ) {
+    fprintf(stderr, "ERROR: Dynamic memory allocation has failed for health_test_ctx_t variable. Reported error: %s\n", strerror(errno));
+    return 1;
+  }
+  if ( health_test_init(data->health, min_entropy, HEALTH_TEST_ALPHA_LOG2) ) {
+    free(data->health);
+    data->health = NULL;
+    return 1;
+  }
+  data->health_action = action;
+  return 0;
+}
+//}}}
+
 //{{{ static int fill_buffer_using_file ( rng_buf_type* data )
 static void fill_buffer_using_file ( rng_buf_type* data )
 {
@@ -181,10 +323,7 @@ static void fill_buffer_using_file ( rng_buf_type* data )
   int bytes_to_fill_the_buffer;
   
   // 1. Rewind buffer
-  if ( data->valid_data_size ) {
-    memmove(data->buf, data->buf_start, data->valid_data_size);
-  }
-  data->buf_start =  data->buf;
+  rewind_buffer(data);
 
   if ( data->eof == 1 ) return;
   
@@ -222,10 +361,7 @@ static void fill_buffer_using_HAVEGE ( rng_buf_type* data )
   DATA_TYPE *p;
 
   // 1. Rewind buffer
-  if ( data->valid_data_size ) {
-    memmove(data->buf, data->buf_start, data->valid_data_size);
-  }
-  data->buf_start =  data->buf;
+  rewind_buffer(data);
   if ( data->eof == 1 ) return;
 
   // 2. Fill buffer
@@ -239,7 +375,7 @@ static void fill_buffer_using_HAVEGE ( rng_buf_type* data )
   }
   */
   p = (DATA_TYPE *) (data->buf_start + data->valid_data_size);
-  blocks_read = generate_words_using_havege (p, blocks_to_fill_the_buffer);
+  blocks_read = generate_words_using_havege (data->rng_state.havege, p, blocks_to_fill_the_buffer);
   data->valid_data_size += ( sizeof(DATA_TYPE) * blocks_read );
   data->bytes_in += ( sizeof(DATA_TYPE) * blocks_read );
   //fwrite(p, sizeof(DATA_TYPE), blocks_read, stdout);
@@ -260,10 +396,7 @@ static void fill_buffer_using_SHA ( rng_buf_type* data )
   int bytes_to_fill_the_buffer;
 
   // 1. Rewind buffer
-  if ( data->valid_data_size ) {
-    memmove(data->buf, data->buf_start, data->valid_data_size);
-  }
-  data->buf_start =  data->buf;
+  rewind_buffer(data);
   if ( data->eof == 1 ) return;
 
   // 2. Fill buffer
@@ -288,13 +421,9 @@ static void fill_buffer_using_HTTP ( rng_buf_type* data )
   int bytes_read;
   int bytes_to_fill_the_buffer;
   const int bytes_requested = data->total_size - data->valid_data_size;
-  static int zero_round = 0;        //Counts how many times we got no bytes
   
   // 1. Rewind buffer
-  if ( data->valid_data_size ) {
-    memmove(data->buf, data->buf_start, data->valid_data_size);
-  }
-  data->buf_start =  data->buf;
+  rewind_buffer(data);
 
   if ( data->eof == 1 ) return;
   
@@ -314,16 +443,16 @@ static void fill_buffer_using_HTTP ( rng_buf_type* data )
     //TODO: check if http_random_generate was stop because of the interrupt (signal)
     if ( bytes_read < bytes_to_fill_the_buffer ) {
       if ( bytes_read == 0 ) {
-        ++zero_round;
-        fprintf(stderr,"WARNING: fill_buffer_using_HTTP: got 0 bytes from HTTP_RNG already %d times in row.\n", zero_round);
-        if ( zero_round >= HTTP_ZERO_ROUNDS_THRESHOLD ) {
-          fprintf(stderr,"WARNING: fill_buffer_using_HTTP: got 0 bytes from HTTP_RNG %d times in row. Closing HTTP_RNG generator.\n", zero_round);
+        ++data->zero_rounds;
+        fprintf(stderr,"WARNING: fill_buffer_using_HTTP: got 0 bytes from HTTP_RNG already %d times in row.\n", data->zero_rounds);
+        if ( data->zero_rounds >= HTTP_ZERO_ROUNDS_THRESHOLD ) {
+          fprintf(stderr,"WARNING: fill_buffer_using_HTTP: got 0 bytes from HTTP_RNG %d times in row. Closing HTTP_RNG generator.\n", data->zero_rounds);
           //TODO: should we mark EOF at this stage????
           data->eof = 1;
           break;
         }
       } else {
-        zero_round = 0;
+        data->zero_rounds = 0;
       }
     }
   } while ( data->total_size - data->valid_data_size > 0 );
@@ -341,10 +470,7 @@ static void fill_buffer_using_MT_RNG ( rng_buf_type* data )
   uint32_t *p;
 
   // 1. Rewind buffer
-  if ( data->valid_data_size ) {
-    memmove(data->buf, data->buf_start, data->valid_data_size);
-  }
-  data->buf_start =  data->buf;
+  rewind_buffer(data);
   if ( data->eof == 1 ) return;
 
   // 2. Fill buffer
@@ -363,38 +489,307 @@ static void fill_buffer_using_MT_RNG ( rng_buf_type* data )
 }
 //}}}
 
+//{{{ static uint64_t monotonic_ns ( void )
+static uint64_t monotonic_ns ( void )
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+//}}}
+
+//{{{ static int read_source ( rng_buf_type* data )
+/*
+ * Append the data of the source behind the valid data. Returns 0 on success, 1 for unsupported source
+ */
+static int read_source ( rng_buf_type* data )
+{
+  int return_value = 0;
+
+  switch (data->source) {
+    case HAVEGE:
+      fill_buffer_using_HAVEGE (data);
+      break;
+    case SHA1_RNG:
+      fill_buffer_using_SHA (data);
+      break;
+    case HTTP_RNG:
+      fill_buffer_using_HTTP (data);
+      break;
+    case MT_RNG:
+      fill_buffer_using_MT_RNG (data);
+      break;
+    case STDIN:
+    case EXTERNAL:
+      fill_buffer_using_file ( data );
+      break;
+    default:
+      fprintf( stderr, "ERROR: refill_buffer: Unsupported data source '%s' for buffer %s.\n", source_names[data->source], data->buffer_name );
+      return_value = 1;
+      //TODO: FIPS validation at this stage??? Or directly in each method???
+  }
+  return return_value;
+}
+//}}}
+
+//{{{ static int refill_buffer ( rng_buf_type* data, uint64_t* elapsed_ns )
+/*
+ * Read more data from the source of the buffer. Returns 0 on success, 1 for unsupported source and
+ * when the data have failed the health tests and data->health_action does not allow to use them.
+ * elapsed_ns is set to the time spent in the source, the health tests of the new data are not included
+ */
+static int refill_buffer ( rng_buf_type* data, uint64_t* elapsed_ns )
+{
+  uint64_t start;
+  unsigned int old_valid = data->valid_data_size;
+  unsigned int failures, size;
+  int dropped = 0;
+  int return_value;
+
+  *elapsed_ns = 0;
+  for (;;) {
+    if ( data->source_mutex != NULL ) pthread_mutex_lock(data->source_mutex);
+    start = monotonic_ns();
+    return_value = read_source(data);
+    *elapsed_ns += monotonic_ns() - start;
+    if ( data->source_mutex != NULL ) pthread_mutex_unlock(data->source_mutex);
+
+    //rewind_buffer does not change valid_data_size, new data follow the old ones
+    if ( data->health == NULL || data->valid_data_size == old_valid ) break;
+    size = data->valid_data_size - old_valid;
+    failures = health_test_run(data->health, data->buf_start + old_valid, size);
+    data->health_statistics = data->health->statistics;
+    if ( failures == 0 ) break;
+    if ( data->health_action == HEALTH_WARN ) {
+      fprintf(stderr, "WARNING: refill_buffer: %u SP 800-90B health test failures in %u bytes from %s for buffer %s.\n",
+          failures, size, source_names[data->source], data->buffer_name);
+      break;
+    }
+
+    memset(data->buf_start + old_valid, 0, size);
+    data->valid_data_size = old_valid;
+    data->health_dropped += size;
+    if ( data->health_action == HEALTH_FAIL || ++dropped == HEALTH_DROP_MAX_BATCHES ) {
+      fprintf(stderr, "ERROR: refill_buffer: %u SP 800-90B health test failures in %u bytes from %s for buffer %s. "
+          "The source is not used any more.\n", failures, size, source_names[data->source], data->buffer_name);
+      data->eof = 1;
+      return 1;
+    }
+    fprintf(stderr, "WARNING: refill_buffer: %u SP 800-90B health test failures in %u bytes from %s for buffer %s. "
+        "The data are dropped.\n", failures, size, source_names[data->source], data->buffer_name);
+  }
+  return return_value;
+}
+//}}}
+
+//{{{ static void record_latency ( uint64_t* count, uint64_t* total_ns, uint64_t* max_ns, uint64_t elapsed_ns )
+static void record_latency ( uint64_t* count, uint64_t* total_ns, uint64_t* max_ns, uint64_t elapsed_ns )
+{
+  ++*count;
+  *total_ns += elapsed_ns;
+  if ( elapsed_ns > *max_ns ) *max_ns = elapsed_ns;
+}
+//}}}
+
+//{{{ struct rng_prefetch_type
+/*
+ * The prefetch thread reads the source into its private fill buffer and appends the data behind the valid
+ * data of the ring buffer whenever less than watermark bytes are valid. The reader only takes the mutex
+ * and copies nothing. The last reserved bytes in front of buf_start were returned to the reader by
+ * get_data_from_RNG_buffer and are not overwritten until the next call.
+ */
+struct rng_prefetch_type {
+  pthread_t thread;
+  rng_buf_type* fill;               //Private buffer of the thread, the source is read into it
+  unsigned int watermark;           //Refill when less than watermark bytes are valid
+  unsigned int reserved;            //Bytes still in use by the reader
+  int stop;                         //Request to terminate the thread
+  int done;                         //Source has no more data, the thread has terminated
+  pthread_mutex_t mutex;            //Guards valid_data_size, buf_start, statistics and the fields above
+  pthread_cond_t data_ready;
+  pthread_cond_t space_ready;
+};
+//}}}
+
+//{{{ static void* prefetch_thread ( void* arg )
+static void* prefetch_thread ( void* arg )
+{
+  rng_buf_type* data = (rng_buf_type*) arg;
+  rng_prefetch_type* prefetch = data->prefetch;
+  rng_buf_type* fill = prefetch->fill;
+  uint64_t elapsed_ns;
+  unsigned int len;
+  int rc;
+
+  pthread_mutex_lock(&prefetch->mutex);
+  while ( ! prefetch->stop ) {
+    len = data->total_size - data->valid_data_size - prefetch->reserved;
+    if ( data->valid_data_size >= prefetch->watermark || len == 0 ) {
+      pthread_cond_wait(&prefetch->space_ready, &prefetch->mutex);
+      continue;
+    }
+
+    if ( fill->valid_data_size == 0 ) {
+      pthread_mutex_unlock(&prefetch->mutex);
+      rc = refill_buffer(fill, &elapsed_ns);
+      pthread_mutex_lock(&prefetch->mutex);
+      record_latency(&data->refills, &data->refill_ns, &data->refill_max_ns, elapsed_ns);
+      data->health_statistics = fill->health_statistics;
+      data->health_dropped = fill->health_dropped;
+      if ( rc || fill->valid_data_size == 0 ) {
+        prefetch->done = 1;
+        pthread_cond_broadcast(&prefetch->data_ready);
+        break;
+      }
+      continue;
+    }
+
+    if ( len > fill->valid_data_size ) len = fill->valid_data_size;
+    memcpy(data->buf_start + data->valid_data_size, fill->buf_start, len);
+    memset(fill->buf_start, 0, len);
+    consume_buffer(fill, len);
+    data->valid_data_size += len;
+    data->bytes_in += len;
+    pthread_cond_signal(&prefetch->data_ready);
+  }
+  pthread_mutex_unlock(&prefetch->mutex);
+  return NULL;
+}
+//}}}
+
+//{{{ static int start_prefetch ( rng_buf_type* data, int percent )
+/*
+ * Start the thread keeping more than percent % of the buffer filled. Returns 0 on success, 1 on error
+ */
+static int start_prefetch ( rng_buf_type* data, int percent )
+{
+  rng_prefetch_type* prefetch;
+  sigset_t all_signals, old_signals;
+  int rc;
+
+  //Data are appended behind the valid data without moving them
+  if ( data->ring == 0 ) {
+    fprintf(stderr, "WARNING: start_prefetch: Buffer %s is not a ring buffer, it will be refilled synchronously.\n", data->buffer_name);
+    return 0;
+  }
+
+  prefetch = (rng_prefetch_type*) calloc(1, sizeof(rng_prefetch_type));
+  if ( prefetch == NULL ) {
+    fprintf(stderr, "ERROR: Dynamic memory allocation has failed for rng_prefetch_type variable. Reported error: %s\n", strerror(errno));
+    return 1;
+  }
+  prefetch->fill = init_buffer( data->source, data->rng_state, data->filename, data->fd, data->total_size, "PREFETCH BUF");
+  if ( prefetch->fill == NULL ) {
+    fprintf(stderr, "ERROR: init_buffer for the prefetch buffer of %s has failed.\n", data->buffer_name);
+    free(prefetch);
+    return 1;
+  }
+  prefetch->fill->source_mutex = data->source_mutex;
+  prefetch->fill->health = data->health;
+  prefetch->fill->health_action = data->health_action;
+  prefetch->watermark = (unsigned int) ( (uint64_t) data->total_size * percent / 100 );
+  if ( prefetch->watermark == 0 ) prefetch->watermark = 1;
+
+  pthread_mutex_init(&prefetch->mutex, NULL);
+  pthread_cond_init(&prefetch->data_ready, NULL);
+  pthread_cond_init(&prefetch->space_ready, NULL);
+  data->prefetch = prefetch;
+
+  //Signals are handled by the application threads
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  rc = pthread_create(&prefetch->thread, NULL, prefetch_thread, data);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+  if ( rc ) {
+    fprintf(stderr, "ERROR: start_prefetch: pthread_create has failed for buffer %s: %s\n", data->buffer_name, strerror(rc));
+    data->prefetch = NULL;
+    pthread_cond_destroy(&prefetch->space_ready);
+    pthread_cond_destroy(&prefetch->data_ready);
+    pthread_mutex_destroy(&prefetch->mutex);
+    prefetch->fill->health = NULL;
+    destroy_buffer(prefetch->fill);
+    free(prefetch);
+    return 1;
+  }
+  return 0;
+}
+//}}}
+
+//{{{ static void stop_prefetch ( rng_buf_type* data )
+/*
+ * Stop the thread. Data already prefetched stay in the buffer
+ */
+static void stop_prefetch ( rng_buf_type* data )
+{
+  rng_prefetch_type* prefetch = data->prefetch;
+
+  pthread_mutex_lock(&prefetch->mutex);
+  prefetch->stop = 1;
+  pthread_cond_signal(&prefetch->space_ready);
+  pthread_mutex_unlock(&prefetch->mutex);
+  pthread_join(prefetch->thread, NULL);
+
+  data->prefetch = NULL;
+  pthread_cond_destroy(&prefetch->space_ready);
+  pthread_cond_destroy(&prefetch->data_ready);
+  pthread_mutex_destroy(&prefetch->mutex);
+  prefetch->fill->health = NULL;
+  destroy_buffer(prefetch->fill);
+  free(prefetch);
+}
+//}}}
+
+//{{{ static const unsigned char* get_prefetched_data ( rng_buf_type* data, unsigned int size )
+static const unsigned char* get_prefetched_data ( rng_buf_type* data, unsigned int size )
+{
+  rng_prefetch_type* prefetch = data->prefetch;
+  const unsigned char* temp = NULL;
+  uint64_t start;
+
+  pthread_mutex_lock(&prefetch->mutex);
+  //Data returned by the previous call can be overwritten now
+  prefetch->reserved = 0;
+  if ( size > data->valid_data_size && ! prefetch->done ) {
+    start = monotonic_ns();
+    pthread_cond_signal(&prefetch->space_ready);
+    while ( size > data->valid_data_size && ! prefetch->done ) {
+      pthread_cond_wait(&prefetch->data_ready, &prefetch->mutex);
+    }
+    record_latency(&data->stalls, &data->stall_ns, &data->stall_max_ns, monotonic_ns() - start);
+  }
+
+  if ( size > data->valid_data_size ) {
+    fprintf ( stderr, "ERROR: get_data_from_RNG_buffer: Failed to get requested bytes for buffer %s.\n", data->buffer_name );
+    fprintf ( stderr, "ERROR:                           Bytes requested %d, bytes available %d.\n", size, data->valid_data_size );
+  } else {
+    temp = consume_buffer(data, size);
+    prefetch->reserved = size;
+    if ( data->valid_data_size < prefetch->watermark ) pthread_cond_signal(&prefetch->space_ready);
+  }
+  pthread_mutex_unlock(&prefetch->mutex);
+  return temp;
+}
+//}}}
+
 //{{{ static const unsigned char* get_data_from_RNG_buffer ( rng_buf_type* data, int size )
 static const unsigned char* get_data_from_RNG_buffer ( rng_buf_type* data, unsigned int size )
 {
+  uint64_t elapsed_ns;
+
   //assert ( data->source < SOURCES_COUNT ); => Moved to init_buffer function
   //assert( size <= data->total_size);
 
-  unsigned char* temp;
   //unsigned int old_valid = data->valid_data_size;
 
+  if ( data->prefetch != NULL ) return get_prefetched_data(data, size);
+
   if ( size > data->valid_data_size ) {
-    switch (data->source) {
-      case HAVEGE:
-        fill_buffer_using_HAVEGE (data);
-        break;
-      case SHA1_RNG:
-        fill_buffer_using_SHA (data);
-        break;
-      case HTTP_RNG:
-        fill_buffer_using_HTTP (data);
-        break;
-      case MT_RNG:
-        fill_buffer_using_MT_RNG (data);
-        break;
-      case STDIN:
-      case EXTERNAL:
-        fill_buffer_using_file ( data );
-        break;
-      default:
-        fprintf( stderr, "ERROR: get_data_from_RNG_buffer: Unsupported data source '%s' for buffer %s.\n", source_names[data->source], data->buffer_name );
-        return (NULL);
-        //TODO: FIPS validation at this stage??? Or directly in each method???
-    }
+    if ( refill_buffer(data, &elapsed_ns) ) return (NULL);
+    //Synchronous refill always stalls the reader
+    record_latency(&data->refills, &data->refill_ns, &data->refill_max_ns, elapsed_ns);
+    record_latency(&data->stalls, &data->stall_ns, &data->stall_max_ns, elapsed_ns);
 
     //fprintf ( stderr, "get_data_from_RNG_buffer: requested %u Bytes, provided %u Bytes\n", size, data->valid_data_size - old_valid);
 
@@ -406,15 +801,37 @@ static const unsigned char* get_data_from_RNG_buffer ( rng_buf_type* data, unsig
     }
   }
 
-  data->valid_data_size -= size;
-  data->bytes_out += size;
-  temp = data->buf_start;
-  data->buf_start = data->buf_start + size;
-  //if ( ((unsigned long)data->buf_start & 7) != 0 ) {
-  //  fprintf(stderr, "INFO: get_data_from_RNG_buffer. Not 8-byte alligned %p\n",  data->buf_start);
-  //} 
+  return consume_buffer(data, size);
+}
+//}}}
 
-  return(temp);
+//{{{ static void print_buffer_latency ( rng_buf_type* data, const char* name )
+static void print_buffer_latency ( rng_buf_type* data, const char* name )
+{
+  if ( data->prefetch != NULL ) pthread_mutex_lock(&data->prefetch->mutex);
+  fprintf(stderr,"%s: %s refills %"PRIu64", refill time avg %.1f us, max %.1f us; reads waiting for data %"PRIu64", wait time avg %.1f us, max %.1f us\n",
+      name, data->prefetch != NULL ? "prefetched," : "synchronous,",
+      data->refills, data->refills ? data->refill_ns / 1e3 / data->refills : 0.0, data->refill_max_ns / 1e3,
+      data->stalls, data->stalls ? data->stall_ns / 1e3 / data->stalls : 0.0, data->stall_max_ns / 1e3);
+  if ( data->prefetch != NULL ) pthread_mutex_unlock(&data->prefetch->mutex);
+}
+//}}}
+
+//{{{ static void print_buffer_health ( rng_buf_type* data, const char* name )
+static void print_buffer_health ( rng_buf_type* data, const char* name )
+{
+  health_test_statistics_type statistics;
+  uint64_t dropped;
+
+  if ( data->health == NULL ) return;
+  if ( data->prefetch != NULL ) pthread_mutex_lock(&data->prefetch->mutex);
+  statistics = data->health_statistics;
+  dropped = data->health_dropped;
+  if ( data->prefetch != NULL ) pthread_mutex_unlock(&data->prefetch->mutex);
+  fprintf(stderr,"%s: SP 800-90B health tests of %s, min-entropy %g bits per byte (cutoffs RCT %u, APT %u/%d), on failure %s: "
+      "bytes tested %"PRIu64", Repetition Count Test failures %"PRIu64", Adaptive Proportion Test failures %"PRIu64", bytes dropped %"PRIu64"\n",
+      name, source_names[data->source], data->health->min_entropy, data->health->rct_cutoff, data->health->apt_cutoff, HEALTH_TEST_APT_WINDOW,
+      health_action_names[data->health_action], statistics.samples, statistics.rct_failures, statistics.apt_failures, dropped);
 }
 //}}}
 
@@ -444,26 +861,44 @@ static inline unsigned long int random_number_in_range( rng_buf_type* rng_buf, c
 }
 //}}}
 
-//{{{ static int fill_buffer_using_csprng (fips_state_type* fips_state)
-static int fill_buffer_using_csprng (fips_state_type* fips_state)
+//{{{ static void start_reseed_interval (fips_state_type* fips_state)
+/*
+ * Bytes to generate until the next reseed: max_number_of_csprng_blocks, or a random number of blocks
+ * when random_length_of_csprng_generated_bytes is set
+ */
+static void start_reseed_interval (fips_state_type* fips_state)
 {
-  unsigned long int generated_bytes;
-  unsigned long int bytes_to_generate;
   unsigned long int csprng_blocks_to_generate;             //Number of CSPRNG blocks (NIST_BLOCK_OUTLEN_BYTES in one block) to generate 
-  rng_buf_type* data = fips_state->raw_buf;
-  static unsigned long int remaining_bytes_to_reseed = 0;  //Bytes to be generated without need for reseed
-  uint8_t reseed;
-  uint8_t reseed_possible;
 
-//#define fill_buffer_using_csprng_DEBUG
-#ifdef fill_buffer_using_csprng_DEBUG
+//#define start_reseed_interval_DEBUG
+#ifdef start_reseed_interval_DEBUG
   static double sum=0.0;
   static double sum_count=0.0;
-  static double total=0.0;
-  static double total_count=0.0;
-  unsigned long int csprng_blocks;
 #endif  
 
+  if ( fips_state->csprng_state->mode.random_length_of_csprng_generated_bytes == 0 ) {
+    csprng_blocks_to_generate  = fips_state->csprng_state->mode.max_number_of_csprng_blocks;
+  } else {
+    csprng_blocks_to_generate = random_number_in_range( 
+        fips_state->csprng_state->random_length_buf, fips_state->csprng_state->mode.max_number_of_csprng_blocks);
+#ifdef start_reseed_interval_DEBUG
+    sum_count++;
+    sum+=csprng_blocks_to_generate;
+    fprintf(stderr,"Number of planned CSPRNG blocks:\t %lu,\t Mean: %g\t Count: %g\t Planned blocks: %g\n", csprng_blocks_to_generate, sum/sum_count, sum_count, sum);
+#endif
+  }
+  fips_state->remaining_bytes_to_reseed = csprng_blocks_to_generate * NIST_BLOCK_OUTLEN_BYTES;
+}
+//}}}
+
+//{{{ static void plan_csprng_request (fips_state_type* fips_state, unsigned long int* bytes_to_generate, uint8_t* reseed)
+/*
+ * Size of the next csprng_generate request and whether the DRBG is reseeded after it. The request is cut
+ * at NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST when the reseed interval is longer
+ */
+static void plan_csprng_request (fips_state_type* fips_state, unsigned long int* bytes_to_generate, uint8_t* reseed)
+{
+  uint8_t reseed_possible;
 
   if ( fips_state->csprng_state->mode.max_number_of_csprng_blocks * NIST_BLOCK_OUTLEN_BYTES > NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST ) {
     reseed_possible = 1;
@@ -471,43 +906,65 @@ static int fill_buffer_using_csprng (fips_state_type* fips_state)
     reseed_possible = 0;
   }
 
-  if ( remaining_bytes_to_reseed == 0 ) {
-    if ( fips_state->csprng_state->mode.random_length_of_csprng_generated_bytes == 0 ) {
-      csprng_blocks_to_generate  = fips_state->csprng_state->mode.max_number_of_csprng_blocks;
-    } else {
-      csprng_blocks_to_generate = random_number_in_range( 
-          fips_state->csprng_state->random_length_buf, fips_state->csprng_state->mode.max_number_of_csprng_blocks);
-#ifdef fill_buffer_using_csprng_DEBUG
-      sum_count++;
-      sum+=csprng_blocks_to_generate;
-      fprintf(stderr,"Number of planned CSPRNG blocks:\t %lu,\t Mean: %g\t Count: %g\t Planned blocks: %g\n", csprng_blocks_to_generate, sum/sum_count, sum_count, sum);
-#endif
-
-    }
-    remaining_bytes_to_reseed = csprng_blocks_to_generate * NIST_BLOCK_OUTLEN_BYTES;
-  }
-
-
-  // 1. Rewind buffer
-  if ( data->valid_data_size ) {
-    memmove(data->buf, data->buf_start, data->valid_data_size);
+  if ( reseed_possible && fips_state->remaining_bytes_to_reseed > NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST ) {
+    *bytes_to_generate =  NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST;
+    *reseed = 0;
+  } else {
+    *bytes_to_generate = fips_state->remaining_bytes_to_reseed;
+    *reseed = 1;
   }
-  data->buf_start =  data->buf;
+}
+//}}}
 
-  if ( data->eof == 1 ) return 1;
+//{{{ static int run_csprng_request (fips_state_type* fips_state, unsigned char* output, unsigned long int bytes_to_generate, uint8_t reseed)
+/*
+ * Generate the planned request to output and advance the reseed interval. Returns 0 on success, 1 on error
+ */
+static int run_csprng_request (fips_state_type* fips_state, unsigned char* output, unsigned long int bytes_to_generate, uint8_t reseed)
+{
+  unsigned long int generated_bytes;
 
+  generated_bytes = csprng_generate ( fips_state->csprng_state, output, bytes_to_generate, reseed);
+  if ( generated_bytes != bytes_to_generate ) return 1;
 
-  // 2. Fill buffer
-  if ( reseed_possible && remaining_bytes_to_reseed > NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST ) {
-    bytes_to_generate =  NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST;
-    reseed = 0;
+  if ( reseed ) {
+    start_reseed_interval(fips_state);
   } else {
-    bytes_to_generate = remaining_bytes_to_reseed;
-    reseed = 1;
+    fips_state->remaining_bytes_to_reseed -= bytes_to_generate;
   }
+  return 0;
+}
+//}}}
 
-  if ( data->valid_data_size + bytes_to_generate > data->total_size ) {
-    fprintf(stderr, "WARNING: fill_buffer_using_csprng: Number of Bytes to generate %lu does not fit to the output buffer with free space of %u Bytes. "
+//{{{ static int fill_buffer_using_csprng (fips_state_type* fips_state)
+static int fill_buffer_using_csprng (fips_state_type* fips_state)
+{
+  unsigned long int bytes_to_generate;
+  rng_buf_type* data = fips_state->raw_buf;
+  uint8_t reseed;
+
+//#define fill_buffer_using_csprng_DEBUG
+#ifdef fill_buffer_using_csprng_DEBUG
+  static double total=0.0;
+  static double total_count=0.0;
+  unsigned long int csprng_blocks;
+#endif  
+
+
+  if ( fips_state->remaining_bytes_to_reseed == 0 ) start_reseed_interval(fips_state);
+
+
+  // 1. Rewind buffer
+  rewind_buffer(data);
+
+  if ( data->eof == 1 ) return 1;
+
+
+  // 2. Fill buffer
+  plan_csprng_request(fips_state, &bytes_to_generate, &reseed);
+
+  if ( data->valid_data_size + bytes_to_generate > data->total_size ) {
+    fprintf(stderr, "WARNING: fill_buffer_using_csprng: Number of Bytes to generate %lu does not fit to the output buffer with free space of %u Bytes. "
         "Total buffer size is %u Bytes.\n", 
         bytes_to_generate, data->total_size - data->valid_data_size,  data->total_size);
     return 1;
@@ -515,14 +972,12 @@ static int fill_buffer_using_csprng (fips_state_type* fips_state)
 
   while ( data->valid_data_size + bytes_to_generate <= data->total_size ) {
 
-    generated_bytes = csprng_generate ( fips_state->csprng_state, data->buf_start + data->valid_data_size, bytes_to_generate, reseed);
-
-    if ( generated_bytes != bytes_to_generate ) {
+    if ( run_csprng_request(fips_state, data->buf_start + data->valid_data_size, bytes_to_generate, reseed) ) {
       data->eof = 1;
       return 1;
     }
-    data->valid_data_size += generated_bytes;
-    data->bytes_in += generated_bytes;
+    data->valid_data_size += bytes_to_generate;
+    data->bytes_in += bytes_to_generate;
 
 #ifdef fill_buffer_using_csprng_DEBUG
     if ( fips_state->csprng_state->mode.random_length_of_csprng_generated_bytes == 1 ) {
@@ -533,69 +988,12 @@ static int fill_buffer_using_csprng (fips_state_type* fips_state)
     }
 #endif    
 
-    if ( reseed ) {
-      if ( fips_state->csprng_state->mode.random_length_of_csprng_generated_bytes == 0 ) {
-        csprng_blocks_to_generate  = fips_state->csprng_state->mode.max_number_of_csprng_blocks;
-      } else {
-        csprng_blocks_to_generate = random_number_in_range( 
-            fips_state->csprng_state->random_length_buf, fips_state->csprng_state->mode.max_number_of_csprng_blocks);
-#ifdef fill_buffer_using_csprng_DEBUG
-        sum_count++;
-        sum+=csprng_blocks_to_generate;
-        fprintf(stderr,"Number of planned CSPRNG blocks:\t %lu,\t Mean: %g\t Count: %g\t Planned blocks: %g\n", csprng_blocks_to_generate, sum/sum_count, sum_count, sum);
-#endif
-      }
-      remaining_bytes_to_reseed = csprng_blocks_to_generate * NIST_BLOCK_OUTLEN_BYTES;
-    } else {
-      remaining_bytes_to_reseed -= bytes_to_generate;
-    }
-
-    if ( reseed_possible && remaining_bytes_to_reseed > NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST ) {
-      bytes_to_generate =  NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST;
-      reseed = 0;
-    } else {
-      bytes_to_generate = remaining_bytes_to_reseed;
-      reseed = 1;
-    }
-
+    plan_csprng_request(fips_state, &bytes_to_generate, &reseed);
   }
   return 0;
 }		/* -----  end of function fill_buffer_using_csprng  ----- */
 //}}}
 
-//{{{ get_data_from_csprng_buffer
-/* 
- * ===  FUNCTION  ======================================================================
- *         Name:  get_data_from_csprng_buffer
- *  Description:  Return pointer to data from the CSPRNG buffer. 
- * =====================================================================================
- */
-static const unsigned char*
-get_data_from_csprng_buffer ( fips_state_type* fips_state, unsigned int size)
-{
-  unsigned char* temp;
-  rng_buf_type* data = fips_state->raw_buf;
-  if ( size > data->valid_data_size ) {
-    fill_buffer_using_csprng (fips_state);
-    if ( size > data->valid_data_size ) {
-      fprintf ( stderr, "ERROR: get_data_from_csprng_buffer: Failed to get requested bytes for buffer %s.\n", data->buffer_name );
-      fprintf ( stderr, "ERROR:                              Bytes requested %d, bytes available %d.\n", size, data->valid_data_size );
-      return (NULL);
-    }
-  }
-
-  data->valid_data_size -= size;
-  data->bytes_out += size;
-  temp = data->buf_start;
-  data->buf_start = data->buf_start + size;
-  //if ( ((unsigned long)data->buf_start & 7) != 0 ) {
-  //  fprintf(stderr, "INFO: get_data_from_RNG_buffer. Not 8-byte alligned %p\n",  data->buf_start);
-  //} 
-
-  return(temp);
-}		/* -----  end of function get_data_from_csprng_buffer  ----- */
-//}}}
-
 //{{{ static void destroy_seed(char* seed, char* locked, unsigned int* size)
 static void destroy_seed(unsigned char* seed, char* locked, unsigned int* size)
 {
@@ -604,15 +1002,9 @@ static void destroy_seed(unsigned char* seed, char* locked, unsigned int* size)
     return;
   }
 
-  memset(seed, 0, *size);
-  if ( *locked == 1 ) {
-    *locked = 0;
-    if ( munlock(seed, *size) != 0) {
-      fprintf (stderr, "\nWARNING: Function destroy_seed: cannot unlock buffer from RAM (lock prevents memory from being paged to the swap area).\n"
-          "Size of buffer is %u Bytes. Reported error: %s\n", *size, strerror (errno) );
-    }
-  }
-  free (seed);
+  //secure_free wipes the seed
+  secure_free(seed, *size);
+  *locked = 0;
   seed = NULL;
   *size = 0;
 
@@ -739,7 +1131,7 @@ BN_CTX_free_label:
 //}}}
 
 //{{{ unsigned char* create_seed(const char* filename, const unsigned int size, char* locked, unsigned int* allocated_size)
-//*locked is the output. It specifies if memory was locked using mlock call
+//*locked is the output. It specifies if memory was locked using mlock call. Seed comes from the secure arena, which is locked as a whole => always 0
 //*allocated_size is the output. *allocated_size>=0, *allocated_size is alligned on 20 bytes boundary
 unsigned char* create_seed(const char* filename, unsigned int size, char* locked, unsigned int* allocated_size) {
   FILE* randomDataFile;
@@ -748,9 +1140,6 @@ unsigned char* create_seed(const char* filename, unsigned int size, char* locked
   unsigned char sha1_md[SHA_DIGEST_LENGTH], sha1_input[SHA_DIGEST_LENGTH], openssl_rand[SHA_DIGEST_LENGTH];
   unsigned long int i,j, requested_size;
   unsigned char* return_status = NULL;
-  struct rlimit rlim;
-  unsigned int mlock_limit;
-
 
   assert (locked != NULL);
   assert (allocated_size != NULL);
@@ -762,34 +1151,14 @@ unsigned char* create_seed(const char* filename, unsigned int size, char* locked
   if (size % SHA_DIGEST_LENGTH ) size += ( SHA_DIGEST_LENGTH - size % SHA_DIGEST_LENGTH );
   assert(size > requested_size);
 
-  data = (unsigned char*) malloc ( size );
+  //Prevent seed from being swapped out or dumped
+  data = (unsigned char*) secure_alloc ( size );
   if ( data == NULL ) {
-    fprintf(stderr, "ERROR: Dynamic memory allocation has failed for buffer of size %u. Reported error: %s\n", size, strerror(errno));
     return NULL;
   } else {
     *allocated_size = size;
   }
 
-  //{{{ getrlimit
-  if ( getrlimit(RLIMIT_MEMLOCK, &rlim) == 0 ) {
-    mlock_limit = rlim.rlim_cur;
-    //fprintf(stderr, "INFO:  getrlimit(RLIMIT_MEMLOCK, rlim) reports: current limit %d, maximum (ceiling) %d.\n", rlim.rlim_cur, rlim.rlim_max);
-  } else {
-    mlock_limit = 16384;
-    fprintf (stderr, "\nWARNING: Function init_buffer: getrlimit(RLIMIT_MEMLOCK, rlim) has failed. Using %d as default limit. Reported error: %s\n", mlock_limit,  strerror (errno) );
-  }
-  //}}}
-
-  //Prevent buffer from being swapped out
-  if ( size <= mlock_limit ) {
-    if ( mlock(data, size ) == 0 ) {
-      *locked = 1;
-    } else {
-      fprintf (stderr, "\nWARNING: Cannot lock buffer to RAM (preventing that memory from being paged to the swap area)\n"
-          "Size of buffer is %u Bytes. Reported error: %s\n", size, strerror (errno) );
-    }
-  }
-
   //Open file
   randomDataFile = fopen(filename, "r");
   if ( randomDataFile == NULL ) {
@@ -891,6 +1260,122 @@ static FILE* open_file_for_reading(const char* filename) {
 }
 //}}}
 
+//{{{ DRBG mechanism helpers
+/*
+ * Fastest approved mechanism on this CPU. CTR_DRBG wins clearly with AES-NI.
+ * Without it, multi-buffer SHA-256 makes Hash_DRBG faster than the constant-time
+ * software AES. HMAC_DRBG needs two serial compressions per output block and is never the fastest.
+ */
+static drbg_mechanism_type fastest_drbg_mechanism(void)
+{
+  const csprng_kernel_table_type* k = csprng_cpu_kernels();
+
+  if ( k->aes_encrypt != nist_ctr_drbg_encrypt_generic && k->aes_encrypt != nist_ctr_drbg_encrypt_bitsliced ) return DRBG_CTR;
+  if ( k->sha256_multi != sha256_multi_generic ) return DRBG_HASH;
+  return DRBG_CTR;
+}
+
+/*
+ * Multi-lane CTR_DRBG. Lane 0 gets the entropy passed by the caller, every other lane draws its own
+ * entropy_length bytes from entropy_buf. All lanes get the same personalization string/additional input.
+ */
+static int ctr_drbg_lanes_instantiate ( csprng_state_type* csprng_state, const unsigned char* entropy, const unsigned char* personalization_string )
+{
+  int lane;
+
+  for ( lane = 0; lane < csprng_state->mode.ctr_drbg_lanes; ++lane ) {
+    if ( lane > 0 ) {
+      entropy = get_data_from_RNG_buffer ( csprng_state->entropy_buf, csprng_state->entropy_length );
+      if ( entropy == NULL ) return 1;
+      csprng_state->entropy_tot += csprng_state->entropy_length;
+    }
+    csprng_state->ctr_drbg_lane[lane] = nist_ctr_drbg_instantiate(entropy, csprng_state->entropy_length, NULL, 0,
+        personalization_string, csprng_state->additional_input_length_reseed, csprng_state->mode.use_df, csprng_state->mode.aes_key_length);
+    if ( csprng_state->ctr_drbg_lane[lane] == NULL ) return 1;
+  }
+  csprng_state->ctr_drbg = csprng_state->ctr_drbg_lane[0];
+
+  return nist_ctr_drbg_set_threads(csprng_state->ctr_drbg, csprng_state->mode.generate_threads);
+}
+
+static int ctr_drbg_lanes_reseed ( csprng_state_type* csprng_state, const unsigned char* entropy, const unsigned char* additional_input )
+{
+  int lane, error;
+
+  for ( lane = 0; lane < csprng_state->mode.ctr_drbg_lanes; ++lane ) {
+    if ( lane > 0 ) {
+      entropy = get_data_from_RNG_buffer ( csprng_state->entropy_buf, csprng_state->entropy_length );
+      if ( entropy == NULL ) return 1;
+      csprng_state->entropy_tot += csprng_state->entropy_length;
+    }
+    error = nist_ctr_drbg_reseed(csprng_state->ctr_drbg_lane[lane], entropy, csprng_state->entropy_length,
+        additional_input, csprng_state->additional_input_length_reseed);
+    if ( error ) return error;
+  }
+
+  return 0;
+}
+
+/* Instantiate the DRBG selected by csprng_state->mode.drbg_mechanism. Returns 0 on success */
+static int drbg_instantiate ( csprng_state_type* csprng_state, const unsigned char* entropy, const unsigned char* personalization_string )
+{
+  switch ( csprng_state->mode.drbg_mechanism ) {
+    case DRBG_HASH:
+      csprng_state->hash_drbg = nist_hash_drbg_instantiate(entropy, csprng_state->entropy_length, NULL, 0,
+          personalization_string, csprng_state->additional_input_length_reseed, csprng_state->mode.drbg_hash);
+      return csprng_state->hash_drbg == NULL;
+    case DRBG_HMAC:
+      csprng_state->hmac_drbg = nist_hmac_drbg_instantiate(entropy, csprng_state->entropy_length, NULL, 0,
+          personalization_string, csprng_state->additional_input_length_reseed, csprng_state->mode.drbg_hash);
+      return csprng_state->hmac_drbg == NULL;
+    case DRBG_CHACHA20:
+      csprng_state->chacha20 = chacha20_rng_instantiate(entropy, csprng_state->entropy_length,
+          personalization_string, csprng_state->additional_input_length_reseed);
+      return csprng_state->chacha20 == NULL;
+    default:
+      return ctr_drbg_lanes_instantiate(csprng_state, entropy, personalization_string);
+  }
+}
+
+static int drbg_reseed ( csprng_state_type* csprng_state, const unsigned char* entropy, const unsigned char* additional_input )
+{
+  switch ( csprng_state->mode.drbg_mechanism ) {
+    case DRBG_HASH:
+      return nist_hash_drbg_reseed(csprng_state->hash_drbg, entropy, csprng_state->entropy_length,
+          additional_input, csprng_state->additional_input_length_reseed);
+    case DRBG_HMAC:
+      return nist_hmac_drbg_reseed(csprng_state->hmac_drbg, entropy, csprng_state->entropy_length,
+          additional_input, csprng_state->additional_input_length_reseed);
+    case DRBG_CHACHA20:
+      return chacha20_rng_reseed(csprng_state->chacha20, entropy, csprng_state->entropy_length,
+          additional_input, csprng_state->additional_input_length_reseed);
+    default:
+      return ctr_drbg_lanes_reseed(csprng_state, entropy, additional_input);
+  }
+}
+
+static int drbg_generate ( csprng_state_type* csprng_state, unsigned char* output_buffer, unsigned int output_size, const unsigned char* additional_input )
+{
+  switch ( csprng_state->mode.drbg_mechanism ) {
+    case DRBG_HASH:
+      return nist_hash_drbg_generate(csprng_state->hash_drbg, output_buffer, output_size,
+          additional_input, csprng_state->additional_input_length_generate);
+    case DRBG_HMAC:
+      return nist_hmac_drbg_generate(csprng_state->hmac_drbg, output_buffer, output_size,
+          additional_input, csprng_state->additional_input_length_generate);
+    case DRBG_CHACHA20:
+      return chacha20_rng_generate(csprng_state->chacha20, output_buffer, output_size,
+          additional_input, csprng_state->additional_input_length_generate);
+    default:
+      if ( csprng_state->mode.ctr_drbg_lanes > 1 )
+        return nist_ctr_drbg_generate_lanes(csprng_state->ctr_drbg_lane, csprng_state->mode.ctr_drbg_lanes, output_buffer, output_size,
+            additional_input, csprng_state->additional_input_length_generate);
+      return nist_ctr_drbg_generate(csprng_state->ctr_drbg, output_buffer, output_size,
+          additional_input, csprng_state->additional_input_length_generate);
+  }
+}
+//}}}
+
 //{{{csprng_state_type* csprng_initialize ( const mode_of_operation_type* mode_of_operation)
 csprng_state_type* csprng_initialize( const mode_of_operation_type* mode_of_operation)
 {
@@ -910,6 +1395,16 @@ csprng_state_type* csprng_initialize( const mode_of_operation_type* mode_of_oper
   char* QRBG_RNG_passwd;           //Password for  random.irb.hr
   char HTTP_source_bitmask;        //source bitmask for http_random_init 
 
+  pthread_once(&csprng_fork_once, csprng_register_atfork);
+
+  //{{{ Detect CPU features and select kernels
+  error = csprng_cpu_dispatch_initialize();
+  if ( error ) {
+    fprintf(stderr, "ERROR: csprng_cpu_dispatch_initialize has returned %d\n", error);
+    return NULL;
+  }
+  //}}}
+
   //{{{ Init csprng_state, do sanity checks
   assert ( mode_of_operation->entropy_source   < SOURCES_COUNT );
   assert ( mode_of_operation->add_input_source < SOURCES_COUNT );
@@ -933,14 +1428,19 @@ csprng_state_type* csprng_initialize( const mode_of_operation_type* mode_of_oper
     return NULL;
   }
 
+  pthread_mutex_init(&csprng_state->source_mutex, NULL);
+  csprng_state->fork_count = csprng_fork_count;
   csprng_state->mode = *mode_of_operation;
   csprng_state->mode.max_number_of_csprng_generated_bytes = csprng_state->mode.max_number_of_csprng_blocks * NIST_BLOCK_OUTLEN_BYTES;
 
   //These values are important to correctly call nist_ctr_drbg_destroy
-  csprng_state->HAVEGE_initialized = 0;
+  csprng_state->havege = NULL;
   csprng_state->sha = NULL;
   csprng_state->memt = NULL;
   csprng_state->ctr_drbg = NULL;
+  csprng_state->hash_drbg = NULL;
+  csprng_state->hmac_drbg = NULL;
+  csprng_state->chacha20 = NULL;
   csprng_state->mode.filename_for_entropy = NULL;     //We will create deep copy when needed later
   csprng_state->mode.filename_for_additional = NULL;  //We will create deep copy when needed later
   csprng_state->file_for_entropy_buf = NULL;
@@ -959,21 +1459,95 @@ csprng_state_type* csprng_initialize( const mode_of_operation_type* mode_of_oper
     }
   }
 
-  if ( csprng_state->mode.use_df ) {
+  if ( csprng_state->mode.raw_buf_size > CSPRNG_MAX_BUFFER_SIZE || csprng_state->mode.source_buf_size > CSPRNG_MAX_BUFFER_SIZE ) {
+    fprintf(stderr, "ERROR: csprng_initialize: raw_buf_size %u and source_buf_size %u can be at most %d bytes\n",
+        csprng_state->mode.raw_buf_size, csprng_state->mode.source_buf_size, CSPRNG_MAX_BUFFER_SIZE);
+    goto error_detected_initialize;
+  }
+
+  if ( csprng_state->mode.aes_key_length == 0 ) csprng_state->mode.aes_key_length = NIST_BLOCK_KEYLEN;
+  if ( ! NIST_KEYLEN_VALID(csprng_state->mode.aes_key_length) ) {
+    fprintf(stderr, "ERROR: csprng_initialize: expecting aes_key_length to be 128, 192 or 256 but got %d \n", csprng_state->mode.aes_key_length);
+    goto error_detected_initialize;
+  }
+
+  if ( csprng_state->mode.drbg_mechanism == DRBG_AUTO ) csprng_state->mode.drbg_mechanism = fastest_drbg_mechanism();
+  if ( csprng_state->mode.drbg_mechanism >= DRBG_AUTO ) {
+    fprintf(stderr, "ERROR: csprng_initialize: unsupported drbg_mechanism %d\n", csprng_state->mode.drbg_mechanism);
+    goto error_detected_initialize;
+  }
+  if ( csprng_state->mode.drbg_hash >= NIST_HASH_COUNT ) {
+    fprintf(stderr, "ERROR: csprng_initialize: expecting drbg_hash to be SHA-256 or SHA-512 but got %d\n", csprng_state->mode.drbg_hash);
+    goto error_detected_initialize;
+  }
+  if ( csprng_state->mode.generate_threads < 0 || csprng_state->mode.generate_threads > 64 ) {
+    fprintf(stderr, "ERROR: csprng_initialize: expecting generate_threads to be in range <0, 64> but got %d\n", csprng_state->mode.generate_threads);
+    goto error_detected_initialize;
+  }
+  if ( csprng_state->mode.fips_threads < 0 || csprng_state->mode.fips_threads > 64 ) {
+    fprintf(stderr, "ERROR: csprng_initialize: expecting fips_threads to be in range <0, 64> but got %d\n", csprng_state->mode.fips_threads);
+    goto error_detected_initialize;
+  }
+  if ( csprng_state->mode.ctr_drbg_lanes == 0 ) csprng_state->mode.ctr_drbg_lanes = 1;
+  if ( csprng_state->mode.ctr_drbg_lanes < 1 || csprng_state->mode.ctr_drbg_lanes > NIST_CTR_DRBG_MAX_LANES ) {
+    fprintf(stderr, "ERROR: csprng_initialize: expecting ctr_drbg_lanes to be in range <0, %d> but got %d\n", NIST_CTR_DRBG_MAX_LANES, csprng_state->mode.ctr_drbg_lanes);
+    goto error_detected_initialize;
+  }
+  if ( csprng_state->mode.ctr_drbg_lanes > 1 && csprng_state->mode.generate_threads > 1 ) {
+    fprintf(stderr, "ERROR: csprng_initialize: ctr_drbg_lanes and generate_threads cannot be combined\n");
+    goto error_detected_initialize;
+  }
+  if ( csprng_state->mode.prefetch_watermark < 0 || csprng_state->mode.prefetch_watermark > 100 ) {
+    fprintf(stderr, "ERROR: csprng_initialize: expecting prefetch_watermark to be in range <0, 100> but got %d\n", csprng_state->mode.prefetch_watermark);
+    goto error_detected_initialize;
+  }
+  if ( ! ( csprng_state->mode.health_min_entropy >= 0.0 && csprng_state->mode.health_min_entropy <= 8.0 ) ) {
+    fprintf(stderr, "ERROR: csprng_initialize: expecting health_min_entropy to be in range <0, 8> but got %g\n", csprng_state->mode.health_min_entropy);
+    goto error_detected_initialize;
+  }
+  if ( csprng_state->mode.health_action >= HEALTH_ACTIONS_COUNT ) {
+    fprintf(stderr, "ERROR: csprng_initialize: expecting health_action to be HEALTH_WARN, HEALTH_DROP or HEALTH_FAIL but got %d\n", csprng_state->mode.health_action);
+    goto error_detected_initialize;
+  }
+
+  if ( csprng_state->mode.drbg_mechanism == DRBG_CHACHA20 ) {
+    //Entropy and additional input are hashed into the 256-bit key
+    csprng_state->entropy_length = CHACHA20_SECURITY_STRENGTH_BYTES;
+    if ( csprng_state->mode.add_input_source != NONE ) {
+      csprng_state->additional_input_length_generate = CHACHA20_SECURITY_STRENGTH_BYTES;
+      csprng_state->additional_input_length_reseed = CHACHA20_SECURITY_STRENGTH_BYTES;
+    } else {
+      csprng_state->additional_input_length_generate = 0;
+      csprng_state->additional_input_length_reseed = 0;
+    }
+  } else if ( csprng_state->mode.drbg_mechanism != DRBG_CTR ) {
+    //Hash_DRBG and HMAC_DRBG always use their own derivation function. No nonce is used,
+    //entropy of 3/2 of the security strength covers it (SP 800-90A, section 8.6.7)
+    csprng_state->entropy_length = NIST_HASH_SECURITY_STRENGTH_BYTES * 3 / 2;
     if ( csprng_state->mode.add_input_source != NONE ) {
-      csprng_state->entropy_length = NIST_BLOCK_OUTLEN_BYTES;  //AES-128, 128 bits ~ 16 bytes 
-      csprng_state->additional_input_length_generate = NIST_BLOCK_SEEDLEN_BYTES; //AES-128, 2 *128 bits ~ 64 bytes
-      csprng_state->additional_input_length_reseed = NIST_BLOCK_OUTLEN_BYTES; //AES-128, 128 bits ~ 16 bytes
+      csprng_state->additional_input_length_generate = NIST_HASH_SECURITY_STRENGTH_BYTES;
+      csprng_state->additional_input_length_reseed = NIST_HASH_SECURITY_STRENGTH_BYTES;
     } else {
-      csprng_state->entropy_length = NIST_BLOCK_SEEDLEN_BYTES; //AES-128, 2 *128 bits ~ 64 bytes
+      csprng_state->additional_input_length_generate = 0;
+      csprng_state->additional_input_length_reseed = 0;
+    }
+  } else if ( csprng_state->mode.use_df ) {
+    //seedlen = keylen + outlen. AES-128: 32 bytes, AES-192: 40 bytes, AES-256: 48 bytes
+    if ( csprng_state->mode.add_input_source != NONE ) {
+      //Entropy has to provide the full security strength (keylen), additional input tops it up to seedlen
+      csprng_state->entropy_length = csprng_state->mode.aes_key_length / 8;
+      csprng_state->additional_input_length_generate = NIST_SEEDLEN_BYTES(csprng_state->mode.aes_key_length);
+      csprng_state->additional_input_length_reseed = NIST_BLOCK_OUTLEN_BYTES; //128 bits ~ 16 bytes
+    } else {
+      csprng_state->entropy_length = NIST_SEEDLEN_BYTES(csprng_state->mode.aes_key_length);
       csprng_state->additional_input_length_generate = 0;
       csprng_state->additional_input_length_reseed = 0;
     }
   } else {
-    csprng_state->entropy_length = NIST_BLOCK_SEEDLEN_BYTES; //AES-128, 2 *128 bits ~ 64 bytes
+    csprng_state->entropy_length = NIST_SEEDLEN_BYTES(csprng_state->mode.aes_key_length);
     if ( csprng_state->mode.add_input_source != NONE ) {
-      csprng_state->additional_input_length_generate = NIST_BLOCK_SEEDLEN_BYTES; //AES-128, 2 *128 bits ~ 64 bytes
-      csprng_state->additional_input_length_reseed = NIST_BLOCK_SEEDLEN_BYTES; //AES-128, 2 *128 bits ~ 64 bytes
+      csprng_state->additional_input_length_generate = NIST_SEEDLEN_BYTES(csprng_state->mode.aes_key_length);
+      csprng_state->additional_input_length_reseed = NIST_SEEDLEN_BYTES(csprng_state->mode.aes_key_length);
     } else {
       csprng_state->additional_input_length_generate = 0;
       csprng_state->additional_input_length_reseed = 0;
@@ -1100,15 +1674,14 @@ csprng_state_type* csprng_initialize( const mode_of_operation_type* mode_of_oper
 
   //{{{ Check if need HAVEGE and init it
   if ( csprng_state->mode.entropy_source == HAVEGE || csprng_state->mode.add_input_source == HAVEGE ) {
-    error = havege_init( csprng_state->mode.havege_instruction_cache_size, csprng_state->mode.havege_data_cache_size, csprng_state->mode.havege_debug_flags); 
-    if ( error ) {
-      fprintf(stderr, "ERROR: havege_init has returned %d\n",error);
+    csprng_state->havege = havege_init( csprng_state->mode.havege_instruction_cache_size, csprng_state->mode.havege_data_cache_size, csprng_state->mode.havege_debug_flags); 
+    if ( csprng_state->havege == NULL ) {
+      fprintf(stderr, "ERROR: havege_init has failed.\n");
       goto error_detected_initialize;
     }
-    csprng_state->HAVEGE_initialized = 1;
 
     if ( csprng_state->mode.havege_status_flag == 1 ) {
-      havege_status(buf, 2048);
+      havege_status(csprng_state->havege, buf, 2048);
       fprintf(stderr,"================HAVEGE STATUS REPORT================\n");
       fprintf(stderr, "%s\n", buf);
       fprintf(stderr,"====================================================\n");
@@ -1194,6 +1767,7 @@ csprng_state_type* csprng_initialize( const mode_of_operation_type* mode_of_oper
     case HAVEGE:
       size = sizeof(DATA_TYPE) + csprng_state->entropy_length;
       if ( size < MIN_BUFFER_SIZE ) size = MIN_BUFFER_SIZE;
+      rng_state.havege = csprng_state->havege;
       break;
     case SHA1_RNG:
       size = BYTES_PRODUCED_BY_SHA1 + csprng_state->entropy_length;
@@ -1215,6 +1789,10 @@ csprng_state_type* csprng_initialize( const mode_of_operation_type* mode_of_oper
       fprintf(stderr, "ERROR: Unsupported csprng_state->mode.entropy_source %s in csprng_initialize.\n", source_names[csprng_state->mode.entropy_source] );
       goto error_detected_initialize;
   }
+  //Buffers are consumed in order, a larger one changes only how often it's refilled
+  if ( (int) csprng_state->mode.source_buf_size > size && csprng_state->mode.entropy_source != HTTP_RNG && csprng_state->are_files_same == 0 ) {
+    size = csprng_state->mode.source_buf_size;
+  }
 
   csprng_state->entropy_buf = init_buffer( csprng_state->mode.entropy_source, rng_state, 
       csprng_state->mode.filename_for_entropy, csprng_state->file_for_entropy_buf, size, "ENTROPY BUF");
@@ -1222,6 +1800,7 @@ csprng_state_type* csprng_initialize( const mode_of_operation_type* mode_of_oper
     fprintf(stderr, "ERROR: init_buffer for csprng_state->entropy_buf has failed.\n");
     goto error_detected_initialize;
   }
+  if ( start_health_tests(csprng_state->entropy_buf, csprng_state->mode.health_min_entropy, csprng_state->mode.health_action) ) goto error_detected_initialize;
   //}}}
 
   //{{{ init buffer of random numbers to derive random_length_of_csprng_generated_bytes
@@ -1258,6 +1837,7 @@ csprng_state_type* csprng_initialize( const mode_of_operation_type* mode_of_oper
       case HAVEGE:
         size = sizeof(DATA_TYPE) + max;
         if ( size < MIN_BUFFER_SIZE ) size = MIN_BUFFER_SIZE;
+        rng_state.havege = csprng_state->havege;
         break;
       case SHA1_RNG:
         size = BYTES_PRODUCED_BY_SHA1 + max;
@@ -1279,6 +1859,9 @@ csprng_state_type* csprng_initialize( const mode_of_operation_type* mode_of_oper
         fprintf(stderr, "ERROR: Unsupported csprng_state->mode.add_input_source %s in csprng_initialize.\n", source_names[csprng_state->mode.add_input_source] );
         goto error_detected_initialize;
   }
+    if ( (int) csprng_state->mode.source_buf_size > size && csprng_state->mode.add_input_source != HTTP_RNG && csprng_state->are_files_same == 0 ) {
+      size = csprng_state->mode.source_buf_size;
+    }
 
     csprng_state->add_input_buf = init_buffer( csprng_state->mode.add_input_source, rng_state, 
         csprng_state->mode.filename_for_additional, csprng_state->file_for_additional_buf, size, "ADDITIONAL INPUT BUF");
@@ -1286,6 +1869,33 @@ csprng_state_type* csprng_initialize( const mode_of_operation_type* mode_of_oper
       fprintf(stderr, "ERROR: init_buffer for csprng_state->add_input_buf has failed.\n");
       goto error_detected_initialize;
     }
+    if ( start_health_tests(csprng_state->add_input_buf, csprng_state->mode.health_min_entropy, csprng_state->mode.health_action) ) goto error_detected_initialize;
+  }
+  //}}}
+
+  //{{{ Start prefetch threads for the entropy and additional input buffers
+  if ( csprng_state->mode.prefetch_watermark > 0 ) {
+    //Source states used by more than one buffer are read under csprng_state->source_mutex
+    if ( csprng_state->add_input_buf != NULL && csprng_state->mode.entropy_source == csprng_state->mode.add_input_source &&
+        ( csprng_state->mode.entropy_source != EXTERNAL || csprng_state->are_files_same == 1 ) ) {
+      csprng_state->entropy_buf->source_mutex = &csprng_state->source_mutex;
+      csprng_state->add_input_buf->source_mutex = &csprng_state->source_mutex;
+    }
+    if ( csprng_state->random_length_buf != NULL ) {
+      if ( csprng_state->mode.entropy_source == MT_RNG ) {
+        csprng_state->entropy_buf->source_mutex = &csprng_state->source_mutex;
+        csprng_state->random_length_buf->source_mutex = &csprng_state->source_mutex;
+      }
+      if ( csprng_state->mode.add_input_source == MT_RNG ) {
+        csprng_state->add_input_buf->source_mutex = &csprng_state->source_mutex;
+        csprng_state->random_length_buf->source_mutex = &csprng_state->source_mutex;
+      }
+    }
+
+    if ( start_prefetch(csprng_state->entropy_buf, csprng_state->mode.prefetch_watermark) ) goto error_detected_initialize;
+    if ( csprng_state->add_input_buf != NULL ) {
+      if ( start_prefetch(csprng_state->add_input_buf, csprng_state->mode.prefetch_watermark) ) goto error_detected_initialize;
+    }
   }
   //}}}
 
@@ -1313,6 +1923,8 @@ int csprng_instantiate ( csprng_state_type* csprng_state )
   const unsigned char* entropy = NULL;
   const unsigned char* additional_input = NULL;
 
+  if ( csprng_forked(csprng_state, "csprng_instantiate") ) return 1;
+
   //{{{ Instantiate NIST CTR DRBG  
   entropy = get_data_from_RNG_buffer ( csprng_state->entropy_buf, csprng_state->entropy_length );
   if ( entropy == NULL) goto error_detected_instantiate;
@@ -1335,10 +1947,8 @@ int csprng_instantiate ( csprng_state_type* csprng_state )
 //  dump_hex_byte_string(csprng_state->entropy_buf->buf, csprng_state->entropy_length, "entropy_input: \t");
 //  dump_hex_byte_string(entropy, csprng_state->entropy_length, "entropy_input: \t");
 
-  csprng_state->ctr_drbg = nist_ctr_drbg_instantiate(entropy,  csprng_state->entropy_length, NULL, 0, 
-      additional_input , csprng_state->additional_input_length_reseed, csprng_state->mode.use_df);
-  if ( csprng_state->ctr_drbg == NULL ) {
-    fprintf(stderr, "ERROR: nist_ctr_drbg_instantiate has returned NULL pointer. \n");
+  if ( drbg_instantiate(csprng_state, entropy, additional_input) ) {
+    fprintf(stderr, "ERROR: %s instantiate has returned NULL pointer. \n", drbg_mechanism_names[csprng_state->mode.drbg_mechanism]);
     goto error_detected_instantiate;
   }
   //}}}
@@ -1360,9 +1970,9 @@ int csprng_instantiate ( csprng_state_type* csprng_state )
   } 
   csprng_state->additional_input_reseed_tot +=  csprng_state->additional_input_length_reseed;
 
-  error = nist_ctr_drbg_reseed(csprng_state->ctr_drbg, entropy, csprng_state->entropy_length, additional_input, csprng_state->additional_input_length_reseed);
+  error = drbg_reseed(csprng_state, entropy, additional_input);
   if ( error ) {
-    fprintf(stderr, "ERROR: nist_ctr_drbg_reseed has returned %d\n",error);
+    fprintf(stderr, "ERROR: %s reseed has returned %d\n", drbg_mechanism_names[csprng_state->mode.drbg_mechanism], error);
     goto error_detected_instantiate;
   }
   //}}}
@@ -1370,8 +1980,8 @@ int csprng_instantiate ( csprng_state_type* csprng_state )
   return 0;
 
 error_detected_instantiate:
-  fprintf(stderr, "ERROR: csprng_instantiate - error detected, freeing up the memory\n");
-  csprng_destroy (csprng_state);
+  //csprng_state is destroyed by the caller
+  fprintf(stderr, "ERROR: csprng_instantiate - error detected\n");
   return 1;
 
 }
@@ -1394,6 +2004,7 @@ csprng_generate ( csprng_state_type* csprng_state, unsigned char* output_buffer,
   const unsigned char* additional_input = NULL;
 
   //fprintf(stderr, "csprng_generate: bytes requested %u, reseed %s\n", output_size, (reseed ) ? "YES" : "NO");
+  if ( csprng_forked(csprng_state, "csprng_generate") ) return 0;
 
   if ( csprng_state->additional_input_length_generate ) {
     additional_input = get_data_from_RNG_buffer ( csprng_state->add_input_buf, csprng_state->additional_input_length_generate );
@@ -1401,17 +2012,17 @@ csprng_generate ( csprng_state_type* csprng_state, unsigned char* output_buffer,
     //dump_hex_byte_string(additional_input, csprng_state->additional_input_length_generate, "Generate: \tadditional_input: \t");
   
     csprng_state->additional_input_generate_tot += csprng_state->additional_input_length_generate;
-    error = nist_ctr_drbg_generate( csprng_state->ctr_drbg, output_buffer, output_size, additional_input, csprng_state->additional_input_length_generate );
+    error = drbg_generate( csprng_state, output_buffer, output_size, additional_input );
     if ( error ) {
-      fprintf(stderr, "ERROR: nist_ctr_drbg_generate has returned %d\n",error);
+      fprintf(stderr, "ERROR: %s generate has returned %d\n", drbg_mechanism_names[csprng_state->mode.drbg_mechanism], error);
       return(0);
     }
 
   } else {
 
-    error = nist_ctr_drbg_generate( csprng_state->ctr_drbg, output_buffer, output_size, additional_input, csprng_state->additional_input_length_generate );
+    error = drbg_generate( csprng_state, output_buffer, output_size, additional_input );
     if ( error ) {
-      fprintf(stderr, "ERROR: nist_ctr_drbg_generate has returned %d\n",error);
+      fprintf(stderr, "ERROR: %s generate has returned %d\n", drbg_mechanism_names[csprng_state->mode.drbg_mechanism], error);
       return(0);
     }
   }
@@ -1429,9 +2040,9 @@ csprng_generate ( csprng_state_type* csprng_state, unsigned char* output_buffer,
       //dump_hex_byte_string(additional_input, csprng_state->additional_input_length_reseed, "Reseed: \tadditional_input: \t");
 
       csprng_state->additional_input_reseed_tot += csprng_state->additional_input_length_reseed;
-      error = nist_ctr_drbg_reseed(csprng_state->ctr_drbg, entropy, csprng_state->entropy_length, additional_input, csprng_state->additional_input_length_reseed );
+      error = drbg_reseed( csprng_state, entropy, additional_input );
       if ( error ) {
-        fprintf(stderr, "ERROR: nist_ctr_drbg_reseed has returned %d\n",error);
+        fprintf(stderr, "ERROR: %s reseed has returned %d\n", drbg_mechanism_names[csprng_state->mode.drbg_mechanism], error);
         return(0);
       }
     } else {
@@ -1440,9 +2051,9 @@ csprng_generate ( csprng_state_type* csprng_state, unsigned char* output_buffer,
       //dump_hex_byte_string(entropy, csprng_state->entropy_length, "Reseed: \tentropy_input:     \t");
       csprng_state->entropy_tot += csprng_state->entropy_length;
 
-      error = nist_ctr_drbg_reseed(csprng_state->ctr_drbg, entropy, csprng_state->entropy_length, additional_input, csprng_state->additional_input_length_reseed );
+      error = drbg_reseed( csprng_state, entropy, additional_input );
       if ( error ) {
-        fprintf(stderr, "ERROR: nist_ctr_drbg_reseed has returned %d\n",error);
+        fprintf(stderr, "ERROR: %s reseed has returned %d\n", drbg_mechanism_names[csprng_state->mode.drbg_mechanism], error);
         return(0);
       }
     }
@@ -1463,8 +2074,11 @@ int
 csprng_destroy ( csprng_state_type* csprng_state )
 {
   int return_value=0;   //0 => OK, 1 =>ERROR
+  int i;
 
   if ( csprng_state == NULL ) return 1;
+  //The copy of the parent's state is left to the child: its buffers can't be unmapped safely
+  if ( csprng_forked(csprng_state, "csprng_destroy") ) return 1;
 
   if ( csprng_state->ctr_drbg != NULL ) {
     if ( nist_ctr_drbg_destroy(csprng_state->ctr_drbg) != 0 ) {
@@ -1473,6 +2087,41 @@ csprng_destroy ( csprng_state_type* csprng_state )
     }
   }
 
+  //Lane 0 is csprng_state->ctr_drbg
+  for ( i = 1; i < NIST_CTR_DRBG_MAX_LANES; ++i ) {
+    if ( csprng_state->ctr_drbg_lane[i] != NULL ) {
+      if ( nist_ctr_drbg_destroy(csprng_state->ctr_drbg_lane[i]) != 0 ) {
+        fprintf(stderr, "ERROR: nist_ctr_drbg_destroy has failed.\n");
+        return_value = 1;
+      }
+    }
+  }
+
+  if ( csprng_state->hash_drbg != NULL ) {
+    if ( nist_hash_drbg_destroy(csprng_state->hash_drbg) != 0 ) {
+      fprintf(stderr, "ERROR: nist_hash_drbg_destroy has failed.\n");
+      return_value = 1;
+    }
+  }
+
+  if ( csprng_state->hmac_drbg != NULL ) {
+    if ( nist_hmac_drbg_destroy(csprng_state->hmac_drbg) != 0 ) {
+      fprintf(stderr, "ERROR: nist_hmac_drbg_destroy has failed.\n");
+      return_value = 1;
+    }
+  }
+
+  if ( csprng_state->chacha20 != NULL ) {
+    if ( chacha20_rng_destroy(csprng_state->chacha20) != 0 ) {
+      fprintf(stderr, "ERROR: chacha20_rng_destroy has failed.\n");
+      return_value = 1;
+    }
+  }
+
+  //Prefetch threads use the source states
+  if ( csprng_state->add_input_buf != NULL && csprng_state->add_input_buf->prefetch != NULL ) stop_prefetch(csprng_state->add_input_buf);
+  if ( csprng_state->entropy_buf != NULL && csprng_state->entropy_buf->prefetch != NULL ) stop_prefetch(csprng_state->entropy_buf);
+
   if ( csprng_state->add_input_buf != NULL ) {
    destroy_buffer(csprng_state->add_input_buf);
   } 
@@ -1497,8 +2146,8 @@ csprng_destroy ( csprng_state_type* csprng_state )
     MEMT_destroy( csprng_state->memt );
   }
 
-  if ( csprng_state->HAVEGE_initialized == 1 ) {
-    havege_destroy();
+  if ( csprng_state->havege != NULL ) {
+    havege_destroy( csprng_state->havege );
   }
 
   //We will not close STDIN
@@ -1529,6 +2178,7 @@ csprng_destroy ( csprng_state_type* csprng_state )
     free ( csprng_state->mode.filename_for_entropy );
   }
 
+  pthread_mutex_destroy(&csprng_state->source_mutex);
   memset(csprng_state, 0, sizeof(csprng_state_type) );
   free(csprng_state);
 
@@ -1585,8 +2235,11 @@ fips_state_type* fips_approved_csprng_initialize(int perform_fips_test, int trac
   size = ( fips_state->csprng_state->mode.max_number_of_csprng_generated_bytes > NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST ) ?
       ( unsigned int ) NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST : fips_state->csprng_state->mode.max_number_of_csprng_generated_bytes;
 
-  //Size of the fips_state->raw_buf
-  size += fips_state->max_bytes_to_get_from_raw_buf;
+  //Size of the fips_state->raw_buf. Borrowed data and the data waiting for the FIPS test
+  //can take up to 2 * max_bytes_to_get_from_raw_buf when raw_buf is refilled
+  size += 2 * fips_state->max_bytes_to_get_from_raw_buf;
+  //fill_buffer_using_csprng generates the same requests into a larger buffer, only more of them per refill
+  if ( fips_state->csprng_state->mode.raw_buf_size > size ) size = fips_state->csprng_state->mode.raw_buf_size;
 
   fips_state->raw_buf = init_buffer( NONE, rng_state, NULL, NULL, size, "FIPS TEST INPUT BUF");
   if ( fips_state->raw_buf == NULL ) {
@@ -1594,10 +2247,14 @@ fips_state_type* fips_approved_csprng_initialize(int perform_fips_test, int trac
     goto fips_approved_csprng_initialize_clean;
   }
 
-  fips_state->out_buf = init_buffer( NONE, rng_state, NULL, NULL, fips_state->max_bytes_to_get_from_raw_buf, "FIPS TEST OUTPUT BUF");
-  if ( fips_state->out_buf == NULL ) {
-    fprintf(stderr, "ERROR: init_buffer for fips_state->out_buf has failed.\n");
-    goto fips_approved_csprng_initialize_clean;
+  //raw_buf never holds more than total_size / FIPS_RNG_BUFFER_SIZE untested blocks
+  if ( perform_fips_test && fips_state->csprng_state->mode.fips_threads > 1 ) {
+    fips_state->fips_pool = fips_pool_create(fips_state->csprng_state->mode.fips_threads,
+        fips_state->raw_buf->total_size / FIPS_RNG_BUFFER_SIZE, track_fips_CPU_time);
+    if ( fips_state->fips_pool == NULL ) {
+      fprintf(stderr, "ERROR: fips_pool_create has failed.\n");
+      goto fips_approved_csprng_initialize_clean;
+    }
   }
 
   return fips_state;
@@ -1616,7 +2273,6 @@ int fips_approved_csprng_instantiate( fips_state_type* fips_state) {
   return_code = csprng_instantiate(fips_state->csprng_state);
   if ( return_code ) {
     fprintf(stderr, "ERROR: csprng_instantiate has failed.\n");
-    fips_approved_csprng_destroy(fips_state);
     return 1;
   }
   
@@ -1740,6 +2396,711 @@ get_data_from_stdin_buffer ( fips_state_type* fips_state, int size)
 #endif
 //}}}
 
+//{{{ static unsigned int passed_bytes ( const fips_state_type* fips_state )
+/*
+ * Number of FIPS approved bytes in the tested span of raw_buf
+ */
+static unsigned int passed_bytes ( const fips_state_type* fips_state )
+{
+  if ( fips_state->perform_fips_test ) {
+    return fips_state->tested_bytes - fips_state->failed_blocks * FIPS_RNG_BUFFER_SIZE;
+  } else {
+    return fips_state->raw_buf->valid_data_size;
+  }
+}
+//}}}
+
+//{{{ static void compact_failed_blocks ( fips_state_type* fips_state )
+/*
+ * Remove the failed blocks from the tested span. Data in front of each failed block (starting
+ * from the last one) are moved over it, so that the approved data are contiguous at buf_start.
+ */
+static void compact_failed_blocks ( fips_state_type* fips_state )
+{
+  rng_buf_type* data = fips_state->raw_buf;
+  unsigned int offset;
+
+  while ( fips_state->failed_blocks > 0 ) {
+    offset = fips_state->failed_block_offset[--fips_state->failed_blocks];
+    memmove(data->buf_start + FIPS_RNG_BUFFER_SIZE, data->buf_start, offset);
+    memset(data->buf_start, 0, FIPS_RNG_BUFFER_SIZE);
+    consume_buffer(data, FIPS_RNG_BUFFER_SIZE);
+    fips_state->tested_bytes -= FIPS_RNG_BUFFER_SIZE;
+  }
+}
+//}}}
+
+//{{{ static void commit_tested_block ( fips_state_type* fips_state, int result )
+/*
+ * Account the result of the FIPS test of the block at the end of the tested span.
+ * Failed block at the beginning of raw_buf is dropped right away, otherwise it is recorded as a hole.
+ */
+static void commit_tested_block ( fips_state_type* fips_state, int result )
+{
+  rng_buf_type* data = fips_state->raw_buf;
+  unsigned char* block = data->buf_start + fips_state->tested_bytes;
+
+  if ( result == 0 ) {
+    fips_state->tested_bytes += FIPS_RNG_BUFFER_SIZE;
+  } else if ( fips_state->tested_bytes == 0 ) {
+    memset(block, 0, FIPS_RNG_BUFFER_SIZE);
+    consume_buffer(data, FIPS_RNG_BUFFER_SIZE);
+  } else {
+    //Block does not move, compaction only shifts the data in front of it
+    if ( fips_state->failed_blocks == FIPS_MAX_FAILED_BLOCKS ) compact_failed_blocks(fips_state);
+    fips_state->failed_block_offset[fips_state->failed_blocks++] = fips_state->tested_bytes;
+    fips_state->tested_bytes += FIPS_RNG_BUFFER_SIZE;
+  }
+}
+//}}}
+
+//{{{ static void test_raw_blocks ( fips_state_type* fips_state, unsigned int target )
+/*
+ * Run the FIPS test on the complete blocks available in raw_buf until there are at least target approved bytes.
+ * With fips_pool all complete blocks are tested at once by several threads, the results are committed
+ * in the original order. Untested data after the tested span never move, so the blocks stay in place.
+ */
+static void test_raw_blocks ( fips_state_type* fips_state, unsigned int target )
+{
+  rng_buf_type* data = fips_state->raw_buf;
+  const int* result;
+  int i, blocks;
+
+  while ( passed_bytes(fips_state) < target && data->valid_data_size - fips_state->tested_bytes >= FIPS_RNG_BUFFER_SIZE ) {
+    if ( fips_state->fips_pool == NULL ) {
+      commit_tested_block(fips_state, fips_run_rng_test(&fips_state->fips_ctx, data->buf_start + fips_state->tested_bytes));
+      continue;
+    }
+    blocks = ( data->valid_data_size - fips_state->tested_bytes ) / FIPS_RNG_BUFFER_SIZE;
+    result = fips_pool_test(fips_state->fips_pool, &fips_state->fips_ctx, data->buf_start + fips_state->tested_bytes, blocks);
+    if ( result == NULL ) break;
+    for ( i = 0; i < blocks; ++i ) commit_tested_block(fips_state, result[i]);
+  }
+}
+//}}}
+
+//{{{ static int prepare_borrow ( fips_state_type* fips_state, unsigned int min, unsigned int max )
+/*
+ * Make sure that there are at least min FIPS approved bytes in raw_buf.
+ * Without FIPS tests all valid bytes are approved. Returns 0 on success, 1 on error
+ */
+static int prepare_borrow ( fips_state_type* fips_state, unsigned int min, unsigned int max )
+{
+  rng_buf_type* data = fips_state->raw_buf;
+
+  if ( fips_state->borrowed_bytes ) {
+    fprintf ( stderr, "ERROR: csprng_borrow: %u Bytes are already borrowed. Call csprng_release first.\n", fips_state->borrowed_bytes);
+    return 1;
+  }
+
+  if ( min == 0 || min > max || min > (unsigned int) fips_state->max_bytes_to_get_from_raw_buf ) {
+    fprintf ( stderr, "ERROR: csprng_borrow: Invalid request min %u, max %u Bytes. Valid range is 1 <= min <= max and min <= %d.\n",
+        min, max, fips_state->max_bytes_to_get_from_raw_buf);
+    return 1;
+  }
+
+  if ( ! fips_state->perform_fips_test ) {
+    if ( min > data->valid_data_size ) {
+      fill_buffer_using_csprng (fips_state);
+    }
+  } else {
+    while ( 1 ) {
+      test_raw_blocks(fips_state, max);
+      if ( passed_bytes(fips_state) >= min ) break;
+      //fill_buffer_using_csprng needs the free space taken by the failed blocks
+      compact_failed_blocks(fips_state);
+      fill_buffer_using_csprng (fips_state);
+      if ( data->valid_data_size - fips_state->tested_bytes < FIPS_RNG_BUFFER_SIZE ) break;
+    }
+  }
+
+  if ( min > passed_bytes(fips_state) ) {
+    fprintf ( stderr, "ERROR: csprng_borrow: Failed to get requested bytes for buffer %s.\n", data->buffer_name );
+    fprintf ( stderr, "ERROR:                Bytes requested %u, bytes available %u.\n", min, passed_bytes(fips_state) );
+    return 1;
+  }
+  return 0;
+}
+//}}}
+
+//{{{ static int borrow_raw_buf ( fips_state_type* fips_state, unsigned int min, unsigned int max, const unsigned char** ptr, unsigned int* len )
+/*
+ * Lend contiguous FIPS approved data from raw_buf. Returns 0 on success, 1 on error
+ */
+static int borrow_raw_buf ( fips_state_type* fips_state, unsigned int min, unsigned int max, const unsigned char** ptr, unsigned int* len )
+{
+  unsigned int available;
+
+  if ( prepare_borrow(fips_state, min, max) ) return 1;
+  if ( fips_state->perform_fips_test ) compact_failed_blocks(fips_state);
+
+  available = passed_bytes(fips_state);
+  *len = ( available < max ) ? available : max;
+  *ptr = fips_state->raw_buf->buf_start;
+  fips_state->borrowed_bytes = *len;
+  return 0;
+}
+//}}}
+
+//{{{ static int borrow_raw_buf_iov ( fips_state_type* fips_state, unsigned int min, unsigned int max, struct iovec* iov, int iovcnt )
+/*
+ * Lend FIPS approved data from raw_buf as segments between the failed blocks.
+ * Returns the number of segments, -1 on error
+ */
+static int borrow_raw_buf_iov ( fips_state_type* fips_state, unsigned int min, unsigned int max, struct iovec* iov, int iovcnt )
+{
+  unsigned char* start;
+  unsigned int offset = 0;            //Offset of the current segment from buf_start
+  unsigned int end;                   //End of the current segment
+  unsigned int total = 0;             //Bytes in the segments
+  unsigned int i = 0;
+  int count = 0;
+
+  if ( prepare_borrow(fips_state, min, max) ) return -1;
+  start = fips_state->raw_buf->buf_start;
+
+  while ( count < iovcnt && total < max ) {
+    if ( fips_state->perform_fips_test ) {
+      end = ( i < fips_state->failed_blocks ) ? fips_state->failed_block_offset[i] : fips_state->tested_bytes;
+    } else {
+      end = fips_state->raw_buf->valid_data_size;
+    }
+    if ( end - offset > max - total ) end = offset + max - total;
+    if ( end > offset ) {
+      iov[count].iov_base = start + offset;
+      iov[count].iov_len = end - offset;
+      total += end - offset;
+      ++count;
+    }
+    if ( ! fips_state->perform_fips_test || i == fips_state->failed_blocks ) break;
+    offset = fips_state->failed_block_offset[i++] + FIPS_RNG_BUFFER_SIZE;
+  }
+
+  if ( total < min ) {
+    //Too many holes for iovcnt segments
+    compact_failed_blocks(fips_state);
+    total = passed_bytes(fips_state);
+    if ( total > max ) total = max;
+    iov[0].iov_base = fips_state->raw_buf->buf_start;
+    iov[0].iov_len = total;
+    count = 1;
+  }
+
+  fips_state->borrowed_bytes = (unsigned char*) iov[count-1].iov_base + iov[count-1].iov_len - fips_state->raw_buf->buf_start;
+  return count;
+}
+//}}}
+
+//{{{ static void release_raw_buf ( fips_state_type* fips_state )
+/*
+ * Wipe the borrowed data, including the failed blocks between the segments, and return the space to raw_buf
+ */
+static void release_raw_buf ( fips_state_type* fips_state )
+{
+  unsigned int span = fips_state->borrowed_bytes;
+  unsigned int i, j;
+
+  memset(fips_state->raw_buf->buf_start, 0, span);
+  consume_buffer(fips_state->raw_buf, span);
+  fips_state->borrowed_bytes = 0;
+
+  if ( fips_state->perform_fips_test ) {
+    fips_state->tested_bytes -= span;
+    for ( i = 0, j = 0; i < fips_state->failed_blocks; ++i ) {
+      if ( fips_state->failed_block_offset[i] >= span ) {
+        fips_state->failed_block_offset[j++] = fips_state->failed_block_offset[i] - span;
+      }
+    }
+    fips_state->failed_blocks = j;
+  }
+}
+//}}}
+
+//{{{ Background producer
+struct csprng_producer_type {
+  pthread_t thread;
+  rng_buf_type** slot;              //Ring of buffers. Data are written headroom bytes from buf
+  unsigned int buffers;             //Number of slots
+  unsigned int low_watermark;       //Producer resumes when the number of ready buffers drops to low_watermark
+  unsigned int high_watermark;      //Producer pauses when high_watermark buffers are ready
+  unsigned int headroom;            //Space in front of the data for the tail of the previous buffer
+  uint64_t produced;                //Buffers filled so far. Written by the producer only
+  uint64_t consumed;                //Buffers given back so far. Written by the consumer only
+  unsigned int borrowed_bytes;      //Bytes lent by csprng_borrow starting at the oldest ready buffer
+  int consumer_waiting;             //Consumer sleeps on data_ready
+  int producer_waiting;             //Producer sleeps on space_ready
+  int stop;                         //Request to terminate the producer
+  int failed;                       //Producer could not generate more data and has terminated
+  pthread_mutex_t mutex;            //Only for sleeping, the buffers are passed without locking
+  pthread_cond_t data_ready;
+  pthread_cond_t space_ready;
+};
+
+/*
+ * The ring is a single producer single consumer queue. Slot produced % buffers is owned by the producer
+ * and slots consumed ... produced - 1 by the consumer. Counters are published with sequentially consistent
+ * atomics, a side going to sleep sets its waiting flag and checks the counters again under the mutex.
+ */
+#define PRODUCER_LOAD(x) __atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define PRODUCER_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
+
+//{{{ static int fill_producer_buffer ( fips_state_type* fips_state, rng_buf_type* data )
+/*
+ * Copy CSPRNG_PRODUCER_BUFFER_SIZE FIPS approved bytes to data. Returns 0 on success, 1 when less data are available
+ */
+static int fill_producer_buffer ( fips_state_type* fips_state, rng_buf_type* data )
+{
+  unsigned char* dest = data->buf + fips_state->producer->headroom;
+  const unsigned char* raw_data;
+  unsigned int filled = 0;
+  unsigned int remaining_bytes;
+  unsigned int len;
+
+  while ( filled < CSPRNG_PRODUCER_BUFFER_SIZE ) {
+    remaining_bytes = CSPRNG_PRODUCER_BUFFER_SIZE - filled;
+    if ( borrow_raw_buf(fips_state, 
+          remaining_bytes < fips_state->producer->headroom ? remaining_bytes : fips_state->producer->headroom,
+          remaining_bytes, &raw_data, &len) ) break;
+    memcpy(dest + filled, raw_data, len);
+    filled += len;
+    release_raw_buf(fips_state);
+  }
+
+  data->buf_start = dest;
+  data->valid_data_size = filled;
+  data->bytes_in += filled;
+  return ( filled == CSPRNG_PRODUCER_BUFFER_SIZE ) ? 0 : 1;
+}
+//}}}
+
+//{{{ static void* producer_thread ( void* arg )
+static void* producer_thread ( void* arg )
+{
+  fips_state_type* fips_state = (fips_state_type*) arg;
+  csprng_producer_type* producer = fips_state->producer;
+  rng_buf_type* data;
+  uint64_t produced = producer->produced;
+  uint64_t ready;
+  int rc;
+
+  while ( ! PRODUCER_LOAD(producer->stop) ) {
+    //A consumer waiting for the next buffer gets it even above high_watermark, it may need two buffers
+    //to move the tail of the oldest one
+    ready = produced - PRODUCER_LOAD(producer->consumed);
+    if ( ready >= producer->buffers || ( ready >= producer->high_watermark && ! PRODUCER_LOAD(producer->consumer_waiting) ) ) {
+      pthread_mutex_lock(&producer->mutex);
+      PRODUCER_STORE(producer->producer_waiting, 1);
+      while ( ! PRODUCER_LOAD(producer->stop) ) {
+        ready = produced - PRODUCER_LOAD(producer->consumed);
+        if ( ready <= producer->low_watermark ) break;
+        if ( ready < producer->buffers && PRODUCER_LOAD(producer->consumer_waiting) ) break;
+        pthread_cond_wait(&producer->space_ready, &producer->mutex);
+      }
+      PRODUCER_STORE(producer->producer_waiting, 0);
+      pthread_mutex_unlock(&producer->mutex);
+      continue;
+    }
+
+    data = producer->slot[produced % producer->buffers];
+    rc = fill_producer_buffer(fips_state, data);
+    if ( rc ) {
+      fprintf(stderr, "ERROR: producer_thread: Failed to fill the buffer, the producer has stopped.\n");
+      PRODUCER_STORE(producer->failed, 1);
+    }
+    //Only buffers with some data are published
+    if ( data->valid_data_size ) PRODUCER_STORE(producer->produced, ++produced);
+
+    if ( PRODUCER_LOAD(producer->consumer_waiting) ) {
+      pthread_mutex_lock(&producer->mutex);
+      pthread_cond_signal(&producer->data_ready);
+      pthread_mutex_unlock(&producer->mutex);
+    }
+    if ( rc ) break;
+  }
+  return NULL;
+}
+//}}}
+
+//{{{ static rng_buf_type* producer_buffer ( csprng_producer_type* producer, unsigned int ahead, int wait )
+/*
+ * Ready buffer number ahead counted from the oldest one. With wait == 0 returns NULL when it is not ready yet,
+ * otherwise waits for it. Returns NULL when the producer has failed before filling it
+ */
+static rng_buf_type* producer_buffer ( csprng_producer_type* producer, unsigned int ahead, int wait )
+{
+  uint64_t index = producer->consumed + ahead;
+
+  if ( PRODUCER_LOAD(producer->produced) <= index ) {
+    if ( ! wait ) return NULL;
+    pthread_mutex_lock(&producer->mutex);
+    PRODUCER_STORE(producer->consumer_waiting, 1);
+    if ( PRODUCER_LOAD(producer->producer_waiting) ) pthread_cond_signal(&producer->space_ready);
+    while ( PRODUCER_LOAD(producer->produced) <= index && ! PRODUCER_LOAD(producer->failed) ) {
+      pthread_cond_wait(&producer->data_ready, &producer->mutex);
+    }
+    PRODUCER_STORE(producer->consumer_waiting, 0);
+    pthread_mutex_unlock(&producer->mutex);
+    if ( PRODUCER_LOAD(producer->produced) <= index ) return NULL;
+  }
+  return producer->slot[index % producer->buffers];
+}
+//}}}
+
+//{{{ static void producer_consume ( csprng_producer_type* producer, unsigned int size )
+/*
+ * Wipe size bytes from the oldest ready buffer. Empty buffer is given back to the producer
+ */
+static void producer_consume ( csprng_producer_type* producer, unsigned int size )
+{
+  rng_buf_type* data = producer->slot[producer->consumed % producer->buffers];
+
+  memset(data->buf_start, 0, size);
+  consume_buffer(data, size);
+  if ( data->valid_data_size > 0 ) return;
+
+  PRODUCER_STORE(producer->consumed, producer->consumed + 1);
+  if ( PRODUCER_LOAD(producer->producer_waiting) && PRODUCER_LOAD(producer->produced) - producer->consumed <= producer->low_watermark ) {
+    pthread_mutex_lock(&producer->mutex);
+    pthread_cond_signal(&producer->space_ready);
+    pthread_mutex_unlock(&producer->mutex);
+  }
+}
+//}}}
+
+//{{{ static int producer_borrow ( fips_state_type* fips_state, unsigned int min, unsigned int max, const unsigned char** ptr, unsigned int* len )
+/*
+ * Lend contiguous data from the oldest ready buffer. When it has less than min bytes left,
+ * they are moved to the headroom of the next buffer. Returns 0 on success, 1 on error
+ */
+static int producer_borrow ( fips_state_type* fips_state, unsigned int min, unsigned int max, const unsigned char** ptr, unsigned int* len )
+{
+  csprng_producer_type* producer = fips_state->producer;
+  rng_buf_type* data;
+  rng_buf_type* next;
+  unsigned int tail;
+
+  data = producer_buffer(producer, 0, 1);
+  if ( data != NULL && data->valid_data_size < min ) {
+    next = producer_buffer(producer, 1, 1);
+    if ( next != NULL ) {
+      tail = data->valid_data_size;
+      memcpy(next->buf_start - tail, data->buf_start, tail);
+      next->buf_start -= tail;
+      next->valid_data_size += tail;
+      producer_consume(producer, tail);
+    }
+    data = next;
+  }
+
+  if ( data == NULL || data->valid_data_size < min ) {
+    fprintf ( stderr, "ERROR: csprng_borrow: Failed to get %u Bytes from the background producer.\n", min);
+    return 1;
+  }
+
+  *ptr = data->buf_start;
+  *len = ( data->valid_data_size < max ) ? data->valid_data_size : max;
+  producer->borrowed_bytes = *len;
+  return 0;
+}
+//}}}
+
+//{{{ static int producer_borrow_iov ( fips_state_type* fips_state, unsigned int min, unsigned int max, struct iovec* iov, int iovcnt )
+/*
+ * Lend the ready buffers as segments. Waits only until min bytes are available.
+ * Returns the number of segments, -1 on error
+ */
+static int producer_borrow_iov ( fips_state_type* fips_state, unsigned int min, unsigned int max, struct iovec* iov, int iovcnt )
+{
+  csprng_producer_type* producer = fips_state->producer;
+  rng_buf_type* data;
+  unsigned int total = 0;
+  unsigned int size;
+  const unsigned char* ptr;
+  int count = 0;
+
+  while ( count < iovcnt && total < max ) {
+    data = producer_buffer(producer, count, total < min);
+    if ( data == NULL ) break;
+    size = ( data->valid_data_size < max - total ) ? data->valid_data_size : max - total;
+    iov[count].iov_base = data->buf_start;
+    iov[count].iov_len = size;
+    total += size;
+    ++count;
+  }
+
+  if ( total < min ) {
+    if ( producer_borrow(fips_state, min, max, &ptr, &size) ) return -1;
+    iov[0].iov_base = (void*) ptr;
+    iov[0].iov_len = size;
+    return 1;
+  }
+
+  producer->borrowed_bytes = total;
+  return count;
+}
+//}}}
+
+//{{{ static void producer_release ( csprng_producer_type* producer )
+static void producer_release ( csprng_producer_type* producer )
+{
+  rng_buf_type* data;
+  unsigned int size;
+
+  while ( producer->borrowed_bytes > 0 ) {
+    data = producer->slot[producer->consumed % producer->buffers];
+    size = ( data->valid_data_size < producer->borrowed_bytes ) ? data->valid_data_size : producer->borrowed_bytes;
+    producer_consume(producer, size);
+    producer->borrowed_bytes -= size;
+  }
+}
+//}}}
+//}}}
+
+//{{{ int csprng_borrow (fips_state_type *fips_state, unsigned int min, unsigned int max, const unsigned char **ptr, unsigned int *len)
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_borrow
+ *  Description:  Lend contiguous FIPS approved data. Returns 0 on success, 1 on error
+ * =====================================================================================
+ */
+int csprng_borrow (fips_state_type *fips_state, unsigned int min, unsigned int max, const unsigned char **ptr, unsigned int *len)
+{
+  if ( csprng_forked(fips_state->csprng_state, "csprng_borrow") ) return 1;
+  if ( fips_state->producer == NULL ) return borrow_raw_buf(fips_state, min, max, ptr, len);
+
+  if ( fips_state->producer->borrowed_bytes ) {
+    fprintf ( stderr, "ERROR: csprng_borrow: %u Bytes are already borrowed. Call csprng_release first.\n", fips_state->producer->borrowed_bytes);
+    return 1;
+  }
+  if ( min == 0 || min > max || min > fips_state->producer->headroom ) {
+    fprintf ( stderr, "ERROR: csprng_borrow: Invalid request min %u, max %u Bytes. Valid range is 1 <= min <= max and min <= %d.\n",
+        min, max, fips_state->max_bytes_to_get_from_raw_buf);
+    return 1;
+  }
+  return producer_borrow(fips_state, min, max, ptr, len);
+} /* -----  end of function csprng_borrow  ----- */
+//}}}
+
+//{{{ int csprng_borrow_iov (fips_state_type *fips_state, unsigned int min, unsigned int max, struct iovec *iov, int iovcnt)
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_borrow_iov
+ *  Description:  Lend FIPS approved data as segments. Returns the number of segments, -1 on error
+ * =====================================================================================
+ */
+int csprng_borrow_iov (fips_state_type *fips_state, unsigned int min, unsigned int max, struct iovec *iov, int iovcnt)
+{
+  if ( iovcnt < 1 ) {
+    fprintf ( stderr, "ERROR: csprng_borrow_iov: At least one segment is needed, got %d.\n", iovcnt);
+    return -1;
+  }
+  if ( csprng_forked(fips_state->csprng_state, "csprng_borrow_iov") ) return -1;
+  if ( fips_state->producer == NULL ) return borrow_raw_buf_iov(fips_state, min, max, iov, iovcnt);
+
+  if ( fips_state->producer->borrowed_bytes ) {
+    fprintf ( stderr, "ERROR: csprng_borrow_iov: %u Bytes are already borrowed. Call csprng_release first.\n", fips_state->producer->borrowed_bytes);
+    return -1;
+  }
+  if ( min == 0 || min > max || min > fips_state->producer->headroom ) {
+    fprintf ( stderr, "ERROR: csprng_borrow_iov: Invalid request min %u, max %u Bytes. Valid range is 1 <= min <= max and min <= %d.\n",
+        min, max, fips_state->max_bytes_to_get_from_raw_buf);
+    return -1;
+  }
+  return producer_borrow_iov(fips_state, min, max, iov, iovcnt);
+} /* -----  end of function csprng_borrow_iov  ----- */
+//}}}
+
+//{{{ int csprng_release (fips_state_type *fips_state)
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_release
+ *  Description:  Wipe the borrowed data and give the space back. Returns 0 on success, 1 on error
+ * =====================================================================================
+ */
+int csprng_release (fips_state_type *fips_state)
+{
+  if ( csprng_forked(fips_state->csprng_state, "csprng_release") ) return 1;
+  if ( fips_state->producer != NULL ) {
+    if ( fips_state->producer->borrowed_bytes == 0 ) {
+      fprintf ( stderr, "ERROR: csprng_release: No data are borrowed.\n");
+      return 1;
+    }
+    producer_release(fips_state->producer);
+    return 0;
+  }
+
+  if ( fips_state->borrowed_bytes == 0 ) {
+    fprintf ( stderr, "ERROR: csprng_release: No data are borrowed.\n");
+    return 1;
+  }
+  release_raw_buf(fips_state);
+  return 0;
+} /* -----  end of function csprng_release  ----- */
+//}}}
+
+//{{{ int fips_approved_csprng_start_producer (fips_state_type *fips_state, int buffers, int low_watermark, int high_watermark)
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  fips_approved_csprng_start_producer
+ *  Description:  Start the background producer thread. Returns 0 on success, 1 on error
+ * =====================================================================================
+ */
+int fips_approved_csprng_start_producer (fips_state_type *fips_state, int buffers, int low_watermark, int high_watermark)
+{
+  csprng_producer_type* producer;
+  rng_state_type rng_state;
+  sigset_t all_signals, old_signals;
+  int i, rc;
+
+  if ( csprng_forked(fips_state->csprng_state, "fips_approved_csprng_start_producer") ) return 1;
+  if ( fips_state->producer != NULL ) {
+    fprintf(stderr, "ERROR: fips_approved_csprng_start_producer: Producer is already running.\n");
+    return 1;
+  }
+  if ( fips_state->borrowed_bytes ) {
+    fprintf(stderr, "ERROR: fips_approved_csprng_start_producer: Data are borrowed. Call csprng_release first.\n");
+    return 1;
+  }
+  if ( buffers < 2 || buffers > CSPRNG_PRODUCER_MAX_BUFFERS || low_watermark < 0 || low_watermark >= high_watermark || high_watermark > buffers ) {
+    fprintf(stderr, "ERROR: fips_approved_csprng_start_producer: Expecting 2 <= buffers <= %d and 0 <= low_watermark < high_watermark <= buffers. "
+        "Got buffers %d, low_watermark %d, high_watermark %d.\n", CSPRNG_PRODUCER_MAX_BUFFERS, buffers, low_watermark, high_watermark);
+    return 1;
+  }
+
+  producer = (csprng_producer_type*) calloc(1, sizeof(csprng_producer_type));
+  if ( producer == NULL ) {
+    fprintf(stderr, "ERROR: Dynamic memory allocation has failed for csprng_producer_type variable. Reported error: %s\n", strerror(errno));
+    return 1;
+  }
+  producer->slot = (rng_buf_type**) calloc(buffers, sizeof(rng_buf_type*));
+  if ( producer->slot == NULL ) {
+    fprintf(stderr, "ERROR: Dynamic memory allocation has failed for %d producer buffers. Reported error: %s\n", buffers, strerror(errno));
+    free(producer);
+    return 1;
+  }
+  producer->buffers = buffers;
+  producer->low_watermark = low_watermark;
+  producer->high_watermark = high_watermark;
+  producer->headroom = fips_state->max_bytes_to_get_from_raw_buf;
+
+  memset(&rng_state, 0, sizeof(rng_state) );
+  for ( i = 0; i < buffers; ++i ) {
+    producer->slot[i] = init_buffer( NONE, rng_state, NULL, NULL, producer->headroom + CSPRNG_PRODUCER_BUFFER_SIZE, "PRODUCER BUF");
+    if ( producer->slot[i] == NULL ) {
+      fprintf(stderr, "ERROR: init_buffer for the producer buffer %d has failed.\n", i);
+      while ( i-- > 0 ) destroy_buffer(producer->slot[i]);
+      free(producer->slot);
+      free(producer);
+      return 1;
+    }
+  }
+
+  pthread_mutex_init(&producer->mutex, NULL);
+  pthread_cond_init(&producer->data_ready, NULL);
+  pthread_cond_init(&producer->space_ready, NULL);
+  fips_state->producer = producer;
+
+  //Signals are handled by the application threads
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  rc = pthread_create(&producer->thread, NULL, producer_thread, fips_state);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+  if ( rc ) {
+    fprintf(stderr, "ERROR: fips_approved_csprng_start_producer: pthread_create has failed: %s\n", strerror(rc));
+    fips_state->producer = NULL;
+    pthread_cond_destroy(&producer->space_ready);
+    pthread_cond_destroy(&producer->data_ready);
+    pthread_mutex_destroy(&producer->mutex);
+    for ( i = 0; i < buffers; ++i ) destroy_buffer(producer->slot[i]);
+    free(producer->slot);
+    free(producer);
+    return 1;
+  }
+  return 0;
+} /* -----  end of function fips_approved_csprng_start_producer  ----- */
+//}}}
+
+//{{{ int fips_approved_csprng_stop_producer (fips_state_type *fips_state)
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  fips_approved_csprng_stop_producer
+ *  Description:  Stop the background producer thread. Buffers which were not consumed are wiped.
+ *                Returns 0 on success, 1 on error
+ * =====================================================================================
+ */
+int fips_approved_csprng_stop_producer (fips_state_type *fips_state)
+{
+  csprng_producer_type* producer = fips_state->producer;
+  unsigned int i;
+
+  if ( csprng_forked(fips_state->csprng_state, "fips_approved_csprng_stop_producer") ) return 1;
+  if ( producer == NULL ) {
+    fprintf(stderr, "ERROR: fips_approved_csprng_stop_producer: Producer is not running.\n");
+    return 1;
+  }
+
+  pthread_mutex_lock(&producer->mutex);
+  PRODUCER_STORE(producer->stop, 1);
+  pthread_cond_signal(&producer->space_ready);
+  pthread_mutex_unlock(&producer->mutex);
+  pthread_join(producer->thread, NULL);
+
+  fips_state->producer = NULL;
+  pthread_cond_destroy(&producer->space_ready);
+  pthread_cond_destroy(&producer->data_ready);
+  pthread_mutex_destroy(&producer->mutex);
+  for ( i = 0; i < producer->buffers; ++i ) destroy_buffer(producer->slot[i]);
+  free(producer->slot);
+  free(producer);
+  return 0;
+} /* -----  end of function fips_approved_csprng_stop_producer  ----- */
+//}}}
+
+//{{{ static unsigned int generate_direct ( fips_state_type* fips_state, unsigned char* output_buffer, unsigned int output_size )
+/*
+ * Without FIPS tests the csprng_generate requests which fit whole are written straight to the output.
+ * raw_buf serves only the data generated before and the tail shorter than the next request,
+ * so the output is the same as through raw_buf. Returns the number of bytes written
+ */
+static unsigned int generate_direct ( fips_state_type* fips_state, unsigned char* output_buffer, unsigned int output_size )
+{
+  rng_buf_type* data = fips_state->raw_buf;
+  const unsigned char* raw_data;
+  unsigned long int bytes_to_generate;
+  unsigned int bytes_written = 0;
+  uint8_t reseed;
+
+  //csprng_borrow rejects max 0
+  if ( output_size == 0 ) return 0;
+
+  if ( data->valid_data_size > 0 ) {
+    if ( csprng_borrow(fips_state, 1, output_size, &raw_data, &bytes_written) ) return 0;
+    memcpy(output_buffer, raw_data, bytes_written);
+    csprng_release(fips_state);
+    if ( bytes_written == output_size ) return bytes_written;
+  }
+
+  if ( data->eof ) return bytes_written;
+  if ( fips_state->remaining_bytes_to_reseed == 0 ) start_reseed_interval(fips_state);
+  plan_csprng_request(fips_state, &bytes_to_generate, &reseed);
+
+  while ( bytes_to_generate > 0 && output_size - bytes_written >= bytes_to_generate ) {
+    if ( run_csprng_request(fips_state, output_buffer + bytes_written, bytes_to_generate, reseed) ) {
+      memset(output_buffer + bytes_written, 0, bytes_to_generate);
+      data->eof = 1;
+      break;
+    }
+    //Accounted as if the data went through raw_buf
+    data->bytes_in += bytes_to_generate;
+    data->bytes_out += bytes_to_generate;
+    bytes_written += bytes_to_generate;
+    plan_csprng_request(fips_state, &bytes_to_generate, &reseed);
+  }
+  return bytes_written;
+}
+//}}}
+
 //{{{ fips_approved_csprng_generate
 /* 
  * ===  FUNCTION  ======================================================================
@@ -1750,91 +3111,94 @@ get_data_from_stdin_buffer ( fips_state_type* fips_state, int size)
 int fips_approved_csprng_generate (fips_state_type *fips_state, unsigned char *output_buffer, unsigned int output_size)
 {
   const unsigned char* raw_data;
-  int fips_result=0;
-  int bytes_to_put_into_buffer;
-  int bytes_written=0;
-  int remaining_bytes;
-  int requested_bytes;
-
-//Do we have some data in the buffer??
-  if ( fips_state->out_buf->valid_data_size > 0 ) {
-    if ( fips_state->out_buf->valid_data_size < output_size ) {
-      memcpy(output_buffer, fips_state->out_buf->buf_start, fips_state->out_buf->valid_data_size);
-      bytes_written += fips_state->out_buf->valid_data_size;
-      output_buffer += fips_state->out_buf->valid_data_size;
-      fips_state->out_buf->buf_start = fips_state->out_buf->buf;
-      fips_state->out_buf->valid_data_size = 0;
-    } else if ( fips_state->out_buf->valid_data_size == output_size) {
-      memcpy(output_buffer, fips_state->out_buf->buf_start, output_size);
-      fips_state->out_buf->buf_start = fips_state->out_buf->buf;
-      fips_state->out_buf->valid_data_size = 0;
-      //fprintf(stderr, "#fips_approved_csprng_generate: returned bytes %d, remaining bytes in the buffer %d\n", output_size, fips_state->out_buf.valid_data_size);
-      return output_size;
-    } else {
-      memcpy(output_buffer, fips_state->out_buf->buf_start, output_size);
-      fips_state->out_buf->buf_start += output_size;
-      fips_state->out_buf->valid_data_size -= output_size;
-      //fprintf(stderr, "#fips_approved_csprng_generate: returned bytes %d, remaining bytes in the buffer %d\n", output_size, fips_state->out_buf.valid_data_size);
-      return output_size;
+  unsigned int bytes_written=0;
+  unsigned int remaining_bytes;
+  unsigned int requested_bytes;
+  unsigned int len;
+
+  if ( csprng_forked(fips_state->csprng_state, "fips_approved_csprng_generate") ) return 0;
+  if ( ! fips_state->perform_fips_test && fips_state->producer == NULL && fips_state->borrowed_bytes == 0 ) {
+    bytes_written = generate_direct(fips_state, output_buffer, output_size);
+  }
+
+  while ( bytes_written < output_size ) {
+    remaining_bytes = output_size - bytes_written;
+    requested_bytes = ( remaining_bytes > (unsigned int) fips_state->max_bytes_to_get_from_raw_buf ) ?
+      (unsigned int) fips_state->max_bytes_to_get_from_raw_buf : remaining_bytes;
+
+    if ( csprng_borrow(fips_state, requested_bytes, remaining_bytes, &raw_data, &len) ) {
+      //fprintf(stderr, "#fips_approved_csprng_generate: returned bytes %u\n", bytes_written);
+      return bytes_written;
     }
+    memcpy(output_buffer + bytes_written, raw_data, len);
+    bytes_written += len;
+    csprng_release(fips_state);
   }
+  //fprintf(stderr, "#fips_approved_csprng_generate: returned bytes %u, remaining bytes in the buffer %u\n", output_size, fips_state->raw_buf->valid_data_size);
+  return output_size;
+} /* -----  end of function fips_approved_csprng_generate  ----- */
+//}}}
 
-  remaining_bytes = output_size - bytes_written;
-  while ( (unsigned int) ( bytes_written ) < output_size ) {
+//{{{ int csprng_generate_batch (fips_state_type *fips_state, struct iovec *reqs, int n)
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_generate_batch
+ *  Description:  Fill n output buffers with FIPS approved data, borrowing a region for
+ *                as many of them as it holds. Returns the number of buffers filled
+ * =====================================================================================
+ */
+int csprng_generate_batch (fips_state_type *fips_state, struct iovec *reqs, int n)
+{
+  const unsigned char* raw_data;
+  unsigned char* dest;
+  uint64_t remaining_bytes = 0;       //Bytes still to be written to all buffers
+  unsigned int requested_bytes;
+  unsigned int len;
+  unsigned int used;
+  size_t done = 0;                    //Bytes already written to reqs[i]
+  size_t size;
+  int i;
 
-    if ( fips_state->perform_fips_test ) {
-      requested_bytes = FIPS_RNG_BUFFER_SIZE;
-      raw_data = get_data_from_csprng_buffer(fips_state, requested_bytes);
-      //raw_data = get_data_from_stdin_buffer(fips_state, requested_bytes);
-      if ( raw_data == NULL) {
-        //fprintf(stderr, "#fips_approved_csprng_generate: returned bytes %d, remaining bytes in the buffer %d\n", bytes_written, fips_state->out_buf.valid_data_size);
-        return(bytes_written);
-      }
-      //fips_result = fips_run_rng_test_dummy(&fips_state->fips_ctx, raw_data);
-      fips_result = fips_run_rng_test(&fips_state->fips_ctx, raw_data);
-    } else {
-      //We will eliminate need to put any data to out_buf
-      if ( remaining_bytes > fips_state->max_bytes_to_get_from_raw_buf) {
-        requested_bytes = fips_state->max_bytes_to_get_from_raw_buf;
-      } else {
-        requested_bytes = remaining_bytes;
-      }
-      raw_data = get_data_from_csprng_buffer(fips_state, requested_bytes);
-      if ( raw_data == NULL) {
-        //fprintf(stderr, "#fips_approved_csprng_generate: returned bytes %d, remaining bytes in the buffer %d\n", bytes_written, fips_state->out_buf.valid_data_size);
-        return(bytes_written);
-      }
+  if ( n < 0 ) {
+    fprintf ( stderr, "ERROR: csprng_generate_batch: Invalid number of requests %d.\n", n);
+    return 0;
+  }
+  if ( csprng_forked(fips_state->csprng_state, "csprng_generate_batch") ) return 0;
+  for ( i = 0; i < n; ++i ) remaining_bytes += reqs[i].iov_len;
+
+  i = 0;
+  while ( i < n && reqs[i].iov_len == 0 ) ++i;
+  while ( i < n ) {
+    //One region serves all remaining requests if raw_buf holds them, the current one is filled at least up to the region size
+    requested_bytes = ( reqs[i].iov_len - done > (size_t) fips_state->max_bytes_to_get_from_raw_buf ) ?
+      (unsigned int) fips_state->max_bytes_to_get_from_raw_buf : (unsigned int) ( reqs[i].iov_len - done );
+    if ( csprng_borrow(fips_state, requested_bytes, ( remaining_bytes > UINT_MAX ) ? UINT_MAX : (unsigned int) remaining_bytes,
+          &raw_data, &len) ) {
+      //Partially filled request is not returned
+      memset(reqs[i].iov_base, 0, done);
+      return i;
     }
-        
-   
-    if ( !fips_state->perform_fips_test || fips_result == 0) {
-
-      //Check if we can copy data directly to output_buffer, without need to write to buffer fips_state->out_buf
-      if ( remaining_bytes >= requested_bytes) {
-        memcpy(output_buffer, raw_data, requested_bytes);
-        bytes_written += requested_bytes;
-        output_buffer += requested_bytes;
-        remaining_bytes = output_size - bytes_written;
-      } else {
-        memcpy(output_buffer, raw_data, remaining_bytes);
-        raw_data += remaining_bytes;
-        //output_buffer += remaining_bytes;
-        //bytes_written = output_size;
-        //remaining_bytes = 0;
-        bytes_to_put_into_buffer = requested_bytes - remaining_bytes;
-        assert(fips_state->out_buf->valid_data_size == 0);
-        assert( ( int ) fips_state->out_buf->total_size - ( int ) fips_state->out_buf->valid_data_size >= bytes_to_put_into_buffer);
-        memcpy(fips_state->out_buf->buf_start + fips_state->out_buf->valid_data_size, raw_data, bytes_to_put_into_buffer);
-        fips_state->out_buf->valid_data_size += bytes_to_put_into_buffer;
-  
-        //fprintf(stderr, "#fips_approved_csprng_generate: returned bytes %d, remaining bytes in the buffer %d\n", output_size, fips_state->out_buf.valid_data_size);
-        return output_size;
+
+    used = 0;
+    while ( used < len ) {
+      //The data behind the region are usually the next region
+      __builtin_prefetch(raw_data + used + CSPRNG_BATCH_PREFETCH);
+      dest = (unsigned char*) reqs[i].iov_base + done;
+      size = reqs[i].iov_len - done;
+      if ( size > len - used ) size = len - used;
+      memcpy(dest, raw_data + used, size);
+      used += size;
+      done += size;
+      if ( done == reqs[i].iov_len ) {
+        done = 0;
+        do ++i; while ( i < n && reqs[i].iov_len == 0 );
       }
     }
+    remaining_bytes -= len;
+    csprng_release(fips_state);
   }
-  //fprintf(stderr, "#fips_approved_csprng_generate: returned bytes %d, remaining bytes in the buffer %d\n", output_size, fips_state->out_buf.valid_data_size);
-  return output_size;
-} /* -----  end of function fips_approved_csprng_generate  ----- */
+  return n;
+} /* -----  end of function csprng_generate_batch  ----- */
 //}}}
 
 //{{{ int fips_approved_csprng_destroy (fips_state_type *fips_state)
@@ -1843,14 +3207,19 @@ int fips_approved_csprng_destroy (fips_state_type *fips_state)
   int return_value=0;   //o = OK, 1 =ERROR
 
   if ( fips_state == NULL ) return 1;
+  if ( fips_state->csprng_state != NULL && csprng_forked(fips_state->csprng_state, "fips_approved_csprng_destroy") ) return 1;
+
+  if ( fips_state->producer != NULL ) {
+    if ( fips_approved_csprng_stop_producer(fips_state) ) return_value = 1;
+  }
 
   //if ( fips_state->perform_fips_test ) {
   //  fprintf(stderr, "%s", dump_fips_statistics( &fips_state->fips_ctx.fips_statistics ) );
   //}
 
 
-  if ( fips_state->out_buf != NULL ) {
-    destroy_buffer( fips_state->out_buf);
+  if ( fips_state->fips_pool != NULL ) {
+    fips_pool_destroy(fips_state->fips_pool);
   }
 
   if ( fips_state->raw_buf != NULL ) {
@@ -1878,12 +3247,16 @@ int fips_approved_csprng_destroy (fips_state_type *fips_state)
 int fips_approved_csprng_statistics (fips_state_type *fips_state) 
 {
   int return_value=0;   //o = OK, 1 =ERROR
+  char arena_status[256];
 
   if ( fips_state == NULL ) return 1;
 
   fprintf(stderr,"Entropy buffer: total bytes generated %20"PRIu64", total bytes sent out %20"PRIu64"\n", 
       fips_state->csprng_state->entropy_buf->bytes_in, fips_state->csprng_state->entropy_buf->bytes_out);
 
+  print_buffer_latency(fips_state->csprng_state->entropy_buf, "Entropy buffer");
+  print_buffer_health(fips_state->csprng_state->entropy_buf, "Entropy buffer");
+
   fprintf(stderr,"csprng_generate: total bytes of entropy used to reseed CSRNG %20"PRIu64"\n", 
       fips_state->csprng_state->entropy_tot);
 
@@ -1891,6 +3264,8 @@ int fips_approved_csprng_statistics (fips_state_type *fips_state)
    if ( fips_state->csprng_state->additional_input_length_generate ) {
      fprintf(stderr,"Additional input buffer: total bytes generated %20"PRIu64", total bytes sent out %20"PRIu64"\n", 
          fips_state->csprng_state->add_input_buf->bytes_in, fips_state->csprng_state->add_input_buf->bytes_out);
+     print_buffer_latency(fips_state->csprng_state->add_input_buf, "Additional input buffer");
+     print_buffer_health(fips_state->csprng_state->add_input_buf, "Additional input buffer");
      fprintf(stderr,"csprng_generate: total bytes of additional input used to reseed CSRNG %20"PRIu64"\n", 
          fips_state->csprng_state->additional_input_reseed_tot);
      fprintf(stderr,"csprng_generate: total bytes of additional input used for generate process of CSRNG %20"PRIu64"\n", 
@@ -1900,6 +3275,9 @@ int fips_approved_csprng_statistics (fips_state_type *fips_state)
 
    }
 
+  secure_arena_status(arena_status, sizeof(arena_status));
+  fprintf(stderr,"%s\n", arena_status);
+
   return return_value;
 
 }
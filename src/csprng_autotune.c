@@ -0,0 +1,413 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Buffer geometry tuned to the host by a short measurement at startup
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#define _GNU_SOURCE                                   //F_SETPIPE_SZ
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <csprng/csprng.h>
+
+#define AUTOTUNE_MAX_CANDIDATES 8
+#define AUTOTUNE_IOV_COUNT 16
+#define AUTOTUNE_KEY_SIZE 512
+//A candidate has to be faster by this factor to replace a smaller one
+#define AUTOTUNE_MIN_GAIN 1.03
+
+typedef struct {
+  long l2;                                            //Bytes, 0 => unknown
+  long l3;
+  long cpus;
+  char model[128];
+} autotune_host_type;
+
+//{{{ static long cache_size ( int level )
+/* Size of the unified cache of level in bytes. sysconf first, then sysfs. 0 => unknown */
+static long cache_size ( int level )
+{
+  char path[128], type[32];
+  long size = 0, value;
+  char unit;
+  FILE* f;
+  int i, l;
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  size = sysconf(level == 2 ? _SC_LEVEL2_CACHE_SIZE : _SC_LEVEL3_CACHE_SIZE);
+  if ( size > 0 ) return size;
+#endif
+  for ( i = 0; i < 8; ++i ) {
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+    f = fopen(path, "r");
+    if ( f == NULL ) break;
+    l = ( fscanf(f, "%d", &l) == 1 ) ? l : 0;
+    fclose(f);
+    if ( l != level ) continue;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+    f = fopen(path, "r");
+    if ( f == NULL || fscanf(f, "%31s", type) != 1 || strcmp(type, "Instruction") == 0 ) {
+      if ( f != NULL ) fclose(f);
+      continue;
+    }
+    fclose(f);
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+    f = fopen(path, "r");
+    if ( f == NULL ) continue;
+    unit = 'K';
+    if ( fscanf(f, "%ld%c", &value, &unit) >= 1 ) size = ( unit == 'M' ) ? value << 20 : ( unit == 'K' ) ? value << 10 : value;
+    fclose(f);
+  }
+  return size;
+}
+//}}}
+
+//{{{ static void detect_host ( autotune_host_type* host )
+static void detect_host ( autotune_host_type* host )
+{
+  char line[256];
+  char* p;
+  FILE* f;
+  int i;
+
+  memset(host, 0, sizeof(autotune_host_type));
+  host->l2 = cache_size(2);
+  host->l3 = cache_size(3);
+  host->cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if ( host->cpus < 1 ) host->cpus = 1;
+  strcpy(host->model, "unknown");
+
+  f = fopen("/proc/cpuinfo", "r");
+  if ( f == NULL ) return;
+  while ( fgets(line, sizeof(line), f) != NULL ) {
+    if ( strncmp(line, "model name", 10) != 0 || ( p = strchr(line, ':') ) == NULL ) continue;
+    for ( ++p; *p == ' '; ++p );
+    //The profile key has no white space
+    for ( i = 0; p[i] != '\0' && p[i] != '\n' && i < (int) sizeof(host->model) - 1; ++i ) host->model[i] = ( p[i] == ' ' || p[i] == '\t' ) ? '_' : p[i];
+    host->model[i] = '\0';
+    break;
+  }
+  fclose(f);
+}
+//}}}
+
+//{{{ static void profile_key ( ... )
+/* Host and everything in the mode which changes the cost of the buffers */
+static void profile_key ( char* key, const autotune_host_type* host, const mode_of_operation_type* mode, int perform_fips_test )
+{
+  snprintf(key, AUTOTUNE_KEY_SIZE, "cpu=%s;cpus=%ld;l2=%ld;l3=%ld;drbg=%s;hash=%d;keylen=%d;df=%d;threads=%d;lanes=%d;"
+      "fips=%d;blocks=%u;random_blocks=%d;entropy=%s;additional=%s;prefetch=%d",
+      host->model, host->cpus, host->l2, host->l3, drbg_mechanism_names[mode->drbg_mechanism], (int) mode->drbg_hash,
+      mode->aes_key_length, mode->use_df, mode->generate_threads, mode->ctr_drbg_lanes, perform_fips_test,
+      mode->max_number_of_csprng_blocks, mode->random_length_of_csprng_generated_bytes,
+      source_names[mode->entropy_source], source_names[mode->add_input_source], mode->prefetch_watermark);
+}
+//}}}
+
+//{{{ static int profile_read ( const char* profile, const char* key, unsigned int* raw_buf_size, unsigned int* source_buf_size )
+/* Last entry of key in profile. Returns 0 when found */
+static int profile_read ( const char* profile, const char* key, unsigned int* raw_buf_size, unsigned int* source_buf_size )
+{
+  char line[AUTOTUNE_KEY_SIZE + 128];
+  char* value;
+  unsigned int raw, source;
+  int found = 0;
+  FILE* f;
+
+  f = fopen(profile, "r");
+  if ( f == NULL ) return 1;
+  while ( fgets(line, sizeof(line), f) != NULL ) {
+    if ( line[0] == '#' || ( value = strchr(line, ' ') ) == NULL ) continue;
+    *value++ = '\0';
+    if ( strcmp(line, key) != 0 ) continue;
+    if ( sscanf(value, "raw_buf_size=%u source_buf_size=%u", &raw, &source) == 2 &&
+        raw <= CSPRNG_MAX_BUFFER_SIZE && source <= CSPRNG_MAX_BUFFER_SIZE ) {
+      *raw_buf_size = raw;
+      *source_buf_size = source;
+      found = 1;
+    }
+  }
+  fclose(f);
+  return found ? 0 : 1;
+}
+//}}}
+
+//{{{ static void profile_write ( const char* profile, const char* key, unsigned int raw_buf_size, unsigned int source_buf_size )
+static void profile_write ( const char* profile, const char* key, unsigned int raw_buf_size, unsigned int source_buf_size )
+{
+  struct stat st;
+  FILE* f;
+  int empty;
+
+  empty = ( stat(profile, &st) != 0 || st.st_size == 0 );
+  f = fopen(profile, "a");
+  if ( f == NULL ) {
+    fprintf(stderr, "WARNING: csprng_autotune: cannot open profile %s for writing. Reported error: %s\n", profile, strerror(errno));
+    return;
+  }
+  if ( empty ) fprintf(f, "# csprng buffer geometry, written by csprng_autotune. The last entry of a host and mode is used.\n");
+  fprintf(f, "%s raw_buf_size=%u source_buf_size=%u\n", key, raw_buf_size, source_buf_size);
+  if ( fclose(f) ) fprintf(stderr, "WARNING: csprng_autotune: cannot write profile %s. Reported error: %s\n", profile, strerror(errno));
+}
+//}}}
+
+//{{{ static void* drain_pipe ( void* arg )
+/* Reader of the measurement pipe, the stand-in for the consumer of the output */
+static void* drain_pipe ( void* arg )
+{
+  const int fd = *(int*) arg;
+  unsigned char buf[65536];
+
+  //Ends when the write end is closed
+  while ( read(fd, buf, sizeof(buf)) > 0 );
+  memset(buf, 0, sizeof(buf));
+  return NULL;
+}
+//}}}
+
+//{{{ static double elapsed_ms ( const struct timespec* start )
+static double elapsed_ms ( const struct timespec* start )
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double) ( now.tv_sec - start->tv_sec ) * 1.0e3 + (double) ( now.tv_nsec - start->tv_nsec ) * 1.0e-6;
+}
+//}}}
+
+//{{{ static double measure ( ... )
+/*
+ * Generate for run_ms into the pipe write_fd the way csprng-generate writes its output.
+ * Returns bytes/s, negative value on error. *raw_size and *source_size (when not NULL) get the real sizes of the buffers
+ */
+static double measure ( const mode_of_operation_type* mode, int perform_fips_test, int write_fd, double run_ms,
+    unsigned int* raw_size, unsigned int* source_size )
+{
+  struct iovec iov[AUTOTUNE_IOV_COUNT];
+  struct timespec start;
+  fips_state_type* fips_state;
+  unsigned long long total = 0;
+  double ms;
+  ssize_t rc;
+  int segments, i;
+
+  fips_state = fips_approved_csprng_initialize(perform_fips_test, 0, mode);
+  if ( fips_state == NULL ) return -1.0;
+  if ( fips_approved_csprng_instantiate(fips_state) ) {
+    fips_approved_csprng_destroy(fips_state);
+    return -1.0;
+  }
+  if ( raw_size != NULL ) *raw_size = fips_state->raw_buf->total_size;
+  if ( source_size != NULL ) *source_size = fips_state->csprng_state->entropy_buf->total_size;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  do {
+    segments = csprng_borrow_iov(fips_state, fips_state->max_bytes_to_get_from_raw_buf, UINT32_MAX, iov, AUTOTUNE_IOV_COUNT);
+    if ( segments < 0 ) break;
+    for ( i = 0; i < segments; ++i ) total += iov[i].iov_len;
+    //Partial writes are not resumed, the amount written is what counts
+    rc = writev(write_fd, iov, segments);
+    csprng_release(fips_state);
+    if ( rc < 0 ) {
+      segments = -1;
+      break;
+    }
+  } while ( ( ms = elapsed_ms(&start) ) < run_ms );
+  ms = elapsed_ms(&start);
+
+  fips_approved_csprng_destroy(fips_state);
+  if ( segments < 0 ) return -1.0;
+  return (double) total / ms * 1.0e3;
+}
+//}}}
+
+//{{{ static void measurement_mode ( mode_of_operation_type* mode, const mode_of_operation_type* mode_of_operation )
+/* Copy of mode_of_operation with the default buffers, which never reads the files, STDIN or the network of the caller */
+static void measurement_mode ( mode_of_operation_type* mode, const mode_of_operation_type* mode_of_operation )
+{
+  *mode = *mode_of_operation;
+  mode->raw_buf_size = 0;
+  mode->source_buf_size = 0;
+  if ( mode->entropy_source == EXTERNAL || mode->entropy_source == STDIN || mode->entropy_source == HTTP_RNG ) mode->entropy_source = MT_RNG;
+  if ( mode->add_input_source == EXTERNAL || mode->add_input_source == STDIN || mode->add_input_source == HTTP_RNG ) mode->add_input_source = MT_RNG;
+  mode->filename_for_entropy = NULL;
+  mode->filename_for_additional = NULL;
+}
+//}}}
+
+//{{{ static unsigned int default_raw_size ( const mode_of_operation_type* mode_of_operation, int perform_fips_test )
+/* Real size of the default raw buffer, 0 on error */
+static unsigned int default_raw_size ( const mode_of_operation_type* mode_of_operation, int perform_fips_test )
+{
+  mode_of_operation_type mode;
+  fips_state_type* fips_state;
+  unsigned int size;
+
+  measurement_mode(&mode, mode_of_operation);
+  fips_state = fips_approved_csprng_initialize(perform_fips_test, 0, &mode);
+  if ( fips_state == NULL ) return 0;
+  size = fips_state->raw_buf->total_size;
+  fips_approved_csprng_destroy(fips_state);
+  return size;
+}
+//}}}
+
+//{{{ static void tune_sink ( int sink_fd, unsigned int raw_buf_size )
+/* One write of the raw buffer should fit into the output pipe */
+static void tune_sink ( int sink_fd, unsigned int raw_buf_size )
+{
+#if defined(F_GETPIPE_SZ) && defined(F_SETPIPE_SZ)
+  struct stat st;
+  int capacity, wanted;
+
+  if ( sink_fd < 0 || fstat(sink_fd, &st) != 0 || ! S_ISFIFO(st.st_mode) ) return;
+  capacity = fcntl(sink_fd, F_GETPIPE_SZ);
+  if ( capacity < 0 || (unsigned int) capacity >= raw_buf_size ) return;
+  for ( wanted = capacity; (unsigned int) wanted < raw_buf_size; wanted *= 2 );
+  if ( fcntl(sink_fd, F_SETPIPE_SZ, wanted) < 0 ) {
+    fprintf(stderr, "csprng_autotune: output pipe capacity %d bytes, cannot raise it to %d bytes (see /proc/sys/fs/pipe-max-size)\n", capacity, wanted);
+  } else {
+    fprintf(stderr, "csprng_autotune: output pipe capacity %d -> %d bytes\n", capacity, fcntl(sink_fd, F_GETPIPE_SZ));
+  }
+#else
+  (void) sink_fd;
+  (void) raw_buf_size;
+#endif
+}
+//}}}
+
+//{{{ int csprng_autotune ( mode_of_operation_type* mode_of_operation, int perform_fips_test, const char* profile, int sink_fd )
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_autotune
+ *  Description:  Choose raw_buf_size and source_buf_size for this host
+ * =====================================================================================
+ */
+int csprng_autotune ( mode_of_operation_type* mode_of_operation, int perform_fips_test, const char* profile, int sink_fd )
+{
+  autotune_host_type host;
+  mode_of_operation_type mode;
+  pthread_t drain_thread;
+  char key[AUTOTUNE_KEY_SIZE];
+  unsigned int raw_candidate[AUTOTUNE_MAX_CANDIDATES], source_candidate[AUTOTUNE_MAX_CANDIDATES];
+  unsigned int raw_default, source_default, raw_best, source_best, size;
+  double rate, raw_rate[AUTOTUNE_MAX_CANDIDATES], source_rate[AUTOTUNE_MAX_CANDIDATES];
+  double best_rate, run_ms;
+  long budget;
+  int pipefd[2], raw_count, source_count, i, best;
+
+  detect_host(&host);
+  profile_key(key, &host, mode_of_operation, perform_fips_test);
+  if ( profile != NULL && profile_read(profile, key, &raw_best, &source_best) == 0 ) {
+    fprintf(stderr, "csprng_autotune: raw buffer %u bytes, source buffers %u bytes (0 => default), read from profile %s\n", raw_best, source_best, profile);
+    mode_of_operation->raw_buf_size = raw_best;
+    mode_of_operation->source_buf_size = source_best;
+    //0 stands for the default raw buffer, which the pipe has to hold as well
+    if ( raw_best == 0 && sink_fd >= 0 ) raw_best = default_raw_size(mode_of_operation, perform_fips_test);
+    tune_sink(sink_fd, raw_best);
+    return 0;
+  }
+
+  //Cache for the buffers of one generator: L2 if known, but no more than its share of L3. Half of it leaves room for the DRBG
+  budget = ( host.l2 > 0 ) ? host.l2 : 256 * 1024;
+  if ( host.l3 > 0 && host.l3 / host.cpus < budget ) budget = host.l3 / host.cpus;
+  budget /= 2;
+
+  measurement_mode(&mode, mode_of_operation);
+
+  if ( pipe(pipefd) ) {
+    fprintf(stderr, "ERROR: csprng_autotune: pipe has failed. Reported error: %s\n", strerror(errno));
+    return 1;
+  }
+  if ( pthread_create(&drain_thread, NULL, drain_pipe, &pipefd[0]) ) {
+    fprintf(stderr, "ERROR: csprng_autotune: pthread_create has failed.\n");
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return 1;
+  }
+
+  //Default geometry, then 2x, 4x, ... of the default raw buffer within the budget
+  run_ms = (double) CSPRNG_AUTOTUNE_MS / ( 2 * AUTOTUNE_MAX_CANDIDATES );
+  raw_rate[0] = measure(&mode, perform_fips_test, pipefd[1], run_ms, &raw_default, &source_default);
+  raw_candidate[0] = raw_default;
+  raw_count = 1;
+  for ( size = 2 * raw_default; raw_count < AUTOTUNE_MAX_CANDIDATES && raw_rate[0] >= 0.0 && size <= (unsigned long) budget && size <= CSPRNG_MAX_BUFFER_SIZE; size *= 2 ) {
+    mode.raw_buf_size = size;
+    raw_rate[raw_count] = measure(&mode, perform_fips_test, pipefd[1], run_ms, &raw_candidate[raw_count], NULL);
+    if ( raw_rate[raw_count] < 0.0 ) break;
+    ++raw_count;
+  }
+  best = 0;
+  for ( i = 1; i < raw_count; ++i ) if ( raw_rate[i] > raw_rate[best] * AUTOTUNE_MIN_GAIN ) best = i;
+  raw_best = raw_candidate[best];
+  best_rate = raw_rate[best];
+
+  //Source buffers: refill batches of 1x, 4x, 16x ... of the default. Measured with the chosen raw buffer
+  mode.raw_buf_size = raw_best;
+  source_candidate[0] = source_default;
+  source_rate[0] = best_rate;
+  source_count = 1;
+  for ( size = 4 * source_default; source_count < AUTOTUNE_MAX_CANDIDATES / 2 && best_rate >= 0.0 && size <= (unsigned long) budget / 2; size *= 4 ) {
+    mode.source_buf_size = size;
+    source_rate[source_count] = measure(&mode, perform_fips_test, pipefd[1], run_ms, NULL, &source_candidate[source_count]);
+    if ( source_rate[source_count] < 0.0 ) break;
+    ++source_count;
+  }
+  best = 0;
+  for ( i = 1; i < source_count; ++i ) if ( source_rate[i] > source_rate[best] * AUTOTUNE_MIN_GAIN ) best = i;
+  source_best = ( best == 0 ) ? 0 : source_candidate[best];
+  rate = source_rate[best];
+
+  close(pipefd[1]);
+  pthread_join(drain_thread, NULL);
+  close(pipefd[0]);
+
+  if ( raw_rate[0] < 0.0 ) {
+    fprintf(stderr, "ERROR: csprng_autotune: the generator has failed during the measurement.\n");
+    return 1;
+  }
+
+  fprintf(stderr, "csprng_autotune: L2 %ld KiB, L3 %ld KiB, %ld CPUs => %ld KiB of cache for the buffers\n",
+      host.l2 >> 10, host.l3 >> 10, host.cpus, budget >> 10);
+  fprintf(stderr, "csprng_autotune: raw buffer");
+  for ( i = 0; i < raw_count; ++i ) fprintf(stderr, " %u B: %.1f MiB/s%s", raw_candidate[i], raw_rate[i] / 1048576.0, i + 1 < raw_count ? "," : "\n");
+  fprintf(stderr, "csprng_autotune: source buffer");
+  for ( i = 0; i < source_count; ++i ) fprintf(stderr, " %u B: %.1f MiB/s%s", source_candidate[i], source_rate[i] / 1048576.0, i + 1 < source_count ? "," : "\n");
+  fprintf(stderr, "csprng_autotune: chosen raw buffer %u bytes, source buffers %u bytes%s, %.1f MiB/s\n",
+      raw_best, source_best ? source_best : source_default, source_best ? "" : " (default)", rate / 1048576.0);
+
+  mode_of_operation->raw_buf_size = ( raw_best == raw_default ) ? 0 : raw_best;
+  mode_of_operation->source_buf_size = source_best;
+  if ( profile != NULL ) profile_write(profile, key, mode_of_operation->raw_buf_size, mode_of_operation->source_buf_size);
+  tune_sink(sink_fd, raw_best);
+  return 0;
+}
+//}}}
@@ -0,0 +1,465 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Thread-local generators seeded from a shared root instance
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <csprng/csprng.h>
+#include "secure_arena.h"
+
+/* Generator of one thread. buf[pos] ... buf[valid-1] are validated bytes not served yet */
+typedef struct csprng_tls_type {
+  NIST_CTR_DRBG* drbg;
+  fips_ctx_t fips_ctx;                                //Used only when the root runs the FIPS tests
+  int perform_fips_test;                              //Settings of the root, copied when the instance is seeded
+  uint64_t reseed_interval;
+  uint64_t bytes_since_reseed;
+  unsigned int pos;
+  unsigned int valid;
+  struct csprng_tls_type* next;                       //All instances, guarded by csprng_tls_mutex
+  unsigned char* buf;                                 //CSPRNG_TLS_BUFFER_SIZE bytes from the secure arena, zeroed in a forked child
+} csprng_tls_type;
+
+//{{{ Shared state
+static pthread_mutex_t csprng_tls_mutex = PTHREAD_MUTEX_INITIALIZER; //Guards everything below except csprng_tls_generation
+static pthread_once_t csprng_tls_once = PTHREAD_ONCE_INIT;
+static fips_state_type* csprng_tls_root = NULL;
+static int csprng_tls_stale_root = 0;                 //Root belongs to the parent process, see csprng_tls_atfork_child
+static int csprng_tls_initialized = 0;
+static int csprng_tls_perform_fips_test;
+static mode_of_operation_type csprng_tls_mode;
+static pthread_key_t csprng_tls_key;                  //Created once, never deleted: threads free their instances on exit
+static int csprng_tls_key_created = 0;
+static csprng_tls_type* csprng_tls_list = NULL;
+static uint64_t csprng_tls_counter = 0;               //Instantiations, part of the personalization string
+/* Incremented in the child after fork and by csprng_tls_destroy with release semantics,
+ * the fast path reads it with acquire semantics and no lock */
+static unsigned int csprng_tls_generation = 1;
+static unsigned int csprng_tls_destroyed = 0;         //Calls of csprng_tls_destroy
+/* Only the owning thread frees its instance, except in the child after fork where the other threads are gone */
+static __thread csprng_tls_type* csprng_tls_instance = NULL;
+static __thread unsigned int csprng_tls_instance_generation = 0;   //csprng_tls_generation when the drbg was instantiated
+static __thread unsigned int csprng_tls_instance_destroyed = 0;    //csprng_tls_destroyed when the instance was created
+//}}}
+
+//{{{ static void csprng_tls_free ( csprng_tls_type* t )
+static void csprng_tls_free ( csprng_tls_type* t )
+{
+  if ( t->drbg != NULL ) nist_ctr_drbg_destroy(t->drbg);
+  secure_free(t->buf, CSPRNG_TLS_BUFFER_SIZE);
+  memset(t, 0, sizeof(csprng_tls_type));
+  free(t);
+}
+//}}}
+
+//{{{ static void csprng_tls_unlink ( csprng_tls_type* t )
+/* Remove t from csprng_tls_list. Called with csprng_tls_mutex held */
+static void csprng_tls_unlink ( csprng_tls_type* t )
+{
+  csprng_tls_type** p;
+
+  for ( p = &csprng_tls_list; *p != NULL; p = &(*p)->next ) {
+    if ( *p == t ) {
+      *p = t->next;
+      return;
+    }
+  }
+}
+//}}}
+
+//{{{ static void csprng_tls_thread_exit ( void* arg )
+/* Destructor of csprng_tls_key, runs when a thread with an instance exits */
+static void csprng_tls_thread_exit ( void* arg )
+{
+  csprng_tls_type* t = (csprng_tls_type*) arg;
+
+  pthread_mutex_lock(&csprng_tls_mutex);
+  csprng_tls_unlink(t);
+  pthread_mutex_unlock(&csprng_tls_mutex);
+  if ( csprng_tls_instance == t ) csprng_tls_instance = NULL;
+  csprng_tls_free(t);
+}
+//}}}
+
+//{{{ fork handlers
+static void csprng_tls_atfork_prepare ( void )
+{
+  pthread_mutex_lock(&csprng_tls_mutex);
+}
+
+static void csprng_tls_atfork_parent ( void )
+{
+  pthread_mutex_unlock(&csprng_tls_mutex);
+}
+
+/*
+ * Only the forking thread exists in the child. Instances of the other threads are freed, the instance
+ * of this thread is wiped and reinstantiated on its next use, or freed if csprng_tls_destroy has run.
+ * The root can't be used: its buffers are not inherited (MADV_DONTFORK) and its threads don't exist.
+ * It is left alone and a new root is created on the next use.
+ */
+static void csprng_tls_atfork_child ( void )
+{
+  csprng_tls_type* t;
+  csprng_tls_type* next;
+
+  pthread_mutex_init(&csprng_tls_mutex, NULL);
+  for ( t = csprng_tls_list; t != NULL; t = next ) {
+    next = t->next;
+    if ( t != csprng_tls_instance ) csprng_tls_free(t);
+  }
+  csprng_tls_list = csprng_tls_instance;
+  if ( csprng_tls_instance != NULL ) {
+    csprng_tls_instance->next = NULL;
+    memset(csprng_tls_instance->buf, 0, CSPRNG_TLS_BUFFER_SIZE);
+    csprng_tls_instance->pos = 0;
+    csprng_tls_instance->valid = 0;
+  }
+  if ( csprng_tls_root != NULL ) csprng_tls_stale_root = 1;
+  __atomic_add_fetch(&csprng_tls_generation, 1, __ATOMIC_RELEASE);
+}
+
+static void csprng_tls_register_atfork ( void )
+{
+  //The child handler frees instances, the arena has to be usable by then
+  secure_arena_default_initialize();
+  if ( pthread_atfork(csprng_tls_atfork_prepare, csprng_tls_atfork_parent, csprng_tls_atfork_child) ) {
+    fprintf(stderr, "WARNING: csprng_tls: pthread_atfork has failed. Child processes have to call csprng_tls_destroy and csprng_tls_initialize.\n");
+  }
+  if ( pthread_key_create(&csprng_tls_key, csprng_tls_thread_exit) == 0 ) csprng_tls_key_created = 1;
+}
+//}}}
+
+//{{{ static int csprng_tls_create_root ( void )
+/* Called with csprng_tls_mutex held. Returns 0 on success, 1 on error */
+static int csprng_tls_create_root ( void )
+{
+  csprng_tls_root = fips_approved_csprng_initialize(csprng_tls_perform_fips_test, 0, &csprng_tls_mode);
+  if ( csprng_tls_root == NULL ) {
+    fprintf(stderr, "ERROR: csprng_tls: fips_approved_csprng_initialize has failed.\n");
+    return 1;
+  }
+  if ( fips_approved_csprng_instantiate(csprng_tls_root) ) {
+    fips_approved_csprng_destroy(csprng_tls_root);
+    csprng_tls_root = NULL;
+    fprintf(stderr, "ERROR: csprng_tls: fips_approved_csprng_instantiate has failed.\n");
+    return 1;
+  }
+  csprng_tls_stale_root = 0;
+  return 0;
+}
+//}}}
+
+//{{{ static int csprng_tls_seed ( csprng_tls_type* t )
+/*
+ * Instantiate or reseed the DRBG of t with entropy from the root. Called with csprng_tls_mutex held.
+ * Returns 0 on success, 1 on error
+ */
+static int csprng_tls_seed ( csprng_tls_type* t )
+{
+  unsigned char entropy[NIST_BLOCK_SEEDLEN_MAX_BYTES];
+  unsigned char personalization_string[NIST_BLOCK_SEEDLEN_MAX_BYTES];
+  struct {
+    pid_t pid;
+    pthread_t thread;
+    uint64_t counter;
+  } id;
+  int keylen, length, return_value = 0;
+
+  if ( csprng_tls_stale_root ) {
+    //Not destroyed on purpose, it refers to the threads and the memory of the parent
+    csprng_tls_root = NULL;
+    if ( csprng_tls_create_root() ) return 1;
+  }
+  if ( csprng_tls_root == NULL ) {
+    fprintf(stderr, "ERROR: csprng_tls: csprng_tls_initialize has not been called.\n");
+    return 1;
+  }
+
+  keylen = csprng_tls_root->csprng_state->mode.aes_key_length;
+  length = NIST_SEEDLEN_BYTES(keylen);
+  if ( fips_approved_csprng_generate(csprng_tls_root, entropy, length) != length ) {
+    fprintf(stderr, "ERROR: csprng_tls: cannot get %d bytes from the root generator.\n", length);
+    return 1;
+  }
+
+  if ( t->drbg == NULL ) {
+    //Distinct threads and processes differ even if they got the same entropy
+    memset(&id, 0, sizeof(id));
+    id.pid = getpid();
+    id.thread = pthread_self();
+    id.counter = ++csprng_tls_counter;
+    memset(personalization_string, 0, sizeof(personalization_string));
+    memcpy(personalization_string, &id, sizeof(id) < (size_t) length ? sizeof(id) : (size_t) length);
+    t->drbg = nist_ctr_drbg_instantiate(entropy, length, NULL, 0, personalization_string, length,
+        csprng_tls_root->csprng_state->mode.use_df, keylen);
+    if ( t->drbg == NULL ) {
+      fprintf(stderr, "ERROR: csprng_tls: nist_ctr_drbg_instantiate has failed.\n");
+      return_value = 1;
+    }
+  } else if ( nist_ctr_drbg_reseed(t->drbg, entropy, length, NULL, 0) ) {
+    fprintf(stderr, "ERROR: csprng_tls: nist_ctr_drbg_reseed has failed.\n");
+    return_value = 1;
+  }
+  memset(entropy, 0, sizeof(entropy));
+  t->bytes_since_reseed = 0;
+  return return_value;
+}
+//}}}
+
+//{{{ static csprng_tls_type* csprng_tls_get ( void )
+/* Instance of the calling thread, created or reinstantiated after fork when needed. NULL on error */
+static csprng_tls_type* csprng_tls_get ( void )
+{
+  csprng_tls_type* t = csprng_tls_instance;
+  unsigned int last32;
+
+  pthread_mutex_lock(&csprng_tls_mutex);
+  if ( t != NULL && csprng_tls_instance_destroyed != csprng_tls_destroyed ) {
+    //Left by csprng_tls_destroy for this thread to free
+    csprng_tls_unlink(t);
+    pthread_setspecific(csprng_tls_key, NULL);
+    csprng_tls_free(t);
+    t = csprng_tls_instance = NULL;
+  }
+  if ( t == NULL ) {
+    if ( ! csprng_tls_initialized ) {
+      fprintf(stderr, "ERROR: csprng_tls: csprng_tls_initialize has not been called.\n");
+      goto csprng_tls_get_error;
+    }
+    //The instance itself stays on the heap: the links of csprng_tls_list have to survive fork
+    t = (csprng_tls_type*) calloc(1, sizeof(csprng_tls_type));
+    if ( t == NULL ) {
+      fprintf(stderr, "ERROR: csprng_tls: Dynamic memory allocation has failed. Reported error: %s\n", strerror(errno));
+      goto csprng_tls_get_error;
+    }
+    t->buf = (unsigned char*) secure_alloc(CSPRNG_TLS_BUFFER_SIZE);
+    if ( t->buf == NULL || pthread_setspecific(csprng_tls_key, t) ) {
+      fprintf(stderr, "ERROR: csprng_tls: cannot allocate the instance of the thread.\n");
+      csprng_tls_free(t);
+      goto csprng_tls_get_error;
+    }
+    t->next = csprng_tls_list;
+    csprng_tls_list = t;
+    csprng_tls_instance = t;
+    csprng_tls_instance_destroyed = csprng_tls_destroyed;
+  } else if ( t->drbg != NULL ) {
+    //Forked: the state is shared with the parent
+    nist_ctr_drbg_destroy(t->drbg);
+    t->drbg = NULL;
+  }
+
+  if ( csprng_tls_seed(t) ) goto csprng_tls_get_error;
+  t->perform_fips_test = csprng_tls_perform_fips_test;
+  t->reseed_interval = csprng_tls_mode.max_number_of_csprng_blocks * NIST_BLOCK_OUTLEN_BYTES;
+  if ( t->perform_fips_test ) {
+    if ( nist_ctr_drbg_generate(t->drbg, &last32, sizeof(last32), NULL, 0) ) goto csprng_tls_get_error;
+    fips_init(&t->fips_ctx, last32, 0);
+  }
+  t->pos = 0;
+  t->valid = 0;
+  csprng_tls_instance_generation = __atomic_load_n(&csprng_tls_generation, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&csprng_tls_mutex);
+  return t;
+
+csprng_tls_get_error:
+  pthread_mutex_unlock(&csprng_tls_mutex);
+  return NULL;
+}
+//}}}
+
+//{{{ static int csprng_tls_refill ( csprng_tls_type* t )
+/*
+ * Fill the empty buffer of t with FIPS_RNG_BUFFER_SIZE blocks. Blocks failing the FIPS test are dropped.
+ * Returns 0 on success, 1 on error
+ */
+static int csprng_tls_refill ( csprng_tls_type* t )
+{
+  int error;
+
+  t->pos = 0;
+  t->valid = 0;
+  while ( t->valid + FIPS_RNG_BUFFER_SIZE <= CSPRNG_TLS_BUFFER_SIZE ) {
+    if ( t->bytes_since_reseed >= t->reseed_interval ) {
+      pthread_mutex_lock(&csprng_tls_mutex);
+      error = csprng_tls_seed(t);
+      pthread_mutex_unlock(&csprng_tls_mutex);
+      if ( error ) return 1;
+    }
+    if ( nist_ctr_drbg_generate(t->drbg, t->buf + t->valid, FIPS_RNG_BUFFER_SIZE, NULL, 0) ) {
+      fprintf(stderr, "ERROR: csprng_tls: nist_ctr_drbg_generate has failed.\n");
+      return 1;
+    }
+    t->bytes_since_reseed += FIPS_RNG_BUFFER_SIZE;
+    if ( t->perform_fips_test && fips_run_rng_test(&t->fips_ctx, t->buf + t->valid) ) {
+      memset(t->buf + t->valid, 0, FIPS_RNG_BUFFER_SIZE);
+      continue;
+    }
+    t->valid += FIPS_RNG_BUFFER_SIZE;
+  }
+  return 0;
+}
+//}}}
+
+//{{{ int csprng_tls_initialize ( int perform_fips_test, const mode_of_operation_type* mode_of_operation )
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_tls_initialize
+ *  Description:  Create the root generator of the thread-local API
+ *                Returns 0 on success, 1 on error
+ * =====================================================================================
+ */
+int csprng_tls_initialize ( int perform_fips_test, const mode_of_operation_type* mode_of_operation )
+{
+  int return_value = 0;
+
+  pthread_once(&csprng_tls_once, csprng_tls_register_atfork);
+  pthread_mutex_lock(&csprng_tls_mutex);
+  if ( csprng_tls_initialized ) {
+    fprintf(stderr, "ERROR: csprng_tls_initialize: already initialized.\n");
+    pthread_mutex_unlock(&csprng_tls_mutex);
+    return 1;
+  }
+  if ( ! csprng_tls_key_created ) {
+    fprintf(stderr, "ERROR: csprng_tls_initialize: pthread_key_create has failed.\n");
+    pthread_mutex_unlock(&csprng_tls_mutex);
+    return 1;
+  }
+
+  if ( mode_of_operation->max_number_of_csprng_blocks == 0 ) {
+    fprintf(stderr, "ERROR: csprng_tls_initialize: max_number_of_csprng_blocks has to be positive.\n");
+    pthread_mutex_unlock(&csprng_tls_mutex);
+    return 1;
+  }
+  csprng_tls_perform_fips_test = perform_fips_test;
+  csprng_tls_mode = *mode_of_operation;
+  csprng_tls_mode.filename_for_entropy = NULL;
+  csprng_tls_mode.filename_for_additional = NULL;
+  //Kept for the new root in the child after fork
+  if ( mode_of_operation->filename_for_entropy != NULL ) {
+    csprng_tls_mode.filename_for_entropy = strdup(mode_of_operation->filename_for_entropy);
+    if ( csprng_tls_mode.filename_for_entropy == NULL ) return_value = 1;
+  }
+  if ( mode_of_operation->filename_for_additional != NULL ) {
+    csprng_tls_mode.filename_for_additional = strdup(mode_of_operation->filename_for_additional);
+    if ( csprng_tls_mode.filename_for_additional == NULL ) return_value = 1;
+  }
+
+  if ( return_value || csprng_tls_create_root() ) {
+    free(csprng_tls_mode.filename_for_entropy);
+    free(csprng_tls_mode.filename_for_additional);
+    pthread_mutex_unlock(&csprng_tls_mutex);
+    return 1;
+  }
+  csprng_tls_initialized = 1;
+  pthread_mutex_unlock(&csprng_tls_mutex);
+  return 0;
+} /* -----  end of function csprng_tls_initialize  ----- */
+//}}}
+
+//{{{ int csprng_tls_generate ( unsigned char* output_buffer, unsigned int output_size )
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_tls_generate
+ *  Description:  Fill output_buffer from the generator of the calling thread
+ *                Returns number of bytes written, less than output_size on error
+ * =====================================================================================
+ */
+int csprng_tls_generate ( unsigned char* output_buffer, unsigned int output_size )
+{
+  csprng_tls_type* t = csprng_tls_instance;
+  unsigned int bytes_written = 0;
+  unsigned int size;
+
+  //Fast path: no locks. Only this thread frees t, the generation tells if fork or csprng_tls_destroy made it stale
+  if ( t != NULL && csprng_tls_instance_generation == __atomic_load_n(&csprng_tls_generation, __ATOMIC_ACQUIRE) &&
+      output_size <= t->valid - t->pos ) {
+    memcpy(output_buffer, t->buf + t->pos, output_size);
+    memset(t->buf + t->pos, 0, output_size);
+    t->pos += output_size;
+    return output_size;
+  }
+
+  while ( bytes_written < output_size ) {
+    if ( t == NULL || csprng_tls_instance_generation != __atomic_load_n(&csprng_tls_generation, __ATOMIC_ACQUIRE) ) {
+      t = csprng_tls_get();
+      if ( t == NULL ) return bytes_written;
+    }
+    if ( t->pos == t->valid && csprng_tls_refill(t) ) return bytes_written;
+    size = t->valid - t->pos;
+    if ( size > output_size - bytes_written ) size = output_size - bytes_written;
+    memcpy(output_buffer + bytes_written, t->buf + t->pos, size);
+    memset(t->buf + t->pos, 0, size);
+    t->pos += size;
+    bytes_written += size;
+  }
+  return output_size;
+} /* -----  end of function csprng_tls_generate  ----- */
+//}}}
+
+//{{{ int csprng_tls_destroy ( void )
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_tls_destroy
+ *  Description:  Destroy the root generator and the instance of the calling thread.
+ *                The other threads free their instances on their next call or when they exit.
+ *                Returns 0 on success, 1 on error
+ * =====================================================================================
+ */
+int csprng_tls_destroy ( void )
+{
+  int return_value = 0;
+
+  pthread_mutex_lock(&csprng_tls_mutex);
+  if ( ! csprng_tls_initialized ) {
+    fprintf(stderr, "ERROR: csprng_tls_destroy: not initialized.\n");
+    pthread_mutex_unlock(&csprng_tls_mutex);
+    return 1;
+  }
+  csprng_tls_initialized = 0;
+  //The other threads may be copying from their buffers right now, they see the new generation and free their instances
+  if ( csprng_tls_instance != NULL ) {
+    csprng_tls_unlink(csprng_tls_instance);
+    pthread_setspecific(csprng_tls_key, NULL);
+    csprng_tls_free(csprng_tls_instance);
+    csprng_tls_instance = NULL;
+  }
+  ++csprng_tls_destroyed;
+  __atomic_add_fetch(&csprng_tls_generation, 1, __ATOMIC_RELEASE);
+
+  if ( csprng_tls_root != NULL && ! csprng_tls_stale_root ) return_value = fips_approved_csprng_destroy(csprng_tls_root);
+  csprng_tls_root = NULL;
+  csprng_tls_stale_root = 0;
+  free(csprng_tls_mode.filename_for_entropy);
+  free(csprng_tls_mode.filename_for_additional);
+  memset(&csprng_tls_mode, 0, sizeof(csprng_tls_mode));
+  pthread_mutex_unlock(&csprng_tls_mutex);
+  return return_value;
+} /* -----  end of function csprng_tls_destroy  ----- */
+//}}}
@@ -0,0 +1,294 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Uniform integers in a range, floating point numbers and booleans from FIPS approved data
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <csprng/csprng.h>
+#include "cpu_kernels.h"
+
+/*
+ * Values are converted straight from the borrowed region. Each value takes one word of the stream,
+ * 4 bytes for uint32, float and bool, 8 bytes for uint64 and double, in host byte order.
+ * Bounded integers use the multiply-shift method of D. Lemire, "Fast Random Integer Generation in an Interval":
+ * the high half of word * bound is the value, the draw is rejected when the low half is below 2^w mod bound.
+ */
+
+//{{{ Conversion kernels
+int typed_bounded32_generic(const unsigned char* input, int words, uint32_t bound, uint32_t threshold, uint32_t* output)
+{
+  uint64_t m;
+  uint32_t x;
+  int i, count = 0;
+
+  for ( i = 0; i < words; ++i ) {
+    memcpy(&x, input + 4 * i, sizeof(x));
+    m = (uint64_t) x * bound;
+    if ( (uint32_t) m >= threshold ) output[count++] = (uint32_t) ( m >> 32 );
+  }
+  return count;
+}
+
+void typed_float_generic(const unsigned char* input, float* output, int n)
+{
+  uint32_t x;
+  int i;
+
+  for ( i = 0; i < n; ++i ) {
+    memcpy(&x, input + 4 * i, sizeof(x));
+    output[i] = (float) ( x >> 8 ) * ( 1.0f / 16777216.0f );
+  }
+}
+
+void typed_double_generic(const unsigned char* input, double* output, int n)
+{
+  uint64_t x;
+  int i;
+
+  for ( i = 0; i < n; ++i ) {
+    memcpy(&x, input + 8 * i, sizeof(x));
+    output[i] = (double) ( x >> 11 ) * ( 1.0 / 9007199254740992.0 );
+  }
+}
+
+void typed_bool_generic(const unsigned char* input, uint32_t threshold, unsigned char* output, int n)
+{
+  uint32_t x;
+  int i;
+
+  for ( i = 0; i < n; ++i ) {
+    memcpy(&x, input + 4 * i, sizeof(x));
+    output[i] = ( x < threshold );
+  }
+}
+
+#ifdef CSPRNG_HAVE_X86_KERNELS
+#define TYPED_KERNEL_NAME(name) name ## _sse2
+#define TYPED_KERNEL_TARGET     __attribute__ ((target ("sse2")))
+#define TYPED_KERNEL_LANES      4
+#include "typed_kernel.h"
+
+#define TYPED_KERNEL_NAME(name) name ## _avx2
+#define TYPED_KERNEL_TARGET     __attribute__ ((target ("avx2")))
+#define TYPED_KERNEL_LANES      8
+#include "typed_kernel.h"
+
+#define TYPED_KERNEL_NAME(name) name ## _avx512
+#define TYPED_KERNEL_TARGET     __attribute__ ((target ("avx512f")))
+#define TYPED_KERNEL_LANES      16
+#include "typed_kernel.h"
+#endif
+//}}}
+
+//{{{ static uint64_t mul64 ( uint64_t a, uint64_t b, uint64_t* low )
+/* High half of the 128-bit product, the low half is stored to *low */
+static uint64_t mul64 ( uint64_t a, uint64_t b, uint64_t* low )
+{
+#ifdef __SIZEOF_INT128__
+  unsigned __int128 m = (unsigned __int128) a * b;
+
+  *low = (uint64_t) m;
+  return (uint64_t) ( m >> 64 );
+#else
+  uint64_t a_lo = (uint32_t) a, a_hi = a >> 32;
+  uint64_t b_lo = (uint32_t) b, b_hi = b >> 32;
+  uint64_t lo_lo = a_lo * b_lo;
+  uint64_t hi_lo = a_hi * b_lo;
+  uint64_t lo_hi = a_lo * b_hi;
+  uint64_t cross = ( lo_lo >> 32 ) + (uint32_t) hi_lo + lo_hi;
+
+  *low = ( cross << 32 ) | (uint32_t) lo_lo;
+  return a_hi * b_hi + ( hi_lo >> 32 ) + ( cross >> 32 );
+#endif
+}
+//}}}
+
+//{{{ static int borrow_words ( fips_state_type* fips_state, unsigned int word_size, unsigned int words, const unsigned char** ptr, int* count )
+/*
+ * Borrow 1 to words whole words of word_size bytes. Bytes behind the last whole word are wiped
+ * by csprng_release without being used. Returns 0 on success, 1 on error
+ */
+static int borrow_words ( fips_state_type* fips_state, unsigned int word_size, unsigned int words, const unsigned char** ptr, int* count )
+{
+  unsigned int len;
+
+  if ( words > INT_MAX / word_size ) words = INT_MAX / word_size;
+  if ( csprng_borrow(fips_state, word_size, words * word_size, ptr, &len) ) return 1;
+  *count = (int) ( len / word_size );
+  return 0;
+}
+//}}}
+
+//{{{ int csprng_uniform_uint32 (fips_state_type *fips_state, uint32_t *output, unsigned int count, uint32_t bound)
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_uniform_uint32
+ *  Description:  Fill output with count uniform integers in [0, bound). Returns 0 on success, 1 on error
+ * =====================================================================================
+ */
+int csprng_uniform_uint32 (fips_state_type *fips_state, uint32_t *output, unsigned int count, uint32_t bound)
+{
+  const csprng_kernel_table_type* k = csprng_cpu_kernels();
+  const unsigned char* data;
+  uint32_t threshold;
+  unsigned int done = 0;
+  int words;
+
+  if ( bound == 0 ) {
+    fprintf(stderr, "ERROR: csprng_uniform_uint32: bound has to be at least 1.\n");
+    return 1;
+  }
+  threshold = ( 0U - bound ) % bound;
+
+  while ( done < count ) {
+    if ( borrow_words(fips_state, sizeof(uint32_t), count - done, &data, &words) ) return 1;
+    done += k->typed_bounded32(data, words, bound, threshold, output + done);
+    csprng_release(fips_state);
+  }
+  return 0;
+} /* -----  end of function csprng_uniform_uint32  ----- */
+//}}}
+
+//{{{ int csprng_uniform_uint64 (fips_state_type *fips_state, uint64_t *output, unsigned int count, uint64_t bound)
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_uniform_uint64
+ *  Description:  Fill output with count uniform integers in [0, bound). Returns 0 on success, 1 on error
+ * =====================================================================================
+ */
+int csprng_uniform_uint64 (fips_state_type *fips_state, uint64_t *output, unsigned int count, uint64_t bound)
+{
+  const unsigned char* data;
+  uint64_t threshold, x, low, high;
+  unsigned int done = 0;
+  int i, words;
+
+  if ( bound == 0 ) {
+    fprintf(stderr, "ERROR: csprng_uniform_uint64: bound has to be at least 1.\n");
+    return 1;
+  }
+  threshold = ( UINT64_C(0) - bound ) % bound;
+
+  while ( done < count ) {
+    if ( borrow_words(fips_state, sizeof(uint64_t), count - done, &data, &words) ) return 1;
+    for ( i = 0; i < words; ++i ) {
+      memcpy(&x, data + 8 * i, sizeof(x));
+      high = mul64(x, bound, &low);
+      if ( low >= threshold ) output[done++] = high;
+    }
+    csprng_release(fips_state);
+  }
+  return 0;
+} /* -----  end of function csprng_uniform_uint64  ----- */
+//}}}
+
+//{{{ int csprng_uniform_float (fips_state_type *fips_state, float *output, unsigned int count)
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_uniform_float
+ *  Description:  Fill output with count uniform floats in [0, 1), multiples of 2^-24.
+ *                Returns 0 on success, 1 on error
+ * =====================================================================================
+ */
+int csprng_uniform_float (fips_state_type *fips_state, float *output, unsigned int count)
+{
+  const csprng_kernel_table_type* k = csprng_cpu_kernels();
+  const unsigned char* data;
+  unsigned int done = 0;
+  int words;
+
+  while ( done < count ) {
+    if ( borrow_words(fips_state, sizeof(uint32_t), count - done, &data, &words) ) return 1;
+    k->typed_float(data, output + done, words);
+    done += words;
+    csprng_release(fips_state);
+  }
+  return 0;
+} /* -----  end of function csprng_uniform_float  ----- */
+//}}}
+
+//{{{ int csprng_uniform_double (fips_state_type *fips_state, double *output, unsigned int count)
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_uniform_double
+ *  Description:  Fill output with count uniform doubles in [0, 1), multiples of 2^-53.
+ *                Returns 0 on success, 1 on error
+ * =====================================================================================
+ */
+int csprng_uniform_double (fips_state_type *fips_state, double *output, unsigned int count)
+{
+  const csprng_kernel_table_type* k = csprng_cpu_kernels();
+  const unsigned char* data;
+  unsigned int done = 0;
+  int words;
+
+  while ( done < count ) {
+    if ( borrow_words(fips_state, sizeof(uint64_t), count - done, &data, &words) ) return 1;
+    k->typed_double(data, output + done, words);
+    done += words;
+    csprng_release(fips_state);
+  }
+  return 0;
+} /* -----  end of function csprng_uniform_double  ----- */
+//}}}
+
+//{{{ int csprng_bernoulli (fips_state_type *fips_state, unsigned char *output, unsigned int count, double p)
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  csprng_bernoulli
+ *  Description:  Fill output with count booleans (0 or 1), 1 with probability p.
+ *                Returns 0 on success, 1 on error
+ * =====================================================================================
+ */
+int csprng_bernoulli (fips_state_type *fips_state, unsigned char *output, unsigned int count, double p)
+{
+  const csprng_kernel_table_type* k = csprng_cpu_kernels();
+  const unsigned char* data;
+  uint32_t threshold;
+  unsigned int done = 0;
+  int words;
+
+  if ( ! ( p >= 0.0 && p <= 1.0 ) ) {
+    fprintf(stderr, "ERROR: csprng_bernoulli: Probability %g is not in [0, 1].\n", p);
+    return 1;
+  }
+  //No random data are needed for the certain outcomes
+  if ( p == 0.0 || p == 1.0 ) {
+    memset(output, p == 1.0, count);
+    return 0;
+  }
+  //p < 1 is at most 1 - 2^-53, its product with 2^32 is exact and below 2^32
+  threshold = (uint32_t) ( p * 4294967296.0 );
+
+  while ( done < count ) {
+    if ( borrow_words(fips_state, sizeof(uint32_t), count - done, &data, &words) ) return 1;
+    k->typed_bool(data, threshold, output + done, words);
+    done += words;
+    csprng_release(fips_state);
+  }
+  return 0;
+} /* -----  end of function csprng_bernoulli  ----- */
+//}}}
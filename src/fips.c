@@ -32,6 +32,7 @@ along with CSPRNG.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 
 #include "csprng/fips.h"
+#include "cpu_kernels.h"
 
 /*
  * Names for the FIPS tests, and bitmask
@@ -78,42 +79,216 @@ unsigned int const fips_test_mask[N_FIPS_TESTS] = {
 
 
 /*
- * fips_test_store - store 8 bits of entropy in FIPS
- * 			 internal test data pool
+ * The poker, runs, long run and monobit counters are not updated bit by bit. The bytes are scanned
+ * by the fips_scan kernel, which works on whole 64-bit words: transitions between the bits are
+ * found with a shift and XOR, transitions with no other transition in the k bits before them end
+ * runs longer than k bits, and all counts are popcounts. fips_store turns the counts into the run
+ * buckets and handles the runs crossing the boundaries of the buffer. The results are identical
+ * to the original bit-serial implementation, including its way of counting a run with the bit
+ * that ends it.
  */
-static void fips_test_store(fips_ctx_t *ctx, unsigned int rng_data)
+
+static inline uint64_t fips_load_be64(const unsigned char *buf)
+{
+  return ( (uint64_t) buf[0] << 56 ) | ( (uint64_t) buf[1] << 48 ) |
+    ( (uint64_t) buf[2] << 40 ) | ( (uint64_t) buf[3] << 32 ) |
+    ( (uint64_t) buf[4] << 24 ) | ( (uint64_t) buf[5] << 16 ) |
+    ( (uint64_t) buf[6] << 8 ) | (uint64_t) buf[7];
+}
+
+static inline uint32_t fips_load_le32(const unsigned char *buf)
+{
+  return buf[0] | ( buf[1] << 8 ) | ( buf[2] << 16 ) | ( (uint32_t) buf[3] << 24 );
+}
+
+/*
+ * fips_scan_generic - run-boundary scan word by word, the last word is padded with zeros
+ */
+void fips_scan_generic(fips_scan_type *s, const unsigned char *buf, int len)
 {
-  int j;
-
-  ctx->poker[rng_data >> 4]++;
-  ctx->poker[rng_data & 15]++;
-
-  /* Note in the loop below rlength is always one less than the actual
-     run length. This makes things easier. */
-  for (j = 7; j >= 0; j--) {
-    ctx->ones += ctx->current_bit = ((rng_data >> j) & 1);
-    if (ctx->current_bit != ctx->last_bit) {
-      /* If runlength is 1-6 count it in correct bucket. 0's go in
-         runs[0-5] 1's go in runs[6-11] hence the 6*current_bit below */
-      if (ctx->rlength < 5) {
-        ctx->runs[ctx->rlength +
-          (6 * ctx->current_bit)]++;
-      } else {
-        ctx->runs[5 + (6 * ctx->current_bit)]++;
-      }
-
-      /* Check if we just failed longrun test */
-      if (ctx->rlength >= 25)
-        ctx->longrun = 1;
-      ctx->rlength = 0;
-      /* flip the current run type */
-      ctx->last_bit = ctx->current_bit;
+  unsigned char padded[8];
+  const unsigned char *p;
+  uint64_t w, e, d;
+  uint64_t wp = s->last_bit, ep = s->last_e;
+  int i, k, n, shift;
+
+  for (i = 0; i < len; i += 8) {
+    n = len - i;
+    if (n >= 8) {
+      p = buf + i;
+      n = 8;
     } else {
-      ctx->rlength++;
+      memset(padded, 0, sizeof(padded));
+      memcpy(padded, buf + i, n);
+      p = padded;
     }
+    shift = 64 - 8 * n;
+
+    /* bit 63 is the first bit of the word, transitions in the padding are masked off */
+    w = fips_load_be64(p);
+    e = ( w ^ ( ( w >> 1 ) | ( wp << 63 ) ) ) >> shift << shift;
+    s->ones += __builtin_popcountll(w);
+    for (d = e, k = 0; k < 6; ++k) {
+      if (k) d &= ~( ( e >> k ) | ( ep << ( 64 - k ) ) );
+      s->longer[k] += __builtin_popcountll(d);
+      s->longer_ones[k] += __builtin_popcountll(d & w);
+    }
+
+    for (k = 0; k < n; ++k) {
+      s->poker[p[k] >> 4]++;
+      s->poker[p[k] & 15]++;
+      if ( ( p[k] == 0 || p[k] == 0xff ) && i + k + 1 < len && buf[i + k + 1] == p[k] ) s->run_candidate = 1;
+    }
+    wp = w >> shift;
+    ep = e >> shift;
+  }
+  if (len > 0) {
+    s->last_bit = wp & 1;
+    s->last_e = ep & 31;
   }
 }
 
+/*
+ * fips_repeats_generic - continuous run test word by word
+ */
+int fips_repeats_generic(const unsigned char *buf, int words, uint32_t last32)
+{
+  uint32_t new32;
+  int i, repeats = 0;
+
+  for (i = 0; i < words; ++i) {
+    new32 = fips_load_le32(buf + 4 * i);
+    repeats += ( new32 == last32 );
+    last32 = new32;
+  }
+  return repeats;
+}
+
+#ifdef CSPRNG_HAVE_X86_KERNELS
+#define FIPS_KERNEL_NAME(name) name ## _sse2
+#define FIPS_KERNEL_TARGET     __attribute__ ((target ("sse2")))
+#define FIPS_KERNEL_LANES      2
+#define FIPS_KERNEL_PREVIOUS   { 1, 2 }
+#include "fips_kernel.h"
+
+#define FIPS_KERNEL_NAME(name) name ## _avx2
+#define FIPS_KERNEL_TARGET     __attribute__ ((target ("avx2")))
+#define FIPS_KERNEL_LANES      4
+#define FIPS_KERNEL_PREVIOUS   { 3, 4, 5, 6 }
+#include "fips_kernel.h"
+
+#define FIPS_KERNEL_NAME(name) name ## _avx512
+#define FIPS_KERNEL_TARGET     __attribute__ ((target ("avx512f,avx512bw")))
+#define FIPS_KERNEL_LANES      8
+#define FIPS_KERNEL_PREVIOUS   { 7, 8, 9, 10, 11, 12, 13, 14 }
+#include "fips_kernel.h"
+#endif
+
+/*
+ * fips_leading_bits - number of bits equal to bit at the start of buf
+ */
+static int fips_leading_bits(const unsigned char *buf, int len, int bit)
+{
+  const unsigned char fill = bit ? 0xff : 0;
+  int i;
+
+  for (i = 0; i < len && buf[i] == fill; ++i);
+  if (i == len) return 8 * len;
+  return 8 * i + __builtin_clz(buf[i] ^ fill) - 24;
+}
+
+/*
+ * fips_trailing_bits - length of the run at the end of buf
+ */
+static int fips_trailing_bits(const unsigned char *buf, int len)
+{
+  const unsigned char fill = ( buf[len - 1] & 1 ) ? 0xff : 0;
+  int i;
+
+  for (i = len - 1; i >= 0 && buf[i] == fill; --i);
+  if (i < 0) return 8 * len;
+  return 8 * ( len - 1 - i ) + __builtin_ctz(buf[i] ^ fill);
+}
+
+/*
+ * fips_longrun - long run test of the runs which start at or after the first transition
+ *       and end inside buf. Such run of 26 bits or more contains two full equal bytes 0x00 or 0xff
+ */
+static void fips_longrun(fips_ctx_t *ctx, const unsigned char *buf, int len, int first)
+{
+  unsigned char fill;
+  int i, a, b, start, end;
+
+  for (i = 0; i + 1 < len; ++i) {
+    fill = buf[i];
+    if ( ( fill != 0 && fill != 0xff ) || buf[i + 1] != fill ) continue;
+    for (a = i; a > 0 && buf[a - 1] == fill; --a);
+    for (b = i + 1; b + 1 < len && buf[b + 1] == fill; ++b);
+    /* run reaching the end of buf goes on in rlength */
+    if (b + 1 == len) return;
+    start = 8 * a - ( a > 0 ? __builtin_ctz(buf[a - 1] ^ fill) : 0 );
+    end = 8 * ( b + 1 ) + __builtin_clz(buf[b + 1] ^ fill) - 24;
+    if (start >= first && end - start >= 26) {
+      ctx->longrun = 1;
+      return;
+    }
+    i = b;
+  }
+}
+
+/*
+ * fips_store - store len bytes in FIPS internal test data pool
+ */
+static void fips_store(fips_ctx_t *ctx, const unsigned char *buf, int len)
+{
+  fips_scan_type s;
+  uint64_t total, ones;
+  int k, first, rl, bit;
+
+  memset(&s, 0, sizeof(s));
+  s.last_bit = ctx->last_bit;
+  csprng_cpu_kernels()->fips_scan(&s, buf, len);
+
+  ctx->ones += (int) s.ones;
+  for (k = 0; k < 16; ++k)
+    ctx->poker[k] += (int) s.poker[k];
+
+  first = fips_leading_bits(buf, len, ctx->last_bit);
+  if (first == 8 * len) {
+    /* no transition, the run goes on */
+    ctx->rlength += 8 * len;
+    ctx->current_bit = ctx->last_bit;
+    return;
+  }
+
+  /* Run of k + 1 bits (6 or more for k = 5) ends at the transitions counted in longer[k] and not in longer[k + 1].
+     Like in the bit-serial implementation, the run is counted with the bit that ends it */
+  for (k = 0; k < 6; ++k) {
+    total = s.longer[k] - ( k < 5 ? s.longer[k + 1] : 0 );
+    ones = s.longer_ones[k] - ( k < 5 ? s.longer_ones[k + 1] : 0 );
+    ctx->runs[k + 6] += (int) ones;
+    ctx->runs[k] += (int) ( total - ones );
+  }
+
+  /* The first transition ends the run carried in rlength, the scan could not see it
+     and has counted it as a run of 6 or more bits */
+  bit = !ctx->last_bit;
+  ctx->runs[5 + 6 * bit]--;
+  rl = ctx->rlength + first;
+  if (rl >= 25)
+    ctx->longrun = 1;
+  /* rl = -1: the block starts with a transition, no run ends there. The bit-serial
+     implementation counted it in runs[-1], which is poker[15], or in runs[5] */
+  if (rl >= 0)
+    ctx->runs[( rl < 5 ? rl : 5 ) + 6 * bit]++;
+
+  if (s.run_candidate)
+    fips_longrun(ctx, buf, len, first);
+
+  ctx->current_bit = ctx->last_bit = buf[len - 1] & 1;
+  ctx->rlength = fips_trailing_bits(buf, len) - 1;
+}
+
 static void add_timing_difference_to_counter( struct timespec *counter, const struct timespec *start, const struct timespec *end ) {
   counter->tv_sec  = ( counter->tv_sec  - start->tv_sec  ) + end->tv_sec ;
   counter->tv_nsec = ( counter->tv_nsec - start->tv_nsec ) + end->tv_nsec;
@@ -123,36 +298,50 @@ static void add_timing_difference_to_counter( struct timespec *counter, const st
   }
 }  
 
-int fips_run_rng_test (fips_ctx_t *ctx, const void *buf)
+/*
+ * fips_continuous_run - continuous run test on len bytes of the current block.
+ *       The 32-bit words are aligned to the start of the block, a word split
+ *       between two calls is collected in partial32
+ */
+static void fips_continuous_run(fips_ctx_t *ctx, const unsigned char *buf, int len)
 {
-  int i, j;
-  int rng_test = 0;
-  const unsigned char *rngdatabuf;
-  struct timespec cpu_s, cpu_e;
-
-  if ( ctx->fips_statistics.track_CPU_time) clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_s);
+  int i = 0, pos = ctx->block_bytes & 3;
+  int words, repeats = 0;
+
+  if (pos) {
+    for (; i < len && pos < 4; ++i, ++pos)
+      ctx->partial32 |= (unsigned int) buf[i] << (8 * pos);
+    if (pos < 4) return;
+    repeats = ( ctx->partial32 == ctx->last32 );
+    ctx->last32 = ctx->partial32;
+    ctx->partial32 = 0;
+    pos = 0;
+  }
 
-  if (!ctx) return -1;
-  if (!buf) return -1;
-  rngdatabuf = (const unsigned char *)buf;
-
-  for (i=0; i<FIPS_RNG_BUFFER_SIZE; i += 4) {
-    unsigned int new32 = rngdatabuf[i] | 
-      ( rngdatabuf[i+1] << 8 ) | 
-      ( rngdatabuf[i+2] << 16 ) | 
-      ( rngdatabuf[i+3] << 24 );
-    if (new32 == ctx->last32) { 
-      rng_test |= FIPS_RNG_CONTINUOUS_RUN;
-      ++ctx -> fips_statistics.fips_failures[4];
-    }
+  words = ( len - i ) / 4;
+  if (words > 0) {
+    repeats += csprng_cpu_kernels()->fips_repeats(buf + i, words, ctx->last32);
+    i += 4 * words;
+    ctx->last32 = fips_load_le32(buf + i - 4);
+  }
 
-    ctx->last32 = new32;
-    fips_test_store(ctx, rngdatabuf[i]);
-    fips_test_store(ctx, rngdatabuf[i+1]);
-    fips_test_store(ctx, rngdatabuf[i+2]);
-    fips_test_store(ctx, rngdatabuf[i+3]);
+  if (repeats) {
+    ctx->rng_test |= FIPS_RNG_CONTINUOUS_RUN;
+    ctx -> fips_statistics.fips_failures[4] += repeats;
   }
 
+  for (; i < len; ++i, ++pos)
+    ctx->partial32 |= (unsigned int) buf[i] << (8 * pos);
+}
+
+/*
+ * fips_finish_block - evaluate the tests of the complete block, result goes to ctx->rng_test
+ */
+static void fips_finish_block(fips_ctx_t *ctx)
+{
+  int i, j;
+  int rng_test = ctx->rng_test;
+
   /* add in the last (possibly incomplete) run */
   if (ctx->rlength < 5)
     ctx->runs[ctx->rlength + (6 * ctx->current_bit)]++;
@@ -215,14 +404,96 @@ int fips_run_rng_test (fips_ctx_t *ctx, const void *buf)
     ctx -> fips_statistics.good_fips_blocks++;
   }
 
+  ctx->rng_test = rng_test;
+}
+
+int fips_update (fips_ctx_t *ctx, const void *buf, size_t len)
+{
+  int n;
+  struct timespec cpu_s, cpu_e;
+
+  if (!ctx) return -1;
+  if (!buf && len) return -1;
+
+  n = FIPS_RNG_BUFFER_SIZE - ctx->block_bytes;
+  if ( len < (size_t) n ) n = (int) len;
+  if ( n == 0 ) return 0;
+
+  if ( ctx->fips_statistics.track_CPU_time) clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_s);
+
+  fips_continuous_run(ctx, (const unsigned char *)buf, n);
+  fips_store(ctx, (const unsigned char *)buf, n);
+  ctx->block_bytes += n;
+  if ( ctx->block_bytes == FIPS_RNG_BUFFER_SIZE ) fips_finish_block(ctx);
+
   if ( ctx->fips_statistics.track_CPU_time ) { 
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_e);   
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_e);   
     add_timing_difference_to_counter ( &ctx->fips_statistics.cpu_time, &cpu_s, &cpu_e );
   }
 
+  return n;
+}
+
+int fips_block_ready (fips_ctx_t *ctx)
+{
+  int rng_test;
+
+  if (!ctx) return -1;
+  if ( ctx->block_bytes < FIPS_RNG_BUFFER_SIZE ) return -1;
+
+  rng_test = ctx->rng_test;
+  ctx->block_bytes = 0;
+  ctx->rng_test = 0;
   return rng_test;
 }
 
+int fips_run_rng_test (fips_ctx_t *ctx, const void *buf)
+{
+  if (!ctx) return -1;
+  if (!buf) return -1;
+  if ( ctx->block_bytes ) return -1;
+
+  fips_update(ctx, buf, FIPS_RNG_BUFFER_SIZE);
+  return fips_block_ready(ctx);
+}
+
+int fips_continue_after (fips_ctx_t *ctx, const void *block)
+{
+  const unsigned char *end;
+
+  if (!ctx) return -1;
+  if (!block) return -1;
+  if ( ctx->block_bytes ) return -1;
+
+  end = (const unsigned char *)block + FIPS_RNG_BUFFER_SIZE;
+  ctx->last32 = fips_load_le32(end - 4);
+  ctx->last_bit = end[-1] & 1;
+  return 0;
+}
+
+void fips_merge_statistics (fips_statistics_type *to, fips_statistics_type *from)
+{
+  int i;
+
+  to->bad_fips_blocks += from->bad_fips_blocks;
+  to->good_fips_blocks += from->good_fips_blocks;
+  for (i=0; i<N_FIPS_TESTS; ++i) {
+    to->fips_failures[i] += from->fips_failures[i];
+    from->fips_failures[i] = 0;
+  }
+  from->bad_fips_blocks = 0;
+  from->good_fips_blocks = 0;
+
+  to->cpu_time.tv_sec += from->cpu_time.tv_sec;
+  to->cpu_time.tv_nsec += from->cpu_time.tv_nsec;
+  if ( to->cpu_time.tv_nsec >= 1000000000 ) {
+    to->cpu_time.tv_nsec -= 1000000000;
+    to->cpu_time.tv_sec += 1;
+  }
+  from->cpu_time.tv_sec = 0;
+  from->cpu_time.tv_nsec = 0;
+}
+
 static void fips_statistics_init(fips_statistics_type *fips_statistics, int track_CPU_time) {
   int i;
 
@@ -240,7 +511,7 @@ static void fips_statistics_init(fips_statistics_type *fips_statistics, int trac
 
 char* dump_fips_statistics ( fips_statistics_type *fips_statistics) {
   int i;
-  static char buf[84*(3+N_FIPS_TESTS)];
+  static __thread char buf[84*(3+N_FIPS_TESTS)];
   char *p = buf;
   int size = sizeof(buf);
   int remaining_size=size;
@@ -289,6 +560,9 @@ void fips_init(fips_ctx_t *ctx, unsigned int last32, int track_CPU_time)
     ctx->current_bit = 0;
     ctx->last_bit = 0;
     ctx->last32 = last32;
+    ctx->block_bytes = 0;
+    ctx->partial32 = 0;
+    ctx->rng_test = 0;
   }
 }
 
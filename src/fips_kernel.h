@@ -0,0 +1,180 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Vectorized FIPS 140-2 test kernels. Included by fips.c once for each SIMD width
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+/*
+ * Expects FIPS_KERNEL_NAME(name), FIPS_KERNEL_TARGET, FIPS_KERNEL_LANES (number of 64-bit lanes) and
+ * FIPS_KERNEL_PREVIOUS (shuffle mask moving each lane one lane up, lane 0 takes the last lane of
+ * the previous vector) to be defined.
+ *
+ * fips_scan reverses the bits of every byte first, so that the stream goes from bit 0 to bit 63 of
+ * each lane and from lane to lane. Popcounts are kept per byte and summed into the 64-bit lanes every
+ * FIPS_KERNEL_FLUSH vectors, before a byte can overflow. Poker counts the nibbles by comparing them
+ * with each of the 16 values. Each function returns exactly what its _generic variant does,
+ * the bytes not filling a vector are done by the _generic variant.
+ */
+
+#define FIPS_KERNEL_FLUSH 31
+
+/* Add the number of bits set in each byte of v to the byte counters in acc */
+#define FIPS_KERNEL_POPCOUNT(acc, v) do {                       \
+    vec_t t_ = (v);                                             \
+    t_ = t_ - ( ( t_ >> 1 ) & m1 );                             \
+    t_ = ( t_ & m2 ) + ( ( t_ >> 2 ) & m2 );                    \
+    (acc) += ( t_ + ( t_ >> 4 ) ) & m4;                         \
+  } while ( 0 )
+
+/* Sum the byte counters in each lane of v */
+#define FIPS_KERNEL_SUM(v) ( {                                  \
+    vec_t t_ = ( (v) & m8 ) + ( ( (v) >> 8 ) & m8 );            \
+    t_ += t_ >> 16;                                             \
+    t_ += t_ >> 32;                                             \
+    t_ & 0xffff;                                                \
+  } )
+
+//{{{ void fips_scan (fips_scan_type* s, const unsigned char* buf, int len)
+FIPS_KERNEL_TARGET void FIPS_KERNEL_NAME(fips_scan) (fips_scan_type* s, const unsigned char* buf, int len)
+{
+  typedef uint64_t vec_t __attribute__ ((vector_size (8 * FIPS_KERNEL_LANES)));
+  typedef unsigned char bvec_t __attribute__ ((vector_size (8 * FIPS_KERNEL_LANES)));
+  const vec_t zero = { 0 };
+  const vec_t m1 = zero + UINT64_C(0x5555555555555555);
+  const vec_t m2 = zero + UINT64_C(0x3333333333333333);
+  const vec_t m4 = zero + UINT64_C(0x0f0f0f0f0f0f0f0f);
+  const vec_t m8 = zero + UINT64_C(0x00ff00ff00ff00ff);
+  const vec_t previous = FIPS_KERNEL_PREVIOUS;
+  const bvec_t bzero = { 0 };
+  //Counters of the transitions longer[k] and longer_ones[k] are count[2k] and count[2k+1], ones are count[12]
+  vec_t count[13], total[13], poker_total[16];
+  bvec_t poker[16];
+  vec_t x, xl = zero, e, ep, el = zero, d, next, candidate = zero;
+  bvec_t b, hi, lo;
+  uint64_t lane[FIPS_KERNEL_LANES];
+  int i, j, k, n = 0;
+
+  if ( len <= 8 * FIPS_KERNEL_LANES ) {
+    fips_scan_generic(s, buf, len);
+    return;
+  }
+
+  for ( j = 0; j < 13; ++j ) count[j] = total[j] = zero;
+  for ( j = 0; j < 16; ++j ) {
+    poker[j] = bzero;
+    poker_total[j] = zero;
+  }
+  xl[FIPS_KERNEL_LANES - 1] = (uint64_t) s->last_bit << 63;
+  for ( k = 0; k < 5; ++k ) el[FIPS_KERNEL_LANES - 1] |= (uint64_t) ( ( s->last_e >> k ) & 1 ) << ( 63 - k );
+
+  //The byte after the vector is read for the long run candidates
+  for ( i = 0; i + 8 * FIPS_KERNEL_LANES < len; i += 8 * FIPS_KERNEL_LANES ) {
+    memcpy(&x, buf + i, sizeof(vec_t));
+    memcpy(&next, buf + i + 1, sizeof(vec_t));
+    b = (bvec_t) x;
+    candidate |= (vec_t) ( ( b == (bvec_t) next ) & ( ( b == bzero ) | ( b == (bvec_t) ( bzero + 0xff ) ) ) );
+
+    hi = b >> 4;
+    lo = b & 15;
+    for ( k = 0; k < 16; ++k ) {
+      poker[k] -= (bvec_t) ( hi == (bvec_t) ( bzero + (unsigned char) k ) );
+      poker[k] -= (bvec_t) ( lo == (bvec_t) ( bzero + (unsigned char) k ) );
+    }
+
+    x = ( ( x >> 1 ) & m1 ) | ( ( x & m1 ) << 1 );
+    x = ( ( x >> 2 ) & m2 ) | ( ( x & m2 ) << 2 );
+    x = ( ( x >> 4 ) & m4 ) | ( ( x & m4 ) << 4 );
+    e = x ^ ( ( x << 1 ) | ( __builtin_shuffle(xl, x, previous) >> 63 ) );
+    ep = __builtin_shuffle(el, e, previous);
+    FIPS_KERNEL_POPCOUNT(count[12], x);
+    for ( d = e, k = 0; k < 6; ++k ) {
+      if ( k ) d &= ~( ( e << k ) | ( ep >> ( 64 - k ) ) );
+      FIPS_KERNEL_POPCOUNT(count[2 * k], d);
+      FIPS_KERNEL_POPCOUNT(count[2 * k + 1], d & x);
+    }
+    xl = x;
+    el = e;
+
+    if ( ++n == FIPS_KERNEL_FLUSH ) {
+      for ( j = 0; j < 13; ++j ) {
+        total[j] += FIPS_KERNEL_SUM(count[j]);
+        count[j] = zero;
+      }
+      for ( j = 0; j < 16; ++j ) {
+        poker_total[j] += FIPS_KERNEL_SUM((vec_t) poker[j]);
+        poker[j] = bzero;
+      }
+      n = 0;
+    }
+  }
+
+  for ( j = 0; j < 13; ++j ) total[j] += FIPS_KERNEL_SUM(count[j]);
+  for ( j = 0; j < 16; ++j ) poker_total[j] += FIPS_KERNEL_SUM((vec_t) poker[j]);
+  for ( k = 0; k < FIPS_KERNEL_LANES; ++k ) {
+    for ( j = 0; j < 6; ++j ) {
+      s->longer[j] += total[2 * j][k];
+      s->longer_ones[j] += total[2 * j + 1][k];
+    }
+    s->ones += total[12][k];
+    for ( j = 0; j < 16; ++j ) s->poker[j] += poker_total[j][k];
+  }
+  memcpy(lane, &candidate, sizeof(vec_t));
+  for ( k = 0; k < FIPS_KERNEL_LANES; ++k ) {
+    if ( lane[k] ) s->run_candidate = 1;
+  }
+
+  s->last_bit = xl[FIPS_KERNEL_LANES - 1] >> 63;
+  s->last_e = 0;
+  for ( k = 0; k < 5; ++k ) s->last_e |= ( ( el[FIPS_KERNEL_LANES - 1] >> ( 63 - k ) ) & 1 ) << k;
+  fips_scan_generic(s, buf + i, len - i);
+}
+//}}}
+
+//{{{ int fips_repeats (const unsigned char* buf, int words, uint32_t last32)
+FIPS_KERNEL_TARGET int FIPS_KERNEL_NAME(fips_repeats) (const unsigned char* buf, int words, uint32_t last32)
+{
+  typedef uint32_t wvec_t __attribute__ ((vector_size (8 * FIPS_KERNEL_LANES)));
+  uint32_t lane[2 * FIPS_KERNEL_LANES];
+  wvec_t x, y, repeats = { 0 };
+  int i, j, count;
+
+  if ( words < 1 ) return 0;
+  count = fips_repeats_generic(buf, 1, last32);
+
+  for ( i = 1; i + 2 * FIPS_KERNEL_LANES <= words; i += 2 * FIPS_KERNEL_LANES ) {
+    memcpy(&x, buf + 4 * i, sizeof(wvec_t));
+    memcpy(&y, buf + 4 * i - 4, sizeof(wvec_t));
+    repeats -= (wvec_t) ( x == y );
+  }
+  memcpy(lane, &repeats, sizeof(wvec_t));
+  for ( j = 0; j < 2 * FIPS_KERNEL_LANES; ++j ) count += lane[j];
+
+  return count + fips_repeats_generic(buf + 4 * i, words - i, fips_load_le32(buf + 4 * i - 4));
+}
+//}}}
+
+#undef FIPS_KERNEL_FLUSH
+#undef FIPS_KERNEL_POPCOUNT
+#undef FIPS_KERNEL_SUM
+#undef FIPS_KERNEL_NAME
+#undef FIPS_KERNEL_TARGET
+#undef FIPS_KERNEL_LANES
+#undef FIPS_KERNEL_PREVIOUS
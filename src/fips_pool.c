@@ -0,0 +1,212 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Worker pool running the FIPS 140-2 tests of consecutive blocks
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "fips_pool.h"
+
+typedef struct {
+  fips_pool_type* pool;
+  int slice;
+  pthread_t thread;
+  fips_ctx_t ctx;                                     //Context of the slice, statistics are merged after each request
+} fips_pool_worker_type;
+
+struct fips_pool_type {
+  int threads;                                        //Worker threads + calling thread
+  fips_pool_worker_type* worker;
+  pthread_mutex_t mutex;
+  pthread_cond_t start;                               //Signaled when a new request is posted or on shutdown
+  pthread_cond_t done;                                //Signaled when the last slice of the request is finished
+  uint64_t generation;                                //Incremented for each request
+  int pending;                                        //Slices not finished yet
+  int shutdown;
+  int max_blocks;
+  int* result;                                        //Results of the blocks of the current request
+  //Current request
+  const unsigned char* buf;
+  int blocks;
+  int slices;
+};
+
+//{{{ Slices
+/*
+ * Slice boundaries are spread evenly, slice i starts at block i * blocks / slices
+ */
+static void fips_pool_run_slice(fips_pool_type* pool, fips_ctx_t* ctx, int slice)
+{
+  int first = (int) ( (int64_t) slice * pool->blocks / pool->slices );
+  int last = (int) ( (int64_t) ( slice + 1 ) * pool->blocks / pool->slices );
+  int i;
+
+  //Slice 0 continues from the previous request in the caller's context
+  if ( slice > 0 ) fips_continue_after(ctx, pool->buf + (size_t) ( first - 1 ) * FIPS_RNG_BUFFER_SIZE);
+  for ( i = first; i < last; ++i ) pool->result[i] = fips_run_rng_test(ctx, pool->buf + (size_t) i * FIPS_RNG_BUFFER_SIZE);
+}
+//}}}
+
+//{{{ Worker thread
+static void* fips_pool_worker(void* arg)
+{
+  fips_pool_worker_type* worker = arg;
+  fips_pool_type* pool = worker->pool;
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&pool->mutex);
+  for (;;) {
+    while ( pool->generation == seen && !pool->shutdown ) pthread_cond_wait(&pool->start, &pool->mutex);
+    if ( pool->shutdown ) break;
+    seen = pool->generation;
+    if ( worker->slice >= pool->slices ) continue;
+
+    pthread_mutex_unlock(&pool->mutex);
+    fips_pool_run_slice(pool, &worker->ctx, worker->slice);
+    pthread_mutex_lock(&pool->mutex);
+
+    if ( --pool->pending == 0 ) pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  return NULL;
+}
+//}}}
+
+//{{{ Public API
+fips_pool_type* fips_pool_create(int threads, int max_blocks, int track_CPU_time)
+{
+  fips_pool_type* pool;
+  fips_pool_worker_type* worker;
+  int i, rc;
+
+  if ( threads < 2 ) {
+    fprintf(stderr, "fips_pool_create: expecting at least 2 threads, got %d\n", threads);
+    return NULL;
+  }
+  if ( max_blocks < 1 ) {
+    fprintf(stderr, "fips_pool_create: expecting at least 1 block, got %d\n", max_blocks);
+    return NULL;
+  }
+
+  pool = calloc(1, sizeof(fips_pool_type));
+  if ( pool == NULL ) {
+    fprintf(stderr, "fips_pool_create: Dynamic memory allocation failed\n");
+    return NULL;
+  }
+  pool->worker = calloc(threads - 1, sizeof(fips_pool_worker_type));
+  pool->result = calloc(max_blocks, sizeof(int));
+  if ( pool->worker == NULL || pool->result == NULL ) {
+    fprintf(stderr, "fips_pool_create: Dynamic memory allocation failed\n");
+    free(pool->worker);
+    free(pool->result);
+    free(pool);
+    return NULL;
+  }
+  pool->max_blocks = max_blocks;
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  //Slice 0 belongs to the calling thread
+  for ( i = 0; i < threads - 1; ++i ) {
+    worker = &pool->worker[i];
+    worker->pool = pool;
+    worker->slice = i + 1;
+    fips_init(&worker->ctx, 0, track_CPU_time);
+    rc = pthread_create(&worker->thread, NULL, fips_pool_worker, worker);
+    if ( rc ) {
+      fprintf(stderr, "fips_pool_create: pthread_create has failed: %s\n", strerror(rc));
+      break;
+    }
+  }
+  pool->threads = i + 1;
+
+  if ( pool->threads < threads ) {
+    fips_pool_destroy(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+const int* fips_pool_test(fips_pool_type* pool, fips_ctx_t* ctx, const unsigned char* buf, int blocks)
+{
+  int i, slices = blocks / FIPS_POOL_MIN_BLOCKS;
+
+  if ( blocks < 1 || blocks > pool->max_blocks || ctx->block_bytes ) {
+    fprintf(stderr, "fips_pool_test: expecting 1 to %d blocks at a block boundary, got %d\n", pool->max_blocks, blocks);
+    return NULL;
+  }
+
+  if ( slices > pool->threads ) slices = pool->threads;
+  if ( slices < 2 ) {
+    for ( i = 0; i < blocks; ++i ) pool->result[i] = fips_run_rng_test(ctx, buf + (size_t) i * FIPS_RNG_BUFFER_SIZE);
+    return pool->result;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->buf = buf;
+  pool->blocks = blocks;
+  pool->slices = slices;
+  pool->pending = slices - 1;
+  ++pool->generation;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->mutex);
+
+  fips_pool_run_slice(pool, ctx, 0);
+
+  pthread_mutex_lock(&pool->mutex);
+  while ( pool->pending ) pthread_cond_wait(&pool->done, &pool->mutex);
+  pool->buf = NULL;
+  pthread_mutex_unlock(&pool->mutex);
+
+  for ( i = 0; i < slices - 1; ++i ) fips_merge_statistics(&ctx->fips_statistics, &pool->worker[i].ctx.fips_statistics);
+  fips_continue_after(ctx, buf + (size_t) ( blocks - 1 ) * FIPS_RNG_BUFFER_SIZE);
+  return pool->result;
+}
+
+void fips_pool_destroy(fips_pool_type* pool)
+{
+  int i;
+
+  if ( pool == NULL ) return;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for ( i = 0; i < pool->threads - 1; ++i ) pthread_join(pool->worker[i].thread, NULL);
+
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  pthread_mutex_destroy(&pool->mutex);
+  memset(pool->worker, 0, ( pool->threads - 1 ) * sizeof(fips_pool_worker_type));
+  free(pool->worker);
+  free(pool->result);
+  free(pool);
+}
+//}}}
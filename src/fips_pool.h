@@ -0,0 +1,51 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Worker pool running the FIPS 140-2 tests of consecutive blocks. Internal to libcsprng.
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#ifndef FIPS_POOL_H
+#define FIPS_POOL_H
+
+#include <csprng/fips.h>
+
+//Smallest slice given to one thread. Below it the synchronization costs more than it saves
+#define FIPS_POOL_MIN_BLOCKS 8
+
+/*
+ * threads - 1 worker threads are started, the calling thread tests one slice itself.
+ * One call of fips_pool_test can test up to max_blocks blocks
+ */
+fips_pool_type* fips_pool_create(int threads, int max_blocks, int track_CPU_time);
+
+/*
+ * Test blocks consecutive FIPS_RNG_BUFFER_SIZE blocks at buf. Entry i of the returned array is what
+ * fips_run_rng_test would return for block i after ctx has tested blocks 0 ... i-1, the array is valid
+ * until the next call. Slice 0 is tested with ctx, every other slice with the context of one worker,
+ * which continues after the last block of the previous slice (fips_continue_after). The statistics of
+ * the workers are merged into ctx and ctx continues after the last block, so the results do not depend
+ * on the thread count. ctx must not be in the middle of a block.
+ */
+const int* fips_pool_test(fips_pool_type* pool, fips_ctx_t* ctx, const unsigned char* buf, int blocks);
+
+void fips_pool_destroy(fips_pool_type* pool);
+
+#endif
@@ -28,30 +28,22 @@ along with CSPRNG.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/time.h>
 #include <csprng/havege.h>
 
-//TODO - get rid of global variables
-
 /**
  ** Microsecond resolution times use gettimeofday
  */
-#define MSC_DATA          static struct timeval et0,et1;
-#define MSC_ELAPSED()     (et1.tv_sec - et0.tv_sec)*1000000 + et1.tv_usec - et0.tv_usec
-#define MSC_START()       gettimeofday(&et0,NULL)
-#define MSC_STOP()        gettimeofday(&et1,NULL)
+#define MSC_ELAPSED(h)    ((h)->et1.tv_sec - (h)->et0.tv_sec)*1000000 + (h)->et1.tv_usec - (h)->et0.tv_usec
+#define MSC_START(h)      gettimeofday(&(h)->et0,NULL)
+#define MSC_STOP(h)       gettimeofday(&(h)->et1,NULL)
 
 /**
  ** Compiler intrinsics are used to make the build more portable and stable
  ** with fallbacks provided where the intrisics cannot be used. 
  */
 
-/**
- * State
- */
-static struct  hinfo info;                               // configuration
-MSC_DATA;
-
 /*{{{ GCC */
 #ifdef __GNUC__
 /* ################################################################################# */
@@ -73,7 +65,7 @@ MSC_DATA;
  ** The collection mechanism cannot withstand agressive optimization
  */
 #if GCC_VERSION>=40400
-DATA_TYPE havege_collect(volatile H_PTR hptr) __attribute__((optimize(1)));
+DATA_TYPE havege_collect(havege_type* h) __attribute__((optimize(1)));
 #endif
 /**
  ** For the intel world...
@@ -190,10 +182,10 @@ DATA_TYPE havege_collect(volatile H_PTR hptr) __attribute__((optimize(1)));
 /**
  * Wrapper around the cpuid macro to assist in debugging
  */
-static void cpuid(int fn, unsigned int *p, char * tag)
+static void cpuid(H_RDR info, int fn, unsigned int *p, char * tag)
 {
   CPUID(fn,p);
-  if (DEBUG_ENABLED(DEBUG_CPUID)) {
+  if (DEBUG_ENABLED(info, DEBUG_CPUID)) {
     char *rn = "ABDC";
     char d[sizeof(int)+1];int i,j;
 
@@ -217,16 +209,16 @@ static void cpuid(int fn, unsigned int *p, char * tag)
  *
  * As per AMD document 2541, April 2008
  */
-static int configure_amd(void)
+static int configure_amd(H_PTR info)
 {
    unsigned char regs[4*sizeof(int)];
    unsigned int *p = (unsigned int *)regs;
 
-   cpuid(0x80000000,p,"configure_amd");
+   cpuid(info, 0x80000000,p,"configure_amd");
    if ((p[0]&15)>=5) {                       // We want the L1 info
-      cpuid(0x80000005,p,"configure_amd");
-      info.d_cache   =  (p[2]>>24) & 0xff;   // l1 data cache
-      info.i_cache   =  (p[3]>>24) & 0xff;   // l1 instruction cache
+      cpuid(info, 0x80000005,p,"configure_amd");
+      info->d_cache   =  (p[2]>>24) & 0xff;   // l1 data cache
+      info->i_cache   =  (p[3]>>24) & 0xff;   // l1 instruction cache
       return 1;
       }
    return 0;
@@ -243,7 +235,7 @@ static int configure_amd(void)
  *        same information as leaf 2 - so in this code leaf 4 is only used as
  *        a fallback....
  */
-static int configure_intel(unsigned int lsfn)
+static int configure_intel(H_PTR info, unsigned int lsfn)
 {
    unsigned char regs[4*sizeof(int)] = { 0 };
    unsigned int *p = (unsigned int *)regs;
@@ -276,7 +268,7 @@ static int configure_intel(unsigned int lsfn)
       };
    unsigned int i,j,k,n,sizes[] = {0,0,0};
 
-   cpuid(2,p,"configure_intel");
+   cpuid(info, 2,p,"configure_intel");
    n = p[0]&0xff;
    for(i=0;i<n;i++) {
       for(j=0;j<4;j++)
@@ -288,11 +280,11 @@ static int configure_intel(unsigned int lsfn)
                sizes[desc[k+1]] += desc[k+2];
                break;
                }
-         if (DEBUG_ENABLED(DEBUG_CPUID))
+         if (DEBUG_ENABLED(info, DEBUG_CPUID))
             DEBUG_OUT("lookup %x %d %d\n", regs[j], desc[k+1], desc[k+2]);
          }
       if ((i+1)!=n)
-         cpuid(2,p,"configure_intel(2)");
+         cpuid(info, 2,p,"configure_intel(2)");
       }
    if (sizes[0]<sizes[2])	                  // pentium4 hack
       sizes[0] = sizes[2];
@@ -300,14 +292,14 @@ static int configure_intel(unsigned int lsfn)
       int level, type, ways, parts, lines;
       for(i=0;i<15;i++) {
          p[3] = i;
-         cpuid(4,p,"configure_intel(3)");
+         cpuid(info, 4,p,"configure_intel(3)");
          if ((type=p[0]&0x1f)==0) break;     // No more info
          level = (p[0]>>5)&7;
          lines = p[1] & 0xfff;
          parts = (p[1]>>12) & 0x3ff;
          ways  = (p[1]>>22) & 0x3ff;
          n     = ((ways+1)*(parts+1)*(lines+1)*(p[2]+1))/1024;
-         if (DEBUG_ENABLED(DEBUG_CPUID))
+         if (DEBUG_ENABLED(info, DEBUG_CPUID))
             DEBUG_OUT("type=%d,level=%d,ways=%d,parts=%d,lines=%d,sets=%d: %d\n",
                type,level,ways+1,parts+1,lines+1,p[3]+1,n);
          if (level==1)
@@ -318,11 +310,11 @@ static int configure_intel(unsigned int lsfn)
                }
          }
       }
-   if (info.i_cache<1)
-      info.i_cache   = sizes[0];
-   if (info.d_cache<1)
-      info.d_cache   = sizes[1];
-   if (info.i_cache>0 && info.d_cache>0)
+   if (info->i_cache<1)
+      info->i_cache   = sizes[0];
+   if (info->d_cache<1)
+      info->d_cache   = sizes[1];
+   if (info->i_cache>0 && info->d_cache>0)
       return 1;
    return 0;
 }
@@ -332,36 +324,36 @@ static int configure_intel(unsigned int lsfn)
  * use it to determine the sizes of the data and instruction caches. If these cannot
  * be used supply "generic" defaults.
  */
-static int cache_configure(void)
+static int cache_configure(H_PTR info)
 {
   unsigned char regs[4*sizeof(int)] = { 0 };
   unsigned int *p = (unsigned int *)regs;
 
-  if (info.i_cache>0 && info.d_cache>0)
+  if (info->i_cache>0 && info->d_cache>0)
     return 1;
   if (HASCPUID(p)) {
-    cpuid(0,p,"max info type");
+    cpuid(info, 0,p,"max info type");
     switch(p[1]) {
-      case 0x68747541:  info.vendor = "amd";       break;
-      case 0x69727943:  info.vendor = "cyrix";     break;
-      case 0x746e6543:  info.vendor = "centaur";   break;   // aka via
-      case 0x756e6547:  info.vendor = "intel";     break;
-      case 0x646f6547:  info.vendor = "natsemi";   break;
+      case 0x68747541:  info->vendor = "amd";       break;
+      case 0x69727943:  info->vendor = "cyrix";     break;
+      case 0x746e6543:  info->vendor = "centaur";   break;   // aka via
+      case 0x756e6547:  info->vendor = "intel";     break;
+      case 0x646f6547:  info->vendor = "natsemi";   break;
       case 0x52697365:
-      case 0x65736952:  info.vendor = "rise";      break;   // now owned by sis
-      case 0x20536953:  info.vendor = "sis";       break;
-      default:          info.vendor = "other";     break;
+      case 0x65736952:  info->vendor = "rise";      break;   // now owned by sis
+      case 0x20536953:  info->vendor = "sis";       break;
+      default:          info->vendor = "other";     break;
     }
   }
   else p[0]  = 0;
-  if (!strcmp(info.vendor,"amd") && configure_amd())
+  if (!strcmp(info->vendor,"amd") && configure_amd(info))
     ;
-  else if ( !strcmp(info.vendor,"intel") && configure_intel(p[0]) )
+  else if ( !strcmp(info->vendor,"intel") && configure_intel(info, p[0]) )
     ;
   else {
-    info.generic = 1;
-    if (info.d_cache<1)  info.d_cache = HAVEGE_GENERIC_DCACHE;
-    if (info.i_cache<1)  info.i_cache = HAVEGE_GENERIC_ICACHE;
+    info->generic = 1;
+    if (info->d_cache<1)  info->d_cache = HAVEGE_GENERIC_DCACHE;
+    if (info->i_cache<1)  info->i_cache = HAVEGE_GENERIC_ICACHE;
   }
   return 1;
 }
@@ -371,14 +363,14 @@ static int cache_configure(void)
  * Configure the collector for other architectures. If command line defaults are not
  * supplied provide "generic" defaults.
  */
-static int cache_configure(void)
+static int cache_configure(H_PTR info)
 {
-   if (info.i_cache>0 && info.d_cache>0)
+   if (info->i_cache>0 && info->d_cache>0)
       ;
    else {
-      info.generic = 1;
-      if (info.d_cache<1)  info.d_cache = HAVEGE_GENERIC_DCACHE;
-      if (info.i_cache<1)  info.i_cache = HAVEGE_GENERIC_ICACHE;
+      info->generic = 1;
+      if (info->d_cache<1)  info->d_cache = HAVEGE_GENERIC_DCACHE;
+      if (info->i_cache<1)  info->i_cache = HAVEGE_GENERIC_ICACHE;
       }
    return 1;
 }
@@ -398,7 +390,7 @@ static int cache_configure(void)
  * depending upon whether the collection buffer has been filled.
  */
 #define LOOP(n,m) loop##n: if (n < loop_idx) { \
-                              switch(havege_sp(i,n,LOOP_PT(n))) { \
+                              switch(havege_sp(h,i,n,LOOP_PT(n))) { \
                                  case 0:   goto loop##m; \
                                  case 1:   goto loop40; \
                                  default:  goto loop_exit; \
@@ -414,37 +406,48 @@ inline DATA_TYPE ror32(const DATA_TYPE value, const DATA_TYPE shift) {
 #endif
 
 /**
- * Significant variables used in the calculation. The data is declared local to this
- * compile unit but referenced by havege_df() to ensure that a clever optimizer does
- * not decide to ignore the volatile because a variable only has local access.
- */
-static volatile DATA_TYPE  havege_bigarray [HAVEGE_NDSIZECOLLECT + 16384];
-static volatile DATA_TYPE  ANDPT;
-static volatile DATA_TYPE  havege_hardtick;
-static volatile DATA_TYPE  loop_idx = HAVEGE_LOOP_CT+1;
-static volatile DATA_TYPE  *havege_pwalk;
-static void  *buffer_to_be_freed;
-static volatile char *havege_pts[HAVEGE_LOOP_CT+1];
-static volatile DATA_TYPE  *Pt0;
-static volatile DATA_TYPE  *Pt1;
-static volatile DATA_TYPE  *Pt2;
-static volatile DATA_TYPE  *Pt3;
-static volatile DATA_TYPE   PT;
-static volatile DATA_TYPE   PT2;
-static volatile DATA_TYPE   pt2;
-static volatile DATA_TYPE   PTtest;
+ * This type is used by havege_df() as an affectation to allow static variables
+ * escape the optimizers data flow analysis
+ */
+typedef void volatile * VVAR;
+
+/**
+ * Collector instance. The significant variables used in the calculation are volatile
+ * members whose addresses are exported by havege_df() to ensure that a clever optimizer
+ * does not decide to ignore the volatile because a variable only has local access.
+ */
+struct havege_type {
+  struct hinfo info;                          // configuration
+  struct timeval et0,et1;                     // duration of the last collection
+  volatile DATA_TYPE  *havege_bigarray;       // HAVEGE_NDSIZECOLLECT + 16384 words
+  volatile DATA_TYPE  ANDPT;
+  volatile DATA_TYPE  havege_hardtick;
+  volatile DATA_TYPE  loop_idx;
+  volatile DATA_TYPE  *havege_pwalk;
+  void  *buffer_to_be_freed;
+  volatile char *havege_pts[HAVEGE_LOOP_CT+1];
+  volatile DATA_TYPE  *Pt0;
+  volatile DATA_TYPE  *Pt1;
+  volatile DATA_TYPE  *Pt2;
+  volatile DATA_TYPE  *Pt3;
+  volatile DATA_TYPE   PT;
+  volatile DATA_TYPE   PT2;
+  volatile DATA_TYPE   pt2;
+  volatile DATA_TYPE   PTtest;
+  VVAR escape[16];
+};
 
 /**
  * Debug setup code
  */
-void  havege_debug(char **havege_pts, DATA_TYPE *pts)
+void  havege_debug(H_RDR info, char **havege_pts, DATA_TYPE *pts)
 {
    int i;
 
-   if (DEBUG_ENABLED(DEBUG_COMPILE))
+   if (DEBUG_ENABLED(info, DEBUG_COMPILE))
       for (i=0;i<=(HAVEGE_LOOP_CT+1);i++)
          fprintf(stdout, "Address %d=%p\n", i, havege_pts[i]);
-   if (DEBUG_ENABLED(DEBUG_LOOP))
+   if (DEBUG_ENABLED(info, DEBUG_LOOP))
       for(i=1;i<(HAVEGE_LOOP_CT+1);i++)
          DEBUG_OUT("Loop %d: offset=%d, delta=%d\n", i,pts[i],pts[i]-pts[i-1]);
 }
@@ -454,13 +457,13 @@ void  havege_debug(char **havege_pts, DATA_TYPE *pts)
  * sequence. This happens for all points on the collection pass and only for
  * the terminating point thereafter.
  */
-static DATA_TYPE havege_sp(DATA_TYPE i, DATA_TYPE n,char *p)
+static DATA_TYPE havege_sp(havege_type* h, DATA_TYPE i, DATA_TYPE n,char *p)
 {
-  //if (i>0) fprintf(stderr,"collect, i= %d, value RESULT[%d]=%d\n",i,i-1,havege_bigarray[i-1]);
-  if (loop_idx < HAVEGE_LOOP_CT)
+  //if (i>0) fprintf(stderr,"collect, i= %d, value RESULT[%d]=%d\n",i,i-1,h->havege_bigarray[i-1]);
+  if (h->loop_idx < HAVEGE_LOOP_CT)
     return i < HAVEGE_NDSIZECOLLECT? 1 : 2;
-  havege_pts[n] = CODE_PT(p);
-  if (n==0) loop_idx = 0;
+  h->havege_pts[n] = CODE_PT(p);
+  if (n==0) h->loop_idx = 0;
   return 0;
 }
 
@@ -469,15 +472,16 @@ static DATA_TYPE havege_sp(DATA_TYPE i, DATA_TYPE n,char *p)
  * based on the instruction cache and allocate the walk array based on the size
  * of the data cache.
  */
-static volatile DATA_TYPE *havege_tune(H_PTR hptr)
+static volatile DATA_TYPE *havege_tune(havege_type* h)
 {
+  H_PTR hptr = &h->info;
   DATA_TYPE offsets[HAVEGE_LOOP_CT+1];
   DATA_TYPE i,offs,*p,sz;
 
-  hptr->havege_buf = (DATA_TYPE *)havege_bigarray;
+  hptr->havege_buf = (DATA_TYPE *)h->havege_bigarray;
   for (i=0;i<=HAVEGE_LOOP_CT;i++)
-    offsets[i] = abs(havege_pts[i]-havege_pts[HAVEGE_LOOP_CT]);
-  havege_debug((char **)havege_pts, offsets);
+    offsets[i] = abs(h->havege_pts[i]-h->havege_pts[HAVEGE_LOOP_CT]);
+  havege_debug(hptr, (char **)h->havege_pts, offsets);
   hptr->loop_idxmax = HAVEGE_LOOP_CT;
   hptr->loop_szmax  = offsets[1];
   if (hptr->i_cache<1 || hptr->d_cache<1)
@@ -486,19 +490,39 @@ static volatile DATA_TYPE *havege_tune(H_PTR hptr)
   for(i=HAVEGE_LOOP_CT;i>0;i--)
     if (offsets[i]>sz)
       break;
-  hptr->loop_idx = loop_idx = ++i;
+  hptr->loop_idx = h->loop_idx = ++i;
   hptr->loop_sz  = offsets[i];
-  ANDPT = ((2*hptr->d_cache*1024)/sizeof(int))-1;
+  h->ANDPT = ((2*hptr->d_cache*1024)/sizeof(int))-1;
   //p    = (DATA_TYPE *) malloc((ANDPT + 4097)*sizeof(int));
   //p    = (DATA_TYPE *) calloc((ANDPT + 4097),sizeof(int));
   //buffer_to_be_freed = malloc((ANDPT + 4097)*sizeof(int));
-  buffer_to_be_freed = calloc((ANDPT + 4097),sizeof(int));
-  p = (DATA_TYPE *) buffer_to_be_freed;
+  h->buffer_to_be_freed = calloc((h->ANDPT + 4097),sizeof(int));
+  if (h->buffer_to_be_freed == NULL) {
+    h->ANDPT = 0;
+    return 0;
+  }
+  p = (DATA_TYPE *) h->buffer_to_be_freed;
   offs = (DATA_TYPE)((((LONG_DATA_TYPE)&p[4096])&0xfff)/sizeof(DATA_TYPE));
   //fprintf(stderr, "HAVEGE OFFSET %d\n",offs);
   return &p[4096-offs];
 }
 
+/**
+ * oneiteration.h and the LOOP macro refer to the variables of the instance by name
+ */
+#define ANDPT           (h->ANDPT)
+#define havege_hardtick (h->havege_hardtick)
+#define loop_idx        (h->loop_idx)
+#define havege_pwalk    (h->havege_pwalk)
+#define Pt0             (h->Pt0)
+#define Pt1             (h->Pt1)
+#define Pt2             (h->Pt2)
+#define Pt3             (h->Pt3)
+#define PT              (h->PT)
+#define PT2             (h->PT2)
+#define pt2             (h->pt2)
+#define PTtest          (h->PTtest)
+
 /**
  * The collection loop is constructed by repetitions of oneinteration.h with the
  * number of repetitions tailored to the size of the instruction cache. The use
@@ -506,9 +530,9 @@ static volatile DATA_TYPE *havege_tune(H_PTR hptr)
  * operations for an iteration but DOES NOT prevent compiler optimization of a
  * sequence of interations.
  */
-DATA_TYPE havege_collect(volatile H_PTR hptr)
+DATA_TYPE havege_collect(havege_type* h)
 {
-   volatile DATA_TYPE * RESULT = havege_bigarray;
+   volatile DATA_TYPE * RESULT = h->havege_bigarray;
    DATA_TYPE i=0,pt=0,inter=0;
 
 //fprintf(stderr,"collect, i= %d, value RESULT[%d]=%d\n",i,i,RESULT[i]);
@@ -593,8 +617,8 @@ LOOP(2,1)
 LOOP(1,0)
    #include "oneiteration.h"
 LOOP(0,0)
-   havege_sp(i,0,LOOP_PT(0));
-   havege_pwalk = havege_tune(hptr);
+   havege_sp(h,i,0,LOOP_PT(0));
+   havege_pwalk = havege_tune(h);
 loop_exit:
   //fprintf(stderr,"collect, i= %d, value RESULT[%d]=%d\n",i,i,RESULT[i]);
   //if (i > 0 ) {
@@ -604,39 +628,40 @@ loop_exit:
   //info.havege_max_pointer=i;
    return ANDPT==0? 0 : 1;
 }
+#undef ANDPT
+#undef havege_hardtick
+#undef loop_idx
+#undef havege_pwalk
+#undef Pt0
+#undef Pt1
+#undef Pt2
+#undef Pt3
+#undef PT
+#undef PT2
+#undef pt2
+#undef PTtest
+
 /**
  * This function provides additional optimizer insurance. It should never be called.
- * But because it CAN export the addresses of the calculation static variables to an
+ * But because it CAN export the addresses of the calculation variables to an
  * outside caller, this must further limit any compiler optimizations.
  */
-
-/**
- * This type is used by havege_df() as an affectation to allow static variables
- * escape the optimizers data flow analysis
- */
-typedef void volatile * VVAR;
-
-VVAR *havege_df()
+VVAR *havege_df(havege_type* h)
 {
-  static VVAR escape[16] = {
-    havege_bigarray,  // 0
-    &ANDPT,           // 1
-    &havege_hardtick, // 2
-    &havege_pwalk,    // 3
-    havege_pts,       // 4
-    &Pt0,             // 5
-    &Pt1,             // 6
-    &Pt2,             // 7
-    &Pt3,             // 8
-    &PT,              // 9
-    &PT2,             // 10
-    &pt2,             // 11
-    &PTtest,          // 12
-    0,                // 13
-    0,                // 14
-    0,                // 15
-  };
-  return escape;
+  h->escape[0]  = h->havege_bigarray;
+  h->escape[1]  = &h->ANDPT;
+  h->escape[2]  = &h->havege_hardtick;
+  h->escape[3]  = &h->havege_pwalk;
+  h->escape[4]  = h->havege_pts;
+  h->escape[5]  = &h->Pt0;
+  h->escape[6]  = &h->Pt1;
+  h->escape[7]  = &h->Pt2;
+  h->escape[8]  = &h->Pt3;
+  h->escape[9]  = &h->PT;
+  h->escape[10] = &h->PT2;
+  h->escape[11] = &h->pt2;
+  h->escape[12] = &h->PTtest;
+  return h->escape;
 }
 
 /**
@@ -645,58 +670,59 @@ VVAR *havege_df()
  * Initialize the entropy collector. An intermediate walk table twice the size
  * of the L1 data cache is allocated to be used in permutting processor time
  * stamp readings. This is meant to exercies processort TLBs.
+ * Returns NULL on failure.
  */
-int havege_init(int icache, int dcache, int flags)
+havege_type* havege_init(int icache, int dcache, int flags)
 {
-  memset( (void *) havege_bigarray, 0, sizeof(havege_bigarray));
-  ANDPT = 0;
-  havege_hardtick = 0;
-  loop_idx = HAVEGE_LOOP_CT+1;
-  havege_pwalk = NULL;
-  buffer_to_be_freed = NULL;
-  memset( (void *) havege_pts, 0, sizeof(havege_pts) );
-  Pt0 = NULL;
-  Pt1 = NULL;
-  Pt2 = NULL;
-  Pt3 = NULL;
-  PT = 0;
-  PT2 = 0;
-  pt2 = 0;
-  PTtest = 0;
-
-   info.arch    = ARCH;
-   info.vendor  = "";
-   info.generic = 0;
-   info.i_cache = icache;
-   info.d_cache = dcache;
-
-   info.havege_opts = flags;
-   if (cache_configure() && havege_collect(&info)!= 0) {
+  havege_type* h;
+
+  h = (havege_type*) calloc(1, sizeof(havege_type));
+  if ( h == NULL ) {
+    fprintf(stderr, "ERROR: havege_init: Dynamic memory allocation has failed for havege_type variable. Reported error: %s\n", strerror(errno));
+    return NULL;
+  }
+  h->havege_bigarray = (volatile DATA_TYPE *) calloc(HAVEGE_NDSIZECOLLECT + 16384, sizeof(DATA_TYPE));
+  if ( h->havege_bigarray == NULL ) {
+    fprintf(stderr, "ERROR: havege_init: Dynamic memory allocation has failed for collection buffer. Reported error: %s\n", strerror(errno));
+    free(h);
+    return NULL;
+  }
+  h->loop_idx = HAVEGE_LOOP_CT+1;
+
+   h->info.arch    = ARCH;
+   h->info.vendor  = "";
+   h->info.generic = 0;
+   h->info.i_cache = icache;
+   h->info.d_cache = dcache;
+
+   h->info.havege_opts = flags;
+   if (cache_configure(&h->info) && havege_collect(h)!= 0) {
       const int max = HAVEGE_MININITRAND*HAVEGE_CRYPTOSIZECOLLECT/HAVEGE_NDSIZECOLLECT;
       int i;
 
       for (i = 0; i < max; i++) {
-         MSC_START();
-         havege_collect(&info);
-         MSC_STOP();
-         info.etime = MSC_ELAPSED();
+         MSC_START(h);
+         havege_collect(h);
+         MSC_STOP(h);
+         h->info.etime = MSC_ELAPSED(h);
          }
-      info.havege_ndpt = 0;
-      return 0;
+      h->info.havege_ndpt = 0;
+      return h;
       }
-   return 1;
+   havege_destroy(h);
+   return NULL;
 }
 /**
  * Limit access to our state variable to those who explicity ask
  */
-H_RDR havege_state(void)
+H_RDR havege_state(const havege_type* h)
 {
-   return &info;
+   return &h->info;
 }
 /**
  * Debug dump
  */
-void havege_status(char *buf, const int buf_size)
+void havege_status(const havege_type* h, char *buf, const int buf_size)
 {
    const char *fmt =
       "arch:        %s\n"
@@ -711,102 +737,106 @@ void havege_status(char *buf, const int buf_size)
       "etime:       %d\n"
       "havege_ndpt  %d\n";
    snprintf(buf,buf_size, fmt,
-      info.arch,
-      info.vendor,
-      info.generic,
-      info.i_cache,
-      info.d_cache,
-      info.loop_idx,
-      info.loop_idxmax,
-      info.loop_sz,
-      info.loop_szmax,
-      info.etime,
-      info.havege_ndpt
+      h->info.arch,
+      h->info.vendor,
+      h->info.generic,
+      h->info.i_cache,
+      h->info.d_cache,
+      h->info.loop_idx,
+      h->info.loop_idxmax,
+      h->info.loop_sz,
+      h->info.loop_szmax,
+      h->info.etime,
+      h->info.havege_ndpt
       );
 }
 /**
  * Main access point
  */
-DATA_TYPE ndrand()
+DATA_TYPE ndrand(havege_type* h)
 {
-   if (info.havege_ndpt >= HAVEGE_NDSIZECOLLECT) {
-//     if (info.havege_ndpt >= info.havege_max_pointer) {
-      MSC_START();
-      havege_collect(&info);
-      info.havege_ndpt = 0;
-      MSC_STOP();
-      info.etime = MSC_ELAPSED();
+   if (h->info.havege_ndpt >= HAVEGE_NDSIZECOLLECT) {
+//     if (h->info.havege_ndpt >= h->info.havege_max_pointer) {
+      MSC_START(h);
+      havege_collect(h);
+      h->info.havege_ndpt = 0;
+      MSC_STOP(h);
+      h->info.etime = MSC_ELAPSED(h);
       }
-   return info.havege_buf[info.havege_ndpt++];
+   return h->info.havege_buf[h->info.havege_ndpt++];
 }
 
 //It will return pointer to READ ONLY!!! buffer containing random data. The size is returned in size parameter.
 //Please note that units are not BYTES but sizeof(DATA_TYPE) Bytes!!!!
 
-const DATA_TYPE* ndrand_remaining_buffer(unsigned int *size) {
-   DATA_TYPE position=info.havege_ndpt;
-   if (info.havege_ndpt >= HAVEGE_NDSIZECOLLECT) {
-//     if (info.havege_ndpt >= info.havege_max_pointer) {
-      MSC_START();
-      havege_collect(&info);
-      info.havege_ndpt = 0;
-      MSC_STOP();
-      info.etime = MSC_ELAPSED();
+const DATA_TYPE* ndrand_remaining_buffer(havege_type* h, unsigned int *size) {
+   DATA_TYPE position=h->info.havege_ndpt;
+   if (h->info.havege_ndpt >= HAVEGE_NDSIZECOLLECT) {
+//     if (h->info.havege_ndpt >= h->info.havege_max_pointer) {
+      MSC_START(h);
+      havege_collect(h);
+      h->info.havege_ndpt = 0;
+      MSC_STOP(h);
+      h->info.etime = MSC_ELAPSED(h);
       }
-   *size = HAVEGE_NDSIZECOLLECT - info.havege_ndpt;
-   info.havege_ndpt = HAVEGE_NDSIZECOLLECT;
-   return info.havege_buf+position;
+   *size = HAVEGE_NDSIZECOLLECT - h->info.havege_ndpt;
+   h->info.havege_ndpt = HAVEGE_NDSIZECOLLECT;
+   return h->info.havege_buf+position;
 }
 
 //It will return pointer to READ ONLY!!! buffer containing random data. Size is guaranteed to be HAVEGE_NDSIZECOLLECT
 //Please note that units are not BYTES but sizeof(DATA_TYPE) Bytes!!!!
-const DATA_TYPE* ndrand_full_buffer() {
-   if (info.havege_ndpt > 0) {
-      MSC_START();
-      havege_collect(&info);
-      info.havege_ndpt = 0;
-      MSC_STOP();
-      info.etime = MSC_ELAPSED();
+const DATA_TYPE* ndrand_full_buffer(havege_type* h) {
+   if (h->info.havege_ndpt > 0) {
+      MSC_START(h);
+      havege_collect(h);
+      h->info.havege_ndpt = 0;
+      MSC_STOP(h);
+      h->info.etime = MSC_ELAPSED(h);
       }
-   info.havege_ndpt = HAVEGE_NDSIZECOLLECT;
-   //fwrite(info.havege_buf, sizeof(DATA_TYPE), HAVEGE_NDSIZECOLLECT, stdout);
-   return info.havege_buf;
+   h->info.havege_ndpt = HAVEGE_NDSIZECOLLECT;
+   //fwrite(h->info.havege_buf, sizeof(DATA_TYPE), HAVEGE_NDSIZECOLLECT, stdout);
+   return h->info.havege_buf;
 }
 
-void havege_destroy() {
-  free(buffer_to_be_freed);
+void havege_destroy(havege_type* h) {
+  if ( h == NULL ) return;
+  free(h->buffer_to_be_freed);
+  free((void *) h->havege_bigarray);
+  memset(h, 0, sizeof(havege_type));
+  free(h);
 }
 
 //Please note that units are not BYTES but sizeof(DATA_TYPE) Bytes!!!!
-size_t generate_words_using_havege (DATA_TYPE* output_buffer, size_t output_size) {
+size_t generate_words_using_havege (havege_type* h, DATA_TYPE* output_buffer, size_t output_size) {
   size_t words_written = 0;
   size_t words_to_produce = output_size;
   size_t words_ready;
   DATA_TYPE* p = output_buffer;
 
   while ( words_written < output_size ) {
-    if (info.havege_ndpt >= HAVEGE_NDSIZECOLLECT) {
+    if (h->info.havege_ndpt >= HAVEGE_NDSIZECOLLECT) {
       //Generate new data
-      MSC_START();
-      havege_collect(&info);
-      info.havege_ndpt = 0;
-      MSC_STOP();
-      info.etime = MSC_ELAPSED();
+      MSC_START(h);
+      havege_collect(h);
+      h->info.havege_ndpt = 0;
+      MSC_STOP(h);
+      h->info.etime = MSC_ELAPSED(h);
     }
-    //Available bytes: HAVEGE_NDSIZECOLLECT - info.havege_ndpt
-    //if ( info.havege_ndpt >= HAVEGE_NDSIZECOLLECT) return bytes_written;
+    //Available bytes: HAVEGE_NDSIZECOLLECT - h->info.havege_ndpt
+    //if ( h->info.havege_ndpt >= HAVEGE_NDSIZECOLLECT) return bytes_written;
 
-    words_ready = HAVEGE_NDSIZECOLLECT - info.havege_ndpt;
+    words_ready = HAVEGE_NDSIZECOLLECT - h->info.havege_ndpt;
 
    if ( words_ready < words_to_produce ) {
-      memcpy(p, info.havege_buf+info.havege_ndpt, sizeof(DATA_TYPE) * words_ready );
+      memcpy(p, h->info.havege_buf+h->info.havege_ndpt, sizeof(DATA_TYPE) * words_ready );
       words_written +=  words_ready;
       p += words_ready;
       words_to_produce -= words_ready;
-      info.havege_ndpt += words_ready;
+      h->info.havege_ndpt += words_ready;
    } else {
-     memcpy(p, info.havege_buf+info.havege_ndpt, sizeof(DATA_TYPE) * words_to_produce );
-     info.havege_ndpt += words_to_produce;
+     memcpy(p, h->info.havege_buf+h->info.havege_ndpt, sizeof(DATA_TYPE) * words_to_produce );
+     h->info.havege_ndpt += words_to_produce;
      words_written +=  words_to_produce;
      ///fwrite(output_buffer, sizeof(DATA_TYPE), words_written, stdout);
      return words_written;
@@ -0,0 +1,125 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+health_tests.c -- NIST SP 800-90B continuous health tests of the noise sources
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "csprng/health_tests.h"
+
+//{{{ static unsigned int critbinom ( int n, double p, int alpha_log2 )
+/*
+ * Smallest k with P(X <= k) >= 1 - 2^-alpha_log2 for X ~ B(n, p), 0 < p < 1. The upper tail is summed
+ * from k = n down in the log domain, the probabilities of the small k underflow (1 - p)^n otherwise
+ */
+static unsigned int critbinom ( int n, double p, int alpha_log2 )
+{
+  const double alpha = ldexp(1.0, -alpha_log2);
+  double tail = 0.0;
+  int k;
+
+  for ( k = n; k > 0; --k ) {
+    tail += exp(lgamma(n + 1.0) - lgamma(k + 1.0) - lgamma(n - k + 1.0) + k * log(p) + ( n - k ) * log1p(-p));
+    if ( tail > alpha ) return k;
+  }
+  return 0;
+}
+//}}}
+
+//{{{ int health_test_cutoffs(double min_entropy, int alpha_log2, unsigned int *rct_cutoff, unsigned int *apt_cutoff)
+int health_test_cutoffs(double min_entropy, int alpha_log2, unsigned int *rct_cutoff, unsigned int *apt_cutoff)
+{
+  if ( ! ( min_entropy > 0.0 && min_entropy <= 8.0 ) || alpha_log2 < 1 || alpha_log2 > 64 ) {
+    fprintf(stderr, "health_test_cutoffs: expecting min-entropy in range (0, 8] and alpha_log2 in range <1, 64>, got %g and %d\n",
+        min_entropy, alpha_log2);
+    return 1;
+  }
+  *rct_cutoff = 1 + (unsigned int) ceil(alpha_log2 / min_entropy);
+  *apt_cutoff = 1 + critbinom(HEALTH_TEST_APT_WINDOW, exp2(-min_entropy), alpha_log2);
+  return 0;
+}
+//}}}
+
+//{{{ int health_test_init(health_test_ctx_t *ctx, double min_entropy, int alpha_log2)
+int health_test_init(health_test_ctx_t *ctx, double min_entropy, int alpha_log2)
+{
+  memset(ctx, 0, sizeof(health_test_ctx_t));
+  if ( health_test_cutoffs(min_entropy, alpha_log2, &ctx->rct_cutoff, &ctx->apt_cutoff) ) return 1;
+  ctx->min_entropy = min_entropy;
+  return 0;
+}
+//}}}
+
+//{{{ unsigned int health_test_run(health_test_ctx_t *ctx, const unsigned char *buf, size_t len)
+/*
+ * Both tests are done in one pass without branches on the data. The run length stops one past
+ * the cutoff, so a stuck source fails once per run however long it is. The first sample of a window
+ * is counted by the loop as a copy of itself
+ */
+unsigned int health_test_run(health_test_ctx_t *ctx, const unsigned char *buf, size_t len)
+{
+  const unsigned int rct_cutoff = ctx->rct_cutoff;
+  const unsigned int apt_cutoff = ctx->apt_cutoff;
+  unsigned int rct_count = ctx->rct_count;
+  unsigned int apt_count = ctx->apt_count;
+  unsigned int apt_index = ctx->apt_index;
+  unsigned char rct_value = ctx->rct_value;
+  unsigned char apt_value = ctx->apt_value;
+  unsigned int rct_failures = 0, apt_failures = 0, same;
+  size_t i = 0, n, end;
+  unsigned char x;
+
+  while ( i < len ) {
+    if ( apt_index == 0 ) {
+      apt_value = buf[i];
+      apt_count = 0;
+    }
+    n = len - i;
+    if ( n > HEALTH_TEST_APT_WINDOW - apt_index ) n = HEALTH_TEST_APT_WINDOW - apt_index;
+
+    for ( end = i + n; i < end; ++i ) {
+      x = buf[i];
+      rct_count = ( x == rct_value ) ? rct_count + ( rct_count <= rct_cutoff ) : 1;
+      rct_failures += ( rct_count == rct_cutoff );
+      rct_value = x;
+      same = ( x == apt_value );
+      apt_count += same;
+      apt_failures += same & ( apt_count == apt_cutoff );
+    }
+
+    apt_index += n;
+    if ( apt_index == HEALTH_TEST_APT_WINDOW ) apt_index = 0;
+  }
+
+  ctx->rct_count = rct_count;
+  ctx->apt_count = apt_count;
+  ctx->apt_index = apt_index;
+  ctx->rct_value = rct_value;
+  ctx->apt_value = apt_value;
+  ctx->statistics.samples += len;
+  ctx->statistics.rct_failures += rct_failures;
+  ctx->statistics.apt_failures += apt_failures;
+  return rct_failures + apt_failures;
+}
+//}}}
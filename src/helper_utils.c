@@ -70,7 +70,7 @@ static const char *power_letter[] = {
 };
 
 const char* human_print_int (uint64_t number_of_bytes) {
-  static char buf[64];
+  static __thread char buf[64];
   int size = sizeof(buf);
   uint64_t integer_part = number_of_bytes;
   uint64_t remainder = number_of_bytes;
@@ -99,7 +99,7 @@ const char* human_print_int (uint64_t number_of_bytes) {
 }
 
 const char* human_print_ldouble (uint64_t number_of_bytes) {
-  static char buf[16];
+  static __thread char buf[16];
   int size = sizeof(buf);
   unsigned int human_bytes_index = 0;
   int ret;
@@ -119,7 +119,7 @@ const char* human_print_ldouble (uint64_t number_of_bytes) {
 }
 
 const char* human_print_ldouble_left_alligned (uint64_t number_of_bytes) {
-  static char buf[16];
+  static __thread char buf[16];
   int size = sizeof(buf);
   unsigned int human_bytes_index = 0;
   int ret;
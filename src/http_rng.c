@@ -55,11 +55,6 @@ const char* const http_random_source_port[HTTP_COUNT] = { "80", "80", "80", "122
 //const char* const http_random_source_server[HTTP_COUNT] = { "localhost", "www.random.org", "www.randomnumbers.info", "random.irb.hr" };
 //const char* const http_random_source_port[HTTP_COUNT] = { "8080", "80", "80", "1227" };
 
-typedef struct {
-  http_random_source_t source;
-  http_random_state_t* state;
-} http_random_thread_arg_t;
-
 typedef struct {
   http_random_source_t* source;
   uint8_t** data;
@@ -70,30 +65,11 @@ typedef struct {
   struct addrinfo** resolve_addr_p;
   struct QRBG** p_QRBG;
   char* verbosity;
+  http_random_state_t* state;
 } http_random_producer_cancel_t;
 
-typedef struct {
-  char* name;
-  size_t size;
-  uint8_t mlocked;
-} string_with_mlock;
-
-static string_with_mlock QRBG_RNG_user;
-static string_with_mlock QRBG_RNG_passwd;
-
-static pthread_t thread[HTTP_COUNT];  //0=> HOTBITS, 1=>RANDOM_ORG, 2=>RANDOMNUMBERS_INFO
-static pthread_cond_t empty, fill;    //Signals to control multiple producers/ one consumer
-static pthread_mutex_t mutex;         //Guards access control to http_random_state_t
-
-static pthread_mutex_t state_mutex;                //Guards acces control to thread_running array
-static pthread_cond_t state_cond;                  //Signal that thread state has changed
-static http_random_thread_state_t thread_running[HTTP_COUNT] = { 0 }; //Index 0=> HOTBITS, 1=>RANDOM_ORG, 2=>RANDOMNUMBERS_INFO .
-static http_random_thread_arg_t input[HTTP_COUNT];
-
 //static uint8_t http_random_source_mask[HTTP_COUNT] = { 1, 2, 4 , 8 };
-static uint8_t http_random_source_mask[HTTP_COUNT] = { MASK_HOTBITS, MASK_RANDOM_ORG, MASK_RANDOMNUMBERS_INFO, MASK_QRBG };
-
-static uint8_t init = 0;                        //Only one init is allowed
+static const uint8_t http_random_source_mask[HTTP_COUNT] = { MASK_HOTBITS, MASK_RANDOM_ORG, MASK_RANDOMNUMBERS_INFO, MASK_QRBG };
 //}}}
 
 //{{{ static uint32_t bitmask (uint8_t num_of_bits) 
@@ -131,15 +107,15 @@ static uint32_t bitmask_offset (uint8_t num_of_bits, uint8_t offset)
 }
 //}}}
 
-//{{{ static void safe_sleep(unsigned long sec, char source)
+//{{{ static void safe_sleep(http_random_state_t* state, unsigned long sec, char source)
 //Thread safe sleep which does not interfere with alarm signal
 //Link with -lrt
-static void safe_sleep(unsigned long sec, uint8_t source, char verbosity)
+static void safe_sleep(http_random_state_t* state, unsigned long sec, uint8_t source, char verbosity)
 {
-  pthread_mutex_lock( &state_mutex );
-  thread_running[source] = STATE_SLEEPING;
-  pthread_cond_signal( &state_cond);
-  pthread_mutex_unlock( &state_mutex);
+  pthread_mutex_lock( &state->state_mutex );
+  state->thread_running[source] = STATE_SLEEPING;
+  pthread_cond_signal( &state->state_cond);
+  pthread_mutex_unlock( &state->state_mutex);
 
 
   //Index 0 => current time
@@ -173,10 +149,10 @@ static void safe_sleep(unsigned long sec, uint8_t source, char verbosity)
   while(nanosleep(&req,&req)==-1)
     continue;
 
-  pthread_mutex_lock( &state_mutex );
-  thread_running[source] = STATE_RUNNING;
-  pthread_cond_signal( &state_cond);
-  pthread_mutex_unlock( &state_mutex);
+  pthread_mutex_lock( &state->state_mutex );
+  state->thread_running[source] = STATE_RUNNING;
+  pthread_cond_signal( &state->state_cond);
+  pthread_mutex_unlock( &state->state_mutex);
 }
 //}}}
 
@@ -368,6 +344,7 @@ end_of_random_org_quota:
 //{{{ void http_random_producer_cleanup (void *arg)
 void http_random_producer_cleanup (void *arg) {
   http_random_producer_cancel_t *input = (http_random_producer_cancel_t *) arg;
+  http_random_state_t* state = input->state;
 
   if ( *input->verbosity > 1 ) fprintf(stderr, "http_random_producer_cleanup for %s\n", http_random_source_names[*input->source]);
   if ( *input->data != NULL ) free(*input->data);
@@ -379,10 +356,10 @@ void http_random_producer_cleanup (void *arg) {
   if ( *input->p_QRBG != NULL ) deleteQRBG(*input->p_QRBG);
   *input->p_QRBG = NULL;
 
-  pthread_mutex_lock( &state_mutex );
-  thread_running[*input->source] = STATE_FINISHED;
-  pthread_cond_signal( &state_cond );
-  pthread_mutex_unlock( &state_mutex );
+  pthread_mutex_lock( &state->state_mutex );
+  state->thread_running[*input->source] = STATE_FINISHED;
+  pthread_cond_signal( &state->state_cond );
+  pthread_mutex_unlock( &state->state_mutex );
 
 }
 //}}}
@@ -419,12 +396,12 @@ void mux_cleanup(void *arg) {
 }
 //}}}
 
-//{{{ static void delete_name_and_password ()
-static void delete_name_and_password ()
+//{{{ static void delete_name_and_password (http_random_state_t* state)
+static void delete_name_and_password (http_random_state_t* state)
 {
   //fprintf(stderr, "delete_name_and_password\n");
-  clear_string_with_mlock(&QRBG_RNG_user);
-  clear_string_with_mlock(&QRBG_RNG_passwd);
+  clear_string_with_mlock(&state->QRBG_RNG_user);
+  clear_string_with_mlock(&state->QRBG_RNG_passwd);
 }
 //}}}
 
@@ -459,15 +436,15 @@ static void delete_name_and_password ()
 }
 //}}}
 
-//{{{ static uint8_t copy_name_and_password (const char* QRBG_RNG_user_input,  const char* QRBG_RNG_passwd_input)
-static uint8_t copy_name_and_password (const char* QRBG_RNG_user_input,  const char* QRBG_RNG_passwd_input)
+//{{{ static uint8_t copy_name_and_password (http_random_state_t* state, const char* QRBG_RNG_user_input,  const char* QRBG_RNG_passwd_input)
+static uint8_t copy_name_and_password (http_random_state_t* state, const char* QRBG_RNG_user_input,  const char* QRBG_RNG_passwd_input)
 {
   //fprintf(stderr, "copy_name_and_password\n");
-  if ( set_string_with_mlock(&QRBG_RNG_user,   QRBG_RNG_user_input) == 0 && 
-       set_string_with_mlock(&QRBG_RNG_passwd, QRBG_RNG_passwd_input) == 0 ) {
+  if ( set_string_with_mlock(&state->QRBG_RNG_user,   QRBG_RNG_user_input) == 0 && 
+       set_string_with_mlock(&state->QRBG_RNG_passwd, QRBG_RNG_passwd_input) == 0 ) {
     return 0;
   } else {
-    delete_name_and_password();
+    delete_name_and_password(state);
     return 1;
   }
     
@@ -482,11 +459,13 @@ static void* http_random_producer( void *arg_ptr ) {
 //{{{ Init
   volatile size_t size, buf_size;        //How much bytes can we request, local buffer size
   uint8_t *data, *end;                   //Local buffer
+  uint8_t *chunk;                        //Part of the local buffer not yet added to the common buffer
   volatile size_t valid_data;            //Amount of valid bytes in the local buf
   volatile unsigned int zero_round = 0;  //Count fatal ERRORs
 
   int n;
   int rc;
+  int fips_result;
   struct timeval timeout;      
   timeout.tv_sec = 60;
   timeout.tv_usec = 0;
@@ -513,19 +492,19 @@ static void* http_random_producer( void *arg_ptr ) {
   http_random_producer_cancel_t http_random_producer_cancel;
 
 
-  pthread_mutex_lock( &mutex );
   input = ( http_random_thread_arg_t* ) arg_ptr;
   http_random_source_t source = input->source;
   http_random_state_t* state = input->state;
+  pthread_mutex_lock( &state->mutex );
   verbosity = state->verbosity;
-  pthread_mutex_unlock( &mutex );
+  pthread_mutex_unlock( &state->mutex );
 
 
   if ( source < HTTP_COUNT ) {
-    pthread_mutex_lock( &state_mutex );
-    thread_running[source] = STATE_RUNNING;
-    pthread_cond_signal( &state_cond);
-    pthread_mutex_unlock( &state_mutex);
+    pthread_mutex_lock( &state->state_mutex );
+    state->thread_running[source] = STATE_RUNNING;
+    pthread_cond_signal( &state->state_cond);
+    pthread_mutex_unlock( &state->state_mutex);
   } else {
     return NULL;
   }
@@ -553,6 +532,7 @@ static void* http_random_producer( void *arg_ptr ) {
   http_random_producer_cancel.resolve_addr_p = &resolve_addr_p;
   http_random_producer_cancel.p_QRBG = &p_QRBG;
   http_random_producer_cancel.verbosity = &state->verbosity;
+  http_random_producer_cancel.state = state;
 
 
   pthread_cleanup_push( http_random_producer_cleanup, (void *)&http_random_producer_cancel );
@@ -628,12 +608,12 @@ static void* http_random_producer( void *arg_ptr ) {
         goto end_of_http_random_producer;
       }
 
-      rc = defineUserQRBG(p_QRBG, QRBG_RNG_user.name, QRBG_RNG_passwd.name);
+      rc = defineUserQRBG(p_QRBG, state->QRBG_RNG_user.name, state->QRBG_RNG_passwd.name);
       if ( rc ) {
         fprintf(stderr, "ERROR: http_random_producer: defineUserQRBG failure\n");
         goto end_of_http_random_producer;
       }
-      delete_name_and_password();
+      delete_name_and_password(state);
 
       break;
 
@@ -670,7 +650,7 @@ static void* http_random_producer( void *arg_ptr ) {
       }
 
       if ( sleeptime > max_sleep ) sleeptime = max_sleep;
-      safe_sleep( sleeptime, source, verbosity );
+      safe_sleep( state, sleeptime, source, verbosity );
 
       //ERROR has occured. Make sleeptime exponentially longer
       if ( zero_round > 0 ) {
@@ -943,21 +923,21 @@ static void* http_random_producer( void *arg_ptr ) {
     //fprintf(stderr, "http_random_producer:  %s waiting fox mux\n", http_random_source_names[source]);
 
     //Make sure that we will release the mutex when thread is cancelled.
-    pthread_cleanup_push(mux_cleanup, (void *) &mutex);
-    pthread_mutex_lock( &mutex );
+    pthread_cleanup_push(mux_cleanup, (void *) &state->mutex);
+    pthread_mutex_lock( &state->mutex );
 
     //fprintf(stderr, "http_random_producer:  got mutex\n");
-    pthread_mutex_lock( &state_mutex );
-    thread_running[source] = STATE_WAITING_FOR_BUFFER_TO_BE_EMPTY;
-    pthread_cond_signal( &state_cond);
-    pthread_mutex_unlock( &state_mutex);
+    pthread_mutex_lock( &state->state_mutex );
+    state->thread_running[source] = STATE_WAITING_FOR_BUFFER_TO_BE_EMPTY;
+    pthread_cond_signal( &state->state_cond);
+    pthread_mutex_unlock( &state->state_mutex);
 
-    while (state->size - state->valid_data < valid_data) pthread_cond_wait( &empty, &mutex );
+    while (state->size - state->valid_data < valid_data) pthread_cond_wait( &state->empty, &state->mutex );
 
-    pthread_mutex_lock( &state_mutex );
-    thread_running[source] = STATE_RUNNING;
-    pthread_cond_signal( &state_cond);
-    pthread_mutex_unlock( &state_mutex);
+    pthread_mutex_lock( &state->state_mutex );
+    state->thread_running[source] = STATE_RUNNING;
+    pthread_cond_signal( &state->state_cond);
+    pthread_mutex_unlock( &state->state_mutex);
 
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
     // 1. Rewind buffer
@@ -966,23 +946,28 @@ static void* http_random_producer( void *arg_ptr ) {
     }
     state->buf_start =  state->buf;
 
-    //Fill buffer
-    memcpy(state->buf_start + state->valid_data, data, valid_data);
-    state->valid_data += valid_data;
-    if ( verbosity > 1 ) fprintf(stderr, "http_random_producer: %s added %zu bytes, resulting in %zu available bytes in buffer from which %zu are FIPS validated\n", 
+    if ( verbosity > 1 ) fprintf(stderr, "http_random_producer: %s adding %zu bytes to %zu available bytes in buffer from which %zu are FIPS validated\n", 
         http_random_source_names[source], valid_data, state->valid_data, state->fips_valided);
     state->data_added[source] += valid_data;
 
-    //FIPS testing
-    while ( state->valid_data - state->fips_valided >= FIPS_RNG_BUFFER_SIZE ) {
+    //Fill buffer and perform FIPS testing. Local buffer is tested in place and copied up to the end of the
+    //FIPS block, so that the bytes behind fips_valided are always the current block. Failed block is dropped from the end.
+    chunk = data;
+    while ( chunk < data + valid_data ) {
+      n = fips_update(&state->fips_ctx, chunk, data + valid_data - chunk);
+      memcpy(state->buf_start + state->valid_data, chunk, n);
+      state->valid_data += n;
+      chunk += n;
+
+      fips_result = fips_block_ready(&state->fips_ctx);
+      if ( fips_result < 0 ) continue;
+
       ++state->fips_tests_executed[source] ;
-      if ( fips_run_rng_test(&state->fips_ctx, state->buf_start + state->fips_valided) ) {
+      if ( fips_result ) {
         //FIPS test has failed
         ++state->fips_fails[source];
         ++ state->fips_fails_in_row;
         if ( state->fips_fails_in_row > state->max_fips_fails_in_row ) state->max_fips_fails_in_row =  state->fips_fails_in_row;
-        if ( verbosity > 1 ) fprintf(stderr, "http_random_producer: %s has rejectected %d bytes because of FIPS test failure, resulting in %zu available bytes in buffer from which %zu are FIPS validated\n", 
-            http_random_source_names[source], FIPS_RNG_BUFFER_SIZE, state->valid_data, state->fips_valided);
         if ( state->fips_fails_in_row > 2 ) {
           if ( verbosity > 0 ) {
             fprintf(stderr, "ERROR: http_random_producer: %s. Allready %zu FIPS tests has failed in row. We will output FIPS tested data\n", http_random_source_names[source], state->fips_fails_in_row);
@@ -996,36 +981,26 @@ static void* http_random_producer( void *arg_ptr ) {
           }
         }
 
-        if ( state->fips_valided == 0 ) {
-          //We just need to move the beginning of the buffer
-          state->buf_start += FIPS_RNG_BUFFER_SIZE;
-          state->valid_data -= FIPS_RNG_BUFFER_SIZE;
-        } else {
-          //We have a hole in the data
-          if ( state->valid_data - state->fips_valided - FIPS_RNG_BUFFER_SIZE > 0 ) {
-            memcpy(state->buf_start + state->fips_valided, 
-                state->buf_start + state->fips_valided + FIPS_RNG_BUFFER_SIZE, 
-                state->valid_data - state->fips_valided - FIPS_RNG_BUFFER_SIZE);
-          }
-          state->valid_data -= FIPS_RNG_BUFFER_SIZE;
-        }
+        state->valid_data = state->fips_valided;
+        if ( verbosity > 1 ) fprintf(stderr, "http_random_producer: %s has rejectected %d bytes because of FIPS test failure, resulting in %zu available bytes in buffer from which %zu are FIPS validated\n", 
+            http_random_source_names[source], FIPS_RNG_BUFFER_SIZE, state->valid_data, state->fips_valided);
 
       } else {
         //FIPS test has passed
         data_added = 1;
         state->fips_fails_in_row = 0;
-        state->fips_valided += FIPS_RNG_BUFFER_SIZE;
+        state->fips_valided = state->valid_data;
         if ( verbosity > 1 ) fprintf(stderr, "http_random_producer: %s has FIPS validated block of data, resulting in %zu FIPS validated data in buffer\n", http_random_source_names[source], state->fips_valided);
       }
     }
 
     if ( data_added ) {
-      pthread_cond_signal( &fill );
+      pthread_cond_signal( &state->fill );
     }
 
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 
-    pthread_mutex_unlock( &mutex );
+    pthread_mutex_unlock( &state->mutex );
     pthread_cleanup_pop(0);         /* Mutex has been released, cancel clenup handler execution */
 
     pthread_testcancel();           /* A cancellation point */
@@ -1036,7 +1011,7 @@ static void* http_random_producer( void *arg_ptr ) {
 end_of_http_random_producer:
   if ( verbosity > 0 ) fprintf(stderr, "http_random_producer: %s ending thread\n", http_random_source_names[source]);
   pthread_cleanup_pop (1);
-  if ( source == QRBG_RNG ) delete_name_and_password();
+  if ( source == QRBG_RNG ) delete_name_and_password(state);
   return ( (void *) 0 );
 
 }
@@ -1054,24 +1029,22 @@ http_random_state_t* http_random_init(char source, size_t size, char verbosity,
   assert(size>=16384);               //Or at least FIPS_RNG_BUFFER_SIZE + 8192 = 2500 + 8192 = 10692 Bytes. 
                                      //Possible dead lock if buffer is smaller than FIPS_RNG_BUFFER_SIZE + MAX(local buffer size, over all producers)
   
-  if ( init ) {
-    fprintf(stderr, "ERROR: http_random_init: only one instance of http_random generator is allowed\n");
+  state = (http_random_state_t*) calloc( 1, sizeof(http_random_state_t));
+  if ( state ==NULL ) {
+    fprintf(stderr, "ERROR: Dynamic memory allocation has failed for buffer of size %zu. Reported error: %s\n", sizeof(http_random_state_t), strerror(errno));
     return NULL;
-  } else {
-    init = 1;
   }
 
-
   if ( ( source & http_random_source_mask[QRBG_RNG] ) == http_random_source_mask[QRBG_RNG] ) {
-    reset_string_with_mlock(&QRBG_RNG_user);
-    reset_string_with_mlock(&QRBG_RNG_passwd);
+    reset_string_with_mlock(&state->QRBG_RNG_user);
+    reset_string_with_mlock(&state->QRBG_RNG_passwd);
     //Check if user & password has been provided for QRBG_RNG
     if ( QRBG_RNG_user_input == NULL || QRBG_RNG_passwd_input == NULL ) {
       fprintf(stderr, "ERROR: http_random_init: %s generator has been requested but either USERNAME and/or PASSWORD has not been provided. Disabling %s.\n", http_random_source_names[QRBG_RNG], http_random_source_names[QRBG_RNG]);
       source &= ~ http_random_source_mask[QRBG_RNG];     //Set http_random_source_mask[QRBG_RNG] bit to ZERO
     } else {
       //Copy username and password
-      if ( copy_name_and_password( QRBG_RNG_user_input, QRBG_RNG_passwd_input) ) {
+      if ( copy_name_and_password( state, QRBG_RNG_user_input, QRBG_RNG_passwd_input) ) {
         fprintf(stderr, "ERROR: http_random_init: generator %s. Error while copying username and/or password. Disabling %s.\n", http_random_source_names[QRBG_RNG], http_random_source_names[QRBG_RNG]);
         source &= ~ http_random_source_mask[QRBG_RNG];     //Set http_random_source_mask[QRBG_RNG] bit to ZERO
       }
@@ -1079,30 +1052,21 @@ http_random_state_t* http_random_init(char source, size_t size, char verbosity,
 
     if ( source == 0 ) {
       fprintf(stderr, "ERROR: http_random_init: No other generator than %s has been specified, http_random_init has failed.\n", http_random_source_names[QRBG_RNG] );
+      free(state);
       return NULL;
     }
 
   }
 
-
-
-  pthread_mutex_lock( &state_mutex );
   for ( i=HOTBITS_RNG; i<HTTP_COUNT; ++i) {
-    thread_running[i] = STATE_NOT_STARTED;
-  }
-  pthread_cond_signal( &state_cond);
-  pthread_mutex_unlock( &state_mutex);
-
-
-  state = (http_random_state_t*) calloc( 1, sizeof(http_random_state_t));
-  if ( state ==NULL ) {
-    fprintf(stderr, "ERROR: Dynamic memory allocation has failed for buffer of size %zu. Reported error: %s\n", sizeof(http_random_state_t), strerror(errno));
-    return NULL;
+    state->thread_running[i] = STATE_NOT_STARTED;
   }
 
   state->buf	= (uint8_t*) calloc ( 1, size );
   if ( state->buf ==NULL ) {
     fprintf(stderr, "ERROR: Dynamic memory allocation has failed for buffer of size %zu. Reported error: %s\n", size, strerror(errno));
+    delete_name_and_password(state);
+    free(state);
     return NULL;
   }
 
@@ -1122,19 +1086,19 @@ http_random_state_t* http_random_init(char source, size_t size, char verbosity,
   state->verbosity = verbosity;
   fips_init( &state->fips_ctx, last32, 0);
 
-  pthread_mutex_init( &mutex, NULL);
-  pthread_mutex_init( &state_mutex, NULL);
+  pthread_mutex_init( &state->mutex, NULL);
+  pthread_mutex_init( &state->state_mutex, NULL);
 
-  pthread_cond_init( &fill, NULL);
-  pthread_cond_init( &empty, NULL);
-  pthread_cond_init( &state_cond, NULL);
+  pthread_cond_init( &state->fill, NULL);
+  pthread_cond_init( &state->empty, NULL);
+  pthread_cond_init( &state->state_cond, NULL);
 
   for ( i=HOTBITS_RNG; i<HTTP_COUNT; ++i) {
     if ((source & http_random_source_mask[i]) == http_random_source_mask[i]) {
-      input[i].source = i;
-      input[i].state = state;
+      state->input[i].source = i;
+      state->input[i].state = state;
 
-      rc = pthread_create(&thread[i], NULL, http_random_producer, (void *) &input[i]);
+      rc = pthread_create(&state->thread[i], NULL, http_random_producer, (void *) &state->input[i]);
       if (rc){
         fprintf(stderr, "ERROR: return code from pthread_create() for %s is %d\n", http_random_source_names[i], rc);
       }
@@ -1158,7 +1122,7 @@ unsigned int http_random_generate(http_random_state_t* state, uint8_t* output, s
   char verbosity;
   struct sigaction sigact[4];
 
-  pthread_mutex_lock( &mutex );
+  pthread_mutex_lock( &state->mutex );
   verbosity = state->verbosity;
 
   sigemptyset( &sigact[0].sa_mask );
@@ -1175,7 +1139,7 @@ unsigned int http_random_generate(http_random_state_t* state, uint8_t* output, s
     ts.tv_sec += max_timeout;               //WAIT TIME IN SECONDS
     if ( verbosity > 1 ) fprintf(stderr,"http_random_generate: available FIPS validated %zu bytes. Bytes requested %zu. Waiting for max %u seconds.\n", 
         state->fips_valided, size, max_timeout);
-    rc = pthread_cond_timedwait(&fill, &mutex, &ts);
+    rc = pthread_cond_timedwait(&state->fill, &state->mutex, &ts);
     if (rc == ETIMEDOUT) {
       if ( verbosity > 1 ) fprintf(stderr, "http_random_generate: pthread_cond_timedwait timed out!\n");
       if ( verbosity > 1 ) fprintf(stderr, "http_random_generate: FIPS validated bytes available %zu, bytes requested %zu\n", state->fips_valided, size);
@@ -1184,8 +1148,8 @@ unsigned int http_random_generate(http_random_state_t* state, uint8_t* output, s
         break;
       } else {
         fprintf(stderr, "ERROR: http_random_generate: No bytes currently available!\n");
-        pthread_cond_signal(&empty);
-        pthread_mutex_unlock(&mutex);
+        pthread_cond_signal(&state->empty);
+        pthread_mutex_unlock(&state->mutex);
         return 0;
       }
     }
@@ -1200,8 +1164,8 @@ unsigned int http_random_generate(http_random_state_t* state, uint8_t* output, s
   state->fips_valided -= size;
   state->buf_start += size;
 
-  pthread_cond_signal(&empty);
-  pthread_mutex_unlock(&mutex);
+  pthread_cond_signal(&state->empty);
+  pthread_mutex_unlock(&state->mutex);
 
   return size;
 }
@@ -1214,32 +1178,30 @@ unsigned int http_random_destroy(http_random_state_t* state) {
   uint8_t i;
   uint8_t call_pthread_cancel;
 
-  if ( ! init ) {
+  if ( state == NULL ) {
     fprintf(stderr, "ERROR: http_random_destroy: http_random_init has not been called\n");
     return 1;
-  } else {
-    init = 0;
   }
   for ( i=HOTBITS_RNG; i<HTTP_COUNT; ++i) {
     if ((state->source & http_random_source_mask[i]) == http_random_source_mask[i]) {
-      if ( pthread_mutex_trylock ( &state_mutex ) ) {
+      if ( pthread_mutex_trylock ( &state->state_mutex ) ) {
         //Mutex is locked by another thread => call cancel without checking the status
         call_pthread_cancel = 1;
        } else {
         //We got mutex => can check the state
-        if ( thread_running[i] == STATE_FINISHED ) {
+        if ( state->thread_running[i] == STATE_FINISHED ) {
           call_pthread_cancel = 0;
         } else {
           call_pthread_cancel = 1;
         }
         //Release mutex
-        pthread_mutex_unlock( &state_mutex );
+        pthread_mutex_unlock( &state->state_mutex );
       }
 
       if ( call_pthread_cancel == 1 ) {
         if ( state->verbosity > 1 ) fprintf(stderr, "INFO: http_random_destroy: We will call pthread_cancel for thread %s\n",
             http_random_source_names[i]);
-        rc = pthread_cancel(thread[i]);
+        rc = pthread_cancel(state->thread[i]);
         if (rc) {
           fprintf(stderr, "ERROR: http_random_destroy. Return code from pthread_cancel() for %s is %d\n", http_random_source_names[i], rc);
         }
@@ -1247,8 +1209,8 @@ unsigned int http_random_destroy(http_random_state_t* state) {
         if ( state->verbosity > 1 ) fprintf(stderr, "INFO: http_random_destroy: thread %s has already finished, we will call pthread_join\n",
             http_random_source_names[i]);
       }
-      //rc = pthread_join(thread[i], &status);
-      rc = pthread_join(thread[i], NULL);
+      //rc = pthread_join(state->thread[i], &status);
+      rc = pthread_join(state->thread[i], NULL);
       if (rc) {
         fprintf(stderr, "ERROR: http_random_destroy. Return code from pthread_join() for %s is %d\n", http_random_source_names[i], rc);
         continue; 
@@ -1258,30 +1220,30 @@ unsigned int http_random_destroy(http_random_state_t* state) {
   }
 
 
-  rc = pthread_mutex_destroy( &mutex );
+  rc = pthread_mutex_destroy( &state->mutex );
   if (rc) {
     fprintf(stderr, "ERROR: http_random_destroy. Return code from pthread_mutex_destroy() for \"mutex\" is %s\n", strerror(rc));
   }
-  rc = pthread_mutex_destroy( &state_mutex );
+  rc = pthread_mutex_destroy( &state->state_mutex );
   if (rc) {
     fprintf(stderr, "ERROR: http_random_destroy. Return code from pthread_mutex_destroy() for \"state_mutex\" is %s\n", strerror(rc));
   }
 
-  rc = pthread_cond_destroy( &fill );
+  rc = pthread_cond_destroy( &state->fill );
   if (rc) {
     fprintf(stderr, "ERROR: http_random_destroy. Return code from pthread_cond_destroy() for \"fill\" is %s\n", strerror(rc));
   }
-  rc = pthread_cond_destroy( &empty );
+  rc = pthread_cond_destroy( &state->empty );
   if (rc) {
     fprintf(stderr, "ERROR: http_random_destroy. Return code from pthread_cond_destroy() for \"empty\" is %s\n", strerror(rc));
   }
-  rc = pthread_cond_destroy( &state_cond );
+  rc = pthread_cond_destroy( &state->state_cond );
   if (rc) {
     fprintf(stderr, "ERROR: http_random_destroy. Return code from pthread_cond_destroy() for \"state_cond\" is %s\n", strerror(rc));
   }
 
   //QRBG_RNG_user & QRBG_RNG_passwd should be deleted already in this stage. Calling it again just to make sure that nothing went wrong during thread cancellation
-  if ( ( state->source & http_random_source_mask[QRBG_RNG] ) == http_random_source_mask[QRBG_RNG] ) delete_name_and_password();
+  if ( ( state->source & http_random_source_mask[QRBG_RNG] ) == http_random_source_mask[QRBG_RNG] ) delete_name_and_password(state);
 
   free(state->buf);
   free(state);
@@ -1303,18 +1265,18 @@ unsigned int http_random_status(http_random_state_t* state, char print) {
     verbosity = 0;
   }
 
-  if ( ! init ) {
+  if ( state == NULL ) {
     fprintf(stderr, "ERROR: http_random_status: http_random_init has not been called\n");
     status = -1;
     return status;
   }
 
-  pthread_mutex_lock( &state_mutex );
+  pthread_mutex_lock( &state->state_mutex );
 
   for ( i=HOTBITS_RNG; i<HTTP_COUNT; ++i) {
     detailed_statistics = 0;
     if ((state->source & http_random_source_mask[i]) == http_random_source_mask[i]) {
-      switch (thread_running[i]) {
+      switch (state->thread_running[i]) {
         case STATE_NOT_STARTED:
           if ( verbosity) fprintf(stderr, "INFO: thread %s has not been started yet.", http_random_source_names[i] );
           break;
@@ -1338,7 +1300,7 @@ unsigned int http_random_status(http_random_state_t* state, char print) {
           detailed_statistics = 1;
           break;
         default:
-          fprintf(stderr, "ERROR: thread %s: unknown state %d.", http_random_source_names[i], thread_running[i]  );
+          fprintf(stderr, "ERROR: thread %s: unknown state %d.", http_random_source_names[i], state->thread_running[i]  );
       }
       if ( detailed_statistics ) {
         if ( verbosity) fprintf(stderr, "It has produced %s bytes, has executed %"PRIu64" FIPS tests from which %"PRIu64" has failed.\n",
@@ -1369,7 +1331,7 @@ unsigned int http_random_status(http_random_state_t* state, char print) {
     fprintf ( stderr, "============http_random_status: end of report============================\n");
   }
 
-  pthread_mutex_unlock( &state_mutex);
+  pthread_mutex_unlock( &state->state_mutex);
 
   return status;
 }
@@ -25,13 +25,14 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include <csprng/memt19937ar-JH.h>
+#include "cpu_kernels.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <string.h>
 
 /* mag01[x] = x * MEMT_MATRIX_A  for x=0,1 */
-static uint32_t mag01[2]={0x0U, MEMT_MATRIX_A};
+static const uint32_t mag01[2]={0x0U, MEMT_MATRIX_A};
 
 /*plot type*/
 static uint32_t case_1(memt_type* state);
@@ -214,7 +215,10 @@ uint32_t MEMT_genrand_int32(memt_type* state)
 int MEMT_fill_buffer (memt_type* state, uint32_t *output_buffer, int output_size) {
 //  Total size of buffer in Bytes = output_size * sizeof(uint32_t) = output_size * 4
 //  It will return number of generated uint32_t blocks.
+  return csprng_cpu_kernels()->memt_fill(state, output_buffer, output_size);
+}
 
+int MEMT_fill_buffer_generic (memt_type* state, uint32_t *output_buffer, int output_size) {
   int i;
   
   for ( i=0; i<output_size; ++i ) {
@@ -225,6 +229,49 @@ int MEMT_fill_buffer (memt_type* state, uint32_t *output_buffer, int output_size
   return i;
 }
 
+#ifdef CSPRNG_HAVE_X86_KERNELS
+/* Can words kk ... kk+lanes-1 be produced by one vector? */
+static inline int memt_vector_fits(int kk, int lanes)
+{
+  //Word MEMT_N-1 wraps around to mt[0]
+  if ( kk + lanes > MEMT_N - 1 ) return 0;
+  if ( ( kk + MEMT_M ) % MEMT_N + lanes > MEMT_N ) return 0;
+  if ( ( kk + 224 ) % MEMT_N + lanes > MEMT_N ) return 0;
+  if ( ( kk + 124 ) % MEMT_N + lanes > MEMT_N ) return 0;
+  if ( ( kk +  24 ) % MEMT_N + lanes > MEMT_N ) return 0;
+  if ( ( kk + 324 ) % MEMT_N + lanes > MEMT_N ) return 0;
+  return 1;
+}
+
+/* Set kk and the matching case_N function */
+static inline void memt_set_position(memt_type* state, int kk)
+{
+  state->kk = kk;
+  if      ( kk < MEMT_N-MEMT_M ) state->genrand_int32 = case_1;
+  else if ( kk < 300 )           state->genrand_int32 = case_2;
+  else if ( kk < 400 )           state->genrand_int32 = case_3;
+  else if ( kk < 500 )           state->genrand_int32 = case_4;
+  else if ( kk < 600 )           state->genrand_int32 = case_5;
+  else if ( kk < MEMT_N-1 )      state->genrand_int32 = case_6;
+  else                           state->genrand_int32 = case_7;
+}
+
+#define MEMT_KERNEL_NAME   MEMT_fill_buffer_sse2
+#define MEMT_KERNEL_TARGET __attribute__ ((target ("sse2")))
+#define MEMT_KERNEL_LANES  4
+#include "memt_kernel.h"
+
+#define MEMT_KERNEL_NAME   MEMT_fill_buffer_avx2
+#define MEMT_KERNEL_TARGET __attribute__ ((target ("avx2")))
+#define MEMT_KERNEL_LANES  8
+#include "memt_kernel.h"
+
+#define MEMT_KERNEL_NAME   MEMT_fill_buffer_avx512
+#define MEMT_KERNEL_TARGET __attribute__ ((target ("avx512f")))
+#define MEMT_KERNEL_LANES  16
+#include "memt_kernel.h"
+#endif
+
   /* generates a random number on [0,0x7fffffff]-interval */
 uint32_t MEMT_genrand_int31(memt_type* state)
 {
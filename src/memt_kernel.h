@@ -0,0 +1,78 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Vectorized MEMT_fill_buffer. Included by memt19937ar-JH.c once for each SIMD width
+
+Copyright (C) 2012-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+/*
+ * Expects MEMT_KERNEL_NAME, MEMT_KERNEL_TARGET and MEMT_KERNEL_LANES to be defined.
+ *
+ * All seven case_N functions compute the same recurrence with indices taken modulo MEMT_N:
+ *   mt[kk] = mt[kk+M] ^ twist(mt[kk], mt[kk+1])
+ *   y = mt[kk] ^ f(mt[kk+224], mt[kk+124], mt[kk+24]) ... ^ mt[kk+324]
+ * The nearest index read is 24 words away, so up to 16 consecutive outputs do not depend
+ * on each other and can be computed in one vector. Whenever the vector would cross
+ * the end of the mt array for any of the offsets, one word is produced by the scalar code.
+ */
+
+MEMT_KERNEL_TARGET int MEMT_KERNEL_NAME (memt_type* state, uint32_t *output_buffer, int output_size)
+{
+  typedef uint32_t vec_t __attribute__ ((vector_size (4 * MEMT_KERNEL_LANES)));
+  uint32_t* mt = state->mt;
+  vec_t x, x1, xm, t224, t124, t24, t324, y;
+  int i = 0, kk;
+
+  while ( i < output_size ) {
+    kk = state->kk;
+    if ( output_size - i >= MEMT_KERNEL_LANES && memt_vector_fits(kk, MEMT_KERNEL_LANES) ) {
+      memcpy(&x,  mt + kk, sizeof(vec_t));
+      memcpy(&x1, mt + kk + 1, sizeof(vec_t));
+      memcpy(&xm, mt + ( kk + MEMT_M ) % MEMT_N, sizeof(vec_t));
+
+      y = ( x & MEMT_UPPER_MASK ) | ( x1 & MEMT_LOWER_MASK );
+      x = xm ^ ( y >> 1 ) ^ ( -( y & 1U ) & MEMT_MATRIX_A );
+      memcpy(mt + kk, &x, sizeof(vec_t));
+
+      memcpy(&t224, mt + ( kk + 224 ) % MEMT_N, sizeof(vec_t));
+      memcpy(&t124, mt + ( kk + 124 ) % MEMT_N, sizeof(vec_t));
+      memcpy(&t24,  mt + ( kk +  24 ) % MEMT_N, sizeof(vec_t));
+      memcpy(&t324, mt + ( kk + 324 ) % MEMT_N, sizeof(vec_t));
+
+      y = x ^ ( ( t224 << 14 ) & 0x3cd68000U ) ^ ( ( t124 << 3 ) & 0x576bad28U ) ^ ( ( t24 << 18 ) & 0xd6740000U );
+      y ^= MEMT_TEMPERING_SHIFT_U(y);
+      y ^= MEMT_TEMPERING_SHIFT_S(y);
+      y ^= ( t324 & 0x09040000U );
+      memcpy(output_buffer + i, &y, sizeof(vec_t));
+
+      memt_set_position(state, kk + MEMT_KERNEL_LANES);
+      i += MEMT_KERNEL_LANES;
+    } else {
+      output_buffer[i] = state->genrand_int32(state);
+      ++i;
+    }
+  }
+
+  return i;
+}
+
+#undef MEMT_KERNEL_NAME
+#undef MEMT_KERNEL_TARGET
+#undef MEMT_KERNEL_LANES
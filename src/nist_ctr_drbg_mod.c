@@ -27,19 +27,46 @@ NIST SP 800-90 CTR_DRBG (Random Number Generator)
 */
 
 #include <csprng/nist_ctr_drbg.h>
+#include "cpu_kernels.h"
+#include "nist_ctr_drbg_pool.h"
+#include "aes_ct.h"
+#include "secure_arena.h"
 
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Functions using the intrinsics are compiled with the target attribute so that
+ * the rest of the library does not need -maes and runs on any x86 CPU.
+ * They are selected at run time by cpu_dispatch.c
+ */
+#ifdef CSPRNG_HAVE_X86_KERNELS
+#include <wmmintrin.h>
+#define NIST_AESNI_TARGET __attribute__ ((target ("aes,sse2")))
+#endif
+#ifdef CSPRNG_HAVE_VAES_KERNELS
+#include <immintrin.h>
+#define NIST_VAES256_TARGET __attribute__ ((target ("aes,vaes,avx2")))
+#define NIST_VAES512_TARGET __attribute__ ((target ("aes,vaes,avx512f")))
+#endif
+
+//Number of counter blocks encrypted in one pass of the pipelined kernels
+#define NIST_CTR_PIPELINE_BLOCKS 8
+#define NIST_CTR_VAES256_BLOCKS  ( 2 * NIST_CTR_PIPELINE_BLOCKS )
+#define NIST_CTR_VAES512_BLOCKS  ( 4 * NIST_CTR_PIPELINE_BLOCKS )
+//Blocks of one lane encrypted at once by the portable multi-lane kernel
+#define NIST_CTR_LANES_ROWS      64
 
 /*
  * NIST SP 800-90 March 2007
  * 10.4.2 Derivation Function Using a Block Cipher Algorithm
  * Global Constants
  */
-static NIST_Key nist_cipher_df_ctx;
-static unsigned char nist_cipher_df_encrypted_iv[NIST_BLOCK_SEEDLEN / NIST_BLOCK_OUTLEN][NIST_BLOCK_OUTLEN_BYTES];
+static NIST_Key nist_cipher_df_ctx[NIST_KEYLEN_COUNT];
+static unsigned char nist_cipher_df_encrypted_iv[NIST_KEYLEN_COUNT][NIST_SEEDLEN_MAX_BLOCKS][NIST_BLOCK_OUTLEN_BYTES];
 
 /*
  * NIST SP 800-90 March 2007
@@ -47,7 +74,14 @@ static unsigned char nist_cipher_df_encrypted_iv[NIST_BLOCK_SEEDLEN / NIST_BLOCK
  *            Function is Used
  * Global Constants
  */
-static NIST_Key nist_cipher_zero_ctx;
+static NIST_Key nist_cipher_zero_ctx[NIST_KEYLEN_COUNT];
+
+/*
+ * The global constants are computed once per block cipher implementation, so that
+ * generators instantiated in other threads never see them being rewritten
+ */
+static pthread_mutex_t nist_ctr_initialize_mutex = PTHREAD_MUTEX_INITIALIZER;
+static aes_encrypt_kernel_type nist_ctr_initialized_cipher = NULL;
 
 /*
  * NIST SP 800-90 March 2007
@@ -55,7 +89,7 @@ static NIST_Key nist_cipher_zero_ctx;
  *            Derivation Function is Used for the DRBG Implementation
  * Global Constants
  */
-static const unsigned int nist_ctr_drgb_generate_null_input[NIST_BLOCK_SEEDLEN_INTS] = { 0 };
+static const unsigned int nist_ctr_drgb_generate_null_input[NIST_BLOCK_SEEDLEN_MAX_INTS] = { 0 };
 
 
 /*
@@ -115,39 +149,765 @@ dump_hex_byte_string (const unsigned char* data, const unsigned int size, const
 }
 
 /*
- * NIST SP 800-90 March 2007
- * 10.4.3 BCC Function
+ * Counter V as native integers
+ *    V is stored as big-endian number. hi holds the leftmost 64 bits.
  */
-static void
-nist_ctr_drbg_bcc_update(const NIST_Key* ctx, const unsigned int* data, unsigned int n, unsigned int *chaining_value)
+static __inline void
+nist_counter_load(const unsigned int* V, uint64_t* hi, uint64_t* lo)
 {
-	unsigned int i, j;
-	unsigned int input_block[NIST_BLOCK_OUTLEN_INTS];
+	const unsigned char* p = (const unsigned char *)V;
+	int i;
+
+	*hi = 0;
+	*lo = 0;
+	for (i = 0; i < 8; ++i) {
+		*hi = ( *hi << 8 ) | p[i];
+		*lo = ( *lo << 8 ) | p[8 + i];
+	}
+}
+
+static __inline void
+nist_counter_store(unsigned int* V, uint64_t hi, uint64_t lo)
+{
+	unsigned char* p = (unsigned char *)V;
+	int i;
+
+	for (i = 7; i >= 0; --i) {
+		p[i] = (unsigned char)hi;
+		p[8 + i] = (unsigned char)lo;
+		hi >>= 8;
+		lo >>= 8;
+	}
+}
+
+/*
+ * Fill n counter blocks V+1 ... V+n in the memory layout of the cipher input
+ */
+static __inline void
+nist_counter_fill(unsigned char* c, int n, uint64_t* hi, uint64_t* lo)
+{
+	uint64_t be[2];
+	int i;
 
-	/* [4] for i = 1 to n */
 	for (i = 0; i < n; ++i) {
+		if (++(*lo) == 0)
+			++(*hi);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		be[0] = __builtin_bswap64(*hi);
+		be[1] = __builtin_bswap64(*lo);
+#else
+		be[0] = *hi;
+		be[1] = *lo;
+#endif
+		memcpy(c, be, sizeof(be));
+		c += NIST_BLOCK_OUTLEN_BYTES;
+	}
+}
+
+/*
+ * Only the cipher key (first round key) is kept in the OpenSSL schedule for the debug dumps.
+ * Used by the kernels which do not need the OpenSSL round keys.
+ */
+static void
+nist_key_store_cipher_key(NIST_Key* ctx, const unsigned char* key, int keylen)
+{
+	int i;
+
+	memset(&ctx->key, 0, sizeof(ctx->key));
+	for (i = 0; i < keylen / 32; ++i)
+		ctx->key.rd_key[i] = ( (uint32_t)key[4 * i] << 24 ) | ( (uint32_t)key[4 * i + 1] << 16 ) |
+			( (uint32_t)key[4 * i + 2] << 8 ) | key[4 * i + 3];
+	ctx->key.rounds = ctx->rounds;
+}
+
+#ifdef CSPRNG_HAVE_X86_KERNELS
+/*
+ * AES-NI key expansion. Produces round keys in the layout of the AESENC instruction.
+ */
+static NIST_AESNI_TARGET __m128i
+nist_aesni_128_assist(__m128i key, __m128i keygened)
+{
+	keygened = _mm_shuffle_epi32(keygened, 0xff);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, keygened);
+}
+
+#define NIST_AESNI_128_ROUND(rk, i, rcon) \
+	rk[i] = nist_aesni_128_assist(rk[i-1], _mm_aeskeygenassist_si128(rk[i-1], rcon))
+
+/*
+ * Second half of the AES-256 step: SubWord without RotWord and Rcon
+ */
+static NIST_AESNI_TARGET __m128i
+nist_aesni_256_assist(__m128i key, __m128i keygened)
+{
+	keygened = _mm_shuffle_epi32(keygened, 0xaa);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, keygened);
+}
+
+#define NIST_AESNI_256_ROUND(rk, i, rcon) \
+	rk[i] = nist_aesni_128_assist(rk[i-2], _mm_aeskeygenassist_si128(rk[i-1], rcon)); \
+	rk[i+1] = nist_aesni_256_assist(rk[i-1], _mm_aeskeygenassist_si128(rk[i], 0x00))
+
+/*
+ * RotWord(SubWord(w)) XOR Rcon(i) for the word based AES-192 expansion.
+ * AESKEYGENASSIST needs the round constant as an immediate.
+ */
+static NIST_AESNI_TARGET uint32_t
+nist_aesni_192_rot_sub_word(uint32_t w, int i)
+{
+	__m128i x = _mm_set_epi32(0, 0, (int)w, 0);
+
+	switch (i) {
+		case 1: x = _mm_aeskeygenassist_si128(x, 0x01); break;
+		case 2: x = _mm_aeskeygenassist_si128(x, 0x02); break;
+		case 3: x = _mm_aeskeygenassist_si128(x, 0x04); break;
+		case 4: x = _mm_aeskeygenassist_si128(x, 0x08); break;
+		case 5: x = _mm_aeskeygenassist_si128(x, 0x10); break;
+		case 6: x = _mm_aeskeygenassist_si128(x, 0x20); break;
+		case 7: x = _mm_aeskeygenassist_si128(x, 0x40); break;
+		default: x = _mm_aeskeygenassist_si128(x, 0x80); break;
+	}
+	return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x, 4));
+}
 
+static NIST_AESNI_TARGET void
+nist_aesni_192_expand(uint64_t* rd_key, const unsigned char* key)
+{
+	//13 round keys of 4 words each
+	uint32_t w[52];
+	uint32_t t;
+	int i;
+
+	memcpy(w, key, 24);
+	for (i = 6; i < 52; ++i) {
+		t = w[i - 1];
+		if (i % 6 == 0)
+			t = nist_aesni_192_rot_sub_word(t, i / 6);
+		w[i] = w[i - 6] ^ t;
+	}
+	memcpy(rd_key, w, sizeof(w));
+	nist_zeroize(w, sizeof(w));
+}
+
+NIST_AESNI_TARGET int
+nist_ctr_drbg_schedule_aesni(NIST_Key* ctx, const unsigned char* key, int keylen)
+{
+	__m128i* rk = (__m128i *)ctx->rd_key_ni;
+
+	switch (keylen) {
+		case 128:
+			rk[0] = _mm_loadu_si128((const __m128i *)key);
+			NIST_AESNI_128_ROUND(rk, 1, 0x01);
+			NIST_AESNI_128_ROUND(rk, 2, 0x02);
+			NIST_AESNI_128_ROUND(rk, 3, 0x04);
+			NIST_AESNI_128_ROUND(rk, 4, 0x08);
+			NIST_AESNI_128_ROUND(rk, 5, 0x10);
+			NIST_AESNI_128_ROUND(rk, 6, 0x20);
+			NIST_AESNI_128_ROUND(rk, 7, 0x40);
+			NIST_AESNI_128_ROUND(rk, 8, 0x80);
+			NIST_AESNI_128_ROUND(rk, 9, 0x1b);
+			NIST_AESNI_128_ROUND(rk, 10, 0x36);
+			ctx->rounds = 10;
+			break;
+		case 192:
+			nist_aesni_192_expand(ctx->rd_key_ni, key);
+			ctx->rounds = 12;
+			break;
+		case 256:
+			rk[0] = _mm_loadu_si128((const __m128i *)key);
+			rk[1] = _mm_loadu_si128((const __m128i *)(key + 16));
+			NIST_AESNI_256_ROUND(rk, 2, 0x01);
+			NIST_AESNI_256_ROUND(rk, 4, 0x02);
+			NIST_AESNI_256_ROUND(rk, 6, 0x04);
+			NIST_AESNI_256_ROUND(rk, 8, 0x08);
+			NIST_AESNI_256_ROUND(rk, 10, 0x10);
+			NIST_AESNI_256_ROUND(rk, 12, 0x20);
+			rk[14] = nist_aesni_128_assist(rk[12], _mm_aeskeygenassist_si128(rk[13], 0x40));
+			ctx->rounds = 14;
+			break;
+		default:
+			return 1;
+	}
+
+	nist_key_store_cipher_key(ctx, key, keylen);
+	return 0;
+}
+
+NIST_AESNI_TARGET void
+nist_ctr_drbg_encrypt_aesni(const NIST_Key* ctx, const unsigned char* input, unsigned char* output)
+{
+	const __m128i* rk = (const __m128i *)ctx->rd_key_ni;
+	__m128i b;
+	int r;
+
+	b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)input), rk[0]);
+	for (r = 1; r < ctx->rounds; ++r)
+		b = _mm_aesenc_si128(b, rk[r]);
+	_mm_storeu_si128((__m128i *)output, _mm_aesenclast_si128(b, rk[ctx->rounds]));
+}
+
+/*
+ * AES-NI CTR kernel
+ *    Encrypts V+1, V+2, ... V+blocks and writes the result directly to output.
+ *    NIST_CTR_PIPELINE_BLOCKS independent blocks are kept in flight so that
+ *    the latency of AESENC is hidden. On return V holds the last counter used.
+ */
+NIST_AESNI_TARGET void
+nist_ctr_drbg_ctr_aesni(const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks)
+{
+	const __m128i* rk = (const __m128i *)ctx->rd_key_ni;
+	const int rounds = ctx->rounds;
+	__m128i b[NIST_CTR_PIPELINE_BLOCKS];
+	uint64_t hi, lo;
+	int i, r, n;
+
+	nist_counter_load(V, &hi, &lo);
+
+	while (blocks > 0) {
+		n = ( blocks < NIST_CTR_PIPELINE_BLOCKS ) ? blocks : NIST_CTR_PIPELINE_BLOCKS;
+
+		/* [4.1] V = (V + 1) mod 2^outlen */
+		for (i = 0; i < n; ++i) {
+			if (++lo == 0)
+				++hi;
+			b[i] = _mm_xor_si128(_mm_set_epi64x((long long)__builtin_bswap64(lo), (long long)__builtin_bswap64(hi)), rk[0]);
+		}
+
+		/* [4.2] output_block = Block_Encrypt(Key, V) */
+		if (n == NIST_CTR_PIPELINE_BLOCKS) {
+			for (r = 1; r < rounds; ++r) {
+				b[0] = _mm_aesenc_si128(b[0], rk[r]);
+				b[1] = _mm_aesenc_si128(b[1], rk[r]);
+				b[2] = _mm_aesenc_si128(b[2], rk[r]);
+				b[3] = _mm_aesenc_si128(b[3], rk[r]);
+				b[4] = _mm_aesenc_si128(b[4], rk[r]);
+				b[5] = _mm_aesenc_si128(b[5], rk[r]);
+				b[6] = _mm_aesenc_si128(b[6], rk[r]);
+				b[7] = _mm_aesenc_si128(b[7], rk[r]);
+			}
+		} else {
+			for (r = 1; r < rounds; ++r)
+				for (i = 0; i < n; ++i)
+					b[i] = _mm_aesenc_si128(b[i], rk[r]);
+		}
+
+		for (i = 0; i < n; ++i) {
+			b[i] = _mm_aesenclast_si128(b[i], rk[rounds]);
+			_mm_storeu_si128((__m128i *)output, b[i]);
+			output += NIST_BLOCK_OUTLEN_BYTES;
+		}
+		blocks -= n;
+	}
+
+	nist_counter_store(V, hi, lo);
+}
+
+/*
+ * AES-NI multi-lane CTR kernel
+ *    Block i of output is the next counter block of lane i mod lanes, encrypted with the key
+ *    of that lane. The blocks in flight use different round keys, so even short requests
+ *    keep NIST_CTR_PIPELINE_BLOCKS AESENC instructions independent. All lanes have the same key length.
+ */
+NIST_AESNI_TARGET void
+nist_ctr_drbg_ctr_lanes_aesni(const NIST_Key* const* ctx, unsigned int* const* V, int lanes, unsigned char* output, int blocks)
+{
+	const __m128i* rk[NIST_CTR_PIPELINE_BLOCKS];
+	const int rounds = ctx[0]->rounds;
+	__m128i b[NIST_CTR_PIPELINE_BLOCKS];
+	uint64_t hi[NIST_CTR_DRBG_MAX_LANES], lo[NIST_CTR_DRBG_MAX_LANES];
+	int i, l, r, n, lane = 0;
+
+	for (l = 0; l < lanes; ++l)
+		nist_counter_load(V[l], &hi[l], &lo[l]);
+
+	while (blocks > 0) {
+		n = ( blocks < NIST_CTR_PIPELINE_BLOCKS ) ? blocks : NIST_CTR_PIPELINE_BLOCKS;
+
+		/* [4.1] V = (V + 1) mod 2^outlen, for the lane owning the block */
+		for (i = 0; i < n; ++i) {
+			l = lane;
+			if (++lane == lanes)
+				lane = 0;
+			if (++lo[l] == 0)
+				++hi[l];
+			rk[i] = (const __m128i *)ctx[l]->rd_key_ni;
+			b[i] = _mm_xor_si128(_mm_set_epi64x((long long)__builtin_bswap64(lo[l]), (long long)__builtin_bswap64(hi[l])), rk[i][0]);
+		}
+
+		/* [4.2] output_block = Block_Encrypt(Key, V) */
+		if (n == NIST_CTR_PIPELINE_BLOCKS) {
+			for (r = 1; r < rounds; ++r) {
+				b[0] = _mm_aesenc_si128(b[0], rk[0][r]);
+				b[1] = _mm_aesenc_si128(b[1], rk[1][r]);
+				b[2] = _mm_aesenc_si128(b[2], rk[2][r]);
+				b[3] = _mm_aesenc_si128(b[3], rk[3][r]);
+				b[4] = _mm_aesenc_si128(b[4], rk[4][r]);
+				b[5] = _mm_aesenc_si128(b[5], rk[5][r]);
+				b[6] = _mm_aesenc_si128(b[6], rk[6][r]);
+				b[7] = _mm_aesenc_si128(b[7], rk[7][r]);
+			}
+		} else {
+			for (r = 1; r < rounds; ++r)
+				for (i = 0; i < n; ++i)
+					b[i] = _mm_aesenc_si128(b[i], rk[i][r]);
+		}
+
+		for (i = 0; i < n; ++i) {
+			b[i] = _mm_aesenclast_si128(b[i], rk[i][rounds]);
+			_mm_storeu_si128((__m128i *)output, b[i]);
+			output += NIST_BLOCK_OUTLEN_BYTES;
+		}
+		blocks -= n;
+	}
+
+	for (l = 0; l < lanes; ++l)
+		nist_counter_store(V[l], hi[l], lo[l]);
+}
+
+/*
+ * AES-NI BCC kernel
+ *    The chains are independent, so their AESENC instructions are interleaved.
+ *    Each chain on its own is serial (CBC-MAC).
+ */
+NIST_AESNI_TARGET void
+nist_ctr_drbg_bcc_aesni(const NIST_Key* ctx, unsigned char* chaining_value, int chains, const unsigned char* input, int blocks)
+{
+	const __m128i* rk = (const __m128i *)ctx->rd_key_ni;
+	const int rounds = ctx->rounds;
+	__m128i c[NIST_SEEDLEN_MAX_BLOCKS];
+	__m128i d;
+	int i, r;
+
+	assert(chains >= 1 && chains <= NIST_SEEDLEN_MAX_BLOCKS);
+
+	for (i = 0; i < chains; ++i)
+		c[i] = _mm_loadu_si128((const __m128i *)(chaining_value + i * NIST_BLOCK_OUTLEN_BYTES));
+
+	while (blocks > 0) {
 		/* [4.1] input_block = chaining_value XOR block_i */
-		for (j = 0; j < NIST_BLOCK_OUTLEN_INTS; ++j)
-			input_block[j] = chaining_value[j] ^ *data++;
+		d = _mm_xor_si128(_mm_loadu_si128((const __m128i *)input), rk[0]);
 
 		/* [4.2] chaining_value = Block_Encrypt(Key, input_block) */
-		Block_Encrypt(ctx, &input_block[0], &chaining_value[0]);
+		if (chains == 1) {
+			c[0] = _mm_xor_si128(c[0], d);
+			for (r = 1; r < rounds; ++r)
+				c[0] = _mm_aesenc_si128(c[0], rk[r]);
+			c[0] = _mm_aesenclast_si128(c[0], rk[rounds]);
+		} else if (chains == 2) {
+			c[0] = _mm_xor_si128(c[0], d);
+			c[1] = _mm_xor_si128(c[1], d);
+			for (r = 1; r < rounds; ++r) {
+				c[0] = _mm_aesenc_si128(c[0], rk[r]);
+				c[1] = _mm_aesenc_si128(c[1], rk[r]);
+			}
+			c[0] = _mm_aesenclast_si128(c[0], rk[rounds]);
+			c[1] = _mm_aesenclast_si128(c[1], rk[rounds]);
+		} else {
+			c[0] = _mm_xor_si128(c[0], d);
+			c[1] = _mm_xor_si128(c[1], d);
+			c[2] = _mm_xor_si128(c[2], d);
+			for (r = 1; r < rounds; ++r) {
+				c[0] = _mm_aesenc_si128(c[0], rk[r]);
+				c[1] = _mm_aesenc_si128(c[1], rk[r]);
+				c[2] = _mm_aesenc_si128(c[2], rk[r]);
+			}
+			c[0] = _mm_aesenclast_si128(c[0], rk[rounds]);
+			c[1] = _mm_aesenclast_si128(c[1], rk[rounds]);
+			c[2] = _mm_aesenclast_si128(c[2], rk[rounds]);
+		}
+
+		input += NIST_BLOCK_OUTLEN_BYTES;
+		--blocks;
 	}
 
-	/* [5] output_block = chaining_value */
-	/* chaining_value already is output_block, so no copy is required */
+	for (i = 0; i < chains; ++i)
+		_mm_storeu_si128((__m128i *)(chaining_value + i * NIST_BLOCK_OUTLEN_BYTES), c[i]);
+}
+#endif
+
+#ifdef CSPRNG_HAVE_VAES_KERNELS
+/*
+ * VAES CTR kernels
+ *    Same as the AES-NI kernel with 2 (YMM) or 4 (ZMM) counter blocks per register.
+ *    The remaining blocks are handled by the AES-NI kernel.
+ */
+NIST_VAES256_TARGET void
+nist_ctr_drbg_ctr_vaes256(const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks)
+{
+	const __m128i* rk = (const __m128i *)ctx->rd_key_ni;
+	const int rounds = ctx->rounds;
+	__m256i rk256[AES_MAXNR + 1];
+	__m256i b[NIST_CTR_PIPELINE_BLOCKS];
+	uint64_t c[2 * NIST_CTR_VAES256_BLOCKS];
+	uint64_t hi, lo;
+	int i, r;
+
+	if (blocks < NIST_CTR_VAES256_BLOCKS) {
+		nist_ctr_drbg_ctr_aesni(ctx, V, output, blocks);
+		return;
+	}
+
+	for (r = 0; r <= rounds; ++r)
+		rk256[r] = _mm256_broadcastsi128_si256(rk[r]);
+
+	nist_counter_load(V, &hi, &lo);
+
+	while (blocks >= NIST_CTR_VAES256_BLOCKS) {
+		/* [4.1] V = (V + 1) mod 2^outlen */
+		nist_counter_fill((unsigned char *)c, NIST_CTR_VAES256_BLOCKS, &hi, &lo);
+		for (i = 0; i < NIST_CTR_PIPELINE_BLOCKS; ++i)
+			b[i] = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&c[4 * i]), rk256[0]);
+
+		/* [4.2] output_block = Block_Encrypt(Key, V) */
+		for (r = 1; r < rounds; ++r) {
+			b[0] = _mm256_aesenc_epi128(b[0], rk256[r]);
+			b[1] = _mm256_aesenc_epi128(b[1], rk256[r]);
+			b[2] = _mm256_aesenc_epi128(b[2], rk256[r]);
+			b[3] = _mm256_aesenc_epi128(b[3], rk256[r]);
+			b[4] = _mm256_aesenc_epi128(b[4], rk256[r]);
+			b[5] = _mm256_aesenc_epi128(b[5], rk256[r]);
+			b[6] = _mm256_aesenc_epi128(b[6], rk256[r]);
+			b[7] = _mm256_aesenc_epi128(b[7], rk256[r]);
+		}
+
+		for (i = 0; i < NIST_CTR_PIPELINE_BLOCKS; ++i) {
+			b[i] = _mm256_aesenclast_epi128(b[i], rk256[rounds]);
+			_mm256_storeu_si256((__m256i *)output, b[i]);
+			output += 2 * NIST_BLOCK_OUTLEN_BYTES;
+		}
+		blocks -= NIST_CTR_VAES256_BLOCKS;
+	}
+
+	nist_counter_store(V, hi, lo);
+	if (blocks)
+		nist_ctr_drbg_ctr_aesni(ctx, V, output, blocks);
+}
+
+NIST_VAES512_TARGET void
+nist_ctr_drbg_ctr_vaes512(const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks)
+{
+	const __m128i* rk = (const __m128i *)ctx->rd_key_ni;
+	const int rounds = ctx->rounds;
+	__m512i rk512[AES_MAXNR + 1];
+	__m512i b[NIST_CTR_PIPELINE_BLOCKS];
+	uint64_t c[2 * NIST_CTR_VAES512_BLOCKS];
+	uint64_t hi, lo;
+	int i, r;
+
+	if (blocks < NIST_CTR_VAES512_BLOCKS) {
+		nist_ctr_drbg_ctr_aesni(ctx, V, output, blocks);
+		return;
+	}
+
+	for (r = 0; r <= rounds; ++r)
+		rk512[r] = _mm512_broadcast_i32x4(rk[r]);
+
+	nist_counter_load(V, &hi, &lo);
+
+	while (blocks >= NIST_CTR_VAES512_BLOCKS) {
+		/* [4.1] V = (V + 1) mod 2^outlen */
+		nist_counter_fill((unsigned char *)c, NIST_CTR_VAES512_BLOCKS, &hi, &lo);
+		for (i = 0; i < NIST_CTR_PIPELINE_BLOCKS; ++i)
+			b[i] = _mm512_xor_si512(_mm512_loadu_si512((const void *)&c[8 * i]), rk512[0]);
+
+		/* [4.2] output_block = Block_Encrypt(Key, V) */
+		for (r = 1; r < rounds; ++r) {
+			b[0] = _mm512_aesenc_epi128(b[0], rk512[r]);
+			b[1] = _mm512_aesenc_epi128(b[1], rk512[r]);
+			b[2] = _mm512_aesenc_epi128(b[2], rk512[r]);
+			b[3] = _mm512_aesenc_epi128(b[3], rk512[r]);
+			b[4] = _mm512_aesenc_epi128(b[4], rk512[r]);
+			b[5] = _mm512_aesenc_epi128(b[5], rk512[r]);
+			b[6] = _mm512_aesenc_epi128(b[6], rk512[r]);
+			b[7] = _mm512_aesenc_epi128(b[7], rk512[r]);
+		}
+
+		for (i = 0; i < NIST_CTR_PIPELINE_BLOCKS; ++i) {
+			b[i] = _mm512_aesenclast_epi128(b[i], rk512[rounds]);
+			_mm512_storeu_si512((void *)output, b[i]);
+			output += 4 * NIST_BLOCK_OUTLEN_BYTES;
+		}
+		blocks -= NIST_CTR_VAES512_BLOCKS;
+	}
+
+	nist_counter_store(V, hi, lo);
+	if (blocks)
+		nist_ctr_drbg_ctr_aesni(ctx, V, output, blocks);
+}
+
+/*
+ * VAES multi-lane CTR kernel
+ *    Each 128-bit lane of a ZMM register gets the round keys of its own DRBG lane. When lanes
+ *    divides NIST_CTR_VAES512_BLOCKS, register i always holds lanes (4i ... 4i+3) mod lanes,
+ *    so two sets of combined round keys cover up to 8 lanes. Other lane counts and the
+ *    remaining blocks are handled by the AES-NI kernel.
+ */
+NIST_VAES512_TARGET void
+nist_ctr_drbg_ctr_lanes_vaes512(const NIST_Key* const* ctx, unsigned int* const* V, int lanes, unsigned char* output, int blocks)
+{
+	const int rounds = ctx[0]->rounds;
+	__m512i rk512[2][AES_MAXNR + 1];
+	__m512i b[NIST_CTR_PIPELINE_BLOCKS];
+	uint64_t c[2 * NIST_CTR_VAES512_BLOCKS];
+	uint64_t hi[NIST_CTR_DRBG_MAX_LANES], lo[NIST_CTR_DRBG_MAX_LANES];
+	int i, l, q, r;
+
+	if (blocks < NIST_CTR_VAES512_BLOCKS || NIST_CTR_VAES512_BLOCKS % lanes || lanes > 8) {
+		nist_ctr_drbg_ctr_lanes_aesni(ctx, V, lanes, output, blocks);
+		return;
+	}
+
+	for (q = 0; q < 2; ++q) {
+		for (r = 0; r <= rounds; ++r) {
+			rk512[q][r] = _mm512_castsi128_si512(((const __m128i *)ctx[( 4 * q ) % lanes]->rd_key_ni)[r]);
+			for (i = 1; i < 4; ++i) {
+				l = ( 4 * q + i ) % lanes;
+				switch (i) {
+					case 1: rk512[q][r] = _mm512_inserti32x4(rk512[q][r], ((const __m128i *)ctx[l]->rd_key_ni)[r], 1); break;
+					case 2: rk512[q][r] = _mm512_inserti32x4(rk512[q][r], ((const __m128i *)ctx[l]->rd_key_ni)[r], 2); break;
+					default: rk512[q][r] = _mm512_inserti32x4(rk512[q][r], ((const __m128i *)ctx[l]->rd_key_ni)[r], 3); break;
+				}
+			}
+		}
+	}
+
+	for (l = 0; l < lanes; ++l)
+		nist_counter_load(V[l], &hi[l], &lo[l]);
+
+	while (blocks >= NIST_CTR_VAES512_BLOCKS) {
+		/* [4.1] V = (V + 1) mod 2^outlen, for the lane owning the block */
+		for (i = 0; i < NIST_CTR_VAES512_BLOCKS; ++i) {
+			l = i % lanes;
+			if (++lo[l] == 0)
+				++hi[l];
+			c[2 * i] = __builtin_bswap64(hi[l]);
+			c[2 * i + 1] = __builtin_bswap64(lo[l]);
+		}
+		for (i = 0; i < NIST_CTR_PIPELINE_BLOCKS; ++i)
+			b[i] = _mm512_xor_si512(_mm512_loadu_si512((const void *)&c[8 * i]), rk512[i & 1][0]);
+
+		/* [4.2] output_block = Block_Encrypt(Key, V) */
+		for (r = 1; r < rounds; ++r) {
+			b[0] = _mm512_aesenc_epi128(b[0], rk512[0][r]);
+			b[1] = _mm512_aesenc_epi128(b[1], rk512[1][r]);
+			b[2] = _mm512_aesenc_epi128(b[2], rk512[0][r]);
+			b[3] = _mm512_aesenc_epi128(b[3], rk512[1][r]);
+			b[4] = _mm512_aesenc_epi128(b[4], rk512[0][r]);
+			b[5] = _mm512_aesenc_epi128(b[5], rk512[1][r]);
+			b[6] = _mm512_aesenc_epi128(b[6], rk512[0][r]);
+			b[7] = _mm512_aesenc_epi128(b[7], rk512[1][r]);
+		}
+
+		for (i = 0; i < NIST_CTR_PIPELINE_BLOCKS; ++i) {
+			b[i] = _mm512_aesenclast_epi128(b[i], rk512[i & 1][rounds]);
+			_mm512_storeu_si512((void *)output, b[i]);
+			output += 4 * NIST_BLOCK_OUTLEN_BYTES;
+		}
+		blocks -= NIST_CTR_VAES512_BLOCKS;
+	}
+
+	for (l = 0; l < lanes; ++l)
+		nist_counter_store(V[l], hi[l], lo[l]);
+	nist_zeroize(c, sizeof(c));
+	if (blocks)
+		nist_ctr_drbg_ctr_lanes_aesni(ctx, V, lanes, output, blocks);
+}
+#endif
+
+/*
+ * Bitsliced cipher
+ *    Constant-time, used when AES-NI is not available
+ */
+int
+nist_ctr_drbg_schedule_bitsliced(NIST_Key* ctx, const unsigned char* key, int keylen)
+{
+	ctx->rounds = aes_ct_keysched(ctx->rd_key_ct, key, keylen / 8);
+	if (ctx->rounds == 0)
+		return 1;
+
+	//Computing the full OpenSSL schedule would use the lookup tables
+	nist_key_store_cipher_key(ctx, key, keylen);
+	return 0;
+}
+
+void
+nist_ctr_drbg_encrypt_bitsliced(const NIST_Key* ctx, const unsigned char* input, unsigned char* output)
+{
+	aes_ct_encrypt_blocks(ctx->rd_key_ct, ctx->rounds, input, output, 1);
+}
+
+void
+nist_ctr_drbg_ctr_bitsliced(const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks)
+{
+	unsigned char c[AES_CT_BLOCKS * NIST_BLOCK_OUTLEN_BYTES];
+	uint64_t hi, lo;
+	int n;
+
+	nist_counter_load(V, &hi, &lo);
+
+	while (blocks > 0) {
+		n = ( blocks < AES_CT_BLOCKS ) ? blocks : AES_CT_BLOCKS;
+
+		/* [4.1] V = (V + 1) mod 2^outlen */
+		nist_counter_fill(c, n, &hi, &lo);
+
+		/* [4.2] output_block = Block_Encrypt(Key, V) */
+		aes_ct_encrypt_blocks(ctx->rd_key_ct, ctx->rounds, c, output, n);
+
+		output += n * NIST_BLOCK_OUTLEN_BYTES;
+		blocks -= n;
+	}
+
+	nist_counter_store(V, hi, lo);
+}
+
+/*
+ * Bitsliced BCC kernel. All chains are encrypted by one call of aes_ct_encrypt_blocks,
+ * which costs the same as encrypting a single block.
+ */
+void
+nist_ctr_drbg_bcc_bitsliced(const NIST_Key* ctx, unsigned char* chaining_value, int chains, const unsigned char* input, int blocks)
+{
+	int i, j;
+
+	assert(chains >= 1 && chains <= AES_CT_BLOCKS);
+
+	while (blocks > 0) {
+		/* [4.1] input_block = chaining_value XOR block_i */
+		for (i = 0; i < chains; ++i)
+			for (j = 0; j < NIST_BLOCK_OUTLEN_BYTES; ++j)
+				chaining_value[i * NIST_BLOCK_OUTLEN_BYTES + j] ^= input[j];
+
+		/* [4.2] chaining_value = Block_Encrypt(Key, input_block) */
+		aes_ct_encrypt_blocks(ctx->rd_key_ct, ctx->rounds, chaining_value, chaining_value, chains);
+
+		input += NIST_BLOCK_OUTLEN_BYTES;
+		--blocks;
+	}
+}
+
+/*
+ * Portable cipher using the OpenSSL lookup tables
+ */
+int
+nist_ctr_drbg_schedule_generic(NIST_Key* ctx, const unsigned char* key, int keylen)
+{
+	int err;
+
+	err = AES_set_encrypt_key(key, keylen, &ctx->key);
+	if (err)
+		return err;
+
+	ctx->rounds = ctx->key.rounds;
+	return 0;
+}
+
+void
+nist_ctr_drbg_encrypt_generic(const NIST_Key* ctx, const unsigned char* input, unsigned char* output)
+{
+	AES_encrypt(input, output, &ctx->key);
+}
+
+/*
+ * Portable BCC kernel, one chain after another. Works with any cipher.
+ */
+void
+nist_ctr_drbg_bcc_generic(const NIST_Key* ctx, unsigned char* chaining_value, int chains, const unsigned char* input, int blocks)
+{
+	unsigned char input_block[NIST_BLOCK_OUTLEN_BYTES];
+	unsigned char* cv;
+	int i, j;
+
+	/* [4] for i = 1 to n */
+	while (blocks > 0) {
+		for (i = 0; i < chains; ++i) {
+			cv = chaining_value + i * NIST_BLOCK_OUTLEN_BYTES;
+
+			/* [4.1] input_block = chaining_value XOR block_i */
+			for (j = 0; j < NIST_BLOCK_OUTLEN_BYTES; ++j)
+				input_block[j] = cv[j] ^ input[j];
+
+			/* [4.2] chaining_value = Block_Encrypt(Key, input_block) */
+			Block_Encrypt(ctx, input_block, cv);
+		}
+
+		input += NIST_BLOCK_OUTLEN_BYTES;
+		--blocks;
+	}
 }
 
+/*
+ * Cipher layer
+ *    Block_Schedule_Encryption and Block_Encrypt use the cipher bound by cpu_dispatch.c
+ */
+const char* const nist_cipher_names[NIST_CIPHER_COUNT] = {
+	"auto",
+	"openssl",
+	"bitsliced",
+	"aesni"
+};
+
+int
+nist_block_schedule_encryption(NIST_Key* ctx, const unsigned char* key, int keylen)
+{
+	return csprng_cpu_kernels()->aes_schedule(ctx, key, keylen);
+}
+
+void
+nist_block_encrypt(const NIST_Key* ctx, const unsigned char* input, unsigned char* output)
+{
+	csprng_cpu_kernels()->aes_encrypt(ctx, input, output);
+}
+
+int
+nist_ctr_drbg_select_cipher(nist_cipher_type cipher)
+{
+	int err;
+
+	err = csprng_cpu_select_cipher(cipher);
+	if (err) {
+		fprintf(stderr, "nist_ctr_drbg_select_cipher: cipher %s is not supported on this CPU.\n", nist_cipher_names[cipher]);
+		return err;
+	}
+
+	//Key schedules of the global constants depend on the cipher
+	return nist_ctr_initialize();
+}
+
+int
+nist_ctr_drbg_aesni_enabled()
+{
+#ifdef CSPRNG_HAVE_X86_KERNELS
+	return csprng_cpu_kernels()->aes_encrypt == nist_ctr_drbg_encrypt_aesni;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * NIST SP 800-90 March 2007
+ * 10.4.3 BCC Function
+ *    The kernels bound by cpu_dispatch.c compute [4] for several chaining values at once.
+ */
 static void
-nist_ctr_drbg_bcc(NIST_Key* ctx, const unsigned int* data, int n, unsigned int *output_block)
+nist_ctr_drbg_bcc(const NIST_Key* ctx, const unsigned int* data, int n, unsigned int *output_block)
 {
 	unsigned int* chaining_value = output_block;
 
 	/* [1] chaining_value = 0^outlen */
 	memset(&chaining_value[0], 0, NIST_BLOCK_OUTLEN_BYTES);
 
-	nist_ctr_drbg_bcc_update(ctx, data, n, output_block);
+	/* [4] for i = 1 to n */
+	csprng_cpu_kernels()->aes_bcc(ctx, (unsigned char *)chaining_value, 1, (const unsigned char *)data, n);
+
+	/* [5] output_block = chaining_value */
+	/* chaining_value already is output_block, so no copy is required */
 }
 
 /*
@@ -158,6 +918,11 @@ nist_ctr_drbg_bcc(NIST_Key* ctx, const unsigned int* data, int n, unsigned int *
 typedef struct {
 	int index;
 	unsigned char S[NIST_BLOCK_OUTLEN_BYTES];
+	//K = Leftmost keylen bits of 0x00010203 ... 1D1E1F
+	const NIST_Key* K;
+	//BCC(K, (IV(i) || S)) for i = 0 ... chains - 1 are computed in one pass over S
+	int chains;
+	unsigned char* chaining_value;
 } NIST_CTR_DRBG_DF_BCC_CTX;
 
 static __inline int
@@ -176,20 +941,31 @@ check_int_alignment(const void* p)
 }
 
 static void
-nist_ctr_drbg_df_bcc_init(NIST_CTR_DRBG_DF_BCC_CTX* ctx, int L, int N)
+nist_ctr_drbg_df_bcc_init(NIST_CTR_DRBG_DF_BCC_CTX* ctx, int L, int N, const NIST_Key* K, int chains, unsigned int* temp)
 {
 	unsigned int* S = (unsigned int *)ctx->S;
 
+	ctx->K = K;
+	ctx->chains = chains;
+	ctx->chaining_value = (unsigned char *)temp;
+
 	/* [4] S = L || N || input_string || 0x80 */
 	S[0] = NIST_HTONL(L);
 	S[1] = NIST_HTONL(N);
 	ctx->index = 2 * sizeof(S[0]);
 }
 
+static __inline void
+nist_ctr_drbg_df_bcc_blocks(NIST_CTR_DRBG_DF_BCC_CTX* ctx, const unsigned char* input, int blocks)
+{
+	/* [9.2] BCC */
+	csprng_cpu_kernels()->aes_bcc(ctx->K, ctx->chaining_value, ctx->chains, input, blocks);
+}
+
 static void
-nist_ctr_drbg_df_bcc_update(NIST_CTR_DRBG_DF_BCC_CTX* ctx, const char* input_string, int input_string_length, unsigned int* temp)
+nist_ctr_drbg_df_bcc_update(NIST_CTR_DRBG_DF_BCC_CTX* ctx, const char* input_string, int input_string_length)
 {
-	int i, len;
+	int len;
 	int index = ctx->index;
 	unsigned char* S = ctx->S;
 
@@ -212,31 +988,17 @@ nist_ctr_drbg_df_bcc_update(NIST_CTR_DRBG_DF_BCC_CTX* ctx, const char* input_str
 		}
 
 		/* We have a full block in S, so let's process it */
-		/* [9.2] BCC */
-		nist_ctr_drbg_bcc_update(&nist_cipher_df_ctx, (unsigned int *)&S[0], 1, temp);
+		nist_ctr_drbg_df_bcc_blocks(ctx, &S[0], 1);
 		index = 0;
 	}
 
-	/* ctx->S is empty, so let's handle as many input blocks as we can */
+	/* ctx->S is empty, so let's handle as many input blocks as we can. The kernels accept unaligned input */
 	len = input_string_length / NIST_BLOCK_OUTLEN_BYTES;
 	if (len > 0) {
-		if (check_int_alignment(input_string)) {
-			/* [9.2] BCC */
-			nist_ctr_drbg_bcc_update(&nist_cipher_df_ctx, (const unsigned int *)input_string, len, temp);
-
-			input_string += len * NIST_BLOCK_OUTLEN_BYTES;
-			input_string_length -= len * NIST_BLOCK_OUTLEN_BYTES;
-		} else {
-			for (i = 0; i < len; ++i) {
-				memcpy(&S[0], input_string, NIST_BLOCK_OUTLEN_BYTES);
-
-				/* [9.2] BCC */
-				nist_ctr_drbg_bcc_update(&nist_cipher_df_ctx, (unsigned int *)&S[0], 1, temp);
+		nist_ctr_drbg_df_bcc_blocks(ctx, (const unsigned char *)input_string, len);
 
-				input_string += NIST_BLOCK_OUTLEN_BYTES;
-				input_string_length -= NIST_BLOCK_OUTLEN_BYTES;
-			}
-		}
+		input_string += len * NIST_BLOCK_OUTLEN_BYTES;
+		input_string_length -= len * NIST_BLOCK_OUTLEN_BYTES;
 	}
 
 	assert(input_string_length < NIST_BLOCK_OUTLEN_BYTES);
@@ -250,33 +1012,33 @@ nist_ctr_drbg_df_bcc_update(NIST_CTR_DRBG_DF_BCC_CTX* ctx, const char* input_str
 }
 
 static void
-nist_ctr_drbg_df_bcc_final(NIST_CTR_DRBG_DF_BCC_CTX* ctx, unsigned int* temp)
+nist_ctr_drbg_df_bcc_final(NIST_CTR_DRBG_DF_BCC_CTX* ctx)
 {
 	int index;
 	unsigned char* S = ctx->S;
 	static const char endmark[] = { 0x80 };
 
-	nist_ctr_drbg_df_bcc_update(ctx, endmark, sizeof(endmark), temp);
+	nist_ctr_drbg_df_bcc_update(ctx, endmark, sizeof(endmark));
 
 	index = ctx->index;
 	if (index) {
 		memset(&S[index], 0, NIST_BLOCK_OUTLEN_BYTES - index);
 
-		/* [9.2] BCC */
-		nist_ctr_drbg_bcc_update(&nist_cipher_df_ctx, (unsigned int *)&S[0], 1, temp);
+		nist_ctr_drbg_df_bcc_blocks(ctx, &S[0], 1);
 	}
 }
 
 static int
 nist_ctr_drbg_block_cipher_df(const char* input_string[], unsigned int L[],
-    int input_string_count, unsigned char* output_string, unsigned int N)
+    int input_string_count, unsigned char* output_string, unsigned int N, int keylen)
 {
 	int j, k, blocks, sum_L;
+	int key_index = NIST_KEYLEN_INDEX(keylen);
 	unsigned int *temp;
 	unsigned int *X;
 	NIST_Key ctx;
 	NIST_CTR_DRBG_DF_BCC_CTX df_bcc_ctx;
-	unsigned int buffer[NIST_BLOCK_SEEDLEN_INTS];
+	unsigned int buffer[NIST_SEEDLEN_MAX_BLOCKS * NIST_BLOCK_OUTLEN_INTS];
 	/*
 	 * NIST SP 800-90 March 2007 10.4.2 states that 512 bits is
 	 * the maximum length for the approved block cipher algorithms.
@@ -294,22 +1056,19 @@ nist_ctr_drbg_block_cipher_df(const char* input_string[], unsigned int L[],
 	temp = buffer;
 
 	/* [9] while len(temp) < keylen + outlen, do */
-	for (j = 0; j < NIST_BLOCK_SEEDLEN / NIST_BLOCK_OUTLEN; ++j) {
-		/* [9.2] temp = temp || BCC(K, (IV || S)) */
+	/* [9.2] temp = temp || BCC(K, (IV || S)) */
+	/* All iterations share S, so their BCC chains are computed together in one pass over S */
 
-		/* Since we have precomputed BCC(K, IV), we start with that... */ 
-		memcpy(&temp[0], &nist_cipher_df_encrypted_iv[j][0], NIST_BLOCK_OUTLEN_BYTES);
+	/* Since we have precomputed BCC(K, IV), we start with that... */ 
+	memcpy(&temp[0], &nist_cipher_df_encrypted_iv[key_index][0][0], NIST_SEEDLEN_BLOCKS(keylen) * NIST_BLOCK_OUTLEN_BYTES);
 
-		nist_ctr_drbg_df_bcc_init(&df_bcc_ctx, sum_L, N);
+	nist_ctr_drbg_df_bcc_init(&df_bcc_ctx, sum_L, N, &nist_cipher_df_ctx[key_index], NIST_SEEDLEN_BLOCKS(keylen), temp);
 
-		/* Compute the rest of BCC(K, (IV || S)) */
-		for (k = 0; k < input_string_count; ++k)
-			nist_ctr_drbg_df_bcc_update(&df_bcc_ctx, input_string[k], L[k], temp);
+	/* Compute the rest of BCC(K, (IV || S)) */
+	for (k = 0; k < input_string_count; ++k)
+		nist_ctr_drbg_df_bcc_update(&df_bcc_ctx, input_string[k], L[k]);
 
-		nist_ctr_drbg_df_bcc_final(&df_bcc_ctx, temp);
-
-		temp += NIST_BLOCK_OUTLEN_INTS;
-	}
+	nist_ctr_drbg_df_bcc_final(&df_bcc_ctx);
 
 	nist_zeroize(&df_bcc_ctx, sizeof(df_bcc_ctx));
 
@@ -317,10 +1076,10 @@ nist_ctr_drbg_block_cipher_df(const char* input_string[], unsigned int L[],
 	temp = buffer;
 
 	/* [10] K = Leftmost keylen bits of temp */
-	Block_Schedule_Encryption(&ctx, &temp[0]);
+	Block_Schedule_Encryption(&ctx, &temp[0], keylen);
 
 	/* [11] X = next outlen bits of temp */
-	X = &temp[NIST_BLOCK_KEYLEN_INTS];
+	X = &temp[keylen / 8 / sizeof(unsigned int)];
 
 	/* [12] temp = Null string */
 	temp = output_buffer;
@@ -340,24 +1099,26 @@ nist_ctr_drbg_block_cipher_df(const char* input_string[], unsigned int L[],
 	memcpy(output_string, output_buffer, N);
 
 	nist_zeroize(&ctx, sizeof(ctx));
+	nist_zeroize(buffer, sizeof(buffer));
 
 	return 0;
 }
 
 
 static int
-nist_ctr_drbg_block_cipher_df_initialize()
+nist_ctr_drbg_block_cipher_df_initialize(int keylen)
 {
 	int err;
   unsigned int i;
-	unsigned char K[NIST_BLOCK_KEYLEN_BYTES];
+	int key_index = NIST_KEYLEN_INDEX(keylen);
+	unsigned char K[NIST_BLOCK_KEYLEN_MAX_BYTES];
 	unsigned int IV[NIST_BLOCK_OUTLEN_INTS];
 
 	/* [8] K = Leftmost keylen bits of 0x00010203 ... 1D1E1F */
 	for (i = 0; i < sizeof(K); ++i)
 		K[i] = (unsigned char)i;
 
-	err = Block_Schedule_Encryption(&nist_cipher_df_ctx, K);
+	err = Block_Schedule_Encryption(&nist_cipher_df_ctx[key_index], K, keylen);
 	if (err)
 		return err;
 
@@ -371,13 +1132,13 @@ nist_ctr_drbg_block_cipher_df_initialize()
 	memset(&IV[0], 0, sizeof(IV));
 
 		/* [9.3] i = i + 1 */
-	for (i = 0; i < NIST_BLOCK_SEEDLEN / NIST_BLOCK_OUTLEN; ++i) {
+	for (i = 0; i < (unsigned int) NIST_SEEDLEN_BLOCKS(keylen); ++i) {
 
 		/* [9.1] IV = i || 0^(outlen - len(i)) */
 		IV[0] = NIST_HTONL(i);
 
 		/* [9.2] temp = temp || BCC(K, (IV || S))  (the IV part, at least) */
-		nist_ctr_drbg_bcc(&nist_cipher_df_ctx, &IV[0], 1, (unsigned int *)&nist_cipher_df_encrypted_iv[i][0]); 
+		nist_ctr_drbg_bcc(&nist_cipher_df_ctx[key_index], &IV[0], 1, (unsigned int *)&nist_cipher_df_encrypted_iv[key_index][i][0]); 
 	}
 
 	return 0;
@@ -391,52 +1152,47 @@ static void
 nist_ctr_drbg_update(NIST_CTR_DRBG* drbg, const unsigned int* provided_data)
 {
 unsigned int i;
-	unsigned int temp[NIST_BLOCK_SEEDLEN_INTS];
-	unsigned int* output_block;
+	unsigned int keylen_ints = drbg->keylen / 8 / sizeof(unsigned int);
+	unsigned int temp[NIST_SEEDLEN_MAX_BLOCKS * NIST_BLOCK_OUTLEN_INTS];
 
-  //dump_hex_byte_string ((unsigned char *)provided_data, NIST_BLOCK_SEEDLEN_BYTES, "Complete provided data:\t\t\t");
+  //dump_hex_byte_string ((unsigned char *)provided_data, NIST_SEEDLEN_BYTES(drbg->keylen), "Complete provided data:\t\t\t");
 	/* 2. while (len(temp) < seedlen) do */
-	for (output_block = temp; output_block < &temp[NIST_BLOCK_SEEDLEN_INTS];
-		output_block += NIST_BLOCK_OUTLEN_INTS) {
-
-		/* 2.1 V = (V + 1) mod 2^outlen */
-		nist_increment_block(&drbg->V[0]);
+	/* 2.1 V = (V + 1) mod 2^outlen */
+	/* 2.2 output_block = Block_Encrypt(K, V) */
+	/* The encryptions do not depend on each other, so the CTR kernel keeps all of them in flight */
+	csprng_cpu_kernels()->aes_ctr(&drbg->ctx, &drbg->V[0], (unsigned char *)temp, NIST_SEEDLEN_BLOCKS(drbg->keylen));
 
   //dump_hex_byte_string ((unsigned char *)drbg->V, NIST_BLOCK_KEYLEN_BYTES, "Plaintext:\t"); 
   //dump_hex_byte_string ((unsigned char *)drbg->ctx.key.rd_key, NIST_BLOCK_KEYLEN_BYTES, "Key:\t\t\t");
+  //dump_hex_byte_string ((unsigned char *)temp, NIST_SEEDLEN_BYTES(drbg->keylen), "AES:\t\t\t");
 
-		/* 2.2 output_block = Block_Encrypt(K, V) */
-		Block_Encrypt(&drbg->ctx, drbg->V, output_block);
-
-  //dump_hex_byte_string ((unsigned char *)output_block, NIST_BLOCK_KEYLEN_BYTES, "AES:\t\t\t");
-
-	}
-
-	/* 3 temp is already of size seedlen (NIST_BLOCK_SEEDLEN_INTS) */
+	/* 3 temp = Leftmost seedlen bits of temp. Only seedlen bits are used below */
 
   //dump_hex_byte_string ((unsigned char *)provided_data, NIST_BLOCK_KEYLEN_BYTES, "First part provided data:\t\t\t");
 	/* 4 (part 1) temp = temp XOR provided_data */
-	for (i = 0; i < NIST_BLOCK_KEYLEN_INTS; ++i)
+	for (i = 0; i < keylen_ints; ++i)
 		temp[i] ^= *provided_data++;
 
 	/* 5 Key = leftmost keylen bits of temp */
-	Block_Schedule_Encryption(&drbg->ctx, &temp[0]);
+	Block_Schedule_Encryption(&drbg->ctx, &temp[0], drbg->keylen);
 
 	/* 4 (part 2) combined with 6 V = rightmost outlen bits of temp */
   //dump_hex_byte_string ((unsigned char *)provided_data, NIST_BLOCK_KEYLEN_BYTES, "Second part provided data:\t\t\t");
 	for (i = 0; i < NIST_BLOCK_OUTLEN_INTS; ++i)
-		drbg->V[i] = temp[NIST_BLOCK_KEYLEN_INTS + i] ^ *provided_data++;
+		drbg->V[i] = temp[keylen_ints + i] ^ *provided_data++;
+
+	nist_zeroize(temp, sizeof(temp));
 }
 
 static int
-nist_ctr_drbg_instantiate_initialize()
+nist_ctr_drbg_instantiate_initialize(int keylen)
 {
 	int err;
-	unsigned char K[NIST_BLOCK_KEYLEN_BYTES];
+	unsigned char K[NIST_BLOCK_KEYLEN_MAX_BYTES];
 
 	memset(&K[0], 0, sizeof(K));
 
-	err = Block_Schedule_Encryption(&nist_cipher_zero_ctx, &K[0]);
+	err = Block_Schedule_Encryption(&nist_cipher_zero_ctx[NIST_KEYLEN_INDEX(keylen)], &K[0], keylen);
 
 	return err;
 }
@@ -451,23 +1207,30 @@ NIST_CTR_DRBG* nist_ctr_drbg_instantiate(
 	const void* entropy_input, int entropy_input_length,
 	const void* nonce, int nonce_length,
 	const void* personalization_string, int personalization_string_length,
-        int derive_function)
+        int derive_function, int keylen)
 {
   int err, count;
-	unsigned int i;
-	unsigned int seed_material[NIST_BLOCK_SEEDLEN_INTS];
-	unsigned int personalization_string_processed [NIST_BLOCK_SEEDLEN_INTS];
+	int i, seedlen_bytes;
+	unsigned int seed_material[NIST_BLOCK_SEEDLEN_MAX_INTS];
+	unsigned char personalization_string_processed [NIST_BLOCK_SEEDLEN_MAX_BYTES];
 	unsigned int length[3] = { 0 };
 	const char *input_string[3];
   NIST_CTR_DRBG* drbg;
 
-  drbg = calloc(1, sizeof(NIST_CTR_DRBG));
+  if ( ! NIST_KEYLEN_VALID(keylen) ) {
+    fprintf ( stderr, "nist_ctr_drbg_instantiate: Unsupported key length %d. Expecting 128, 192 or 256.\n", keylen );
+    return NULL;
+  }
+  seedlen_bytes = NIST_SEEDLEN_BYTES(keylen);
+
+  drbg = secure_alloc(sizeof(NIST_CTR_DRBG));
   if ( drbg == NULL ) {
     fprintf ( stderr, "nist_ctr_drbg_instantiate: Dynamic memory allocation failed\n" );
     return drbg;
   }
 
 	drbg->derive_function = derive_function;
+	drbg->keylen = keylen;
 
 	if ( drbg->derive_function ) {
 		/* [1] seed_material = entropy_input || nonce || personalization_string */
@@ -486,15 +1249,14 @@ NIST_CTR_DRBG* nist_ctr_drbg_instantiate(
 		}
                 //10.2.1.3.2  The Process Steps for Instantiation When a Derivation Function is Used 
                 //1.  seed_material  = entropy_input  ||  nonce ||  personalization_string. 
-                //Comment: Ensure that the length of the seed_material  is exactly  seedlen bits
-
-                //fprintf(stderr, "length[0]: %u, length[1]: %u, length[2]: %u, SEEDLEN_INTS: %u\n", length[0], length[1], length[2], NIST_BLOCK_SEEDLEN_BYTES);
-                assert( length[0] +  length[1] + length[2] == NIST_BLOCK_SEEDLEN_BYTES );
+                //Comment: Block_Cipher_df accepts seed_material of any length, e.g. the CAVS vectors use 3/2 * security_strength
 		/* [2] seed_material = Block_Cipher_df(seed_material, seedlen) */
 		err = nist_ctr_drbg_block_cipher_df(input_string, length, count,
-				(unsigned char *)seed_material, sizeof(seed_material));
-		if (err)
+				(unsigned char *)seed_material, seedlen_bytes, keylen);
+		if (err) {
+			secure_free(drbg, sizeof(NIST_CTR_DRBG));
 			return NULL;
+		}
 	} else {
 		//fprintf(stderr,"No derive function");
 
@@ -505,29 +1267,25 @@ NIST_CTR_DRBG* nist_ctr_drbg_instantiate(
 		/* [1]  temp = len (personalization_string) */
 /* [2] If (temp < seedlen), then personalization_string = personalization_string ||0^(seedlen - temp)
  * [3] seed_material = entropy_input XOR personalization_string */
-		if (personalization_string_length > NIST_BLOCK_SEEDLEN_BYTES)
-			return NULL;
-		if ( entropy_input_length != NIST_BLOCK_SEEDLEN_BYTES)
+		if ( personalization_string_length > seedlen_bytes || entropy_input_length != seedlen_bytes ) {
+			secure_free(drbg, sizeof(NIST_CTR_DRBG));
 			return NULL;
+		}
 
-		memcpy(seed_material, entropy_input, NIST_BLOCK_SEEDLEN_BYTES);
+		memcpy(seed_material, entropy_input, seedlen_bytes);
 
                 if (personalization_string) {
-			if (personalization_string_length < NIST_BLOCK_SEEDLEN_BYTES) {
-				memcpy(personalization_string_processed, personalization_string, personalization_string_length);
-				memset(personalization_string_processed+personalization_string_length,0,NIST_BLOCK_SEEDLEN_BYTES-personalization_string_length);
-			} else {
-				memcpy(personalization_string_processed, personalization_string, NIST_BLOCK_SEEDLEN_BYTES);
-			}
+			memcpy(personalization_string_processed, personalization_string, personalization_string_length);
+			memset(personalization_string_processed + personalization_string_length, 0, seedlen_bytes - personalization_string_length);
 			
-			for (i = 0; i < NIST_BLOCK_KEYLEN_INTS; ++i)
-				seed_material[i] ^= personalization_string_processed[i];
+			for (i = 0; i < seedlen_bytes; ++i)
+				((unsigned char *)seed_material)[i] ^= personalization_string_processed[i];
 		}
 	}          
 
 
 	/* [3] Key = 0^keylen */
-	memcpy(&drbg->ctx, &nist_cipher_zero_ctx, sizeof(drbg->ctx));
+	memcpy(&drbg->ctx, &nist_cipher_zero_ctx[NIST_KEYLEN_INDEX(keylen)], sizeof(drbg->ctx));
 
 	/* [4] V = 0^outlen */
 	memset(&drbg->V, 0, sizeof(drbg->V));
@@ -538,6 +1296,8 @@ NIST_CTR_DRBG* nist_ctr_drbg_instantiate(
 	/* [6] reseed_counter = 1 */
 	drbg->reseed_counter = 1;
 
+	nist_zeroize(seed_material, sizeof(seed_material));
+
 	return drbg;
 }
 
@@ -551,12 +1311,12 @@ nist_ctr_drbg_reseed(NIST_CTR_DRBG* drbg,
 	const void* entropy_input, int entropy_input_length,
 	const void* additional_input, int additional_input_length)
 {
-  unsigned int i;
-	int err, count;
+	int i, err, count;
+	int seedlen_bytes = NIST_SEEDLEN_BYTES(drbg->keylen);
 	const char *input_string[2];
 	unsigned int length[2] = { 0 };
-	unsigned int seed_material[NIST_BLOCK_SEEDLEN_INTS];
-	unsigned int additional_input_processed[NIST_BLOCK_SEEDLEN_INTS];
+	unsigned int seed_material[NIST_BLOCK_SEEDLEN_MAX_INTS];
+	unsigned char additional_input_processed[NIST_BLOCK_SEEDLEN_MAX_BYTES];
 
 #if 0
   static uint64_t calls = 0;
@@ -578,12 +1338,10 @@ nist_ctr_drbg_reseed(NIST_CTR_DRBG* drbg,
 		}
                 //10.2.1.4.2  The Process Steps for Reseeding When a Derivation Function is Used 
                 //seed_material  = entropy_input  ||  additional_input
-                //Comment: Ensure that the length of the seed_material  is exactly  seedlen bits.
-                //fprintf(stderr, "length[0]: %u, length[1]: %u, SEEDLEN_INTS: %u\n", length[0], length[1], NIST_BLOCK_SEEDLEN_BYTES);
-                assert( length[0] + length[1] == NIST_BLOCK_SEEDLEN_BYTES ); 
+                //Comment: Block_Cipher_df accepts seed_material of any length
 		/* [2] seed_material = Block_Cipher_df(seed_material, seedlen) */
 		err = nist_ctr_drbg_block_cipher_df(input_string, length, count,
-				(unsigned char *)seed_material, sizeof(seed_material));
+				(unsigned char *)seed_material, seedlen_bytes, drbg->keylen);
 		if (err)
 			return err;
 
@@ -597,22 +1355,18 @@ Input, and a Derivation Function is Not Used
 2. If (temp < seedlen), then additional_input = additional_input || 0seedlen - temp.
 3. seed_material = entropy_input ⊕ additional_input.
 */
-		if ( additional_input_length > NIST_BLOCK_SEEDLEN_BYTES)
+		if ( additional_input_length > seedlen_bytes)
 			return 1;
-		if ( entropy_input_length != NIST_BLOCK_SEEDLEN_BYTES)
+		if ( entropy_input_length != seedlen_bytes)
 			return 1;
 
-		memcpy(seed_material, entropy_input, NIST_BLOCK_SEEDLEN_BYTES);
+		memcpy(seed_material, entropy_input, seedlen_bytes);
 
 		if ( additional_input ) {
-			if ( additional_input_length < NIST_BLOCK_SEEDLEN_BYTES) {
-				memcpy(additional_input_processed, additional_input, additional_input_length);
-				memset(additional_input_processed+additional_input_length,0,NIST_BLOCK_SEEDLEN_BYTES-additional_input_length);
-			} else {
-				memcpy(additional_input_processed, additional_input, NIST_BLOCK_SEEDLEN_BYTES);
-			}
-			for (i = 0; i < NIST_BLOCK_KEYLEN_INTS; ++i)
-				seed_material[i] ^= additional_input_processed[i];
+			memcpy(additional_input_processed, additional_input, additional_input_length);
+			memset(additional_input_processed + additional_input_length, 0, seedlen_bytes - additional_input_length);
+			for (i = 0; i < seedlen_bytes; ++i)
+				((unsigned char *)seed_material)[i] ^= additional_input_processed[i];
 		}
 	}
 
@@ -622,6 +1376,8 @@ Input, and a Derivation Function is Not Used
 	/* [4] reseed_counter = 1 */
 	drbg->reseed_counter = 1;
 
+	nist_zeroize(seed_material, sizeof(seed_material));
+
 	return 0;
 }
 
@@ -640,44 +1396,75 @@ nist_ctr_drbg_generate_block(NIST_CTR_DRBG* drbg, unsigned int* output_block)
 	Block_Encrypt(&drbg->ctx, &drbg->V[0], output_block);
 }
 
-int
-nist_ctr_drbg_generate(NIST_CTR_DRBG* drbg,
-	void* output_string, int output_string_length,
-	const void* additional_input, int additional_input_length)
+/*
+ * Portable CTR kernel. Uses the OpenSSL key schedule.
+ */
+void
+nist_ctr_drbg_ctr_generic(const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks)
 {
-	int i, len, err;
-	int blocks = output_string_length / NIST_BLOCK_OUTLEN_BYTES;
-	unsigned char* p;
-	unsigned int* temp;
-	const char *input_string[1];
-	unsigned int length[1] = { 0 };
-	unsigned int buffer[NIST_BLOCK_OUTLEN_BYTES];
-	unsigned int additional_input_buffer[NIST_BLOCK_SEEDLEN_INTS];
+	unsigned int buffer[NIST_BLOCK_OUTLEN_INTS];
+	int i;
 
-#if 0
-  static uint64_t calls = 0;
-  ++calls;
-  fprintf(stderr, "nist_ctr_drbg_generate %"PRIu64"\n", calls);
-#endif
+	if (check_int_alignment(output)) {
+		for (i = 0; i < blocks; ++i) {
+			nist_increment_block(V);
+			Block_Encrypt(ctx, V, output);
+			output += NIST_BLOCK_OUTLEN_BYTES;
+		}
+	} else {
+		for (i = 0; i < blocks; ++i) {
+			nist_increment_block(V);
+			Block_Encrypt(ctx, V, buffer);
+			memcpy(output, buffer, NIST_BLOCK_OUTLEN_BYTES);
+			output += NIST_BLOCK_OUTLEN_BYTES;
+		}
+	}
+}
 
-	if (output_string_length < 1) {
-    fprintf(stderr, "nist_ctr_drbg_generate: output_string_length %d has to be bigger than 0\n", output_string_length);
-    return 1;
-  }
-  //2^19 is specified as max_number_of_bits_per_request in table 3, section 10.2.1
-	if (output_string_length > (int) NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST ) {
-    fprintf(stderr, "nist_ctr_drbg_generate: maximum output_string_length is %d bytes, requested was %d bytes\n",
-        (int) NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST, output_string_length);
-		return 1;
-  }
- 
+/*
+ * Portable multi-lane CTR kernel
+ *    Runs the bound CTR kernel on NIST_CTR_LANES_ROWS blocks of each lane and interleaves them.
+ */
+void
+nist_ctr_drbg_ctr_lanes_generic(const NIST_Key* const* ctx, unsigned int* const* V, int lanes, unsigned char* output, int blocks)
+{
+	const csprng_kernel_table_type* k = csprng_cpu_kernels();
+	unsigned char buffer[NIST_CTR_LANES_ROWS * NIST_BLOCK_OUTLEN_BYTES];
+	int i, l, rows;
+
+	while (blocks >= lanes) {
+		rows = blocks / lanes;
+		if (rows > NIST_CTR_LANES_ROWS)
+			rows = NIST_CTR_LANES_ROWS;
+		for (l = 0; l < lanes; ++l) {
+			k->aes_ctr(ctx[l], V[l], buffer, rows);
+			for (i = 0; i < rows; ++i)
+				memcpy(output + ( i * lanes + l ) * NIST_BLOCK_OUTLEN_BYTES, buffer + i * NIST_BLOCK_OUTLEN_BYTES, NIST_BLOCK_OUTLEN_BYTES);
+		}
+		output += rows * lanes * NIST_BLOCK_OUTLEN_BYTES;
+		blocks -= rows * lanes;
+	}
 
-	/* [1] If reseed_counter > reseed_interval ... */
-	if (drbg->reseed_counter >= NIST_CTR_DRBG_RESEED_INTERVAL) {
-    fprintf(stderr, "nist_ctr_drbg_generate: reseed required. reseed_counter %" PRIu64 " has reached the limit of %d\n",
-        drbg->reseed_counter, (int) NIST_CTR_DRBG_RESEED_INTERVAL );
-		return 1;
-  }
+	/* Less than one block per lane is left */
+	for (l = 0; l < blocks; ++l)
+		k->aes_ctr(ctx[l], V[l], output + l * NIST_BLOCK_OUTLEN_BYTES, 1);
+
+	nist_zeroize(buffer, sizeof(buffer));
+}
+
+/*
+ * Step [2] of the generate process: mix additional_input into (Key, V).
+ * additional_input_buffer receives the padded or derived additional input used again by step [6].
+ */
+static int
+nist_ctr_drbg_generate_additional_input(NIST_CTR_DRBG* drbg,
+	const void* additional_input, int additional_input_length,
+	unsigned int* additional_input_buffer)
+{
+	int err;
+	int seedlen_bytes = NIST_SEEDLEN_BYTES(drbg->keylen);
+	const char *input_string[1];
+	unsigned int length[1] = { 0 };
 
 	if ( drbg->derive_function ) {
 
@@ -688,13 +1475,11 @@ nist_ctr_drbg_generate(NIST_CTR_DRBG* drbg,
                         
                         //10.2.1.5.2  The Process Steps for Generating  Pseudorandom Bits When a Derivation Function
                         // is Used for the DRBG Implementation 
-                        // Requirement that the length of the additional_input  is exactly seedlen bits is not specified in the NIST SP800-90
-                        // but it's IMHO (Jirka Hladky) very reasonable
-                        //fprintf(stderr, "length[0]: %u, SEEDLEN_INTS: %u\n", length[0], NIST_BLOCK_SEEDLEN_BYTES);
-                        assert( length[0] == NIST_BLOCK_SEEDLEN_BYTES );
+                        // The length of the additional_input is not restricted by NIST SP800-90, the CAVS vectors use
+                        // additional_input shorter than seedlen bits
 			/* [2.1] additional_input = Block_Cipher_df(additional_input, seedlen) */
 			err = nist_ctr_drbg_block_cipher_df(input_string, length, 1,
-					(unsigned char *)additional_input_buffer, sizeof(additional_input_buffer));
+					(unsigned char *)additional_input_buffer, seedlen_bytes, drbg->keylen);
 			if (err) {
         fprintf(stderr, "nist_ctr_drbg_generate: nist_ctr_drbg_block_cipher_df (DERIVATION FUNCTION) has failed.\n");
 				return err;
@@ -704,18 +1489,6 @@ nist_ctr_drbg_generate(NIST_CTR_DRBG* drbg,
 			nist_ctr_drbg_update(drbg, additional_input_buffer);
 		}
 
-		if (blocks && check_int_alignment(output_string)) {
-			/* [3] temp = Null */
-			temp = (unsigned int *)output_string;
-			for (i = 0; i < blocks; ++i) {
-				nist_ctr_drbg_generate_block(drbg, temp);
-
-				temp += NIST_BLOCK_OUTLEN_INTS;
-				output_string_length -= NIST_BLOCK_OUTLEN_BYTES;
-			}
-
-			output_string = (unsigned char *)temp;
-		}
 	} else {
 /*
 10.2.1.5.1
@@ -731,32 +1504,87 @@ Not Used for the DRBG Implementation
 Else additional_input = 0^seedlen.
 */		
 		if ( additional_input && additional_input_length > 0 ) {
-			if ( additional_input_length > NIST_BLOCK_SEEDLEN_BYTES)
+			if ( additional_input_length > seedlen_bytes)
 				return 1;
 
-			if ( additional_input_length < NIST_BLOCK_SEEDLEN_BYTES) {
-				memcpy(additional_input_buffer, additional_input, additional_input_length);
-				memset(additional_input_buffer+additional_input_length,0,NIST_BLOCK_SEEDLEN_BYTES-additional_input_length);
-				
-			} else {
-				memcpy(additional_input_buffer, additional_input,NIST_BLOCK_SEEDLEN_BYTES);
-			}
+			memcpy(additional_input_buffer, additional_input, additional_input_length);
+			memset((unsigned char *)additional_input_buffer + additional_input_length, 0, seedlen_bytes - additional_input_length);
       nist_ctr_drbg_update(drbg, additional_input_buffer);
 		}
 		//} else {
-		//	memset(additional_input_buffer, 0, NIST_BLOCK_SEEDLEN_BYTES);;
+		//	memset(additional_input_buffer, 0, seedlen_bytes);;
 		//}
 		//We create string with 0 directly at step [6] when needed
 	}
 
-	
-	/* [3] temp = Null */
-	temp = buffer;
+	return 0;
+}
 
-	len = NIST_BLOCK_OUTLEN_BYTES;
+int
+nist_ctr_drbg_generate(NIST_CTR_DRBG* drbg,
+	void* output_string, int output_string_length,
+	const void* additional_input, int additional_input_length)
+{
+	int len, err;
+	int blocks = output_string_length / NIST_BLOCK_OUTLEN_BYTES;
+	unsigned char* p;
+	unsigned int* temp;
+	unsigned int buffer[NIST_BLOCK_OUTLEN_BYTES];
+	unsigned int additional_input_buffer[NIST_BLOCK_SEEDLEN_MAX_INTS];
+
+#if 0
+  static uint64_t calls = 0;
+  ++calls;
+  fprintf(stderr, "nist_ctr_drbg_generate %"PRIu64"\n", calls);
+#endif
+
+	if (output_string_length < 1) {
+    fprintf(stderr, "nist_ctr_drbg_generate: output_string_length %d has to be bigger than 0\n", output_string_length);
+    return 1;
+  }
+  //2^19 is specified as max_number_of_bits_per_request in table 3, section 10.2.1
+	if (output_string_length > (int) NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST ) {
+    fprintf(stderr, "nist_ctr_drbg_generate: maximum output_string_length is %d bytes, requested was %d bytes\n",
+        (int) NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST, output_string_length);
+		return 1;
+  }
+
+  //The state lives in the secure arena, which is zeroed in a forked child. Never generate from the zero key
+	if (drbg->keylen == 0) {
+    fprintf(stderr, "nist_ctr_drbg_generate: the state has been wiped. It cannot be used in a child process after fork\n");
+		return 1;
+  }
+
+	/* [1] If reseed_counter > reseed_interval ... */
+	if (drbg->reseed_counter >= NIST_CTR_DRBG_RESEED_INTERVAL) {
+    fprintf(stderr, "nist_ctr_drbg_generate: reseed required. reseed_counter %" PRIu64 " has reached the limit of %d\n",
+        drbg->reseed_counter, (int) NIST_CTR_DRBG_RESEED_INTERVAL );
+		return 1;
+  }
 
+	/* [2] If (addional_input != Null), then ... */
+	err = nist_ctr_drbg_generate_additional_input(drbg, additional_input, additional_input_length, additional_input_buffer);
+	if (err)
+		return err;
+
+	
+	/* [3] temp = Null */
 	/* [4] While (len(temp) < requested_number_of_bits) do: */
+	/* Whole blocks are written directly to the output. Large requests are split between */
+	/* the pool threads, each slice starting at its own counter value */
 	p = output_string;
+	if (blocks) {
+		if (drbg->pool)
+			nist_ctr_drbg_pool_ctr(drbg->pool, &drbg->ctx, &drbg->V[0], p, blocks);
+		else
+			csprng_cpu_kernels()->aes_ctr(&drbg->ctx, &drbg->V[0], p, blocks);
+		p += blocks * NIST_BLOCK_OUTLEN_BYTES;
+		output_string_length -= blocks * NIST_BLOCK_OUTLEN_BYTES;
+	}
+
+	/* Last incomplete block */
+	temp = buffer;
+	len = NIST_BLOCK_OUTLEN_BYTES;
 	while (output_string_length > 0) {
 		nist_ctr_drbg_generate_block(drbg, temp);
 
@@ -780,28 +1608,136 @@ Else additional_input = 0^seedlen.
 	return 0;
 }
 
+/*
+ * Generate for lanes independent instances at once. Block i of the output comes from lane
+ * i mod lanes, so each lane serves about output_string_length / lanes bytes of the request.
+ * Every lane runs its own steps [1] - [7] with the same additional input; step [4] of all
+ * lanes is done by one multi-lane kernel. All lanes must have the same key length.
+ */
+int
+nist_ctr_drbg_generate_lanes(NIST_CTR_DRBG* const* drbg, int lanes,
+	void* output_string, int output_string_length,
+	const void* additional_input, int additional_input_length)
+{
+	const NIST_Key* ctx[NIST_CTR_DRBG_MAX_LANES];
+	unsigned int* V[NIST_CTR_DRBG_MAX_LANES];
+	unsigned int buffer[NIST_BLOCK_OUTLEN_INTS];
+	unsigned int additional_input_buffer[NIST_CTR_DRBG_MAX_LANES][NIST_BLOCK_SEEDLEN_MAX_INTS];
+	unsigned char* p = output_string;
+	int blocks = output_string_length / NIST_BLOCK_OUTLEN_BYTES;
+	int tail = output_string_length % NIST_BLOCK_OUTLEN_BYTES;
+	int i, err;
+
+	if (lanes < 1 || lanes > NIST_CTR_DRBG_MAX_LANES) {
+		fprintf(stderr, "nist_ctr_drbg_generate_lanes: number of lanes has to be in range 1 - %d, got %d\n", NIST_CTR_DRBG_MAX_LANES, lanes);
+		return 1;
+	}
+	//Each lane is limited to max_number_of_bits_per_request
+	if (output_string_length < 1 || output_string_length > lanes * (int) NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST) {
+		fprintf(stderr, "nist_ctr_drbg_generate_lanes: output_string_length has to be in range 1 - %d bytes, requested was %d bytes\n",
+			lanes * (int) NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST, output_string_length);
+		return 1;
+	}
+
+	for (i = 0; i < lanes; ++i) {
+		if (drbg[i]->keylen != drbg[0]->keylen) {
+			fprintf(stderr, "nist_ctr_drbg_generate_lanes: lane %d uses AES-%d, lane 0 uses AES-%d\n", i, drbg[i]->keylen, drbg[0]->keylen);
+			return 1;
+		}
+		/* [1] If reseed_counter > reseed_interval ... */
+		if (drbg[i]->reseed_counter >= NIST_CTR_DRBG_RESEED_INTERVAL) {
+			fprintf(stderr, "nist_ctr_drbg_generate_lanes: reseed of lane %d required. reseed_counter %" PRIu64 " has reached the limit\n",
+				i, drbg[i]->reseed_counter);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < lanes; ++i) {
+		/* [2] If (addional_input != Null), then ... */
+		err = nist_ctr_drbg_generate_additional_input(drbg[i], additional_input, additional_input_length, additional_input_buffer[i]);
+		if (err)
+			return err;
+		ctx[i] = &drbg[i]->ctx;
+		V[i] = &drbg[i]->V[0];
+	}
+
+	/* [3] temp = Null */
+	/* [4] While (len(temp) < requested_number_of_bits) do: */
+	if (blocks)
+		csprng_cpu_kernels()->aes_ctr_lanes(ctx, V, lanes, p, blocks);
+
+	/* Last incomplete block belongs to the next lane in turn */
+	if (tail) {
+		nist_ctr_drbg_generate_block(drbg[blocks % lanes], buffer);
+		memcpy(p + blocks * NIST_BLOCK_OUTLEN_BYTES, buffer, tail);
+		nist_zeroize(buffer, sizeof(buffer));
+	}
+
+	for (i = 0; i < lanes; ++i) {
+		/* [6] (Key, V) = Update(additional_input, Key, V) */
+		nist_ctr_drbg_update(drbg[i], (additional_input && additional_input_length>0) ?
+			&additional_input_buffer[i][0] :
+			&nist_ctr_drgb_generate_null_input[0]);
+
+		/* [7] reseed_counter = reseed_counter + 1 */
+		++drbg[i]->reseed_counter;
+	}
+
+	return 0;
+}
+
+int
+nist_ctr_drbg_set_threads(NIST_CTR_DRBG* drbg, int threads)
+{
+	nist_ctr_drbg_pool_destroy(drbg->pool);
+	drbg->pool = NULL;
+
+	if (threads <= 1)
+		return 0;
+
+	drbg->pool = nist_ctr_drbg_pool_create(threads);
+	if (drbg->pool == NULL) {
+		fprintf(stderr, "nist_ctr_drbg_set_threads: failed to start %d threads\n", threads);
+		return 1;
+	}
+
+	return 0;
+}
+
 int
 nist_ctr_initialize()
 {
-	int err;
+	int err, keylen;
 
-	err = nist_ctr_drbg_instantiate_initialize();
-	if (err)
-		return err;
-	err = nist_ctr_drbg_block_cipher_df_initialize();
+	err = csprng_cpu_dispatch_initialize();
 	if (err)
 		return err;
 
-	return 0;
+	pthread_mutex_lock(&nist_ctr_initialize_mutex);
+	if (nist_ctr_initialized_cipher != csprng_cpu_kernels()->aes_encrypt) {
+		for (keylen = 128; keylen <= NIST_BLOCK_KEYLEN_MAX; keylen += 64) {
+			err = nist_ctr_drbg_instantiate_initialize(keylen);
+			if (err)
+				break;
+			err = nist_ctr_drbg_block_cipher_df_initialize(keylen);
+			if (err)
+				break;
+		}
+		nist_ctr_initialized_cipher = err ? NULL : csprng_cpu_kernels()->aes_encrypt;
+	}
+	pthread_mutex_unlock(&nist_ctr_initialize_mutex);
+
+	return err;
 }
 
 int
 nist_ctr_drbg_destroy(NIST_CTR_DRBG* drbg)
 {
   if ( drbg != NULL ) {
+    nist_ctr_drbg_pool_destroy(drbg->pool);
     nist_zeroize(drbg, sizeof(*drbg));
     drbg->reseed_counter = ~0U;
-    free(drbg);
+    secure_free(drbg, sizeof(NIST_CTR_DRBG));
   }
 
   return 0;
@@ -0,0 +1,222 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Worker pool splitting one CTR_DRBG generate request
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "nist_ctr_drbg_pool.h"
+#include "cpu_kernels.h"
+
+struct nist_ctr_drbg_pool_type {
+  int threads;                                        //Worker threads + calling thread
+  pthread_t* worker;
+  pthread_mutex_t mutex;
+  pthread_cond_t start;                               //Signaled when a new request is posted or on shutdown
+  pthread_cond_t done;                                //Signaled when the last slice of the request is finished
+  uint64_t generation;                                //Incremented for each request
+  int pending;                                        //Slices not finished yet
+  int shutdown;
+  //Current request
+  const NIST_Key* ctx;
+  unsigned int V[NIST_BLOCK_OUTLEN_INTS];             //Counter before the first block of the request
+  unsigned char* output;
+  int blocks;
+  int slices;
+};
+
+typedef struct {
+  nist_ctr_drbg_pool_type* pool;
+  int slice;
+} nist_ctr_drbg_worker_arg_type;
+
+//{{{ Slices
+/*
+ * V = V + n. V is a big-endian number
+ */
+static void nist_ctr_drbg_pool_add(unsigned int* V, uint64_t n)
+{
+  unsigned char* p = (unsigned char *) V;
+  unsigned int carry;
+  int i;
+
+  for ( i = NIST_BLOCK_OUTLEN_BYTES - 1; i >= 0 && n; --i ) {
+    carry = p[i] + (unsigned int) ( n & 0xff );
+    p[i] = (unsigned char) carry;
+    n = ( n >> 8 ) + ( carry >> 8 );
+  }
+}
+
+/*
+ * Slice boundaries are multiples of 8 blocks so that every slice but the last one keeps the kernels pipelined
+ */
+static void nist_ctr_drbg_pool_run_slice(nist_ctr_drbg_pool_type* pool, int slice)
+{
+  unsigned int V[NIST_BLOCK_OUTLEN_INTS];
+  int per_slice = ( ( pool->blocks / pool->slices ) + 7 ) & ~7;
+  int first = slice * per_slice;
+  int blocks = ( slice == pool->slices - 1 ) ? pool->blocks - first : per_slice;
+
+  if ( blocks <= 0 ) return;
+  memcpy(V, pool->V, sizeof(V));
+  nist_ctr_drbg_pool_add(V, first);
+  csprng_cpu_kernels()->aes_ctr(pool->ctx, V, pool->output + (size_t) first * NIST_BLOCK_OUTLEN_BYTES, blocks);
+  memset(V, 0, sizeof(V));
+}
+//}}}
+
+//{{{ Worker thread
+static void* nist_ctr_drbg_pool_worker(void* arg)
+{
+  nist_ctr_drbg_worker_arg_type* worker = arg;
+  nist_ctr_drbg_pool_type* pool = worker->pool;
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&pool->mutex);
+  for (;;) {
+    while ( pool->generation == seen && !pool->shutdown ) pthread_cond_wait(&pool->start, &pool->mutex);
+    if ( pool->shutdown ) break;
+    seen = pool->generation;
+    if ( worker->slice >= pool->slices ) continue;
+
+    pthread_mutex_unlock(&pool->mutex);
+    nist_ctr_drbg_pool_run_slice(pool, worker->slice);
+    pthread_mutex_lock(&pool->mutex);
+
+    if ( --pool->pending == 0 ) pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  free(worker);
+  return NULL;
+}
+//}}}
+
+//{{{ Public API
+nist_ctr_drbg_pool_type* nist_ctr_drbg_pool_create(int threads)
+{
+  nist_ctr_drbg_pool_type* pool;
+  nist_ctr_drbg_worker_arg_type* worker;
+  int i, rc;
+
+  if ( threads < 2 ) {
+    fprintf(stderr, "nist_ctr_drbg_pool_create: expecting at least 2 threads, got %d\n", threads);
+    return NULL;
+  }
+
+  pool = calloc(1, sizeof(nist_ctr_drbg_pool_type));
+  if ( pool == NULL ) {
+    fprintf(stderr, "nist_ctr_drbg_pool_create: Dynamic memory allocation failed\n");
+    return NULL;
+  }
+  pool->worker = calloc(threads - 1, sizeof(pthread_t));
+  if ( pool->worker == NULL ) {
+    fprintf(stderr, "nist_ctr_drbg_pool_create: Dynamic memory allocation failed\n");
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  //Slice 0 belongs to the calling thread
+  for ( i = 0; i < threads - 1; ++i ) {
+    worker = malloc(sizeof(nist_ctr_drbg_worker_arg_type));
+    if ( worker == NULL ) {
+      fprintf(stderr, "nist_ctr_drbg_pool_create: Dynamic memory allocation failed\n");
+      break;
+    }
+    worker->pool = pool;
+    worker->slice = i + 1;
+    rc = pthread_create(&pool->worker[i], NULL, nist_ctr_drbg_pool_worker, worker);
+    if ( rc ) {
+      fprintf(stderr, "nist_ctr_drbg_pool_create: pthread_create has failed: %s\n", strerror(rc));
+      free(worker);
+      break;
+    }
+  }
+  pool->threads = i + 1;
+
+  if ( pool->threads < threads ) {
+    nist_ctr_drbg_pool_destroy(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+void nist_ctr_drbg_pool_ctr(nist_ctr_drbg_pool_type* pool, const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks)
+{
+  int slices = blocks / NIST_CTR_DRBG_POOL_MIN_BLOCKS;
+
+  if ( slices > pool->threads ) slices = pool->threads;
+  if ( slices < 2 ) {
+    csprng_cpu_kernels()->aes_ctr(ctx, V, output, blocks);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->ctx = ctx;
+  memcpy(pool->V, V, sizeof(pool->V));
+  pool->output = output;
+  pool->blocks = blocks;
+  pool->slices = slices;
+  pool->pending = slices - 1;
+  ++pool->generation;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->mutex);
+
+  nist_ctr_drbg_pool_run_slice(pool, 0);
+
+  pthread_mutex_lock(&pool->mutex);
+  while ( pool->pending ) pthread_cond_wait(&pool->done, &pool->mutex);
+  memset(pool->V, 0, sizeof(pool->V));
+  pool->ctx = NULL;
+  pool->output = NULL;
+  pthread_mutex_unlock(&pool->mutex);
+
+  nist_ctr_drbg_pool_add(V, blocks);
+}
+
+void nist_ctr_drbg_pool_destroy(nist_ctr_drbg_pool_type* pool)
+{
+  int i;
+
+  if ( pool == NULL ) return;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for ( i = 0; i < pool->threads - 1; ++i ) pthread_join(pool->worker[i], NULL);
+
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool->worker);
+  free(pool);
+}
+//}}}
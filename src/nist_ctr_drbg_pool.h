@@ -0,0 +1,44 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Worker pool splitting one CTR_DRBG generate request. Internal to libcsprng.
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#ifndef NIST_CTR_DRBG_POOL_H
+#define NIST_CTR_DRBG_POOL_H
+
+#include <csprng/nist_ctr_drbg.h>
+
+//Smallest slice given to one thread. Below it the synchronization costs more than it saves
+#define NIST_CTR_DRBG_POOL_MIN_BLOCKS 512
+
+/* threads - 1 worker threads are started, the calling thread computes one slice itself */
+nist_ctr_drbg_pool_type* nist_ctr_drbg_pool_create(int threads);
+
+/*
+ * Same contract as the aes_ctr kernel: encrypt counter blocks V+1 ... V+blocks into output and set V to V+blocks.
+ * Slice i is written by one thread starting at counter V+1+offset_i, so the output does not depend on the thread count.
+ */
+void nist_ctr_drbg_pool_ctr(nist_ctr_drbg_pool_type* pool, const NIST_Key* ctx, unsigned int* V, unsigned char* output, int blocks);
+
+void nist_ctr_drbg_pool_destroy(nist_ctr_drbg_pool_type* pool);
+
+#endif
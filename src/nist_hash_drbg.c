@@ -0,0 +1,633 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+NIST SP 800-90A Hash_DRBG (10.1.1) and HMAC_DRBG (10.1.2) with SHA-256 and SHA-512
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <csprng/nist_hash_drbg.h>
+#include "sha2.h"
+#include "cpu_kernels.h"
+#include "secure_arena.h"
+
+const char* const nist_hash_names[NIST_HASH_COUNT] = {
+  "SHA-256",
+  "SHA-512"
+};
+
+//Messages hashed by one call of the multi-buffer kernel in Hashgen
+#define NIST_HASHGEN_BATCH 16
+
+//{{{ Hash function of the DRBG instance
+typedef struct {
+  nist_hash_type hash;
+  union {
+    sha256_ctx_type sha256;
+    sha512_ctx_type sha512;
+  } u;
+} nist_hash_ctx_type;
+
+static void nist_hash_init(nist_hash_ctx_type* ctx, nist_hash_type hash)
+{
+  ctx->hash = hash;
+  if ( hash == NIST_HASH_SHA256 ) {
+    sha256_init(&ctx->u.sha256);
+  } else {
+    sha512_init(&ctx->u.sha512);
+  }
+}
+
+static void nist_hash_update(nist_hash_ctx_type* ctx, const void* data, int len)
+{
+  if ( len <= 0 ) return;
+  if ( ctx->hash == NIST_HASH_SHA256 ) {
+    sha256_update(&ctx->u.sha256, data, len);
+  } else {
+    sha512_update(&ctx->u.sha512, data, len);
+  }
+}
+
+static void nist_hash_final(nist_hash_ctx_type* ctx, unsigned char* digest)
+{
+  if ( ctx->hash == NIST_HASH_SHA256 ) {
+    sha256_final(&ctx->u.sha256, digest);
+  } else {
+    sha512_final(&ctx->u.sha512, digest);
+  }
+}
+
+static int nist_hash_valid(nist_hash_type hash, const char* function)
+{
+  if ( hash != NIST_HASH_SHA256 && hash != NIST_HASH_SHA512 ) {
+    fprintf(stderr, "%s: Unsupported hash function %d. Expecting SHA-256 or SHA-512.\n", function, (int) hash);
+    return 0;
+  }
+  return 1;
+}
+//}}}
+
+//{{{ Hash_DRBG
+/*
+ * x = ( x + y ) mod 2^(8*xlen). Both numbers are big-endian, ylen <= xlen
+ */
+static void nist_hash_drbg_add(unsigned char* x, int xlen, const unsigned char* y, int ylen)
+{
+  unsigned int carry = 0;
+  int i, j;
+
+  for ( i = xlen - 1, j = ylen - 1; i >= 0; --i, --j ) {
+    carry += x[i] + ( j >= 0 ? y[j] : 0 );
+    x[i] = carry & 0xff;
+    carry >>= 8;
+  }
+}
+
+static void nist_hash_drbg_increment(unsigned char* x, int xlen)
+{
+  int i;
+
+  for ( i = xlen - 1; i >= 0; --i ) {
+    if ( ++x[i] != 0 ) return;
+  }
+}
+
+/*
+ * NIST SP 800-90A 10.4.1 Hash_df
+ *    The input string is input_string[0] || input_string[1] || ... of lengths L[]
+ */
+static void nist_hash_df(nist_hash_type hash, const void* input_string[], const int L[], int input_string_count,
+    unsigned char* requested_bits, int no_of_bytes_to_return)
+{
+  nist_hash_ctx_type ctx;
+  unsigned char digest[NIST_HASH_OUTLEN_MAX_BYTES];
+  unsigned char prefix[5];
+  const int outlen = NIST_HASH_OUTLEN_BYTES(hash);
+  int i, len;
+
+  /* [3] counter = 0x01 */
+  prefix[0] = 0x01;
+  prefix[1] = ( no_of_bytes_to_return * 8 ) >> 24;
+  prefix[2] = ( no_of_bytes_to_return * 8 ) >> 16;
+  prefix[3] = ( no_of_bytes_to_return * 8 ) >> 8;
+  prefix[4] = ( no_of_bytes_to_return * 8 );
+
+  /* [4] For i = 1 to len do */
+  while ( no_of_bytes_to_return > 0 ) {
+    /* [4.1] temp = temp || Hash(counter || no_of_bits_to_return || input_string) */
+    nist_hash_init(&ctx, hash);
+    nist_hash_update(&ctx, prefix, sizeof(prefix));
+    for ( i = 0; i < input_string_count; ++i ) nist_hash_update(&ctx, input_string[i], L[i]);
+    nist_hash_final(&ctx, digest);
+
+    /* [5] requested_bits = Leftmost (no_of_bits_to_return) of temp */
+    len = ( no_of_bytes_to_return < outlen ) ? no_of_bytes_to_return : outlen;
+    memcpy(requested_bits, digest, len);
+    requested_bits += len;
+    no_of_bytes_to_return -= len;
+
+    /* [4.2] counter = counter + 1 */
+    ++prefix[0];
+  }
+
+  memset(digest, 0, sizeof(digest));
+}
+
+/*
+ * V = seed, C = Hash_df((0x00 || V), seedlen), reseed_counter = 1
+ * Shared by instantiate (10.1.1.2 steps 2-5) and reseed (10.1.1.3 steps 2-5)
+ */
+static void nist_hash_drbg_seed(NIST_HASH_DRBG* drbg, const void* seed_material[], const int L[], int count)
+{
+  static const unsigned char zero = 0x00;
+  const void* input_string[2];
+  int length[2];
+
+  /* [2] seed = Hash_df(seed_material, seedlen) */
+  /* [3] V = seed */
+  nist_hash_df(drbg->hash, seed_material, L, count, drbg->V, drbg->seedlen);
+
+  /* [4] C = Hash_df((0x00 || V), seedlen) */
+  input_string[0] = &zero;
+  length[0] = 1;
+  input_string[1] = drbg->V;
+  length[1] = drbg->seedlen;
+  nist_hash_df(drbg->hash, input_string, length, 2, drbg->C, drbg->seedlen);
+
+  /* [5] reseed_counter = 1 */
+  drbg->reseed_counter = 1;
+}
+
+/*
+ * 10.1.1.4 Hashgen
+ *    Hashes of data, data+1, ... do not depend on each other. seedlen bytes of data together with
+ *    the padding fill exactly one block (55+1+8 = 64 for SHA-256, 111+1+16 = 128 for SHA-512),
+ *    so they are hashed by the multi-buffer kernel in batches of NIST_HASHGEN_BATCH.
+ */
+static void nist_hash_drbg_hashgen(const NIST_HASH_DRBG* drbg, unsigned char* output, int output_length)
+{
+  unsigned char blocks[NIST_HASHGEN_BATCH * SHA512_BLOCK_BYTES];
+  unsigned char digests[NIST_HASHGEN_BATCH * NIST_HASH_OUTLEN_MAX_BYTES];
+  unsigned char data[NIST_HASH_SEEDLEN_MAX_BYTES];
+  const int outlen = NIST_HASH_OUTLEN_BYTES(drbg->hash);
+  const int block_bytes = ( drbg->hash == NIST_HASH_SHA256 ) ? SHA256_BLOCK_BYTES : SHA512_BLOCK_BYTES;
+  const sha2_multi_kernel_type multi = ( drbg->hash == NIST_HASH_SHA256 ) ?
+    csprng_cpu_kernels()->sha256_multi : csprng_cpu_kernels()->sha512_multi;
+  const uint64_t bits = drbg->seedlen * 8;
+  unsigned char* block;
+  int i, m, len;
+
+  /* [2] data = V */
+  memcpy(data, drbg->V, drbg->seedlen);
+
+  /* [4] For i = 1 to m */
+  while ( output_length > 0 ) {
+    /* [1] m = ceil(requested_no_of_bits / outlen) */
+    m = ( output_length + outlen - 1 ) / outlen;
+    if ( m > NIST_HASHGEN_BATCH ) m = NIST_HASHGEN_BATCH;
+
+    for ( i = 0; i < m; ++i ) {
+      block = blocks + i * block_bytes;
+      memcpy(block, data, drbg->seedlen);
+      block[drbg->seedlen] = 0x80;
+      memset(block + drbg->seedlen + 1, 0, block_bytes - drbg->seedlen - 1 - 2);
+      block[block_bytes - 2] = bits >> 8;
+      block[block_bytes - 1] = bits;
+
+      /* [4.3] data = (data + 1) mod 2^seedlen */
+      nist_hash_drbg_increment(data, drbg->seedlen);
+    }
+
+    /* [4.1] w = Hash(data) */
+    /* [4.2] W = W || w */
+    if ( output_length >= m * outlen ) {
+      multi(blocks, m, output);
+      len = m * outlen;
+    } else {
+      multi(blocks, m, digests);
+      len = output_length;
+      memcpy(output, digests, len);
+    }
+    output += len;
+    output_length -= len;
+  }
+
+  memset(blocks, 0, sizeof(blocks));
+  memset(digests, 0, sizeof(digests));
+  memset(data, 0, sizeof(data));
+}
+
+/*
+ * 10.1.1.2 Instantiation of Hash_DRBG
+ */
+NIST_HASH_DRBG* nist_hash_drbg_instantiate(
+    const void* entropy_input, int entropy_input_length,
+    const void* nonce, int nonce_length,
+    const void* personalization_string, int personalization_string_length,
+    nist_hash_type hash)
+{
+  NIST_HASH_DRBG* drbg;
+  const void* seed_material[3];
+  int length[3];
+
+  if ( ! nist_hash_valid(hash, "nist_hash_drbg_instantiate") ) return NULL;
+  if ( entropy_input_length < NIST_HASH_SECURITY_STRENGTH_BYTES ) {
+    fprintf(stderr, "nist_hash_drbg_instantiate: entropy_input_length has to be at least %d bytes, got %d bytes\n",
+        NIST_HASH_SECURITY_STRENGTH_BYTES, entropy_input_length);
+    return NULL;
+  }
+
+  drbg = secure_alloc(sizeof(NIST_HASH_DRBG));
+  if ( drbg == NULL ) {
+    fprintf(stderr, "nist_hash_drbg_instantiate: Dynamic memory allocation failed\n");
+    return drbg;
+  }
+  drbg->hash = hash;
+  drbg->seedlen = NIST_HASH_SEEDLEN_BYTES(hash);
+
+  /* [1] seed_material = entropy_input || nonce || personalization_string */
+  seed_material[0] = entropy_input;
+  length[0] = entropy_input_length;
+  seed_material[1] = nonce;
+  length[1] = nonce ? nonce_length : 0;
+  seed_material[2] = personalization_string;
+  length[2] = personalization_string ? personalization_string_length : 0;
+
+  nist_hash_drbg_seed(drbg, seed_material, length, 3);
+
+  return drbg;
+}
+
+/*
+ * 10.1.1.3 Reseeding a Hash_DRBG Instantiation
+ */
+int nist_hash_drbg_reseed(NIST_HASH_DRBG* drbg,
+    const void* entropy_input, int entropy_input_length,
+    const void* additional_input, int additional_input_length)
+{
+  static const unsigned char one = 0x01;
+  unsigned char V[NIST_HASH_SEEDLEN_MAX_BYTES];
+  const void* seed_material[4];
+  int length[4];
+
+  if ( entropy_input_length < NIST_HASH_SECURITY_STRENGTH_BYTES ) {
+    fprintf(stderr, "nist_hash_drbg_reseed: entropy_input_length has to be at least %d bytes, got %d bytes\n",
+        NIST_HASH_SECURITY_STRENGTH_BYTES, entropy_input_length);
+    return 1;
+  }
+
+  /* [1] seed_material = 0x01 || V || entropy_input || additional_input */
+  memcpy(V, drbg->V, drbg->seedlen);
+  seed_material[0] = &one;
+  length[0] = 1;
+  seed_material[1] = V;
+  length[1] = drbg->seedlen;
+  seed_material[2] = entropy_input;
+  length[2] = entropy_input_length;
+  seed_material[3] = additional_input;
+  length[3] = additional_input ? additional_input_length : 0;
+
+  nist_hash_drbg_seed(drbg, seed_material, length, 4);
+
+  memset(V, 0, sizeof(V));
+  return 0;
+}
+
+/*
+ * 10.1.1.4 Generating Pseudorandom Bits Using Hash_DRBG
+ */
+int nist_hash_drbg_generate(NIST_HASH_DRBG* drbg,
+    void* output_string, int output_string_length,
+    const void* additional_input, int additional_input_length)
+{
+  static const unsigned char two = 0x02, three = 0x03;
+  const int outlen = NIST_HASH_OUTLEN_BYTES(drbg->hash);
+  nist_hash_ctx_type ctx;
+  unsigned char w[NIST_HASH_OUTLEN_MAX_BYTES];
+  unsigned char counter[8];
+  int i;
+
+  if ( output_string_length < 1 || output_string_length > (int) NIST_HASH_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST ) {
+    fprintf(stderr, "nist_hash_drbg_generate: output_string_length has to be in range 1 - %d bytes, requested was %d bytes\n",
+        (int) NIST_HASH_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST, output_string_length);
+    return 1;
+  }
+
+  /* [1] If reseed_counter > reseed_interval, then return an indication that a reseed is required */
+  if ( drbg->reseed_counter >= NIST_HASH_DRBG_RESEED_INTERVAL ) {
+    fprintf(stderr, "nist_hash_drbg_generate: reseed required. reseed_counter %" PRIu64 " has reached the limit\n",
+        drbg->reseed_counter);
+    return 1;
+  }
+
+  /* [2] If (additional_input != Null), then do */
+  if ( additional_input && additional_input_length > 0 ) {
+    /* [2.1] w = Hash(0x02 || V || additional_input) */
+    nist_hash_init(&ctx, drbg->hash);
+    nist_hash_update(&ctx, &two, 1);
+    nist_hash_update(&ctx, drbg->V, drbg->seedlen);
+    nist_hash_update(&ctx, additional_input, additional_input_length);
+    nist_hash_final(&ctx, w);
+
+    /* [2.2] V = (V + w) mod 2^seedlen */
+    nist_hash_drbg_add(drbg->V, drbg->seedlen, w, outlen);
+  }
+
+  /* [3] (returned_bits) = Hashgen(requested_number_of_bits, V) */
+  nist_hash_drbg_hashgen(drbg, output_string, output_string_length);
+
+  /* [4] H = Hash(0x03 || V) */
+  nist_hash_init(&ctx, drbg->hash);
+  nist_hash_update(&ctx, &three, 1);
+  nist_hash_update(&ctx, drbg->V, drbg->seedlen);
+  nist_hash_final(&ctx, w);
+
+  /* [5] V = (V + H + C + reseed_counter) mod 2^seedlen */
+  for ( i = 0; i < 8; ++i ) counter[i] = drbg->reseed_counter >> ( 56 - 8 * i );
+  nist_hash_drbg_add(drbg->V, drbg->seedlen, w, outlen);
+  nist_hash_drbg_add(drbg->V, drbg->seedlen, drbg->C, drbg->seedlen);
+  nist_hash_drbg_add(drbg->V, drbg->seedlen, counter, sizeof(counter));
+
+  /* [6] reseed_counter = reseed_counter + 1 */
+  ++drbg->reseed_counter;
+
+  memset(w, 0, sizeof(w));
+  return 0;
+}
+
+int nist_hash_drbg_destroy(NIST_HASH_DRBG* drbg)
+{
+  if ( drbg != NULL ) {
+    memset(drbg, 0, sizeof(*drbg));
+    drbg->reseed_counter = ~0ULL;
+    secure_free(drbg, sizeof(NIST_HASH_DRBG));
+  }
+
+  return 0;
+}
+//}}}
+
+//{{{ HMAC_DRBG
+/*
+ * Precompute the chaining values of Hash(K XOR ipad || ...) and Hash(K XOR opad || ...)
+ */
+static void nist_hmac_set_key(NIST_HMAC_DRBG* drbg)
+{
+  const csprng_kernel_table_type* k = csprng_cpu_kernels();
+  unsigned char block[SHA512_BLOCK_BYTES];
+  int i, block_bytes;
+
+  block_bytes = ( drbg->hash == NIST_HASH_SHA256 ) ? SHA256_BLOCK_BYTES : SHA512_BLOCK_BYTES;
+
+  for ( i = 0; i < block_bytes; ++i ) block[i] = ( i < drbg->outlen ? drbg->K[i] : 0 ) ^ 0x36;
+  if ( drbg->hash == NIST_HASH_SHA256 ) {
+    memcpy(drbg->ipad_state.sha256, sha256_initial_state, sizeof(drbg->ipad_state.sha256));
+    k->sha256_blocks(drbg->ipad_state.sha256, block, 1);
+  } else {
+    memcpy(drbg->ipad_state.sha512, sha512_initial_state, sizeof(drbg->ipad_state.sha512));
+    k->sha512_blocks(drbg->ipad_state.sha512, block, 1);
+  }
+
+  for ( i = 0; i < block_bytes; ++i ) block[i] ^= 0x36 ^ 0x5c;
+  if ( drbg->hash == NIST_HASH_SHA256 ) {
+    memcpy(drbg->opad_state.sha256, sha256_initial_state, sizeof(drbg->opad_state.sha256));
+    k->sha256_blocks(drbg->opad_state.sha256, block, 1);
+  } else {
+    memcpy(drbg->opad_state.sha512, sha512_initial_state, sizeof(drbg->opad_state.sha512));
+    k->sha512_blocks(drbg->opad_state.sha512, block, 1);
+  }
+
+  memset(block, 0, sizeof(block));
+}
+
+static void nist_hmac_init(nist_hash_ctx_type* ctx, const NIST_HMAC_DRBG* drbg)
+{
+  ctx->hash = drbg->hash;
+  if ( drbg->hash == NIST_HASH_SHA256 ) {
+    sha256_resume(&ctx->u.sha256, drbg->ipad_state.sha256, SHA256_BLOCK_BYTES);
+  } else {
+    sha512_resume(&ctx->u.sha512, drbg->ipad_state.sha512, SHA512_BLOCK_BYTES);
+  }
+}
+
+static void nist_hmac_final(nist_hash_ctx_type* ctx, const NIST_HMAC_DRBG* drbg, unsigned char* mac)
+{
+  unsigned char inner[NIST_HASH_OUTLEN_MAX_BYTES];
+
+  nist_hash_final(ctx, inner);
+  if ( drbg->hash == NIST_HASH_SHA256 ) {
+    sha256_resume(&ctx->u.sha256, drbg->opad_state.sha256, SHA256_BLOCK_BYTES);
+  } else {
+    sha512_resume(&ctx->u.sha512, drbg->opad_state.sha512, SHA512_BLOCK_BYTES);
+  }
+  nist_hash_update(ctx, inner, drbg->outlen);
+  nist_hash_final(ctx, mac);
+
+  memset(inner, 0, sizeof(inner));
+}
+
+/*
+ * 10.1.2.2 The HMAC_DRBG Update Function
+ *    provided_data = provided_data[0] || provided_data[1] || ... of lengths L[]
+ */
+static void nist_hmac_drbg_update(NIST_HMAC_DRBG* drbg, const void* provided_data[], const int L[], int count)
+{
+  static const unsigned char separator[2] = { 0x00, 0x01 };
+  nist_hash_ctx_type ctx;
+  int i, round, provided_data_length = 0;
+
+  for ( i = 0; i < count; ++i ) provided_data_length += L[i];
+
+  for ( round = 0; round < 2; ++round ) {
+    /* [1] K = HMAC(K, V || 0x00 || provided_data) */
+    /* [4] K = HMAC(K, V || 0x01 || provided_data) */
+    nist_hmac_init(&ctx, drbg);
+    nist_hash_update(&ctx, drbg->V, drbg->outlen);
+    nist_hash_update(&ctx, &separator[round], 1);
+    for ( i = 0; i < count; ++i ) nist_hash_update(&ctx, provided_data[i], L[i]);
+    nist_hmac_final(&ctx, drbg, drbg->K);
+    nist_hmac_set_key(drbg);
+
+    /* [2] V = HMAC(K, V) */
+    /* [5] V = HMAC(K, V) */
+    nist_hmac_init(&ctx, drbg);
+    nist_hash_update(&ctx, drbg->V, drbg->outlen);
+    nist_hmac_final(&ctx, drbg, drbg->V);
+
+    /* [3] If (provided_data = Null), then return K and V */
+    if ( provided_data_length == 0 ) break;
+  }
+}
+
+/*
+ * 10.1.2.3 Instantiation of HMAC_DRBG
+ */
+NIST_HMAC_DRBG* nist_hmac_drbg_instantiate(
+    const void* entropy_input, int entropy_input_length,
+    const void* nonce, int nonce_length,
+    const void* personalization_string, int personalization_string_length,
+    nist_hash_type hash)
+{
+  NIST_HMAC_DRBG* drbg;
+  const void* seed_material[3];
+  int length[3];
+
+  if ( ! nist_hash_valid(hash, "nist_hmac_drbg_instantiate") ) return NULL;
+  if ( entropy_input_length < NIST_HASH_SECURITY_STRENGTH_BYTES ) {
+    fprintf(stderr, "nist_hmac_drbg_instantiate: entropy_input_length has to be at least %d bytes, got %d bytes\n",
+        NIST_HASH_SECURITY_STRENGTH_BYTES, entropy_input_length);
+    return NULL;
+  }
+
+  drbg = secure_alloc(sizeof(NIST_HMAC_DRBG));
+  if ( drbg == NULL ) {
+    fprintf(stderr, "nist_hmac_drbg_instantiate: Dynamic memory allocation failed\n");
+    return drbg;
+  }
+  drbg->hash = hash;
+  drbg->outlen = NIST_HASH_OUTLEN_BYTES(hash);
+
+  /* [1] seed_material = entropy_input || nonce || personalization_string */
+  seed_material[0] = entropy_input;
+  length[0] = entropy_input_length;
+  seed_material[1] = nonce;
+  length[1] = nonce ? nonce_length : 0;
+  seed_material[2] = personalization_string;
+  length[2] = personalization_string ? personalization_string_length : 0;
+
+  /* [2] Key = 0x00 00...00 */
+  memset(drbg->K, 0x00, drbg->outlen);
+  nist_hmac_set_key(drbg);
+
+  /* [3] V = 0x01 01...01 */
+  memset(drbg->V, 0x01, drbg->outlen);
+
+  /* [4] (Key, V) = HMAC_DRBG_Update(seed_material, Key, V) */
+  nist_hmac_drbg_update(drbg, seed_material, length, 3);
+
+  /* [5] reseed_counter = 1 */
+  drbg->reseed_counter = 1;
+
+  return drbg;
+}
+
+/*
+ * 10.1.2.4 Reseeding an HMAC_DRBG Instantiation
+ */
+int nist_hmac_drbg_reseed(NIST_HMAC_DRBG* drbg,
+    const void* entropy_input, int entropy_input_length,
+    const void* additional_input, int additional_input_length)
+{
+  const void* seed_material[2];
+  int length[2];
+
+  if ( entropy_input_length < NIST_HASH_SECURITY_STRENGTH_BYTES ) {
+    fprintf(stderr, "nist_hmac_drbg_reseed: entropy_input_length has to be at least %d bytes, got %d bytes\n",
+        NIST_HASH_SECURITY_STRENGTH_BYTES, entropy_input_length);
+    return 1;
+  }
+
+  /* [1] seed_material = entropy_input || additional_input */
+  seed_material[0] = entropy_input;
+  length[0] = entropy_input_length;
+  seed_material[1] = additional_input;
+  length[1] = additional_input ? additional_input_length : 0;
+
+  /* [2] (Key, V) = HMAC_DRBG_Update(seed_material, Key, V) */
+  nist_hmac_drbg_update(drbg, seed_material, length, 2);
+
+  /* [3] reseed_counter = 1 */
+  drbg->reseed_counter = 1;
+
+  return 0;
+}
+
+/*
+ * 10.1.2.5 Generating Pseudorandom Bits Using HMAC_DRBG
+ *    Each output block depends on the previous one, so the blocks cannot be hashed in parallel.
+ *    The precomputed ipad/opad chaining values halve the number of compressions per block.
+ */
+int nist_hmac_drbg_generate(NIST_HMAC_DRBG* drbg,
+    void* output_string, int output_string_length,
+    const void* additional_input, int additional_input_length)
+{
+  unsigned char* output = output_string;
+  nist_hash_ctx_type ctx;
+  const void* provided_data[1];
+  int length[1];
+  int len;
+
+  if ( output_string_length < 1 || output_string_length > (int) NIST_HASH_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST ) {
+    fprintf(stderr, "nist_hmac_drbg_generate: output_string_length has to be in range 1 - %d bytes, requested was %d bytes\n",
+        (int) NIST_HASH_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST, output_string_length);
+    return 1;
+  }
+
+  /* [1] If reseed_counter > reseed_interval, then return an indication that a reseed is required */
+  if ( drbg->reseed_counter >= NIST_HASH_DRBG_RESEED_INTERVAL ) {
+    fprintf(stderr, "nist_hmac_drbg_generate: reseed required. reseed_counter %" PRIu64 " has reached the limit\n",
+        drbg->reseed_counter);
+    return 1;
+  }
+
+  provided_data[0] = additional_input;
+  length[0] = ( additional_input && additional_input_length > 0 ) ? additional_input_length : 0;
+
+  /* [2] If additional_input != Null, then (Key, V) = HMAC_DRBG_Update(additional_input, Key, V) */
+  if ( length[0] ) nist_hmac_drbg_update(drbg, provided_data, length, 1);
+
+  /* [4] While (len(temp) < requested_number_of_bits) do: */
+  while ( output_string_length > 0 ) {
+    /* [4.1] V = HMAC(Key, V) */
+    nist_hmac_init(&ctx, drbg);
+    nist_hash_update(&ctx, drbg->V, drbg->outlen);
+    nist_hmac_final(&ctx, drbg, drbg->V);
+
+    /* [4.2] temp = temp || V */
+    len = ( output_string_length < drbg->outlen ) ? output_string_length : drbg->outlen;
+    memcpy(output, drbg->V, len);
+    output += len;
+    output_string_length -= len;
+  }
+
+  /* [6] (Key, V) = HMAC_DRBG_Update(additional_input, Key, V) */
+  nist_hmac_drbg_update(drbg, provided_data, length, 1);
+
+  /* [7] reseed_counter = reseed_counter + 1 */
+  ++drbg->reseed_counter;
+
+  return 0;
+}
+
+int nist_hmac_drbg_destroy(NIST_HMAC_DRBG* drbg)
+{
+  if ( drbg != NULL ) {
+    memset(drbg, 0, sizeof(*drbg));
+    drbg->reseed_counter = ~0ULL;
+    secure_free(drbg, sizeof(NIST_HMAC_DRBG));
+  }
+
+  return 0;
+}
+//}}}
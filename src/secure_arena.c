@@ -0,0 +1,528 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Locked memory for random data and generator states
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "secure_arena.h"
+
+#define SECURE_ARENA_HUGE_PAGE (2 * 1024 * 1024)
+#define SECURE_ARENA_SLOTS (SECURE_ARENA_CHUNK / SECURE_ARENA_MIN_SLOT)
+//Slot sizes SECURE_ARENA_MIN_SLOT << class up to half of the chunk. Larger requests take whole chunks
+#define SECURE_ARENA_CLASSES 10
+
+enum { SECURE_CHUNK_FREE = 0, SECURE_CHUNK_SLAB, SECURE_CHUNK_RUN, SECURE_CHUNK_RUN_TAIL };
+
+/* Kept outside of the arena, so that it survives MADV_WIPEONFORK */
+typedef struct {
+  unsigned char type;
+  unsigned char size_class;                           //SECURE_CHUNK_SLAB
+  unsigned short used;                                //SECURE_CHUNK_SLAB: slots in use
+  unsigned int run;                                   //SECURE_CHUNK_RUN: chunks of the allocation
+  uint64_t bitmap[SECURE_ARENA_SLOTS / 64];           //SECURE_CHUNK_SLAB: slots in use
+} secure_chunk_type;
+
+/* Header of the allocations which did not fit into the arena */
+typedef struct {
+  size_t size;
+  int locked;
+} secure_heap_header_type;
+#define SECURE_HEAP_HEADER SECURE_ARENA_MIN_SLOT
+
+static pthread_mutex_t secure_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t secure_once = PTHREAD_ONCE_INIT;
+static int secure_initialized = 0;
+static unsigned char* arena = NULL;                   //NULL => arena is not available, heap only
+static size_t arena_size = 0;
+static int arena_huge = 0;
+static int arena_locked = 0;
+static unsigned int arena_chunks = 0;
+static secure_chunk_type* arena_chunk = NULL;
+static size_t arena_used = 0;
+static size_t arena_peak = 0;
+static size_t heap_used = 0;
+static size_t locked_bytes = 0;
+static size_t lock_budget = 0;                        //0 => unlimited
+static int lock_warning = 0;
+
+//{{{ static size_t page_span ( const void* ptr, size_t size )
+/* Bytes of the pages mlock would lock for [ptr, ptr+size) */
+static size_t page_span ( const void* ptr, size_t size )
+{
+  const uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t) ptr & ~( page - 1 );
+  uintptr_t end = ( (uintptr_t) ptr + size + page - 1 ) & ~( page - 1 );
+  return end - start;
+}
+//}}}
+
+//{{{ static size_t parse_size ( const char* text )
+/* bytes with optional K or M suffix. 0 on error */
+static size_t parse_size ( const char* text )
+{
+  char* end;
+  unsigned long long size;
+
+  errno = 0;
+  size = strtoull(text, &end, 10);
+  if ( errno || end == text ) return 0;
+  if ( *end == 'K' || *end == 'k' ) {
+    size <<= 10;
+    ++end;
+  } else if ( *end == 'M' || *end == 'm' ) {
+    size <<= 20;
+    ++end;
+  }
+  return ( *end == '\0' ) ? (size_t) size : 0;
+}
+//}}}
+
+//{{{ static void secure_budget_initialize ( void )
+static void secure_budget_initialize ( void )
+{
+  struct rlimit rlim;
+
+  if ( getrlimit(RLIMIT_MEMLOCK, &rlim) == 0 ) {
+    lock_budget = ( rlim.rlim_cur == RLIM_INFINITY ) ? 0 : (size_t) rlim.rlim_cur;
+  } else {
+    lock_budget = 16384;
+    fprintf(stderr, "WARNING: secure_arena: getrlimit(RLIMIT_MEMLOCK) has failed. Using %zu as locked memory budget. Reported error: %s\n",
+        lock_budget, strerror(errno));
+  }
+}
+//}}}
+
+//{{{ static int secure_lock_locked ( void* ptr, size_t size )
+/* secure_lock with secure_mutex held */
+static int secure_lock_locked ( void* ptr, size_t size )
+{
+  const size_t span = page_span(ptr, size);
+
+  if ( lock_budget != 0 && locked_bytes + span > lock_budget ) {
+    if ( ! lock_warning ) {
+      fprintf(stderr, "WARNING: secure_arena: locked memory budget of %zu bytes (RLIMIT_MEMLOCK) is exhausted, %zu bytes are locked. "
+          "Further buffers can be paged to the swap area.\n", lock_budget, locked_bytes);
+      lock_warning = 1;
+    }
+    return 0;
+  }
+  if ( mlock(ptr, size) != 0 ) {
+    if ( ! lock_warning ) {
+      fprintf(stderr, "WARNING: secure_arena: cannot lock %zu bytes to RAM (preventing that memory from being paged to the swap area). "
+          "Reported error: \"%s\". See man -S2 mlock for the interpretation.\n", size, strerror(errno));
+      lock_warning = 1;
+    }
+    return 0;
+  }
+  locked_bytes += span;
+  return 1;
+}
+//}}}
+
+//{{{ static int secure_arena_map ( size_t size )
+/* Called with secure_mutex held. Returns 0 on success, 1 on error */
+static int secure_arena_map ( size_t size )
+{
+  const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  unsigned char* reserve;
+  unsigned char* base;
+  size_t reserve_size;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+
+  size = ( ( size + SECURE_ARENA_CHUNK - 1 ) / SECURE_ARENA_CHUNK ) * SECURE_ARENA_CHUNK;
+  if ( size == 0 ) size = SECURE_ARENA_CHUNK;
+
+  //Address space for the arena aligned to the huge page and a guard page on both sides. Unused space stays PROT_NONE
+  reserve_size = size + 2 * SECURE_ARENA_HUGE_PAGE;
+  reserve = mmap(NULL, reserve_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if ( reserve == MAP_FAILED ) {
+    fprintf(stderr, "WARNING: secure_arena: cannot reserve %zu bytes of address space. Reported error: %s\n", reserve_size, strerror(errno));
+    return 1;
+  }
+  base = (unsigned char*) ( ( (uintptr_t) reserve + page + SECURE_ARENA_HUGE_PAGE - 1 ) & ~( (uintptr_t) SECURE_ARENA_HUGE_PAGE - 1 ) );
+
+  arena_huge = 0;
+#ifdef MAP_HUGETLB
+  if ( size % SECURE_ARENA_HUGE_PAGE == 0 && mmap(base, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0) == base ) arena_huge = 1;
+#endif
+  if ( ! arena_huge ) {
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;
+#endif
+    if ( mmap(base, size, PROT_READ | PROT_WRITE, flags, -1, 0) != base ) {
+      fprintf(stderr, "WARNING: secure_arena: cannot map %zu bytes. Reported error: %s\n", size, strerror(errno));
+      munmap(reserve, reserve_size);
+      return 1;
+    }
+#ifdef MADV_HUGEPAGE
+    if ( size >= SECURE_ARENA_HUGE_PAGE ) madvise(base, size, MADV_HUGEPAGE);
+#endif
+  }
+  secure_dontdump(base, size);
+#ifdef MADV_WIPEONFORK
+  madvise(base, size, MADV_WIPEONFORK);
+#endif
+
+  arena_chunks = size / SECURE_ARENA_CHUNK;
+  arena_chunk = (secure_chunk_type*) calloc(arena_chunks, sizeof(secure_chunk_type));
+  if ( arena_chunk == NULL ) {
+    fprintf(stderr, "ERROR: secure_arena: Dynamic memory allocation has failed. Reported error: %s\n", strerror(errno));
+    munmap(reserve, reserve_size);
+    return 1;
+  }
+  arena = base;
+  arena_size = size;
+  arena_locked = secure_lock_locked(arena, arena_size);
+  return 0;
+}
+//}}}
+
+//{{{ fork handlers
+/* The arena is zeroed in the child (MADV_WIPEONFORK), the allocations of the parent stay accounted until freed */
+static void secure_atfork_prepare ( void )
+{
+  pthread_mutex_lock(&secure_mutex);
+}
+
+static void secure_atfork_parent ( void )
+{
+  pthread_mutex_unlock(&secure_mutex);
+}
+
+static void secure_atfork_child ( void )
+{
+  pthread_mutex_init(&secure_mutex, NULL);
+}
+//}}}
+
+//{{{ static void secure_arena_default ( void )
+static void secure_arena_default ( void )
+{
+  const char* env = getenv(SECURE_ARENA_ENV);
+  size_t size = SECURE_ARENA_DEFAULT_SIZE;
+
+  if ( pthread_atfork(secure_atfork_prepare, secure_atfork_parent, secure_atfork_child) ) {
+    fprintf(stderr, "WARNING: secure_arena: pthread_atfork has failed.\n");
+  }
+  pthread_mutex_lock(&secure_mutex);
+  if ( ! secure_initialized ) {
+    secure_budget_initialize();
+    if ( env != NULL ) {
+      size = parse_size(env);
+      if ( size == 0 ) {
+        fprintf(stderr, "WARNING: secure_arena: cannot parse %s=%s. Using %d bytes.\n", SECURE_ARENA_ENV, env, SECURE_ARENA_DEFAULT_SIZE);
+        size = SECURE_ARENA_DEFAULT_SIZE;
+      }
+    } else if ( lock_budget != 0 && size > lock_budget / 4 ) {
+      //Leave most of a low budget to the ring buffers
+      size = lock_budget / 4;
+    }
+    secure_arena_map(size);
+    secure_initialized = 1;
+  }
+  pthread_mutex_unlock(&secure_mutex);
+}
+//}}}
+
+//{{{ static void* secure_arena_alloc ( size_t size )
+/* Called with secure_mutex held. NULL when the arena has no space */
+static void* secure_arena_alloc ( size_t size )
+{
+  unsigned int i, j, n, slot, slot_size, slots, size_class;
+  secure_chunk_type* c;
+
+  if ( arena == NULL ) return NULL;
+
+  if ( size > ( (size_t) SECURE_ARENA_MIN_SLOT << ( SECURE_ARENA_CLASSES - 1 ) ) ) {
+    //First fit run of free chunks
+    n = ( size + SECURE_ARENA_CHUNK - 1 ) / SECURE_ARENA_CHUNK;
+    for ( i = 0; i + n <= arena_chunks; ++i ) {
+      for ( j = 0; j < n && arena_chunk[i+j].type == SECURE_CHUNK_FREE; ++j );
+      if ( j == n ) {
+        arena_chunk[i].type = SECURE_CHUNK_RUN;
+        arena_chunk[i].run = n;
+        for ( j = 1; j < n; ++j ) arena_chunk[i+j].type = SECURE_CHUNK_RUN_TAIL;
+        arena_used += (size_t) n * SECURE_ARENA_CHUNK;
+        if ( arena_used > arena_peak ) arena_peak = arena_used;
+        return arena + (size_t) i * SECURE_ARENA_CHUNK;
+      }
+      i += j;
+    }
+    return NULL;
+  }
+
+  for ( size_class = 0; ( (size_t) SECURE_ARENA_MIN_SLOT << size_class ) < size; ++size_class );
+  slot_size = SECURE_ARENA_MIN_SLOT << size_class;
+  slots = SECURE_ARENA_CHUNK / slot_size;
+
+  //Slab of this class with a free slot, otherwise a free chunk becomes a new slab
+  c = NULL;
+  for ( i = 0; i < arena_chunks; ++i ) {
+    if ( arena_chunk[i].type == SECURE_CHUNK_SLAB && arena_chunk[i].size_class == size_class && arena_chunk[i].used < slots ) {
+      c = &arena_chunk[i];
+      break;
+    }
+  }
+  if ( c == NULL ) {
+    for ( i = 0; i < arena_chunks && arena_chunk[i].type != SECURE_CHUNK_FREE; ++i );
+    if ( i == arena_chunks ) return NULL;
+    c = &arena_chunk[i];
+    memset(c, 0, sizeof(secure_chunk_type));
+    c->type = SECURE_CHUNK_SLAB;
+    c->size_class = size_class;
+  }
+
+  for ( slot = 0; slot < slots && ( c->bitmap[slot / 64] & ( UINT64_C(1) << ( slot % 64 ) ) ); ++slot );
+  c->bitmap[slot / 64] |= UINT64_C(1) << ( slot % 64 );
+  ++c->used;
+  arena_used += slot_size;
+  if ( arena_used > arena_peak ) arena_peak = arena_used;
+  return arena + (size_t) i * SECURE_ARENA_CHUNK + (size_t) slot * slot_size;
+}
+//}}}
+
+//{{{ static void secure_arena_release ( unsigned char* ptr )
+/* Wipe and return ptr to the arena. Called with secure_mutex held */
+static void secure_arena_release ( unsigned char* ptr )
+{
+  const size_t offset = ptr - arena;
+  secure_chunk_type* c = &arena_chunk[offset / SECURE_ARENA_CHUNK];
+  unsigned int j, slot, slot_size;
+
+  if ( c->type == SECURE_CHUNK_RUN ) {
+    memset(ptr, 0, (size_t) c->run * SECURE_ARENA_CHUNK);
+    arena_used -= (size_t) c->run * SECURE_ARENA_CHUNK;
+    for ( j = 1; j < c->run; ++j ) c[j].type = SECURE_CHUNK_FREE;
+    c->type = SECURE_CHUNK_FREE;
+    c->run = 0;
+    return;
+  }
+  if ( c->type != SECURE_CHUNK_SLAB ) {
+    fprintf(stderr, "ERROR: secure_free: %p was not allocated by secure_alloc.\n", (void*) ptr);
+    return;
+  }
+  slot_size = SECURE_ARENA_MIN_SLOT << c->size_class;
+  slot = ( offset % SECURE_ARENA_CHUNK ) / slot_size;
+  memset(ptr, 0, slot_size);
+  c->bitmap[slot / 64] &= ~( UINT64_C(1) << ( slot % 64 ) );
+  arena_used -= slot_size;
+  if ( --c->used == 0 ) c->type = SECURE_CHUNK_FREE;
+}
+//}}}
+
+//{{{ int secure_arena_initialize ( size_t size )
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  secure_arena_initialize
+ *  Description:  Reserve the arena of size bytes. Has to be called before the first
+ *                allocation. Returns 0 on success, 1 on error
+ * =====================================================================================
+ */
+int secure_arena_initialize ( size_t size )
+{
+  int return_value;
+
+  pthread_mutex_lock(&secure_mutex);
+  if ( secure_initialized ) {
+    pthread_mutex_unlock(&secure_mutex);
+    fprintf(stderr, "ERROR: secure_arena_initialize: the arena has been already reserved.\n");
+    return 1;
+  }
+  secure_budget_initialize();
+  return_value = secure_arena_map(size);
+  secure_initialized = 1;
+  pthread_mutex_unlock(&secure_mutex);
+  //Nothing left for the default initialization to do
+  pthread_once(&secure_once, secure_arena_default);
+  return return_value;
+}
+//}}}
+
+//{{{ void secure_arena_default_initialize ( void )
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  secure_arena_default_initialize
+ *  Description:  Reserve the default arena unless it has been reserved already
+ * =====================================================================================
+ */
+void secure_arena_default_initialize ( void )
+{
+  pthread_once(&secure_once, secure_arena_default);
+}
+//}}}
+
+//{{{ void* secure_alloc ( size_t size )
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  secure_alloc
+ *  Description:  Zeroed memory from the arena, from the heap when the arena is full
+ * =====================================================================================
+ */
+void* secure_alloc ( size_t size )
+{
+  secure_heap_header_type* header;
+  unsigned char* ptr;
+
+  pthread_once(&secure_once, secure_arena_default);
+  if ( size == 0 ) size = 1;
+
+  pthread_mutex_lock(&secure_mutex);
+  ptr = secure_arena_alloc(size);
+  pthread_mutex_unlock(&secure_mutex);
+  if ( ptr != NULL ) return ptr;
+
+  if ( posix_memalign((void**) &ptr, SECURE_ARENA_MIN_SLOT, SECURE_HEAP_HEADER + size) != 0 ) {
+    fprintf(stderr, "ERROR: secure_alloc: Dynamic memory allocation has failed for buffer of size %zu.\n", size);
+    return NULL;
+  }
+  memset(ptr, 0, SECURE_HEAP_HEADER + size);
+  header = (secure_heap_header_type*) ptr;
+  header->size = size;
+  secure_dontdump(ptr, SECURE_HEAP_HEADER + size);
+  pthread_mutex_lock(&secure_mutex);
+  header->locked = secure_lock_locked(ptr, SECURE_HEAP_HEADER + size);
+  heap_used += size;
+  pthread_mutex_unlock(&secure_mutex);
+  return ptr + SECURE_HEAP_HEADER;
+}
+//}}}
+
+//{{{ void secure_free ( void* ptr, size_t size )
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  secure_free
+ *  Description:  Wipe and release memory from secure_alloc
+ * =====================================================================================
+ */
+void secure_free ( void* ptr, size_t size )
+{
+  unsigned char* p = (unsigned char*) ptr;
+  secure_heap_header_type* header;
+
+  if ( p == NULL ) return;
+  if ( arena != NULL && p >= arena && p < arena + arena_size ) {
+    pthread_mutex_lock(&secure_mutex);
+    secure_arena_release(p);
+    pthread_mutex_unlock(&secure_mutex);
+    return;
+  }
+
+  p -= SECURE_HEAP_HEADER;
+  header = (secure_heap_header_type*) p;
+  if ( header->size != size ) {
+    fprintf(stderr, "WARNING: secure_free: size %zu differs from the allocated size %zu.\n", size, header->size);
+  }
+  size = header->size;
+  memset(p + SECURE_HEAP_HEADER, 0, size);
+  pthread_mutex_lock(&secure_mutex);
+  if ( header->locked ) {
+    munlock(p, SECURE_HEAP_HEADER + size);
+    locked_bytes -= ( locked_bytes < page_span(p, SECURE_HEAP_HEADER + size) ) ? locked_bytes : page_span(p, SECURE_HEAP_HEADER + size);
+  }
+  heap_used -= size;
+  pthread_mutex_unlock(&secure_mutex);
+  memset(header, 0, sizeof(secure_heap_header_type));
+  free(p);
+}
+//}}}
+
+//{{{ int secure_lock ( void* ptr, size_t size )
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  secure_lock
+ *  Description:  mlock within the process-wide budget. Returns 1 when locked
+ * =====================================================================================
+ */
+int secure_lock ( void* ptr, size_t size )
+{
+  int locked;
+
+  pthread_once(&secure_once, secure_arena_default);
+  pthread_mutex_lock(&secure_mutex);
+  locked = secure_lock_locked(ptr, size);
+  pthread_mutex_unlock(&secure_mutex);
+  return locked;
+}
+//}}}
+
+//{{{ void secure_unlock ( void* ptr, size_t size )
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  secure_unlock
+ *  Description:  munlock memory locked by secure_lock and return it to the budget
+ * =====================================================================================
+ */
+void secure_unlock ( void* ptr, size_t size )
+{
+  const size_t span = page_span(ptr, size);
+
+  if ( munlock(ptr, size) != 0 ) {
+    fprintf(stderr, "WARNING: secure_unlock: cannot unlock %zu bytes from RAM. Reported error: %s\n", size, strerror(errno));
+  }
+  pthread_mutex_lock(&secure_mutex);
+  //Locks are not inherited by a forked child, the count can be off there
+  locked_bytes -= ( locked_bytes < span ) ? locked_bytes : span;
+  pthread_mutex_unlock(&secure_mutex);
+}
+//}}}
+
+//{{{ void secure_dontdump ( void* ptr, size_t size )
+void secure_dontdump ( void* ptr, size_t size )
+{
+#ifdef MADV_DONTDUMP
+  const uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+  uintptr_t start = ( (uintptr_t) ptr + page - 1 ) & ~( page - 1 );
+  uintptr_t end = ( (uintptr_t) ptr + size ) & ~( page - 1 );
+
+  //Only the whole pages, the rest of a shared page may belong to something else
+  if ( end > start ) madvise((void*) start, end - start, MADV_DONTDUMP);
+#else
+  (void) ptr;
+  (void) size;
+#endif
+}
+//}}}
+
+//{{{ void secure_arena_status ( char* buf, int buf_size )
+void secure_arena_status ( char* buf, int buf_size )
+{
+  pthread_mutex_lock(&secure_mutex);
+  if ( arena == NULL ) {
+    snprintf(buf, buf_size, "Secure arena: not available, heap %zu bytes. Locked %zu bytes of budget %s%zu bytes.",
+        heap_used, locked_bytes, lock_budget == 0 ? "unlimited " : "", lock_budget);
+  } else {
+    snprintf(buf, buf_size, "Secure arena: %zu bytes%s%s, in use %zu bytes, peak %zu bytes, heap %zu bytes. Locked %zu bytes of budget %s%zu bytes.",
+        arena_size, arena_huge ? ", huge pages" : "", arena_locked ? ", locked" : ", NOT locked", arena_used, arena_peak, heap_used,
+        locked_bytes, lock_budget == 0 ? "unlimited " : "", lock_budget);
+  }
+  pthread_mutex_unlock(&secure_mutex);
+}
+//}}}
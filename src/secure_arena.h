@@ -0,0 +1,76 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Locked memory for random data and generator states. Internal to libcsprng.
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#ifndef SECURE_ARENA_H
+#define SECURE_ARENA_H
+
+#include <stddef.h>
+
+/*
+ * The arena is one mapping reserved on the first allocation: huge pages when the size is a multiple
+ * of the huge page size and the system has them, PROT_NONE guard pages on both sides, excluded from
+ * core dumps, zeroed in a forked child and locked in RAM when the locked memory budget allows it.
+ * Size is SECURE_ARENA_DEFAULT_SIZE, or less when RLIMIT_MEMLOCK is low. Environment variable
+ * CSPRNG_SECURE_ARENA_SIZE=bytes[K|M] sets it.
+ */
+#define SECURE_ARENA_ENV "CSPRNG_SECURE_ARENA_SIZE"
+#define SECURE_ARENA_DEFAULT_SIZE (1024 * 1024)
+
+/* Slabs and multi-chunk allocations are carved from chunks of this size */
+#define SECURE_ARENA_CHUNK (64 * 1024)
+/* Smallest slot and its alignment */
+#define SECURE_ARENA_MIN_SLOT 64
+
+/* Reserve the arena explicitly, before the first allocation. Returns 0 on success, 1 on error */
+int secure_arena_initialize(size_t size);
+
+/*
+ * Reserve the default arena unless it has been reserved already. The arena registers fork handlers then.
+ * Code with its own fork handlers calling secure_free or secure_alloc has to call it before pthread_atfork,
+ * so that the arena lock is taken last in the parent and released first in the child.
+ */
+void secure_arena_default_initialize(void);
+
+/*
+ * Zeroed memory aligned to SECURE_ARENA_MIN_SLOT bytes. When the arena is full the memory comes from
+ * the heap and is locked if the budget allows it. Returns NULL on error.
+ * secure_free wipes the memory. size has to be the same as for secure_alloc.
+ */
+void* secure_alloc(size_t size);
+void secure_free(void* ptr, size_t size);
+
+/*
+ * Process-wide locked memory budget, RLIMIT_MEMLOCK. secure_lock returns 1 when the pages were locked,
+ * 0 when they would exceed the budget or mlock has failed. Only locked memory may be passed to secure_unlock.
+ */
+int secure_lock(void* ptr, size_t size);
+void secure_unlock(void* ptr, size_t size);
+
+/* Exclude memory from core dumps */
+void secure_dontdump(void* ptr, size_t size);
+
+/* Arena size, bytes in use, locked bytes and budget for the statistics */
+void secure_arena_status(char* buf, int buf_size);
+
+#endif
@@ -23,6 +23,7 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 }}} */
 
 #include <csprng/sha1_rng.h>
+#include "cpu_kernels.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,6 +33,11 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 #include <inttypes.h>
 #include <assert.h>
 
+#ifdef CSPRNG_HAVE_X86_KERNELS
+#include <immintrin.h>
+#define SHA1_SHANI_TARGET __attribute__ ((target ("sha,sse4.1,ssse3")))
+#endif
+
 static void increment_block(uint8_t V[], int n)
 {
   //Increment the output block by one as a big-endian number
@@ -42,6 +48,75 @@ static void increment_block(uint8_t V[], int n)
   }
 }
 
+void sha1_rng_generic(const unsigned char* V, unsigned char* digest) {
+  SHA1(V, SHA1_VECTOR_LENGTH_IN_BYTES, digest);
+}
+
+#ifdef CSPRNG_HAVE_X86_KERNELS
+/*
+ * SHA-1 using the SHA extensions.
+ * 55 bytes long vector with the padding fits exactly into one 64 bytes block.
+ * Four rounds are computed by each step, message schedule runs 3 steps ahead.
+ */
+#define SHA1_SHANI_STEP(i) do {                                           \
+  if ( (i) == 0 ) {                                                       \
+    e[0] = _mm_add_epi32(e[0], msg[0]);                                   \
+  } else {                                                                \
+    e[(i) & 1] = _mm_sha1nexte_epu32(e[(i) & 1], msg[(i) & 3]);           \
+  }                                                                       \
+  e[((i) + 1) & 1] = abcd;                                                \
+  if ( (i) >= 3 && (i) <= 18 )                                            \
+    msg[((i) + 1) & 3] = _mm_sha1msg2_epu32(msg[((i) + 1) & 3], msg[(i) & 3]); \
+  abcd = _mm_sha1rnds4_epu32(abcd, e[(i) & 1], (i) / 5);                 \
+  if ( (i) >= 1 && (i) <= 16 )                                            \
+    msg[((i) + 3) & 3] = _mm_sha1msg1_epu32(msg[((i) + 3) & 3], msg[(i) & 3]); \
+  if ( (i) >= 2 && (i) <= 17 )                                            \
+    msg[((i) + 2) & 3] = _mm_xor_si128(msg[((i) + 2) & 3], msg[(i) & 3]);  \
+} while (0)
+
+SHA1_SHANI_TARGET void sha1_rng_shani(const unsigned char* V, unsigned char* digest) {
+  const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+  unsigned char block[64];
+  __m128i abcd, abcd_save, e_save, msg[4], e[2];
+  uint32_t h[5];
+  int i;
+
+  memcpy(block, V, SHA1_VECTOR_LENGTH_IN_BYTES);
+  block[SHA1_VECTOR_LENGTH_IN_BYTES] = 0x80;
+  memset(block + SHA1_VECTOR_LENGTH_IN_BYTES + 1, 0, 64 - SHA1_VECTOR_LENGTH_IN_BYTES - 1 - 2);
+  block[62] = ( SHA1_VECTOR_LENGTH_IN_BYTES * 8 ) >> 8;
+  block[63] = ( SHA1_VECTOR_LENGTH_IN_BYTES * 8 ) & 0xff;
+
+  abcd = _mm_shuffle_epi32(_mm_set_epi32(0x10325476, 0x98BADCFE, 0xEFCDAB89, 0x67452301), 0x1B);
+  e[0] = _mm_set_epi32(0xC3D2E1F0, 0, 0, 0);
+  abcd_save = abcd;
+  e_save = e[0];
+
+  for ( i = 0; i < 4; ++i ) msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(block + 16 * i)), mask);
+
+  SHA1_SHANI_STEP(0);  SHA1_SHANI_STEP(1);  SHA1_SHANI_STEP(2);  SHA1_SHANI_STEP(3);
+  SHA1_SHANI_STEP(4);  SHA1_SHANI_STEP(5);  SHA1_SHANI_STEP(6);  SHA1_SHANI_STEP(7);
+  SHA1_SHANI_STEP(8);  SHA1_SHANI_STEP(9);  SHA1_SHANI_STEP(10); SHA1_SHANI_STEP(11);
+  SHA1_SHANI_STEP(12); SHA1_SHANI_STEP(13); SHA1_SHANI_STEP(14); SHA1_SHANI_STEP(15);
+  SHA1_SHANI_STEP(16); SHA1_SHANI_STEP(17); SHA1_SHANI_STEP(18); SHA1_SHANI_STEP(19);
+
+  //After step 19 the last E input is in e[0]
+  e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+  abcd = _mm_add_epi32(abcd, abcd_save);
+
+  abcd = _mm_shuffle_epi32(abcd, 0x1B);
+  _mm_storeu_si128((__m128i*) h, abcd);
+  h[4] = _mm_extract_epi32(e[0], 3);
+
+  for ( i = 0; i < 5; ++i ) {
+    digest[4 * i]     = h[i] >> 24;
+    digest[4 * i + 1] = h[i] >> 16;
+    digest[4 * i + 2] = h[i] >> 8;
+    digest[4 * i + 3] = h[i];
+  }
+}
+#endif
+
 SHA1_state* create_SHA1(uint8_t* seed, int len, int remove, int use) {
   assert(remove < 20);
   assert(remove >= 0);
@@ -75,14 +150,10 @@ void destroy_SHA1(SHA1_state* state) {
 int generate_using_SHA1 (SHA1_state *state, unsigned char *output_buffer, int output_size) {
   int bytes_written=0;
   int bytes_to_produce = output_size;
-  unsigned char* ret;
+  const sha1_rng_kernel_type sha1_rng = csprng_cpu_kernels()->sha1_rng;
 
   if ( state->valid == 0 ) {
-    ret = SHA1( state->V, SHA1_VECTOR_LENGTH_IN_BYTES, state->output);
-    if ( ret != state->output ) { 
-      fprintf ( stderr, "ERROR: SHA1 function has failed.\n" );
-      return bytes_written;
-    }
+    sha1_rng( state->V, state->output);
 
     increment_block(state->V, SHA1_VECTOR_LENGTH_IN_BYTES);
     state->valid = state->use;
@@ -98,11 +169,7 @@ int generate_using_SHA1 (SHA1_state *state, unsigned char *output_buffer, int ou
       //state->valid = 0;
       //state->data = NULL;
 
-      ret = SHA1( state->V, SHA1_VECTOR_LENGTH_IN_BYTES, state->output);
-      if ( ret != state->output ) { 
-        fprintf ( stderr, "ERROR: SHA1 function has failed.\n" );
-        return bytes_written;
-      }
+      sha1_rng( state->V, state->output);
       increment_block(state->V, SHA1_VECTOR_LENGTH_IN_BYTES);
       state->valid = state->use;
       state->data = state->output + state->remove;
@@ -0,0 +1,490 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+SHA-256 and SHA-512 (FIPS 180-4) for Hash_DRBG and HMAC_DRBG
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <string.h>
+#include <inttypes.h>
+
+#include "sha2.h"
+#include "cpu_kernels.h"
+
+#ifdef CSPRNG_HAVE_X86_KERNELS
+#include <immintrin.h>
+#define SHA256_SHANI_TARGET __attribute__ ((target ("sha,sse4.1,ssse3")))
+#endif
+
+//{{{ Constants
+const uint32_t sha256_initial_state[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+const uint64_t sha512_initial_state[8] = {
+  0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+  0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint32_t sha256_k[64] __attribute__ ((aligned (16))) = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint64_t sha512_k[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+//}}}
+
+//{{{ Big-endian loads and stores
+static inline uint32_t sha2_load32_be(const unsigned char* p)
+{
+  return ( (uint32_t) p[0] << 24 ) | ( (uint32_t) p[1] << 16 ) | ( (uint32_t) p[2] << 8 ) | p[3];
+}
+
+static inline uint64_t sha2_load64_be(const unsigned char* p)
+{
+  return ( (uint64_t) sha2_load32_be(p) << 32 ) | sha2_load32_be(p + 4);
+}
+
+static inline void sha2_store32_be(unsigned char* p, uint32_t x)
+{
+  p[0] = x >> 24;
+  p[1] = x >> 16;
+  p[2] = x >> 8;
+  p[3] = x;
+}
+
+static inline void sha2_store64_be(unsigned char* p, uint64_t x)
+{
+  sha2_store32_be(p, x >> 32);
+  sha2_store32_be(p + 4, x);
+}
+//}}}
+
+//{{{ Portable compression functions
+#define ROTR32(x, n) ( ( (x) >> (n) ) | ( (x) << ( 32 - (n) ) ) )
+#define ROTR64(x, n) ( ( (x) >> (n) ) | ( (x) << ( 64 - (n) ) ) )
+
+void sha256_blocks_generic(uint32_t* state, const unsigned char* data, int blocks)
+{
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h, t1, t2;
+  int t;
+
+  while ( blocks-- > 0 ) {
+    for ( t = 0; t < 16; ++t ) w[t] = sha2_load32_be(data + 4 * t);
+    for ( t = 16; t < 64; ++t )
+      w[t] = ( ROTR32(w[t - 2], 17) ^ ROTR32(w[t - 2], 19) ^ ( w[t - 2] >> 10 ) ) + w[t - 7] +
+        ( ROTR32(w[t - 15], 7) ^ ROTR32(w[t - 15], 18) ^ ( w[t - 15] >> 3 ) ) + w[t - 16];
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+    for ( t = 0; t < 64; ++t ) {
+      t1 = h + ( ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25) ) + ( ( e & f ) ^ ( ~e & g ) ) + sha256_k[t] + w[t];
+      t2 = ( ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22) ) + ( ( a & b ) ^ ( a & c ) ^ ( b & c ) );
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    data += SHA256_BLOCK_BYTES;
+  }
+
+  memset(w, 0, sizeof(w));
+}
+
+void sha512_blocks_generic(uint64_t* state, const unsigned char* data, int blocks)
+{
+  uint64_t w[80];
+  uint64_t a, b, c, d, e, f, g, h, t1, t2;
+  int t;
+
+  while ( blocks-- > 0 ) {
+    for ( t = 0; t < 16; ++t ) w[t] = sha2_load64_be(data + 8 * t);
+    for ( t = 16; t < 80; ++t )
+      w[t] = ( ROTR64(w[t - 2], 19) ^ ROTR64(w[t - 2], 61) ^ ( w[t - 2] >> 6 ) ) + w[t - 7] +
+        ( ROTR64(w[t - 15], 1) ^ ROTR64(w[t - 15], 8) ^ ( w[t - 15] >> 7 ) ) + w[t - 16];
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+    for ( t = 0; t < 80; ++t ) {
+      t1 = h + ( ROTR64(e, 14) ^ ROTR64(e, 18) ^ ROTR64(e, 41) ) + ( ( e & f ) ^ ( ~e & g ) ) + sha512_k[t] + w[t];
+      t2 = ( ROTR64(a, 28) ^ ROTR64(a, 34) ^ ROTR64(a, 39) ) + ( ( a & b ) ^ ( a & c ) ^ ( b & c ) );
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    data += SHA512_BLOCK_BYTES;
+  }
+
+  memset(w, 0, sizeof(w));
+}
+//}}}
+
+//{{{ SHA extensions
+#ifdef CSPRNG_HAVE_X86_KERNELS
+/*
+ * Four rounds are computed by each step. Message words for step i+1 are completed during step i.
+ * state0 holds ABEF, state1 CDGH.
+ */
+#define SHA256_SHANI_STEP(i, state0, state1, msg, tmp) do {                              \
+  tmp = _mm_add_epi32(msg[(i) & 3], _mm_load_si128((const __m128i*) &sha256_k[4 * (i)])); \
+  state1 = _mm_sha256rnds2_epu32(state1, state0, tmp);                                    \
+  if ( (i) >= 3 && (i) <= 14 ) {                                                          \
+    msg[((i) + 1) & 3] = _mm_add_epi32(msg[((i) + 1) & 3],                                \
+        _mm_alignr_epi8(msg[(i) & 3], msg[((i) - 1) & 3], 4));                            \
+    msg[((i) + 1) & 3] = _mm_sha256msg2_epu32(msg[((i) + 1) & 3], msg[(i) & 3]);          \
+  }                                                                                       \
+  tmp = _mm_shuffle_epi32(tmp, 0x0E);                                                     \
+  state0 = _mm_sha256rnds2_epu32(state0, state1, tmp);                                    \
+  if ( (i) >= 1 && (i) <= 12 )                                                            \
+    msg[((i) - 1) & 3] = _mm_sha256msg1_epu32(msg[((i) - 1) & 3], msg[(i) & 3]);          \
+} while (0)
+
+#define SHA256_SHANI_ROUNDS(state0, state1, msg, tmp) do {                                \
+  SHA256_SHANI_STEP(0, state0, state1, msg, tmp);  SHA256_SHANI_STEP(1, state0, state1, msg, tmp);   \
+  SHA256_SHANI_STEP(2, state0, state1, msg, tmp);  SHA256_SHANI_STEP(3, state0, state1, msg, tmp);   \
+  SHA256_SHANI_STEP(4, state0, state1, msg, tmp);  SHA256_SHANI_STEP(5, state0, state1, msg, tmp);   \
+  SHA256_SHANI_STEP(6, state0, state1, msg, tmp);  SHA256_SHANI_STEP(7, state0, state1, msg, tmp);   \
+  SHA256_SHANI_STEP(8, state0, state1, msg, tmp);  SHA256_SHANI_STEP(9, state0, state1, msg, tmp);   \
+  SHA256_SHANI_STEP(10, state0, state1, msg, tmp); SHA256_SHANI_STEP(11, state0, state1, msg, tmp);  \
+  SHA256_SHANI_STEP(12, state0, state1, msg, tmp); SHA256_SHANI_STEP(13, state0, state1, msg, tmp);  \
+  SHA256_SHANI_STEP(14, state0, state1, msg, tmp); SHA256_SHANI_STEP(15, state0, state1, msg, tmp);  \
+} while (0)
+
+SHA256_SHANI_TARGET static inline void sha256_shani_load_state(const uint32_t* state, __m128i* state0, __m128i* state1)
+{
+  __m128i tmp;
+
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &state[0]), 0xB1);
+  *state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &state[4]), 0x1B);
+  *state0 = _mm_alignr_epi8(tmp, *state1, 8);
+  *state1 = _mm_blend_epi16(*state1, tmp, 0xF0);
+}
+
+SHA256_SHANI_TARGET static inline void sha256_shani_store_digest(__m128i state0, __m128i state1, unsigned char* digest)
+{
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i tmp;
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  _mm_storeu_si128((__m128i*) digest, _mm_shuffle_epi8(_mm_blend_epi16(tmp, state1, 0xF0), mask));
+  _mm_storeu_si128((__m128i*) (digest + 16), _mm_shuffle_epi8(_mm_alignr_epi8(state1, tmp, 8), mask));
+}
+
+SHA256_SHANI_TARGET void sha256_blocks_shani(uint32_t* state, const unsigned char* data, int blocks)
+{
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, abef_save, cdgh_save, tmp, msg[4];
+  int i;
+
+  sha256_shani_load_state(state, &state0, &state1);
+
+  while ( blocks-- > 0 ) {
+    abef_save = state0;
+    cdgh_save = state1;
+
+    for ( i = 0; i < 4; ++i ) msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), mask);
+    SHA256_SHANI_ROUNDS(state0, state1, msg, tmp);
+
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+    data += SHA256_BLOCK_BYTES;
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  _mm_storeu_si128((__m128i*) &state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+  _mm_storeu_si128((__m128i*) &state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+/*
+ * Two messages are hashed at once. The rounds instructions have long latency,
+ * so the second chain fills the gaps of the first one.
+ */
+SHA256_SHANI_TARGET void sha256_multi_shani(const unsigned char* blocks, int n, unsigned char* digests)
+{
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i a0, a1, b0, b1, init0, init1, tmp_a, tmp_b, msg_a[4], msg_b[4];
+  int i, j;
+
+  sha256_shani_load_state(sha256_initial_state, &init0, &init1);
+
+  for ( i = 0; i + 1 < n; i += 2 ) {
+    a0 = b0 = init0;
+    a1 = b1 = init1;
+    for ( j = 0; j < 4; ++j ) {
+      msg_a[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(blocks + i * SHA256_BLOCK_BYTES + 16 * j)), mask);
+      msg_b[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(blocks + ( i + 1 ) * SHA256_BLOCK_BYTES + 16 * j)), mask);
+    }
+
+    SHA256_SHANI_STEP(0, a0, a1, msg_a, tmp_a);  SHA256_SHANI_STEP(0, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(1, a0, a1, msg_a, tmp_a);  SHA256_SHANI_STEP(1, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(2, a0, a1, msg_a, tmp_a);  SHA256_SHANI_STEP(2, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(3, a0, a1, msg_a, tmp_a);  SHA256_SHANI_STEP(3, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(4, a0, a1, msg_a, tmp_a);  SHA256_SHANI_STEP(4, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(5, a0, a1, msg_a, tmp_a);  SHA256_SHANI_STEP(5, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(6, a0, a1, msg_a, tmp_a);  SHA256_SHANI_STEP(6, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(7, a0, a1, msg_a, tmp_a);  SHA256_SHANI_STEP(7, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(8, a0, a1, msg_a, tmp_a);  SHA256_SHANI_STEP(8, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(9, a0, a1, msg_a, tmp_a);  SHA256_SHANI_STEP(9, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(10, a0, a1, msg_a, tmp_a); SHA256_SHANI_STEP(10, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(11, a0, a1, msg_a, tmp_a); SHA256_SHANI_STEP(11, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(12, a0, a1, msg_a, tmp_a); SHA256_SHANI_STEP(12, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(13, a0, a1, msg_a, tmp_a); SHA256_SHANI_STEP(13, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(14, a0, a1, msg_a, tmp_a); SHA256_SHANI_STEP(14, b0, b1, msg_b, tmp_b);
+    SHA256_SHANI_STEP(15, a0, a1, msg_a, tmp_a); SHA256_SHANI_STEP(15, b0, b1, msg_b, tmp_b);
+
+    sha256_shani_store_digest(_mm_add_epi32(a0, init0), _mm_add_epi32(a1, init1), digests + i * SHA256_DIGEST_BYTES);
+    sha256_shani_store_digest(_mm_add_epi32(b0, init0), _mm_add_epi32(b1, init1), digests + ( i + 1 ) * SHA256_DIGEST_BYTES);
+  }
+
+  if ( i < n ) {
+    a0 = init0;
+    a1 = init1;
+    for ( j = 0; j < 4; ++j )
+      msg_a[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(blocks + i * SHA256_BLOCK_BYTES + 16 * j)), mask);
+    SHA256_SHANI_ROUNDS(a0, a1, msg_a, tmp_a);
+    sha256_shani_store_digest(_mm_add_epi32(a0, init0), _mm_add_epi32(a1, init1), digests + i * SHA256_DIGEST_BYTES);
+  }
+}
+#endif
+//}}}
+
+//{{{ Multi-buffer kernels: n messages of exactly one padded block each
+void sha256_multi_generic(const unsigned char* blocks, int n, unsigned char* digests)
+{
+  uint32_t h[8];
+  int i, j;
+
+  for ( i = 0; i < n; ++i ) {
+    memcpy(h, sha256_initial_state, sizeof(h));
+    sha256_blocks_generic(h, blocks + i * SHA256_BLOCK_BYTES, 1);
+    for ( j = 0; j < 8; ++j ) sha2_store32_be(digests + i * SHA256_DIGEST_BYTES + 4 * j, h[j]);
+  }
+}
+
+void sha512_multi_generic(const unsigned char* blocks, int n, unsigned char* digests)
+{
+  uint64_t h[8];
+  int i, j;
+
+  for ( i = 0; i < n; ++i ) {
+    memcpy(h, sha512_initial_state, sizeof(h));
+    sha512_blocks_generic(h, blocks + i * SHA512_BLOCK_BYTES, 1);
+    for ( j = 0; j < 8; ++j ) sha2_store64_be(digests + i * SHA512_DIGEST_BYTES + 8 * j, h[j]);
+  }
+}
+
+#ifdef CSPRNG_HAVE_X86_KERNELS
+#define SHA2_KERNEL_NAME      sha256_multi_sse2
+#define SHA2_KERNEL_TARGET    __attribute__ ((target ("sse2")))
+#define SHA2_KERNEL_LANES     4
+#define SHA2_KERNEL_WORD_BITS 32
+#include "sha2_kernel.h"
+
+#define SHA2_KERNEL_NAME      sha256_multi_avx2
+#define SHA2_KERNEL_TARGET    __attribute__ ((target ("avx2")))
+#define SHA2_KERNEL_LANES     8
+#define SHA2_KERNEL_WORD_BITS 32
+#include "sha2_kernel.h"
+
+#define SHA2_KERNEL_NAME      sha256_multi_avx512
+#define SHA2_KERNEL_TARGET    __attribute__ ((target ("avx512f")))
+#define SHA2_KERNEL_LANES     16
+#define SHA2_KERNEL_WORD_BITS 32
+#include "sha2_kernel.h"
+
+#define SHA2_KERNEL_NAME      sha512_multi_sse2
+#define SHA2_KERNEL_TARGET    __attribute__ ((target ("sse2")))
+#define SHA2_KERNEL_LANES     2
+#define SHA2_KERNEL_WORD_BITS 64
+#include "sha2_kernel.h"
+
+#define SHA2_KERNEL_NAME      sha512_multi_avx2
+#define SHA2_KERNEL_TARGET    __attribute__ ((target ("avx2")))
+#define SHA2_KERNEL_LANES     4
+#define SHA2_KERNEL_WORD_BITS 64
+#include "sha2_kernel.h"
+
+#define SHA2_KERNEL_NAME      sha512_multi_avx512
+#define SHA2_KERNEL_TARGET    __attribute__ ((target ("avx512f")))
+#define SHA2_KERNEL_LANES     8
+#define SHA2_KERNEL_WORD_BITS 64
+#include "sha2_kernel.h"
+#endif
+//}}}
+
+//{{{ Incremental interface
+void sha256_init(sha256_ctx_type* ctx)
+{
+  sha256_resume(ctx, sha256_initial_state, 0);
+}
+
+void sha256_resume(sha256_ctx_type* ctx, const uint32_t* h, uint64_t length)
+{
+  memcpy(ctx->h, h, sizeof(ctx->h));
+  ctx->length = length;
+}
+
+void sha256_update(sha256_ctx_type* ctx, const void* data, size_t len)
+{
+  const unsigned char* p = data;
+  const sha256_blocks_kernel_type compress = csprng_cpu_kernels()->sha256_blocks;
+  size_t index = ctx->length % SHA256_BLOCK_BYTES;
+  size_t n;
+
+  ctx->length += len;
+
+  if ( index ) {
+    n = SHA256_BLOCK_BYTES - index;
+    if ( len < n ) {
+      memcpy(ctx->block + index, p, len);
+      return;
+    }
+    memcpy(ctx->block + index, p, n);
+    compress(ctx->h, ctx->block, 1);
+    p += n;
+    len -= n;
+  }
+
+  if ( len >= SHA256_BLOCK_BYTES ) {
+    compress(ctx->h, p, len / SHA256_BLOCK_BYTES);
+    p += len - len % SHA256_BLOCK_BYTES;
+    len %= SHA256_BLOCK_BYTES;
+  }
+
+  if ( len ) memcpy(ctx->block, p, len);
+}
+
+void sha256_final(sha256_ctx_type* ctx, unsigned char* digest)
+{
+  const sha256_blocks_kernel_type compress = csprng_cpu_kernels()->sha256_blocks;
+  size_t index = ctx->length % SHA256_BLOCK_BYTES;
+  int i;
+
+  ctx->block[index++] = 0x80;
+  if ( index > SHA256_BLOCK_BYTES - 8 ) {
+    memset(ctx->block + index, 0, SHA256_BLOCK_BYTES - index);
+    compress(ctx->h, ctx->block, 1);
+    index = 0;
+  }
+  memset(ctx->block + index, 0, SHA256_BLOCK_BYTES - 8 - index);
+  sha2_store64_be(ctx->block + SHA256_BLOCK_BYTES - 8, ctx->length * 8);
+  compress(ctx->h, ctx->block, 1);
+
+  for ( i = 0; i < 8; ++i ) sha2_store32_be(digest + 4 * i, ctx->h[i]);
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+void sha512_init(sha512_ctx_type* ctx)
+{
+  sha512_resume(ctx, sha512_initial_state, 0);
+}
+
+void sha512_resume(sha512_ctx_type* ctx, const uint64_t* h, uint64_t length)
+{
+  memcpy(ctx->h, h, sizeof(ctx->h));
+  ctx->length = length;
+}
+
+void sha512_update(sha512_ctx_type* ctx, const void* data, size_t len)
+{
+  const unsigned char* p = data;
+  const sha512_blocks_kernel_type compress = csprng_cpu_kernels()->sha512_blocks;
+  size_t index = ctx->length % SHA512_BLOCK_BYTES;
+  size_t n;
+
+  ctx->length += len;
+
+  if ( index ) {
+    n = SHA512_BLOCK_BYTES - index;
+    if ( len < n ) {
+      memcpy(ctx->block + index, p, len);
+      return;
+    }
+    memcpy(ctx->block + index, p, n);
+    compress(ctx->h, ctx->block, 1);
+    p += n;
+    len -= n;
+  }
+
+  if ( len >= SHA512_BLOCK_BYTES ) {
+    compress(ctx->h, p, len / SHA512_BLOCK_BYTES);
+    p += len - len % SHA512_BLOCK_BYTES;
+    len %= SHA512_BLOCK_BYTES;
+  }
+
+  if ( len ) memcpy(ctx->block, p, len);
+}
+
+void sha512_final(sha512_ctx_type* ctx, unsigned char* digest)
+{
+  const sha512_blocks_kernel_type compress = csprng_cpu_kernels()->sha512_blocks;
+  size_t index = ctx->length % SHA512_BLOCK_BYTES;
+  int i;
+
+  ctx->block[index++] = 0x80;
+  if ( index > SHA512_BLOCK_BYTES - 16 ) {
+    memset(ctx->block + index, 0, SHA512_BLOCK_BYTES - index);
+    compress(ctx->h, ctx->block, 1);
+    index = 0;
+  }
+  //128-bit message length, the upper half is always 0 here
+  memset(ctx->block + index, 0, SHA512_BLOCK_BYTES - 8 - index);
+  sha2_store64_be(ctx->block + SHA512_BLOCK_BYTES - 8, ctx->length * 8);
+  compress(ctx->h, ctx->block, 1);
+
+  for ( i = 0; i < 8; ++i ) sha2_store64_be(digest + 8 * i, ctx->h[i]);
+  memset(ctx, 0, sizeof(*ctx));
+}
+//}}}
@@ -0,0 +1,66 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+SHA-256 and SHA-512 (FIPS 180-4). Internal to libcsprng.
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#ifndef SHA2_H
+#define SHA2_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#define SHA256_BLOCK_BYTES  64
+#define SHA256_DIGEST_BYTES 32
+#define SHA512_BLOCK_BYTES  128
+#define SHA512_DIGEST_BYTES 64
+
+typedef struct {
+  uint32_t h[8];                              //Chaining value
+  uint64_t length;                            //Bytes hashed so far
+  unsigned char block[SHA256_BLOCK_BYTES];    //Incomplete block
+} sha256_ctx_type;
+
+typedef struct {
+  uint64_t h[8];
+  uint64_t length;
+  unsigned char block[SHA512_BLOCK_BYTES];
+} sha512_ctx_type;
+
+extern const uint32_t sha256_initial_state[8];
+extern const uint64_t sha512_initial_state[8];
+
+/*
+ * The compression is done by the kernels bound by the CPU dispatch layer.
+ * sha*_resume continues from a saved chaining value after length bytes (multiple of the block size).
+ * sha*_final zeroizes the context.
+ */
+void sha256_init(sha256_ctx_type* ctx);
+void sha256_resume(sha256_ctx_type* ctx, const uint32_t* h, uint64_t length);
+void sha256_update(sha256_ctx_type* ctx, const void* data, size_t len);
+void sha256_final(sha256_ctx_type* ctx, unsigned char* digest);
+
+void sha512_init(sha512_ctx_type* ctx);
+void sha512_resume(sha512_ctx_type* ctx, const uint64_t* h, uint64_t length);
+void sha512_update(sha512_ctx_type* ctx, const void* data, size_t len);
+void sha512_final(sha512_ctx_type* ctx, unsigned char* digest);
+
+#endif
@@ -0,0 +1,124 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Multi-buffer SHA-256 and SHA-512. Included by sha2.c once for each SIMD width and word size
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+/*
+ * Expects SHA2_KERNEL_NAME, SHA2_KERNEL_TARGET, SHA2_KERNEL_LANES and SHA2_KERNEL_WORD_BITS (32 => SHA-256, 64 => SHA-512)
+ * to be defined.
+ *
+ * Hashes n messages, each of them exactly one padded block, starting from the initial state.
+ * Lane j of the vectors works on message j, so SHA2_KERNEL_LANES messages are hashed by one pass
+ * of the rounds. Unused lanes of the last pass repeat the first message of the pass.
+ */
+
+#if SHA2_KERNEL_WORD_BITS == 32
+#define SHA2_WORD             uint32_t
+#define SHA2_ROUNDS           64
+#define SHA2_K                sha256_k
+#define SHA2_INITIAL          sha256_initial_state
+#define SHA2_LOAD             sha2_load32_be
+#define SHA2_STORE            sha2_store32_be
+#define SHA2_BSIG0(x)         ( SHA2_ROTR(x,  2) ^ SHA2_ROTR(x, 13) ^ SHA2_ROTR(x, 22) )
+#define SHA2_BSIG1(x)         ( SHA2_ROTR(x,  6) ^ SHA2_ROTR(x, 11) ^ SHA2_ROTR(x, 25) )
+#define SHA2_SSIG0(x)         ( SHA2_ROTR(x,  7) ^ SHA2_ROTR(x, 18) ^ ( (x) >>  3 ) )
+#define SHA2_SSIG1(x)         ( SHA2_ROTR(x, 17) ^ SHA2_ROTR(x, 19) ^ ( (x) >> 10 ) )
+#else
+#define SHA2_WORD             uint64_t
+#define SHA2_ROUNDS           80
+#define SHA2_K                sha512_k
+#define SHA2_INITIAL          sha512_initial_state
+#define SHA2_LOAD             sha2_load64_be
+#define SHA2_STORE            sha2_store64_be
+#define SHA2_BSIG0(x)         ( SHA2_ROTR(x, 28) ^ SHA2_ROTR(x, 34) ^ SHA2_ROTR(x, 39) )
+#define SHA2_BSIG1(x)         ( SHA2_ROTR(x, 14) ^ SHA2_ROTR(x, 18) ^ SHA2_ROTR(x, 41) )
+#define SHA2_SSIG0(x)         ( SHA2_ROTR(x,  1) ^ SHA2_ROTR(x,  8) ^ ( (x) >>  7 ) )
+#define SHA2_SSIG1(x)         ( SHA2_ROTR(x, 19) ^ SHA2_ROTR(x, 61) ^ ( (x) >>  6 ) )
+#endif
+#define SHA2_ROTR(x, n)       ( ( (x) >> (n) ) | ( (x) << ( SHA2_KERNEL_WORD_BITS - (n) ) ) )
+#define SHA2_WORD_BYTES       ( SHA2_KERNEL_WORD_BITS / 8 )
+#define SHA2_BLOCK            ( 16 * SHA2_WORD_BYTES )
+#define SHA2_DIGEST           ( 8 * SHA2_WORD_BYTES )
+
+SHA2_KERNEL_TARGET void SHA2_KERNEL_NAME (const unsigned char* blocks, int n, unsigned char* digests)
+{
+  typedef SHA2_WORD vec_t __attribute__ ((vector_size (SHA2_WORD_BYTES * SHA2_KERNEL_LANES)));
+  SHA2_WORD lane[SHA2_KERNEL_LANES];
+  vec_t w[16], s[8], zero = { 0 };
+  vec_t a, b, c, d, e, f, g, h, t1, t2;
+  int i, j, t, lanes;
+
+  for ( i = 0; i < n; i += SHA2_KERNEL_LANES ) {
+    lanes = ( n - i < SHA2_KERNEL_LANES ) ? n - i : SHA2_KERNEL_LANES;
+
+    //Transpose: word t of all messages goes to w[t]
+    for ( t = 0; t < 16; ++t ) {
+      for ( j = 0; j < SHA2_KERNEL_LANES; ++j )
+        lane[j] = SHA2_LOAD(blocks + ( i + ( j < lanes ? j : 0 ) ) * SHA2_BLOCK + t * SHA2_WORD_BYTES);
+      memcpy(&w[t], lane, sizeof(vec_t));
+    }
+
+    for ( t = 0; t < 8; ++t ) s[t] = zero + SHA2_INITIAL[t];
+    a = s[0]; b = s[1]; c = s[2]; d = s[3];
+    e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+    for ( t = 0; t < SHA2_ROUNDS; ++t ) {
+      if ( t >= 16 )
+        w[t & 15] += SHA2_SSIG1(w[( t - 2 ) & 15]) + w[( t - 7 ) & 15] + SHA2_SSIG0(w[( t - 15 ) & 15]);
+      t1 = h + SHA2_BSIG1(e) + ( ( e & f ) ^ ( ~e & g ) ) + SHA2_K[t] + w[t & 15];
+      t2 = SHA2_BSIG0(a) + ( ( a & b ) ^ ( a & c ) ^ ( b & c ) );
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+
+    for ( t = 0; t < 8; ++t ) {
+      memcpy(lane, &s[t], sizeof(vec_t));
+      for ( j = 0; j < lanes; ++j )
+        SHA2_STORE(digests + ( i + j ) * SHA2_DIGEST + t * SHA2_WORD_BYTES, lane[j]);
+    }
+  }
+
+  memset(w, 0, sizeof(w));
+  memset(lane, 0, sizeof(lane));
+}
+
+#undef SHA2_WORD
+#undef SHA2_ROUNDS
+#undef SHA2_K
+#undef SHA2_INITIAL
+#undef SHA2_LOAD
+#undef SHA2_STORE
+#undef SHA2_BSIG0
+#undef SHA2_BSIG1
+#undef SHA2_SSIG0
+#undef SHA2_SSIG1
+#undef SHA2_ROTR
+#undef SHA2_WORD_BYTES
+#undef SHA2_BLOCK
+#undef SHA2_DIGEST
+#undef SHA2_KERNEL_NAME
+#undef SHA2_KERNEL_TARGET
+#undef SHA2_KERNEL_LANES
+#undef SHA2_KERNEL_WORD_BITS
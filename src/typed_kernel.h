@@ -0,0 +1,135 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/* {{{ Copyright notice
+
+Vectorized conversion of random bytes to typed values. Included by csprng_typed.c once for each SIMD width
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+/*
+ * Expects TYPED_KERNEL_NAME(name), TYPED_KERNEL_TARGET and TYPED_KERNEL_LANES (number of 32-bit lanes) to be defined.
+ *
+ * Each function returns exactly what its _generic variant does. Integers are converted to floating point
+ * without a conversion instruction: the integer is put into the mantissa of 2^23 (float) or 2^52 and 2^84
+ * (double) and the exponent is subtracted again, which is exact. The tail shorter than a vector and the
+ * vectors with a rejected draw are done by the _generic variant.
+ */
+
+//{{{ int typed_bounded32 (const unsigned char* input, int words, uint32_t bound, uint32_t threshold, uint32_t* output)
+TYPED_KERNEL_TARGET int TYPED_KERNEL_NAME(typed_bounded32) (const unsigned char* input, int words, uint32_t bound, uint32_t threshold, uint32_t* output)
+{
+  typedef uint64_t wvec_t __attribute__ ((vector_size (4 * TYPED_KERNEL_LANES)));
+  uint64_t lane[TYPED_KERNEL_LANES / 2];
+  wvec_t x, even, odd, reject, zero = { 0 };
+  const wvec_t low = zero + 0xffffffffU;
+  const wvec_t vbound = zero + bound;
+  const wvec_t vthreshold = zero + threshold;
+  uint64_t any;
+  int i, j, count = 0;
+
+  for ( i = 0; i + TYPED_KERNEL_LANES <= words; i += TYPED_KERNEL_LANES ) {
+    //Even words in the low halves, odd words in the high halves of the 64-bit lanes
+    memcpy(&x, input + 4 * i, sizeof(wvec_t));
+    even = ( x & low ) * vbound;
+    odd = ( x >> 32 ) * vbound;
+    reject = (wvec_t) ( ( even & low ) < vthreshold ) | (wvec_t) ( ( odd & low ) < vthreshold );
+    memcpy(lane, &reject, sizeof(wvec_t));
+    for ( any = 0, j = 0; j < TYPED_KERNEL_LANES / 2; ++j ) any |= lane[j];
+    if ( any ) {
+      count += typed_bounded32_generic(input + 4 * i, TYPED_KERNEL_LANES, bound, threshold, output + count);
+    } else {
+      x = ( even >> 32 ) | ( odd & ~low );
+      memcpy(output + count, &x, sizeof(wvec_t));
+      count += TYPED_KERNEL_LANES;
+    }
+  }
+  return count + typed_bounded32_generic(input + 4 * i, words - i, bound, threshold, output + count);
+}
+//}}}
+
+//{{{ void typed_float (const unsigned char* input, float* output, int n)
+TYPED_KERNEL_TARGET void TYPED_KERNEL_NAME(typed_float) (const unsigned char* input, float* output, int n)
+{
+  typedef uint32_t uvec_t __attribute__ ((vector_size (4 * TYPED_KERNEL_LANES)));
+  typedef float fvec_t __attribute__ ((vector_size (4 * TYPED_KERNEL_LANES)));
+  uvec_t x, zero = { 0 };
+  fvec_t hi, lo, fzero = { 0 };
+  const uvec_t exponent = zero + 0x4b000000U;       //2^23
+  const fvec_t bias = fzero + 8388608.0f;
+  int i;
+
+  for ( i = 0; i + TYPED_KERNEL_LANES <= n; i += TYPED_KERNEL_LANES ) {
+    memcpy(&x, input + 4 * i, sizeof(uvec_t));
+    x >>= 8;
+    hi = (fvec_t) ( ( x >> 16 ) | exponent ) - bias;
+    lo = (fvec_t) ( ( x & 0xffffU ) | exponent ) - bias;
+    hi = ( hi * 65536.0f + lo ) * ( 1.0f / 16777216.0f );
+    memcpy(output + i, &hi, sizeof(fvec_t));
+  }
+  typed_float_generic(input + 4 * i, output + i, n - i);
+}
+//}}}
+
+//{{{ void typed_double (const unsigned char* input, double* output, int n)
+TYPED_KERNEL_TARGET void TYPED_KERNEL_NAME(typed_double) (const unsigned char* input, double* output, int n)
+{
+  typedef uint64_t wvec_t __attribute__ ((vector_size (4 * TYPED_KERNEL_LANES)));
+  typedef double dvec_t __attribute__ ((vector_size (4 * TYPED_KERNEL_LANES)));
+  wvec_t x, zero = { 0 };
+  dvec_t hi, lo, dzero = { 0 };
+  const wvec_t exponent_hi = zero + UINT64_C(0x4530000000000000);   //2^84
+  const wvec_t exponent_lo = zero + UINT64_C(0x4330000000000000);   //2^52
+  const dvec_t bias_hi = dzero + 19342813113834066795298816.0;
+  const dvec_t bias_lo = dzero + 4503599627370496.0;
+  int i;
+
+  for ( i = 0; i + TYPED_KERNEL_LANES / 2 <= n; i += TYPED_KERNEL_LANES / 2 ) {
+    memcpy(&x, input + 8 * i, sizeof(wvec_t));
+    x >>= 11;
+    hi = (dvec_t) ( ( x >> 32 ) | exponent_hi ) - bias_hi;
+    lo = (dvec_t) ( ( x & 0xffffffffU ) | exponent_lo ) - bias_lo;
+    hi = ( hi + lo ) * ( 1.0 / 9007199254740992.0 );
+    memcpy(output + i, &hi, sizeof(dvec_t));
+  }
+  typed_double_generic(input + 8 * i, output + i, n - i);
+}
+//}}}
+
+//{{{ void typed_bool (const unsigned char* input, uint32_t threshold, unsigned char* output, int n)
+TYPED_KERNEL_TARGET void TYPED_KERNEL_NAME(typed_bool) (const unsigned char* input, uint32_t threshold, unsigned char* output, int n)
+{
+  typedef uint32_t uvec_t __attribute__ ((vector_size (4 * TYPED_KERNEL_LANES)));
+  uint32_t lane[TYPED_KERNEL_LANES];
+  uvec_t x, zero = { 0 };
+  const uvec_t vthreshold = zero + threshold;
+  int i, j;
+
+  for ( i = 0; i + TYPED_KERNEL_LANES <= n; i += TYPED_KERNEL_LANES ) {
+    memcpy(&x, input + 4 * i, sizeof(uvec_t));
+    x = (uvec_t) ( x < vthreshold ) & 1U;
+    memcpy(lane, &x, sizeof(uvec_t));
+    for ( j = 0; j < TYPED_KERNEL_LANES; ++j ) output[i + j] = (unsigned char) lane[j];
+  }
+  typed_bool_generic(input + 4 * i, threshold, output + i, n - i);
+}
+//}}}
+
+#undef TYPED_KERNEL_NAME
+#undef TYPED_KERNEL_TARGET
+#undef TYPED_KERNEL_LANES
@@ -0,0 +1,218 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/*
+gcc -O2 -I ../include -L../src/.libs -Wextra -Wall -o chacha20_rng_test chacha20_rng_test.c -lcsprng -lcrypto -lrt
+LD_LIBRARY_PATH=../src/.libs ./chacha20_rng_test
+CSPRNG_CPU_TIER=generic LD_LIBRARY_PATH=../src/.libs ./chacha20_rng_test
+LD_LIBRARY_PATH=../src/.libs ./chacha20_rng_test -b
+
+Checks the ChaCha20 generator against a plain reference implementation: the ChaCha20 block of
+the all-zero key, then the fast key erasure output for all request sizes up to 300 bytes and some
+large ones, with and without additional input. Exit code is 0 when all checks pass.
+With -b, throughput of ChaCha20 and CTR_DRBG is compared for 64 KiB requests.
+*/
+
+/* {{{ Copyright notice
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/evp.h>
+#include <csprng/chacha20_rng.h>
+#include <csprng/nist_ctr_drbg.h>
+#include <csprng/cpu_dispatch.h>
+
+#define REQUEST_BYTES 65536
+
+//{{{ Reference implementation
+#define ROTL(x, n) ( ( (x) << (n) ) | ( (x) >> ( 32 - (n) ) ) )
+#define QR(a, b, c, d)                                                \
+  a += b; d ^= a; d = ROTL(d, 16); c += d; b ^= c; b = ROTL(b, 12);   \
+  a += b; d ^= a; d = ROTL(d,  8); c += d; b ^= c; b = ROTL(b,  7)
+
+static void reference_block(const unsigned char* key, uint64_t counter, unsigned char* output)
+{
+  uint32_t s[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+  uint32_t x[16];
+  int i;
+
+  for ( i = 0; i < 8; ++i )
+    s[4 + i] = key[4*i] | ( key[4*i+1] << 8 ) | ( key[4*i+2] << 16 ) | ( (uint32_t) key[4*i+3] << 24 );
+  s[12] = (uint32_t) counter;
+  s[13] = (uint32_t) ( counter >> 32 );
+  s[14] = s[15] = 0;
+
+  memcpy(x, s, sizeof(s));
+  for ( i = 0; i < 10; ++i ) {
+    QR(x[0], x[4], x[ 8], x[12]); QR(x[1], x[5], x[ 9], x[13]);
+    QR(x[2], x[6], x[10], x[14]); QR(x[3], x[7], x[11], x[15]);
+    QR(x[0], x[5], x[10], x[15]); QR(x[1], x[6], x[11], x[12]);
+    QR(x[2], x[7], x[ 8], x[13]); QR(x[3], x[4], x[ 9], x[14]);
+  }
+  for ( i = 0; i < 16; ++i ) {
+    x[i] += s[i];
+    output[4*i] = x[i]; output[4*i+1] = x[i] >> 8; output[4*i+2] = x[i] >> 16; output[4*i+3] = x[i] >> 24;
+  }
+}
+
+//key = SHA-256(key || a || b), the old key is left out when use_key is 0
+static void reference_mix(unsigned char* key, int use_key, const unsigned char* a, int a_length, const unsigned char* b, int b_length)
+{
+  EVP_MD_CTX* ctx;
+
+  //EVP_MD_CTX_create and EVP_MD_CTX_destroy exist in all OpenSSL versions
+  ctx = EVP_MD_CTX_create();
+  if ( ctx == NULL || ! EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) ||
+      ( use_key && ! EVP_DigestUpdate(ctx, key, 32) ) ||
+      ! EVP_DigestUpdate(ctx, a, a_length) || ! EVP_DigestUpdate(ctx, b, b_length) ||
+      ! EVP_DigestFinal_ex(ctx, key, NULL) ) {
+    fprintf(stderr, "FAIL: OpenSSL SHA-256 of the reference implementation\n");
+    exit(EXIT_FAILURE);
+  }
+  EVP_MD_CTX_destroy(ctx);
+}
+
+static void reference_generate(unsigned char* key, unsigned char* output, int length)
+{
+  unsigned char block[64];
+  unsigned char next_key[32];
+  uint64_t counter;
+  int i;
+
+  reference_block(key, 0, block);
+  memcpy(next_key, block, 32);
+  for ( i = 0, counter = 0; i < length; ++i ) {
+    if ( ( i + 32 ) % 64 == 0 ) reference_block(key, ++counter, block);
+    output[i] = block[( i + 32 ) % 64];
+  }
+  memcpy(key, next_key, 32);
+}
+//}}}
+
+//{{{ static int check(void)
+static int check(void)
+{
+  static const unsigned char zero_key_block[16] = {
+    0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90, 0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28 };
+  static unsigned char expected[REQUEST_BYTES], output[REQUEST_BYTES + 1];
+  unsigned char entropy[32], additional_input[32], key[32], block[64];
+  CHACHA20_RNG* rng;
+  int i, length, failed = 0;
+
+  memset(key, 0, sizeof(key));
+  reference_block(key, 0, block);
+  if ( memcmp(block, zero_key_block, sizeof(zero_key_block)) ) {
+    fprintf(stderr, "FAIL: reference ChaCha20 block of the zero key\n");
+    return 1;
+  }
+
+  for ( i = 0; i < 32; ++i ) {
+    entropy[i] = i;
+    additional_input[i] = 0xa0 + i;
+  }
+
+  rng = chacha20_rng_instantiate(entropy, sizeof(entropy), NULL, 0);
+  if ( rng == NULL ) return 1;
+  reference_mix(key, 0, entropy, sizeof(entropy), NULL, 0);
+
+  for ( length = 1; length <= REQUEST_BYTES; length = ( length < 300 ) ? length + 1 : length * 2 + 13 ) {
+    output[length] = 0x5a;
+    if ( length % 3 == 0 ) {
+      if ( chacha20_rng_generate(rng, output, length, additional_input, sizeof(additional_input)) ) return 1;
+      reference_mix(key, 1, additional_input, sizeof(additional_input), NULL, 0);
+    } else {
+      if ( chacha20_rng_generate(rng, output, length, NULL, 0) ) return 1;
+    }
+    reference_generate(key, expected, length);
+    if ( memcmp(output, expected, length) || output[length] != 0x5a ) {
+      fprintf(stderr, "FAIL: request of %d bytes\n", length);
+      ++failed;
+    }
+    if ( length % 7 == 0 ) {
+      if ( chacha20_rng_reseed(rng, entropy, sizeof(entropy), additional_input, sizeof(additional_input)) ) return 1;
+      reference_mix(key, 1, entropy, sizeof(entropy), additional_input, sizeof(additional_input));
+    }
+  }
+
+  chacha20_rng_destroy(rng);
+  return failed;
+}
+//}}}
+
+//{{{ static void benchmark(void)
+static double elapsed(const struct timespec* start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ( now.tv_sec - start->tv_sec ) + ( now.tv_nsec - start->tv_nsec ) / 1e9;
+}
+
+static void benchmark(void)
+{
+  static unsigned char output[REQUEST_BYTES];
+  unsigned char entropy[48] = { 0 };
+  struct timespec start;
+  CHACHA20_RNG* rng;
+  NIST_CTR_DRBG* ctr_drbg;
+  long int requests;
+
+  rng = chacha20_rng_instantiate(entropy, 32, NULL, 0);
+  ctr_drbg = nist_ctr_drbg_instantiate(entropy, NIST_SEEDLEN_BYTES(NIST_BLOCK_KEYLEN), NULL, 0, NULL, 0, 0, NIST_BLOCK_KEYLEN);
+  if ( rng == NULL || ctr_drbg == NULL ) return;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for ( requests = 0; elapsed(&start) < 1.0; ++requests ) chacha20_rng_generate(rng, output, REQUEST_BYTES, NULL, 0);
+  fprintf(stdout, "ChaCha20: %8.1f MiB/s\n", requests * (double) REQUEST_BYTES / elapsed(&start) / 1048576.0);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for ( requests = 0; elapsed(&start) < 1.0; ++requests ) nist_ctr_drbg_generate(ctr_drbg, output, REQUEST_BYTES, NULL, 0);
+  fprintf(stdout, "CTR_DRBG: %8.1f MiB/s\n", requests * (double) REQUEST_BYTES / elapsed(&start) / 1048576.0);
+
+  chacha20_rng_destroy(rng);
+  nist_ctr_drbg_destroy(ctr_drbg);
+}
+//}}}
+
+int main(int argc, char **argv) {
+  int c, failed, run_benchmark = 0;
+
+  while ( ( c = getopt(argc, argv, "bh") ) != -1 ) {
+    switch (c) {
+      case 'b':
+        run_benchmark = 1;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-b]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if ( csprng_cpu_dispatch_initialize() ) return 1;
+  fprintf(stdout, "%s", dump_csprng_cpu_dispatch());
+
+  failed = check();
+  fprintf(stdout, "ChaCha20 generator: %s\n", failed ? "FAILED" : "passed");
+
+  if ( run_benchmark ) benchmark();
+  return failed != 0;
+}
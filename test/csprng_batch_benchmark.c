@@ -0,0 +1,235 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/*
+gcc -O2 -I ../include -L../src/.libs -Wextra -Wall -o csprng_batch_benchmark csprng_batch_benchmark.c -lcsprng -lcrypto -lrt -lpthread
+LD_LIBRARY_PATH=../src/.libs ./csprng_batch_benchmark
+LD_LIBRARY_PATH=../src/.libs ./csprng_batch_benchmark -r 4000000 -k 1024 -f
+
+For requests of 8, 16, 32 and 64 bytes compares
+  - fips_approved_csprng_generate called for each request
+  - csprng_generate_batch filling -k requests per call
+and prints the requests per second of both. Both generators read the same entropy file,
+so they have to produce the same data. The test fails when the outputs differ.
+With -H the entropy comes from HAVEGE and the outputs are not compared.
+*/
+
+/* {{{ Copyright notice
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/uio.h>
+#include <csprng/csprng.h>
+
+#define MAX_REQUEST 64
+#define MAX_BATCH 65536
+
+static const int request_sizes[] = { 8, 16, 32, 64 };
+
+static double elapsed_seconds(const struct timespec* start, const struct timespec* stop) {
+  return (double) ( stop->tv_sec - start->tv_sec ) + (double) ( stop->tv_nsec - start->tv_nsec ) * 1.0e-9;
+}
+
+static uint64_t fnv1a(uint64_t hash, const unsigned char* data, unsigned int size) {
+  unsigned int i;
+  for ( i = 0; i < size; ++i ) {
+    hash ^= data[i];
+    hash *= UINT64_C(0x100000001b3);
+  }
+  return hash;
+}
+
+//Deterministic entropy file for the EXTERNAL source. Returns 0 on success
+static int write_entropy_file(const char* filename, uint64_t size) {
+  unsigned char buf[4096];
+  uint64_t x = UINT64_C(0x9e3779b97f4a7c15);
+  uint64_t written;
+  FILE* fd;
+  int i;
+
+  fd = fopen(filename, "w");
+  if ( fd == NULL ) {
+    fprintf(stderr, "Error: cannot open %s: %s\n", filename, strerror(errno));
+    return 1;
+  }
+  for ( written = 0; written < size; written += sizeof(buf) ) {
+    for ( i = 0; i < (int) sizeof(buf); ++i ) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      buf[i] = (unsigned char) ( x >> 32 );
+    }
+    if ( fwrite(buf, 1, sizeof(buf), fd) != sizeof(buf) ) {
+      fprintf(stderr, "Error: cannot write %s: %s\n", filename, strerror(errno));
+      fclose(fd);
+      return 1;
+    }
+  }
+  return fclose(fd) ? 1 : 0;
+}
+
+/*
+ * Generate requests of request_size bytes, batch of them per call of csprng_generate_batch
+ * or one per call of fips_approved_csprng_generate when batch is 0. With checksum != NULL the output is hashed.
+ * Returns requests per second or negative value on error
+ */
+static double run(const mode_of_operation_type* mode, int fips_test, int requests, int request_size, int batch, uint64_t* checksum) {
+  fips_state_type* fips_state;
+  unsigned char* output;
+  struct iovec* reqs;
+  struct timespec start, stop;
+  int count = ( batch > 0 ) ? batch : 1;
+  int i, n, done, error = 0;
+
+  output = (unsigned char*) malloc((size_t) count * request_size);
+  reqs = (struct iovec*) calloc(count, sizeof(struct iovec));
+  fips_state = fips_approved_csprng_initialize(fips_test, 0, mode);
+  if ( output == NULL || reqs == NULL || fips_state == NULL || fips_approved_csprng_instantiate(fips_state) ) {
+    fprintf(stderr, "Error: cannot instantiate the generator\n");
+    if ( fips_state != NULL ) fips_approved_csprng_destroy(fips_state);
+    free(output);
+    free(reqs);
+    return -1.0;
+  }
+  for ( i = 0; i < count; ++i ) {
+    reqs[i].iov_base = output + (size_t) i * request_size;
+    reqs[i].iov_len = request_size;
+  }
+
+  if ( checksum != NULL ) *checksum = UINT64_C(0xcbf29ce484222325);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for ( done = 0; done < requests && ! error; done += n ) {
+    n = ( requests - done < count ) ? requests - done : count;
+    if ( batch > 0 ) {
+      if ( csprng_generate_batch(fips_state, reqs, n) != n ) error = 1;
+    } else {
+      if ( fips_approved_csprng_generate(fips_state, output, request_size) != request_size ) error = 1;
+    }
+    if ( checksum != NULL ) *checksum = fnv1a(*checksum, output, n * request_size);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  if ( fips_approved_csprng_destroy(fips_state) ) error = 1;
+  free(output);
+  free(reqs);
+  if ( error ) {
+    fprintf(stderr, "Error: %s has failed after %d requests of %d bytes\n",
+        batch > 0 ? "csprng_generate_batch" : "fips_approved_csprng_generate", done, request_size);
+    return -1.0;
+  }
+  return (double) requests / elapsed_seconds(&start, &stop);
+}
+
+int main(int argc, char **argv) {
+  mode_of_operation_type mode;
+  char filename[] = "/tmp/csprng_batch_benchmark.XXXXXX";
+  int requests = 1000000;
+  int batch = 256;
+  int fips_test = 0;
+  int use_havege = 0;
+  int i, fd, opt, failed = 0;
+  uint64_t single_checksum, batch_checksum;
+  double single_rate, batch_rate;
+
+  while ( ( opt = getopt(argc, argv, "r:k:fH") ) != -1 ) {
+    switch ( opt ) {
+      case 'r':
+        requests = atoi(optarg);
+        break;
+      case 'k':
+        batch = atoi(optarg);
+        break;
+      case 'f':
+        fips_test = 1;
+        break;
+      case 'H':
+        use_havege = 1;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-r requests] [-k requests_per_batch] [-f] [-H]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if ( requests < 1 || batch < 1 || batch > MAX_BATCH ) {
+    fprintf(stderr, "Error: invalid -r or -k value. Batch is 1 to %d requests\n", MAX_BATCH);
+    return EXIT_FAILURE;
+  }
+
+  memset(&mode, 0, sizeof(mode));
+  mode.file_read_size = 16384;
+  mode.max_number_of_csprng_blocks = 512;
+  if ( use_havege ) {
+    mode.entropy_source = HAVEGE;
+  } else {
+    fd = mkstemp(filename);
+    if ( fd < 0 ) {
+      fprintf(stderr, "Error: mkstemp has failed: %s\n", strerror(errno));
+      return EXIT_FAILURE;
+    }
+    close(fd);
+    //Seed for every reseed of the largest run plus what the generator buffers ahead
+    if ( write_entropy_file(filename, ( ( (uint64_t) requests * MAX_REQUEST + ( 4 << 20 ) ) /
+            ( mode.max_number_of_csprng_blocks * NIST_BLOCK_OUTLEN_BYTES ) + 1 ) * NIST_BLOCK_SEEDLEN_MAX_BYTES + 2 * mode.file_read_size ) ) {
+      unlink(filename);
+      return EXIT_FAILURE;
+    }
+    mode.entropy_source = EXTERNAL;
+    mode.filename_for_entropy = filename;
+  }
+
+  fprintf(stdout, "%s entropy, %s, %d requests, %d requests per batch\n",
+      use_havege ? "HAVEGE" : "EXTERNAL", fips_test ? "FIPS tests enabled" : "FIPS tests disabled", requests, batch);
+  fprintf(stdout, "request [B]  per call [Mreq/s]  batch [Mreq/s]  speedup\n");
+  for ( i = 0; i < (int) ( sizeof(request_sizes) / sizeof(request_sizes[0]) ); ++i ) {
+    single_rate = run(&mode, fips_test, requests, request_sizes[i], 0, NULL);
+    batch_rate = run(&mode, fips_test, requests, request_sizes[i], batch, NULL);
+    if ( single_rate < 0.0 || batch_rate < 0.0 ) {
+      failed = 1;
+      break;
+    }
+    //Hashing is slower than generating, the outputs are compared in separate runs
+    if ( ! use_havege ) {
+      if ( run(&mode, fips_test, requests, request_sizes[i], 0, &single_checksum) < 0.0 ||
+          run(&mode, fips_test, requests, request_sizes[i], batch, &batch_checksum) < 0.0 ) {
+        failed = 1;
+        break;
+      }
+      if ( single_checksum != batch_checksum ) {
+        fprintf(stderr, "Error: output of csprng_generate_batch differs for %d byte requests\n", request_sizes[i]);
+        failed = 1;
+      }
+    }
+    fprintf(stdout, "%11d  %17.3f  %14.3f  %7.2f\n", request_sizes[i], single_rate * 1.0e-6, batch_rate * 1.0e-6, batch_rate / single_rate);
+  }
+
+  if ( ! use_havege ) unlink(filename);
+  if ( failed ) {
+    fprintf(stdout, "FAILED\n");
+    return EXIT_FAILURE;
+  }
+  fprintf(stdout, "PASSED\n");
+  return EXIT_SUCCESS;
+}
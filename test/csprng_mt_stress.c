@@ -0,0 +1,343 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/*
+gcc -O2 -I ../include -L../src/.libs -Wextra -Wall -o csprng_mt_stress csprng_mt_stress.c -lcsprng -lcrypto -lrt -lpthread
+LD_LIBRARY_PATH=../src/.libs ./csprng_mt_stress
+LD_LIBRARY_PATH=../src/.libs ./csprng_mt_stress -t 16 -n 64M -f
+LD_LIBRARY_PATH=../src/.libs ./csprng_mt_stress -H -t 4
+
+Runs 1, 2, 4, ... up to -t independent fips_state_type generators, each one initialized, used and
+destroyed in its own thread, all at the same time. Every generator reads the same entropy file, so
+every thread has to produce the same output as a generator running alone, which reads the data
+through csprng_borrow instead of fips_approved_csprng_generate. Without FIPS tests the threads get
+whole DRBG requests written straight to their buffer, so this checks the direct path against raw_buf
+as well. The test fails when any output differs. The aggregate throughput is reported for each number of threads together with the
+speedup against one thread, which should be close to the number of threads up to the number of CPUs.
+With -H the entropy comes from a HAVEGE instance per thread and the outputs are not compared.
+At the end one generator runs with the background producer for each of the settings in producer_setting
+and reads the output in requests of 2500 bytes, which keep crossing the ends of the buffers. Its output
+has to match as well. The producer has to fill a buffer above its high watermark when the consumer waits
+for it, the test hangs otherwise.
+*/
+
+/* {{{ Copyright notice
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <csprng/csprng.h>
+
+#define OUTPUT_CHUNK ( 256 * 1024 )
+#define PRODUCER_REQUEST 2500
+
+static const int producer_setting[][3] = { { 2, 0, 1 }, { 8, 0, 8 }, { 4, 1, 3 } };
+
+typedef struct {
+  const mode_of_operation_type* mode;
+  int fips_test;
+  uint64_t size;                  //Bytes to generate
+  int borrow;                     //Read the output with csprng_borrow
+  const int* producer;            //Background producer buffers, low and high watermark. NULL => no producer
+  pthread_barrier_t* barrier;     //Generation starts when all generators are instantiated
+  struct timespec start, stop;    //Time spent generating
+  uint64_t checksum;              //FNV-1a of the output
+  int error;
+} worker_type;
+
+static double elapsed_seconds(const struct timespec* start, const struct timespec* stop) {
+  return (double) ( stop->tv_sec - start->tv_sec ) + (double) ( stop->tv_nsec - start->tv_nsec ) * 1.0e-9;
+}
+
+static uint64_t fnv1a(uint64_t hash, const unsigned char* data, unsigned int size) {
+  unsigned int i;
+  for ( i = 0; i < size; ++i ) {
+    hash ^= data[i];
+    hash *= UINT64_C(0x100000001b3);
+  }
+  return hash;
+}
+
+//Parse size with optional K, M or G suffix (powers of 1024)
+static uint64_t parse_size(const char* text) {
+  char* end;
+  uint64_t size = strtoull(text, &end, 10);
+  switch ( *end ) {
+    case 'K': size <<= 10; break;
+    case 'M': size <<= 20; break;
+    case 'G': size <<= 30; break;
+    case '\0': break;
+    default: return 0;
+  }
+  return size;
+}
+
+//Deterministic entropy file for the EXTERNAL source. Returns 0 on success
+static int write_entropy_file(const char* filename, uint64_t size) {
+  unsigned char buf[4096];
+  uint64_t x = UINT64_C(0x9e3779b97f4a7c15);
+  uint64_t written;
+  FILE* fd;
+  int i;
+
+  fd = fopen(filename, "w");
+  if ( fd == NULL ) {
+    fprintf(stderr, "Error: cannot open %s: %s\n", filename, strerror(errno));
+    return 1;
+  }
+  for ( written = 0; written < size; written += sizeof(buf) ) {
+    for ( i = 0; i < (int) sizeof(buf); ++i ) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      buf[i] = (unsigned char) ( x >> 32 );
+    }
+    if ( fwrite(buf, 1, sizeof(buf), fd) != sizeof(buf) ) {
+      fprintf(stderr, "Error: cannot write %s: %s\n", filename, strerror(errno));
+      fclose(fd);
+      return 1;
+    }
+  }
+  return fclose(fd) ? 1 : 0;
+}
+
+static void* worker(void* arg) {
+  worker_type* w = (worker_type*) arg;
+  unsigned char* output;
+  const unsigned char* data;
+  fips_state_type* fips_state;
+  uint64_t remaining = w->size;
+  unsigned int size;
+
+  w->checksum = UINT64_C(0xcbf29ce484222325);
+  output = (unsigned char*) malloc(OUTPUT_CHUNK);
+  fips_state = fips_approved_csprng_initialize(w->fips_test, 0, w->mode);
+  if ( output == NULL || fips_state == NULL || fips_approved_csprng_instantiate(fips_state) ) {
+    fprintf(stderr, "Error: cannot instantiate the generator\n");
+    w->error = 1;
+  }
+  if ( ! w->error && w->producer != NULL && fips_approved_csprng_start_producer(fips_state, w->producer[0], w->producer[1], w->producer[2]) ) {
+    fprintf(stderr, "Error: cannot start the background producer\n");
+    w->error = 1;
+  }
+  if ( w->barrier != NULL ) pthread_barrier_wait(w->barrier);
+  clock_gettime(CLOCK_MONOTONIC, &w->start);
+
+  while ( ! w->error && remaining > 0 ) {
+    size = ( w->producer != NULL ) ? PRODUCER_REQUEST : OUTPUT_CHUNK;
+    if ( remaining < size ) size = (unsigned int) remaining;
+    if ( w->borrow ) {
+      if ( csprng_borrow(fips_state, 1, size, &data, &size) ) {
+        fprintf(stderr, "Error: csprng_borrow has failed after %" PRIu64 " bytes\n", w->size - remaining);
+        w->error = 1;
+        break;
+      }
+      w->checksum = fnv1a(w->checksum, data, size);
+      csprng_release(fips_state);
+    } else {
+      if ( fips_approved_csprng_generate(fips_state, output, size) != (int) size ) {
+        fprintf(stderr, "Error: fips_approved_csprng_generate has failed after %" PRIu64 " bytes\n", w->size - remaining);
+        w->error = 1;
+        break;
+      }
+      w->checksum = fnv1a(w->checksum, output, size);
+    }
+    remaining -= size;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &w->stop);
+
+  if ( fips_state != NULL && fips_approved_csprng_destroy(fips_state) ) w->error = 1;
+  free(output);
+  return NULL;
+}
+
+//Run threads generators at once. Returns aggregate bytes/s or negative value on error
+static double run_threads(int threads, const mode_of_operation_type* mode, int fips_test, uint64_t size, uint64_t* reference) {
+  pthread_t* thread;
+  worker_type* w;
+  pthread_barrier_t barrier;
+  struct timespec start, stop;
+  int i, failed = 0;
+
+  thread = (pthread_t*) calloc(threads, sizeof(pthread_t));
+  w = (worker_type*) calloc(threads, sizeof(worker_type));
+  if ( thread == NULL || w == NULL || pthread_barrier_init(&barrier, NULL, threads + 1) ) {
+    fprintf(stderr, "Error: cannot allocate %d threads\n", threads);
+    free(thread);
+    free(w);
+    return -1.0;
+  }
+
+  for ( i = 0; i < threads; ++i ) {
+    w[i].mode = mode;
+    w[i].fips_test = fips_test;
+    w[i].size = size;
+    w[i].barrier = &barrier;
+    if ( pthread_create(&thread[i], NULL, worker, &w[i]) ) {
+      //Threads already started are waiting on the barrier
+      fprintf(stderr, "Error: pthread_create has failed for thread %d\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  pthread_barrier_wait(&barrier);
+  for ( i = 0; i < threads; ++i ) pthread_join(thread[i], NULL);
+  pthread_barrier_destroy(&barrier);
+
+  //From the first thread starting to the last one finishing
+  start = w[0].start;
+  stop = w[0].stop;
+  for ( i = 1; i < threads; ++i ) {
+    if ( elapsed_seconds(&w[i].start, &start) > 0.0 ) start = w[i].start;
+    if ( elapsed_seconds(&stop, &w[i].stop) > 0.0 ) stop = w[i].stop;
+  }
+
+  for ( i = 0; i < threads; ++i ) {
+    if ( w[i].error ) {
+      ++failed;
+    } else if ( reference != NULL && w[i].checksum != *reference ) {
+      fprintf(stderr, "Error: output of thread %d of %d differs from the single generator\n", i, threads);
+      ++failed;
+    }
+  }
+  free(thread);
+  free(w);
+  if ( failed ) return -1.0;
+  return (double) threads * (double) size / elapsed_seconds(&start, &stop);
+}
+
+int main(int argc, char **argv) {
+  mode_of_operation_type mode;
+  worker_type alone, producer;
+  char filename[] = "/tmp/csprng_mt_stress.XXXXXX";
+  int max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  uint64_t size = 8 << 20;
+  int blocks = 512;
+  int fips_test = 0;
+  int use_havege = 0;
+  int threads, fd, opt, i, failed = 0;
+  double rate, single_rate = 0.0;
+
+  while ( ( opt = getopt(argc, argv, "t:n:m:fH") ) != -1 ) {
+    switch ( opt ) {
+      case 't':
+        max_threads = atoi(optarg);
+        break;
+      case 'n':
+        size = parse_size(optarg);
+        break;
+      case 'm':
+        blocks = atoi(optarg);
+        break;
+      case 'f':
+        fips_test = 1;
+        break;
+      case 'H':
+        use_havege = 1;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-t max_threads] [-n bytes_per_thread[K|M|G]] [-m blocks_between_reseeds] [-f] [-H]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if ( max_threads < 1 ) max_threads = 1;
+  if ( size == 0 || blocks < 1 ) {
+    fprintf(stderr, "Error: invalid -n or -m value\n");
+    return EXIT_FAILURE;
+  }
+
+  memset(&mode, 0, sizeof(mode));
+  mode.file_read_size = 16384;
+  mode.max_number_of_csprng_blocks = blocks;
+  if ( use_havege ) {
+    mode.entropy_source = HAVEGE;
+  } else {
+    fd = mkstemp(filename);
+    if ( fd < 0 ) {
+      fprintf(stderr, "Error: mkstemp has failed: %s\n", strerror(errno));
+      return EXIT_FAILURE;
+    }
+    close(fd);
+    //Seed for every reseed of size bytes plus what the generator buffers ahead
+    if ( write_entropy_file(filename, ( ( size + ( 4 << 20 ) ) / ( blocks * NIST_BLOCK_OUTLEN_BYTES ) + 1 ) * NIST_BLOCK_SEEDLEN_MAX_BYTES
+          + 2 * mode.file_read_size ) ) {
+      unlink(filename);
+      return EXIT_FAILURE;
+    }
+    mode.entropy_source = EXTERNAL;
+    mode.filename_for_entropy = filename;
+  }
+
+  //Output of the generator running alone
+  memset(&alone, 0, sizeof(alone));
+  alone.mode = &mode;
+  alone.fips_test = fips_test;
+  alone.size = size;
+  alone.borrow = 1;
+  worker(&alone);
+  if ( alone.error ) {
+    if ( ! use_havege ) unlink(filename);
+    return EXIT_FAILURE;
+  }
+
+  fprintf(stdout, "%s entropy, %s, %" PRIu64 " bytes per thread, reseed after %d blocks\n",
+      use_havege ? "HAVEGE" : "EXTERNAL", fips_test ? "FIPS tests enabled" : "FIPS tests disabled", size, blocks);
+  for ( threads = 1; threads <= max_threads && ! failed; threads = ( threads * 2 > max_threads && threads < max_threads ) ? max_threads : threads * 2 ) {
+    rate = run_threads(threads, &mode, fips_test, size, use_havege ? NULL : &alone.checksum);
+    if ( rate < 0.0 ) {
+      failed = 1;
+      break;
+    }
+    if ( threads == 1 ) single_rate = rate;
+    fprintf(stdout, "%3d threads: %10.2f MiB/s, speedup %5.2f\n", threads, rate / 1048576.0, rate / single_rate);
+  }
+
+  for ( i = 0; i < (int) ( sizeof(producer_setting) / sizeof(producer_setting[0]) ) && ! failed && ! use_havege; ++i ) {
+    memset(&producer, 0, sizeof(producer));
+    producer.mode = &mode;
+    producer.fips_test = fips_test;
+    producer.size = size;
+    producer.producer = producer_setting[i];
+    worker(&producer);
+    if ( producer.error ) {
+      failed = 1;
+    } else if ( producer.checksum != alone.checksum ) {
+      fprintf(stderr, "Error: output with the background producer %d buffers %d:%d differs from the single generator\n",
+          producer_setting[i][0], producer_setting[i][1], producer_setting[i][2]);
+      failed = 1;
+    } else {
+      fprintf(stdout, "producer %d buffers %d:%d, %d byte requests: %10.2f MiB/s\n", producer_setting[i][0], producer_setting[i][1],
+          producer_setting[i][2], PRODUCER_REQUEST, (double) size / elapsed_seconds(&producer.start, &producer.stop) / 1048576.0);
+    }
+  }
+
+  if ( ! use_havege ) unlink(filename);
+  if ( failed ) {
+    fprintf(stdout, "FAILED\n");
+    return EXIT_FAILURE;
+  }
+  fprintf(stdout, "PASSED\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,194 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/*
+gcc -O2 -I ../include -L../src/.libs -Wextra -Wall -o csprng_tls_benchmark csprng_tls_benchmark.c -lcsprng -lcrypto -lrt -lpthread
+LD_LIBRARY_PATH=../src/.libs ./csprng_tls_benchmark
+LD_LIBRARY_PATH=../src/.libs ./csprng_tls_benchmark -t 16 -r 1000000 -b 32 -f
+
+Compares small requests from 1, 2, 4, ... up to -t (default 64) threads served by
+  - one fips_state_type shared by all threads behind a mutex
+  - csprng_tls_generate, a generator per thread
+and prints the requests per second of both. The checks of fork and csprng_tls_destroy
+are in csprng_tls_test.
+*/
+
+/* {{{ Copyright notice
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <csprng/csprng.h>
+
+#define MAX_REQUEST 4096
+
+typedef struct {
+  fips_state_type* shared;          //NULL => csprng_tls_generate
+  pthread_mutex_t* mutex;
+  pthread_barrier_t* barrier;
+  struct timespec start, stop;
+  int requests;
+  int request_size;
+  int error;
+} worker_type;
+
+static double elapsed_seconds(const struct timespec* start, const struct timespec* stop) {
+  return (double) ( stop->tv_sec - start->tv_sec ) + (double) ( stop->tv_nsec - start->tv_nsec ) * 1.0e-9;
+}
+
+static void* worker(void* arg) {
+  worker_type* w = (worker_type*) arg;
+  unsigned char output[MAX_REQUEST];
+  int i, bytes;
+
+  //The first request of a thread seeds its generator, keep it out of the measurement
+  if ( w->shared == NULL && csprng_tls_generate(output, w->request_size) != w->request_size ) w->error = 1;
+  pthread_barrier_wait(w->barrier);
+  clock_gettime(CLOCK_MONOTONIC, &w->start);
+
+  for ( i = 0; i < w->requests && ! w->error; ++i ) {
+    if ( w->shared == NULL ) {
+      bytes = csprng_tls_generate(output, w->request_size);
+    } else {
+      pthread_mutex_lock(w->mutex);
+      bytes = fips_approved_csprng_generate(w->shared, output, w->request_size);
+      pthread_mutex_unlock(w->mutex);
+    }
+    if ( bytes != w->request_size ) w->error = 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &w->stop);
+  return NULL;
+}
+
+//Returns requests per second or negative value on error
+static double run_threads(int threads, fips_state_type* shared, int requests, int request_size) {
+  pthread_t* thread;
+  worker_type* w;
+  pthread_barrier_t barrier;
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  struct timespec start, stop;
+  int i, failed = 0;
+
+  thread = (pthread_t*) calloc(threads, sizeof(pthread_t));
+  w = (worker_type*) calloc(threads, sizeof(worker_type));
+  if ( thread == NULL || w == NULL || pthread_barrier_init(&barrier, NULL, threads + 1) ) {
+    fprintf(stderr, "Error: cannot allocate %d threads\n", threads);
+    free(thread);
+    free(w);
+    return -1.0;
+  }
+
+  for ( i = 0; i < threads; ++i ) {
+    w[i].shared = shared;
+    w[i].mutex = &mutex;
+    w[i].barrier = &barrier;
+    w[i].requests = requests;
+    w[i].request_size = request_size;
+    if ( pthread_create(&thread[i], NULL, worker, &w[i]) ) {
+      fprintf(stderr, "Error: pthread_create has failed for thread %d\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  pthread_barrier_wait(&barrier);
+  for ( i = 0; i < threads; ++i ) {
+    pthread_join(thread[i], NULL);
+    failed += w[i].error;
+  }
+  pthread_barrier_destroy(&barrier);
+
+  //From the first thread starting to the last one finishing
+  start = w[0].start;
+  stop = w[0].stop;
+  for ( i = 1; i < threads; ++i ) {
+    if ( elapsed_seconds(&w[i].start, &start) > 0.0 ) start = w[i].start;
+    if ( elapsed_seconds(&stop, &w[i].stop) > 0.0 ) stop = w[i].stop;
+  }
+  free(thread);
+  free(w);
+  if ( failed ) {
+    fprintf(stderr, "Error: %d of %d threads have failed\n", failed, threads);
+    return -1.0;
+  }
+  return (double) threads * (double) requests / elapsed_seconds(&start, &stop);
+}
+
+int main(int argc, char **argv) {
+  mode_of_operation_type mode;
+  fips_state_type* shared;
+  int max_threads = 64;
+  int requests = 100000;
+  int request_size = 16;
+  int fips_test = 0;
+  int threads, opt;
+  double shared_rate, tls_rate;
+
+  while ( ( opt = getopt(argc, argv, "t:r:b:f") ) != -1 ) {
+    switch ( opt ) {
+      case 't':
+        max_threads = atoi(optarg);
+        break;
+      case 'r':
+        requests = atoi(optarg);
+        break;
+      case 'b':
+        request_size = atoi(optarg);
+        break;
+      case 'f':
+        fips_test = 1;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-t max_threads] [-r requests_per_thread] [-b request_size] [-f]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if ( max_threads < 1 || requests < 1 || request_size < 1 || request_size > MAX_REQUEST ) {
+    fprintf(stderr, "Error: invalid -t, -r or -b value. Request size is 1 to %d bytes\n", MAX_REQUEST);
+    return EXIT_FAILURE;
+  }
+
+  memset(&mode, 0, sizeof(mode));
+  mode.entropy_source = HAVEGE;
+  mode.max_number_of_csprng_blocks = 512;
+
+  if ( csprng_tls_initialize(fips_test, &mode) ) return EXIT_FAILURE;
+  shared = fips_approved_csprng_initialize(fips_test, 0, &mode);
+  if ( shared == NULL || fips_approved_csprng_instantiate(shared) ) {
+    csprng_tls_destroy();
+    return EXIT_FAILURE;
+  }
+
+  fprintf(stdout, "%d requests of %d bytes per thread, %s\n", requests, request_size, fips_test ? "FIPS tests enabled" : "FIPS tests disabled");
+  fprintf(stdout, "threads  shared+mutex [Mreq/s]  thread-local [Mreq/s]  ratio\n");
+  for ( threads = 1; threads <= max_threads; threads = ( threads * 2 > max_threads && threads < max_threads ) ? max_threads : threads * 2 ) {
+    shared_rate = run_threads(threads, shared, requests, request_size);
+    tls_rate = run_threads(threads, NULL, requests, request_size);
+    if ( shared_rate < 0.0 || tls_rate < 0.0 ) break;
+    fprintf(stdout, "%7d  %21.3f  %21.3f  %5.1f\n", threads, shared_rate * 1.0e-6, tls_rate * 1.0e-6, tls_rate / shared_rate);
+  }
+
+  fips_approved_csprng_destroy(shared);
+  if ( csprng_tls_destroy() || threads <= max_threads ) return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
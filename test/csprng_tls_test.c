@@ -0,0 +1,297 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/*
+gcc -O2 -I ../include -L../src/.libs -Wextra -Wall -o csprng_tls_test csprng_tls_test.c -lcsprng -lcrypto -lrt -lpthread
+LD_LIBRARY_PATH=../src/.libs ./csprng_tls_test
+
+Checks of the thread-local API csprng_tls_*, with and without the FIPS tests:
+  - a child process does not repeat the output of its parent after fork
+  - a fips_state_type inherited by a child process fails instead of crashing, a new one works
+  - a thread keeps working after another thread has called csprng_tls_destroy and csprng_tls_initialize
+  - threads calling csprng_tls_generate all the time while the main thread destroys and initializes the
+    API again and again. Their requests may fail while the API is destroyed, but must not crash, and
+    all of them have to succeed after the last csprng_tls_initialize
+The entropy comes from a deterministic file read through the EXTERNAL source.
+*/
+
+/* {{{ Copyright notice
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <csprng/csprng.h>
+
+#define THREADS 4
+#define CYCLES 50
+
+//Deterministic entropy file for the EXTERNAL source. Returns 0 on success
+static int write_entropy_file(const char* filename, uint64_t size) {
+  unsigned char buf[4096];
+  uint64_t x = UINT64_C(0x9e3779b97f4a7c15);
+  uint64_t written;
+  FILE* fd;
+  int i;
+
+  fd = fopen(filename, "w");
+  if ( fd == NULL ) {
+    fprintf(stderr, "Error: cannot open %s: %s\n", filename, strerror(errno));
+    return 1;
+  }
+  for ( written = 0; written < size; written += sizeof(buf) ) {
+    for ( i = 0; i < (int) sizeof(buf); ++i ) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      buf[i] = (unsigned char) ( x >> 32 );
+    }
+    if ( fwrite(buf, 1, sizeof(buf), fd) != sizeof(buf) ) {
+      fprintf(stderr, "Error: cannot write %s: %s\n", filename, strerror(errno));
+      fclose(fd);
+      return 1;
+    }
+  }
+  return fclose(fd) ? 1 : 0;
+}
+
+//Child and parent must not produce the same bytes after fork. Returns 0 on success
+static int check_fork(void) {
+  unsigned char parent[64], child[64];
+  int pipefd[2], status;
+  pid_t pid;
+
+  //Leave most of the buffer unread so that the child inherits it
+  if ( csprng_tls_generate(parent, 16) != 16 || pipe(pipefd) ) return 1;
+  pid = fork();
+  if ( pid < 0 ) {
+    fprintf(stderr, "Error: fork has failed: %s\n", strerror(errno));
+    return 1;
+  }
+  if ( pid == 0 ) {
+    close(pipefd[0]);
+    if ( csprng_tls_generate(child, sizeof(child)) != sizeof(child) ) _exit(1);
+    if ( write(pipefd[1], child, sizeof(child)) != sizeof(child) ) _exit(1);
+    _exit(csprng_tls_destroy());
+  }
+  close(pipefd[1]);
+  if ( csprng_tls_generate(parent, sizeof(parent)) != sizeof(parent) ) return 1;
+  if ( read(pipefd[0], child, sizeof(child)) != sizeof(child) ) return 1;
+  close(pipefd[0]);
+  if ( waitpid(pid, &status, 0) != pid || ! WIFEXITED(status) || WEXITSTATUS(status) != 0 ) {
+    fprintf(stderr, "Error: child process has failed\n");
+    return 1;
+  }
+  if ( memcmp(parent, child, sizeof(parent)) == 0 ) {
+    fprintf(stderr, "Error: child has repeated the output of the parent\n");
+    return 1;
+  }
+  return 0;
+}
+
+//The inherited fips_state must fail in the child, it prints errors. Returns 0 on success
+static int check_fips_state_fork(const mode_of_operation_type* mode, int fips_test) {
+  fips_state_type* fips_state;
+  fips_state_type* child_state;
+  unsigned char output[64];
+  int status, error = 0;
+  pid_t pid;
+
+  fips_state = fips_approved_csprng_initialize(fips_test, 0, mode);
+  if ( fips_state == NULL ) return 1;
+  if ( fips_approved_csprng_instantiate(fips_state) ||
+      fips_approved_csprng_generate(fips_state, output, 16) != 16 ) {
+    fips_approved_csprng_destroy(fips_state);
+    return 1;
+  }
+  pid = fork();
+  if ( pid < 0 ) {
+    fprintf(stderr, "Error: fork has failed: %s\n", strerror(errno));
+    fips_approved_csprng_destroy(fips_state);
+    return 1;
+  }
+  if ( pid == 0 ) {
+    if ( fips_approved_csprng_generate(fips_state, output, sizeof(output)) != 0 ) _exit(1);
+    if ( fips_approved_csprng_destroy(fips_state) == 0 ) _exit(1);
+    child_state = fips_approved_csprng_initialize(fips_test, 0, mode);
+    if ( child_state == NULL ) _exit(1);
+    if ( fips_approved_csprng_instantiate(child_state) ||
+        fips_approved_csprng_generate(child_state, output, sizeof(output)) != sizeof(output) ) _exit(1);
+    _exit(fips_approved_csprng_destroy(child_state));
+  }
+  if ( fips_approved_csprng_generate(fips_state, output, sizeof(output)) != sizeof(output) ) error = 1;
+  if ( waitpid(pid, &status, 0) != pid || ! WIFEXITED(status) || WEXITSTATUS(status) != 0 ) {
+    fprintf(stderr, "Error: child process has failed with the fips_state of its parent\n");
+    error = 1;
+  }
+  if ( fips_approved_csprng_destroy(fips_state) ) error = 1;
+  return error;
+}
+
+static void* destroy_worker(void* arg) {
+  pthread_barrier_t* barrier = (pthread_barrier_t*) arg;
+  unsigned char output[64];
+  int error = 0;
+
+  if ( csprng_tls_generate(output, 16) != 16 ) error = 1;
+  pthread_barrier_wait(barrier);
+  //The main thread destroys and initializes again, the old instance of this thread is stale meanwhile
+  pthread_barrier_wait(barrier);
+  if ( csprng_tls_generate(output, sizeof(output)) != sizeof(output) ) error = 1;
+  return error ? arg : NULL;
+}
+
+//A thread must get a new instance after csprng_tls_destroy. Returns 0 on success
+static int check_destroy(const mode_of_operation_type* mode, int fips_test) {
+  pthread_barrier_t barrier;
+  pthread_t thread;
+  void* result;
+  int error;
+
+  if ( pthread_barrier_init(&barrier, NULL, 2) ) return 1;
+  if ( pthread_create(&thread, NULL, destroy_worker, &barrier) ) {
+    pthread_barrier_destroy(&barrier);
+    return 1;
+  }
+  pthread_barrier_wait(&barrier);
+  error = csprng_tls_destroy() || csprng_tls_initialize(fips_test, mode);
+  pthread_barrier_wait(&barrier);
+  pthread_join(thread, &result);
+  pthread_barrier_destroy(&barrier);
+  if ( error || result != NULL ) {
+    fprintf(stderr, "Error: thread has failed after csprng_tls_destroy and csprng_tls_initialize\n");
+    return 1;
+  }
+  return 0;
+}
+
+typedef struct {
+  int* stop;                        //Set by the main thread after the last csprng_tls_initialize
+  uint64_t requests;
+  uint64_t failed;                  //Requests made while the API was destroyed
+  int error;
+} busy_worker_type;
+
+static void* busy_worker(void* arg) {
+  busy_worker_type* w = (busy_worker_type*) arg;
+  unsigned char output[300];
+  struct timespec pause = { 0, 1000000 };
+  unsigned int size = 1;
+
+  while ( ! __atomic_load_n(w->stop, __ATOMIC_ACQUIRE) ) {
+    //Sizes 1 ... 300 bytes, most requests take the fast path, some refill the buffer
+    size = size * 7 % 301;
+    ++w->requests;
+    if ( csprng_tls_generate(output, size) != (int) size ) {
+      //Each failed request prints an error, wait for csprng_tls_initialize
+      ++w->failed;
+      nanosleep(&pause, NULL);
+    }
+  }
+  if ( csprng_tls_generate(output, sizeof(output)) != sizeof(output) ) w->error = 1;
+  return NULL;
+}
+
+//Destroy and initialize while other threads generate. Returns 0 on success
+static int check_concurrent_destroy(const mode_of_operation_type* mode, int fips_test) {
+  pthread_t thread[THREADS];
+  busy_worker_type w[THREADS];
+  struct timespec pause = { 0, 1000000 };
+  uint64_t requests = 0, failed = 0;
+  int i, cycle, stop = 0, error = 0;
+
+  memset(w, 0, sizeof(w));
+  for ( i = 0; i < THREADS; ++i ) {
+    w[i].stop = &stop;
+    if ( pthread_create(&thread[i], NULL, busy_worker, &w[i]) ) {
+      fprintf(stderr, "Error: pthread_create has failed for thread %d\n", i);
+      __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+      while ( --i >= 0 ) pthread_join(thread[i], NULL);
+      return 1;
+    }
+  }
+  for ( cycle = 0; cycle < CYCLES && ! error; ++cycle ) {
+    nanosleep(&pause, NULL);
+    if ( csprng_tls_destroy() || csprng_tls_initialize(fips_test, mode) ) error = 1;
+  }
+  __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+  for ( i = 0; i < THREADS; ++i ) {
+    pthread_join(thread[i], NULL);
+    error |= w[i].error;
+    requests += w[i].requests;
+    failed += w[i].failed;
+  }
+  fprintf(stdout, "%d cycles of csprng_tls_destroy and csprng_tls_initialize, %"PRIu64" requests of %d threads, %"PRIu64" failed while destroyed, %s\n",
+      CYCLES, requests, THREADS, failed, error ? "FAILED" : "OK");
+  return error;
+}
+
+int main(void) {
+  mode_of_operation_type mode;
+  char filename[] = "/tmp/csprng_tls_test.XXXXXX";
+  int fd, fips_test, errors = 0;
+
+  memset(&mode, 0, sizeof(mode));
+  mode.file_read_size = 16384;
+  mode.max_number_of_csprng_blocks = 512;
+  fd = mkstemp(filename);
+  if ( fd < 0 ) {
+    fprintf(stderr, "Error: mkstemp has failed: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  close(fd);
+  //Each new root reads the file from its start
+  if ( write_entropy_file(filename, 4 << 20) ) {
+    unlink(filename);
+    return EXIT_FAILURE;
+  }
+  mode.entropy_source = EXTERNAL;
+  mode.filename_for_entropy = filename;
+
+  for ( fips_test = 0; fips_test <= 1; ++fips_test ) {
+    if ( csprng_tls_initialize(fips_test, &mode) ) {
+      ++errors;
+      break;
+    }
+    if ( check_fork() ) {
+      fprintf(stderr, "Error: fork check has failed, %s\n", fips_test ? "FIPS tests enabled" : "FIPS tests disabled");
+      ++errors;
+    }
+    if ( check_fips_state_fork(&mode, fips_test) ) {
+      fprintf(stderr, "Error: fips_state fork check has failed, %s\n", fips_test ? "FIPS tests enabled" : "FIPS tests disabled");
+      ++errors;
+    }
+    errors += check_destroy(&mode, fips_test);
+    errors += check_concurrent_destroy(&mode, fips_test);
+    if ( csprng_tls_destroy() ) ++errors;
+  }
+
+  unlink(filename);
+  if ( errors ) {
+    fprintf(stdout, "FAILED\n");
+    return EXIT_FAILURE;
+  }
+  fprintf(stdout, "PASSED\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,324 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/*
+gcc -O2 -I ../include -L../src/.libs -Wextra -Wall -o csprng_typed_test csprng_typed_test.c -lcsprng -lcrypto -lrt -lpthread
+LD_LIBRARY_PATH=../src/.libs ./csprng_typed_test
+LD_LIBRARY_PATH=../src/.libs ./csprng_typed_test -n 10000000 -f
+
+Draws -n values of each type: integers below 6, 3*2^30 and 3*2^62, floats, doubles and booleans
+with p = 0.3. Every CPU tier supported by this machine has to give the same values as the generic
+code from the same entropy file. The values of the generic code are checked for their range and
+with a chi-square test of their distribution; the bounds 3*2^30 and 3*2^62 make the bias of
+the modulo reduction obvious. Finally the time to get doubles is compared with converting the
+bytes of fips_approved_csprng_generate in a scalar loop.
+*/
+
+/* {{{ Copyright notice
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <inttypes.h>
+#include <csprng/csprng.h>
+#include <csprng/cpu_dispatch.h>
+
+#define BOUND_SMALL 6U
+#define BOUND_32 ( UINT32_C(3) << 30 )
+#define BOUND_64 ( UINT64_C(3) << 62 )
+#define BERNOULLI_P 0.3
+//Chi-square above this is less likely than 1e-5 for 5 and 2 degrees of freedom
+#define CHI2_LIMIT_5DF 28.5
+#define CHI2_LIMIT_2DF 23.0
+
+typedef struct {
+  uint32_t* small;
+  uint32_t* large32;
+  uint64_t* large64;
+  float* f;
+  double* d;
+  unsigned char* b;
+} values_type;
+
+static double elapsed_seconds(const struct timespec* start, const struct timespec* stop) {
+  return (double) ( stop->tv_sec - start->tv_sec ) + (double) ( stop->tv_nsec - start->tv_nsec ) * 1.0e-9;
+}
+
+//Deterministic entropy file for the EXTERNAL source. Returns 0 on success
+static int write_entropy_file(const char* filename, uint64_t size) {
+  unsigned char buf[4096];
+  uint64_t x = UINT64_C(0x9e3779b97f4a7c15);
+  uint64_t written;
+  FILE* fd;
+  int i;
+
+  fd = fopen(filename, "w");
+  if ( fd == NULL ) {
+    fprintf(stderr, "Error: cannot open %s: %s\n", filename, strerror(errno));
+    return 1;
+  }
+  for ( written = 0; written < size; written += sizeof(buf) ) {
+    for ( i = 0; i < (int) sizeof(buf); ++i ) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      buf[i] = (unsigned char) ( x >> 32 );
+    }
+    if ( fwrite(buf, 1, sizeof(buf), fd) != sizeof(buf) ) {
+      fprintf(stderr, "Error: cannot write %s: %s\n", filename, strerror(errno));
+      fclose(fd);
+      return 1;
+    }
+  }
+  return fclose(fd) ? 1 : 0;
+}
+
+static int alloc_values(values_type* v, unsigned int count) {
+  v->small = (uint32_t*) malloc(count * sizeof(uint32_t));
+  v->large32 = (uint32_t*) malloc(count * sizeof(uint32_t));
+  v->large64 = (uint64_t*) malloc(count * sizeof(uint64_t));
+  v->f = (float*) malloc(count * sizeof(float));
+  v->d = (double*) malloc(count * sizeof(double));
+  v->b = (unsigned char*) malloc(count);
+  return v->small == NULL || v->large32 == NULL || v->large64 == NULL || v->f == NULL || v->d == NULL || v->b == NULL;
+}
+
+static void free_values(values_type* v) {
+  free(v->small);
+  free(v->large32);
+  free(v->large64);
+  free(v->f);
+  free(v->d);
+  free(v->b);
+}
+
+//All types from a new generator. Returns 0 on success
+static int draw_values(const mode_of_operation_type* mode, int fips_test, values_type* v, unsigned int count) {
+  fips_state_type* fips_state;
+  int rc;
+
+  fips_state = fips_approved_csprng_initialize(fips_test, 0, mode);
+  if ( fips_state == NULL || fips_approved_csprng_instantiate(fips_state) ) {
+    fprintf(stderr, "Error: cannot instantiate the generator\n");
+    return 1;
+  }
+  rc = csprng_uniform_uint32(fips_state, v->small, count, BOUND_SMALL) ||
+    csprng_uniform_uint32(fips_state, v->large32, count, BOUND_32) ||
+    csprng_uniform_uint64(fips_state, v->large64, count, BOUND_64) ||
+    csprng_uniform_float(fips_state, v->f, count) ||
+    csprng_uniform_double(fips_state, v->d, count) ||
+    csprng_bernoulli(fips_state, v->b, count, BERNOULLI_P);
+  if ( fips_approved_csprng_destroy(fips_state) ) rc = 1;
+  if ( rc ) fprintf(stderr, "Error: typed output has failed\n");
+  return rc;
+}
+
+static int same_values(const values_type* a, const values_type* b, unsigned int count) {
+  return memcmp(a->small, b->small, count * sizeof(uint32_t)) == 0 &&
+    memcmp(a->large32, b->large32, count * sizeof(uint32_t)) == 0 &&
+    memcmp(a->large64, b->large64, count * sizeof(uint64_t)) == 0 &&
+    memcmp(a->f, b->f, count * sizeof(float)) == 0 &&
+    memcmp(a->d, b->d, count * sizeof(double)) == 0 &&
+    memcmp(a->b, b->b, count) == 0;
+}
+
+static double chi_square(const uint64_t* observed, int bins, double expected) {
+  double chi2 = 0.0;
+  int i;
+  for ( i = 0; i < bins; ++i ) chi2 += ( observed[i] - expected ) * ( observed[i] - expected ) / expected;
+  return chi2;
+}
+
+//Range and distribution of the values. Returns the number of failed checks
+static int check_values(const values_type* v, unsigned int count) {
+  uint64_t bins[6];
+  double chi2, sum, sigma;
+  unsigned int i;
+  int failed = 0;
+
+  memset(bins, 0, sizeof(bins));
+  for ( i = 0; i < count; ++i ) {
+    if ( v->small[i] >= BOUND_SMALL ) break;
+    ++bins[v->small[i]];
+  }
+  chi2 = ( i < count ) ? INFINITY : chi_square(bins, 6, count / 6.0);
+  fprintf(stdout, "uint32 below %u: chi-square %.2f\n", BOUND_SMALL, chi2);
+  if ( chi2 > CHI2_LIMIT_5DF ) ++failed;
+
+  memset(bins, 0, sizeof(bins));
+  for ( i = 0; i < count; ++i ) {
+    if ( v->large32[i] >= BOUND_32 ) break;
+    ++bins[v->large32[i] >> 30];
+  }
+  chi2 = ( i < count ) ? INFINITY : chi_square(bins, 3, count / 3.0);
+  fprintf(stdout, "uint32 below 3*2^30, thirds: chi-square %.2f\n", chi2);
+  if ( chi2 > CHI2_LIMIT_2DF ) ++failed;
+
+  memset(bins, 0, sizeof(bins));
+  for ( i = 0; i < count; ++i ) {
+    if ( v->large64[i] >= BOUND_64 ) break;
+    ++bins[v->large64[i] >> 62];
+  }
+  chi2 = ( i < count ) ? INFINITY : chi_square(bins, 3, count / 3.0);
+  fprintf(stdout, "uint64 below 3*2^62, thirds: chi-square %.2f\n", chi2);
+  if ( chi2 > CHI2_LIMIT_2DF ) ++failed;
+
+  //Mean of uniform [0, 1) values is 1/2, the standard deviation of one value is 1/sqrt(12)
+  sigma = 1.0 / sqrt(12.0 * count);
+  for ( sum = 0.0, i = 0; i < count && v->f[i] >= 0.0f && v->f[i] < 1.0f; ++i ) sum += v->f[i];
+  fprintf(stdout, "float mean: %.6f\n", sum / count);
+  if ( i < count || fabs(sum / count - 0.5) > 5.0 * sigma ) ++failed;
+
+  for ( sum = 0.0, i = 0; i < count && v->d[i] >= 0.0 && v->d[i] < 1.0; ++i ) sum += v->d[i];
+  fprintf(stdout, "double mean: %.6f\n", sum / count);
+  if ( i < count || fabs(sum / count - 0.5) > 5.0 * sigma ) ++failed;
+
+  for ( sum = 0.0, i = 0; i < count && v->b[i] <= 1; ++i ) sum += v->b[i];
+  fprintf(stdout, "bool with p = %g: frequency %.6f\n", BERNOULLI_P, sum / count);
+  if ( i < count || fabs(sum / count - BERNOULLI_P) > 5.0 * sqrt(BERNOULLI_P * ( 1.0 - BERNOULLI_P ) / count) ) ++failed;
+
+  return failed;
+}
+
+//Doubles by csprng_uniform_double and by a scalar loop over bytes. Returns 0 on success
+static int compare_speed(const mode_of_operation_type* mode, int fips_test, double* output, unsigned int count) {
+  fips_state_type* fips_state;
+  unsigned char bytes[4096];
+  struct timespec start, middle, stop;
+  unsigned int i, j, n;
+  uint64_t x;
+  int rc = 0;
+
+  fips_state = fips_approved_csprng_initialize(fips_test, 0, mode);
+  if ( fips_state == NULL || fips_approved_csprng_instantiate(fips_state) ) {
+    fprintf(stderr, "Error: cannot instantiate the generator\n");
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for ( i = 0; i < count && ! rc; i += n ) {
+    n = ( count - i < sizeof(bytes) / 8 ) ? count - i : sizeof(bytes) / 8;
+    if ( fips_approved_csprng_generate(fips_state, bytes, n * 8) != (int) n * 8 ) rc = 1;
+    for ( j = 0; j < n; ++j ) {
+      x = 0;
+      memcpy(&x, bytes + 8 * j, 8);
+      output[i + j] = (double) ( x >> 11 ) / 9007199254740992.0;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &middle);
+  if ( csprng_uniform_double(fips_state, output, count) ) rc = 1;
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  if ( fips_approved_csprng_destroy(fips_state) ) rc = 1;
+  if ( rc ) {
+    fprintf(stderr, "Error: generating doubles has failed\n");
+    return 1;
+  }
+  fprintf(stdout, "doubles: bytes and scalar loop %.1f M/s, csprng_uniform_double %.1f M/s\n",
+      count / elapsed_seconds(&start, &middle) * 1.0e-6, count / elapsed_seconds(&middle, &stop) * 1.0e-6);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  mode_of_operation_type mode;
+  values_type reference, values;
+  char filename[] = "/tmp/csprng_typed_test.XXXXXX";
+  unsigned int count = 1000000;
+  int fips_test = 0;
+  int tier, fd, opt, failed = 0;
+
+  while ( ( opt = getopt(argc, argv, "n:f") ) != -1 ) {
+    switch ( opt ) {
+      case 'n':
+        count = (unsigned int) atoi(optarg);
+        break;
+      case 'f':
+        fips_test = 1;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n values_of_each_type] [-f]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if ( count < 1000 || count > 100000000 ) {
+    fprintf(stderr, "Error: -n has to be 1000 to 100000000\n");
+    return EXIT_FAILURE;
+  }
+  if ( alloc_values(&reference, count) || alloc_values(&values, count) ) {
+    fprintf(stderr, "Error: cannot allocate %u values\n", count);
+    return EXIT_FAILURE;
+  }
+
+  memset(&mode, 0, sizeof(mode));
+  mode.file_read_size = 16384;
+  mode.max_number_of_csprng_blocks = 512;
+  fd = mkstemp(filename);
+  if ( fd < 0 ) {
+    fprintf(stderr, "Error: mkstemp has failed: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  close(fd);
+  //Seed for every reseed of about 40 bytes per value, rejections included, plus what the generator buffers ahead
+  if ( write_entropy_file(filename, ( ( (uint64_t) count * 40 + ( 4 << 20 ) ) /
+          ( mode.max_number_of_csprng_blocks * NIST_BLOCK_OUTLEN_BYTES ) + 1 ) * NIST_BLOCK_SEEDLEN_MAX_BYTES + 2 * mode.file_read_size ) ) {
+    unlink(filename);
+    return EXIT_FAILURE;
+  }
+  mode.entropy_source = EXTERNAL;
+  mode.filename_for_entropy = filename;
+
+  fprintf(stdout, "%u values of each type, %s\n", count, fips_test ? "FIPS tests enabled" : "FIPS tests disabled");
+  for ( tier = CSPRNG_CPU_TIER_GENERIC; tier <= (int) csprng_cpu_detected_tier() && ! failed; ++tier ) {
+    //OpenSSL AES is available on every tier
+    if ( nist_ctr_drbg_select_cipher(NIST_CIPHER_OPENSSL) || csprng_cpu_select_tier((csprng_cpu_tier_type) tier) ) {
+      fprintf(stderr, "Error: cannot select CPU tier %s\n", csprng_cpu_tier_names[tier]);
+      failed = 1;
+      break;
+    }
+    if ( draw_values(&mode, fips_test, tier == CSPRNG_CPU_TIER_GENERIC ? &reference : &values, count) ) {
+      failed = 1;
+      break;
+    }
+    if ( tier == CSPRNG_CPU_TIER_GENERIC ) {
+      failed = check_values(&reference, count);
+    } else if ( ! same_values(&reference, &values, count) ) {
+      fprintf(stderr, "Error: %s kernel differs from the generic one\n", csprng_cpu_kernel_name(CSPRNG_KERNEL_TYPED));
+      failed = 1;
+    }
+    fprintf(stdout, "%-8s %-12s %s\n", csprng_cpu_tier_names[tier], csprng_cpu_kernel_name(CSPRNG_KERNEL_TYPED), failed ? "FAILED" : "OK");
+  }
+  if ( ! failed ) {
+    nist_ctr_drbg_select_cipher(NIST_CIPHER_AUTO);
+    failed = compare_speed(&mode, fips_test, values.d, count);
+  }
+
+  unlink(filename);
+  free_values(&reference);
+  free_values(&values);
+  if ( failed ) {
+    fprintf(stdout, "FAILED\n");
+    return EXIT_FAILURE;
+  }
+  fprintf(stdout, "PASSED\n");
+  return EXIT_SUCCESS;
+}
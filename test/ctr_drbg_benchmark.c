@@ -0,0 +1,362 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/*
+gcc -O2 -I ../include -L../src/.libs -Wextra -Wall -o ctr_drbg_benchmark ctr_drbg_benchmark.c -lcsprng -lcrypto -lrt
+LD_LIBRARY_PATH=../src/.libs ./ctr_drbg_benchmark
+LD_LIBRARY_PATH=../src/.libs ./ctr_drbg_benchmark -n 1024 -b 4096 -k 256
+CSPRNG_AES_CIPHER=bitsliced LD_LIBRARY_PATH=../src/.libs ./ctr_drbg_benchmark
+LD_LIBRARY_PATH=../src/.libs ./ctr_drbg_benchmark -R -c 1000000
+LD_LIBRARY_PATH=../src/.libs ./ctr_drbg_benchmark -t 4
+LD_LIBRARY_PATH=../src/.libs ./ctr_drbg_benchmark -l 4 -b 512
+
+Measures CTR_DRBG generate throughput in bytes/s for AES-128, AES-192 and AES-256.
+With -R it measures the number of reseeds per second instead. Input lengths are the same
+as used by csprng_initialize with additional input enabled.
+With -t the generate requests are split between the given number of threads. The output is
+first compared with a single threaded instance and the benchmark fails when it differs.
+With -l the requests are served by the given number of independent CTR_DRBG lanes. The output
+is first checked against separate instances and the result is compared with the single lane rate.
+*/
+
+/* {{{ Copyright notice
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <csprng/nist_ctr_drbg.h>
+#include <csprng/cpu_dispatch.h>
+
+static double elapsed_seconds(const struct timespec* start, const struct timespec* stop) {
+  return (double) ( stop->tv_sec - start->tv_sec ) + (double) ( stop->tv_nsec - start->tv_nsec ) * 1.0e-9;
+}
+
+//Compare the output of a DRBG using threads with a single threaded one. Returns number of differing requests
+static int compare_threads(int keylen, int use_df, int threads) {
+  static unsigned char expected[NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST], output[NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST];
+  unsigned char entropy_input[NIST_BLOCK_SEEDLEN_MAX_BYTES];
+  NIST_CTR_DRBG* serial;
+  NIST_CTR_DRBG* parallel;
+  int i, length, add_length, failed = 0;
+
+  for ( i = 0; i < NIST_BLOCK_SEEDLEN_MAX_BYTES; ++i ) entropy_input[i] = (unsigned char) ( 3 * i );
+
+  serial = nist_ctr_drbg_instantiate(entropy_input, NIST_SEEDLEN_BYTES(keylen), NULL, 0, NULL, 0, use_df, keylen);
+  parallel = nist_ctr_drbg_instantiate(entropy_input, NIST_SEEDLEN_BYTES(keylen), NULL, 0, NULL, 0, use_df, keylen);
+  if ( serial == NULL || parallel == NULL || nist_ctr_drbg_set_threads(parallel, threads) ) {
+    fprintf(stderr, "Error: cannot instantiate CTR_DRBG with %d threads for AES-%d\n", threads, keylen);
+    return 1;
+  }
+
+  //Sizes around the slice boundaries, with and without a partial last block and additional input
+  for ( length = 1; length <= (int) NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST; length = 2 * length + 4093 ) {
+    add_length = ( length & 1 ) ? NIST_SEEDLEN_BYTES(keylen) : 0;
+    if ( nist_ctr_drbg_generate(serial, expected, length, entropy_input, add_length) ||
+         nist_ctr_drbg_generate(parallel, output, length, entropy_input, add_length) ) {
+      ++failed;
+      break;
+    }
+    if ( memcmp(expected, output, length) ) {
+      fprintf(stderr, "Error: AES-%d output of %d threads differs for request of %d bytes\n", keylen, threads, length);
+      ++failed;
+    }
+  }
+  for ( i = 0; i < 16 && ! failed; ++i ) {
+    length = NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST - 7 * i;
+    nist_ctr_drbg_generate(serial, expected, length, NULL, 0);
+    nist_ctr_drbg_generate(parallel, output, length, NULL, 0);
+    if ( memcmp(expected, output, length) ) {
+      fprintf(stderr, "Error: AES-%d output of %d threads differs for request of %d bytes\n", keylen, threads, length);
+      ++failed;
+    }
+  }
+
+  nist_ctr_drbg_destroy(serial);
+  nist_ctr_drbg_destroy(parallel);
+  return failed;
+}
+
+/*
+ * Lane l of a multi-lane request has to produce the same bytes as a separate instance asked for
+ * the blocks at positions l, l + lanes, ... Returns number of differing requests
+ */
+static int compare_lanes(int keylen, int use_df, int lanes) {
+  static unsigned char output[NIST_CTR_DRBG_MAX_LANES * NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST];
+  static unsigned char expected[NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST];
+  unsigned char entropy_input[NIST_BLOCK_SEEDLEN_MAX_BYTES];
+  NIST_CTR_DRBG* lane[NIST_CTR_DRBG_MAX_LANES];
+  NIST_CTR_DRBG* reference[NIST_CTR_DRBG_MAX_LANES];
+  int i, l, length, add_length, blocks, lane_length, failed = 0;
+
+  for ( l = 0; l < lanes; ++l ) {
+    for ( i = 0; i < NIST_BLOCK_SEEDLEN_MAX_BYTES; ++i ) entropy_input[i] = (unsigned char) ( 5 * i + l );
+    lane[l] = nist_ctr_drbg_instantiate(entropy_input, NIST_SEEDLEN_BYTES(keylen), NULL, 0, NULL, 0, use_df, keylen);
+    reference[l] = nist_ctr_drbg_instantiate(entropy_input, NIST_SEEDLEN_BYTES(keylen), NULL, 0, NULL, 0, use_df, keylen);
+    if ( lane[l] == NULL || reference[l] == NULL ) return 1;
+  }
+
+  //Every lane gets at least one block, a separate instance cannot run the update step without output
+  for ( length = lanes * NIST_BLOCK_OUTLEN_BYTES; length <= lanes * (int) NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST && ! failed;
+      length = ( length < 600 ) ? length + 1 : 2 * length + 1 ) {
+    add_length = ( length % 3 == 0 ) ? NIST_SEEDLEN_BYTES(keylen) : 0;
+    if ( nist_ctr_drbg_generate_lanes(lane, lanes, output, length, entropy_input, add_length) ) return 1;
+
+    blocks = length / NIST_BLOCK_OUTLEN_BYTES;
+    for ( l = 0; l < lanes; ++l ) {
+      lane_length = ( blocks / lanes + ( l < blocks % lanes ) ) * NIST_BLOCK_OUTLEN_BYTES;
+      if ( l == blocks % lanes ) lane_length += length % NIST_BLOCK_OUTLEN_BYTES;
+      if ( nist_ctr_drbg_generate(reference[l], expected, lane_length, entropy_input, add_length) ) return 1;
+      for ( i = 0; i < lane_length; i += NIST_BLOCK_OUTLEN_BYTES ) {
+        if ( memcmp(output + ( i / NIST_BLOCK_OUTLEN_BYTES * lanes + l ) * NIST_BLOCK_OUTLEN_BYTES, expected + i,
+              lane_length - i < NIST_BLOCK_OUTLEN_BYTES ? lane_length - i : NIST_BLOCK_OUTLEN_BYTES) ) {
+          fprintf(stderr, "Error: AES-%d lane %d of %d differs for request of %d bytes\n", keylen, l, lanes, length);
+          ++failed;
+          break;
+        }
+      }
+    }
+  }
+
+  for ( l = 0; l < lanes; ++l ) {
+    nist_ctr_drbg_destroy(lane[l]);
+    nist_ctr_drbg_destroy(reference[l]);
+  }
+  return failed;
+}
+
+//Generate total bytes in requests of request_size bytes. Returns bytes/s or negative value on error
+static double benchmark_generate(int keylen, int use_df, uint64_t total, int request_size, int threads, int lanes) {
+  unsigned char entropy_input[NIST_BLOCK_SEEDLEN_MAX_BYTES];
+  unsigned char* output_string;
+  NIST_CTR_DRBG* ctr_drbg[NIST_CTR_DRBG_MAX_LANES];
+  struct timespec start, stop;
+  uint64_t done;
+  int i, l, error;
+
+  //Fixed entropy, the benchmark does not care about the quality of the output
+  for ( i = 0; i < NIST_BLOCK_SEEDLEN_MAX_BYTES; ++i ) entropy_input[i] = (unsigned char) i;
+
+  for ( l = 0; l < lanes; ++l ) {
+    entropy_input[0] = (unsigned char) l;
+    ctr_drbg[l] = nist_ctr_drbg_instantiate(entropy_input, NIST_SEEDLEN_BYTES(keylen), NULL, 0, NULL, 0, use_df, keylen);
+    if ( ctr_drbg[l] == NULL ) {
+      fprintf(stderr, "Error: nist_ctr_drbg_instantiate has failed for AES-%d\n", keylen);
+      return -1.0;
+    }
+  }
+  if ( nist_ctr_drbg_set_threads(ctr_drbg[0], threads) ) {
+    for ( l = 0; l < lanes; ++l ) nist_ctr_drbg_destroy(ctr_drbg[l]);
+    return -1.0;
+  }
+
+  output_string = malloc(request_size);
+  if ( output_string == NULL ) {
+    fprintf(stderr, "Error: Dynamic memory allocation has failed for %d bytes\n", request_size);
+    for ( l = 0; l < lanes; ++l ) nist_ctr_drbg_destroy(ctr_drbg[l]);
+    return -1.0;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for ( done = 0; done < total; done += request_size ) {
+    if ( lanes > 1 )
+      error = nist_ctr_drbg_generate_lanes(ctr_drbg, lanes, output_string, request_size, NULL, 0);
+    else
+      error = nist_ctr_drbg_generate(ctr_drbg[0], output_string, request_size, NULL, 0);
+    if ( error ) {
+      fprintf(stderr, "Error: nist_ctr_drbg_generate has returned %d\n", error);
+      break;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  free(output_string);
+  for ( l = 0; l < lanes; ++l ) nist_ctr_drbg_destroy(ctr_drbg[l]);
+  if ( done < total ) return -1.0;
+
+  return (double) done / elapsed_seconds(&start, &stop);
+}
+
+//Reseed count times. Returns reseeds/s or negative value on error
+static double benchmark_reseed(int keylen, int use_df, uint64_t count) {
+  unsigned char entropy_input[NIST_BLOCK_SEEDLEN_MAX_BYTES];
+  unsigned char additional_input[NIST_BLOCK_SEEDLEN_MAX_BYTES];
+  NIST_CTR_DRBG* ctr_drbg;
+  struct timespec start, stop;
+  uint64_t done;
+  int i, error;
+  int entropy_length, additional_input_length;
+
+  if ( use_df ) {
+    entropy_length = keylen / 8;
+    additional_input_length = NIST_BLOCK_OUTLEN_BYTES;
+  } else {
+    entropy_length = NIST_SEEDLEN_BYTES(keylen);
+    additional_input_length = NIST_SEEDLEN_BYTES(keylen);
+  }
+
+  for ( i = 0; i < NIST_BLOCK_SEEDLEN_MAX_BYTES; ++i ) {
+    entropy_input[i] = (unsigned char) i;
+    additional_input[i] = (unsigned char) ( 255 - i );
+  }
+
+  ctr_drbg = nist_ctr_drbg_instantiate(entropy_input, entropy_length, NULL, 0, additional_input, additional_input_length, use_df, keylen);
+  if ( ctr_drbg == NULL ) {
+    fprintf(stderr, "Error: nist_ctr_drbg_instantiate has failed for AES-%d\n", keylen);
+    return -1.0;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for ( done = 0; done < count; ++done ) {
+    //Vary the input so that the compiler cannot hoist anything out of the loop
+    entropy_input[0] = (unsigned char) done;
+    error = nist_ctr_drbg_reseed(ctr_drbg, entropy_input, entropy_length, additional_input, additional_input_length);
+    if ( error ) {
+      fprintf(stderr, "Error: nist_ctr_drbg_reseed has returned %d\n", error);
+      break;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  nist_ctr_drbg_destroy(ctr_drbg);
+  if ( done < count ) return -1.0;
+
+  return (double) done / elapsed_seconds(&start, &stop);
+}
+
+int main(int argc, char **argv) {
+  static const int keylens[NIST_KEYLEN_COUNT] = { 128, 192, 256 };
+  double rate[NIST_KEYLEN_COUNT];
+  double single_lane_rate;
+  uint64_t total = 256ULL << 20;
+  uint64_t reseeds = 1000000;
+  int request_size = NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST;
+  int only_keylen = 0;
+  int use_df = 0;
+  int reseed_mode = 0;
+  int threads = 1;
+  int lanes = 1;
+  int c, i, error;
+
+  while ( ( c = getopt(argc, argv, "n:b:k:dRc:t:l:h") ) != -1 ) {
+    switch (c) {
+      case 'n':
+        total = strtoull(optarg, NULL, 10) << 20;
+        break;
+      case 'b':
+        request_size = atoi(optarg);
+        break;
+      case 'k':
+        only_keylen = atoi(optarg);
+        break;
+      case 'd':
+        use_df = 1;
+        break;
+      case 'R':
+        reseed_mode = 1;
+        break;
+      case 'c':
+        reseeds = strtoull(optarg, NULL, 10);
+        break;
+      case 't':
+        threads = atoi(optarg);
+        break;
+      case 'l':
+        lanes = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n MiB to generate per key length] [-b bytes per generate call] [-k 128|192|256] [-d] [-t threads | -l lanes]\n"
+            "       %s -R [-c number of reseeds per key length] [-k 128|192|256]\n", argv[0], argv[0]);
+        return 1;
+    }
+  }
+
+  if ( reseed_mode && reseeds == 0 ) {
+    fprintf(stderr, "Error: expecting -c > 0\n");
+    return 1;
+  }
+  if ( total == 0 || request_size < 1 || request_size > (int) NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST ) {
+    fprintf(stderr, "Error: expecting -n > 0 and -b in range 1 - %d\n", (int) NIST_CTR_DRBG_MAX_NUMBER_OF_BYTES_PER_REQUEST);
+    return 1;
+  }
+  if ( only_keylen && ! NIST_KEYLEN_VALID(only_keylen) ) {
+    fprintf(stderr, "Error: key length has to be 128, 192 or 256 bits. Got %d\n", only_keylen);
+    return 1;
+  }
+  if ( threads < 1 || threads > 64 ) {
+    fprintf(stderr, "Error: expecting -t in range 1 - 64\n");
+    return 1;
+  }
+  if ( lanes < 1 || lanes > NIST_CTR_DRBG_MAX_LANES || ( lanes > 1 && threads > 1 ) ) {
+    fprintf(stderr, "Error: expecting -l in range 1 - %d, -l and -t cannot be combined\n", NIST_CTR_DRBG_MAX_LANES);
+    return 1;
+  }
+
+  error = nist_ctr_initialize();
+  if ( error ) {
+    fprintf(stderr, "Error: nist_ctr_initialize has returned %d\n", error);
+    return error;
+  }
+
+  fprintf(stdout, "%s", dump_csprng_cpu_dispatch());
+
+  if ( reseed_mode ) {
+    fprintf(stdout, "CTR_DRBG reseed with additional input, %" PRIu64 " reseeds per key length\n", reseeds);
+    for ( i = 0; i < NIST_KEYLEN_COUNT; ++i ) {
+      double rate_df, rate_no_df;
+      if ( only_keylen && only_keylen != keylens[i] ) continue;
+
+      rate_no_df = benchmark_reseed(keylens[i], 0, reseeds);
+      rate_df = benchmark_reseed(keylens[i], 1, reseeds);
+      if ( rate_no_df < 0.0 || rate_df < 0.0 ) return 1;
+
+      fprintf(stdout, "AES-%d:\t%10.0f reseeds/s without derivation function\t%10.0f reseeds/s with derivation function\n",
+          keylens[i], rate_no_df, rate_df);
+    }
+    return 0;
+  }
+
+  fprintf(stdout, "CTR_DRBG %s derivation function, %" PRIu64 " MiB per key length, %d bytes per generate call, %d thread(s), %d lane(s)\n",
+      use_df ? "with" : "without", total >> 20, request_size, threads, lanes);
+
+  for ( i = 0; i < NIST_KEYLEN_COUNT; ++i ) {
+    rate[i] = 0.0;
+    if ( only_keylen && only_keylen != keylens[i] ) continue;
+
+    if ( threads > 1 && compare_threads(keylens[i], use_df, threads) ) return 1;
+    if ( lanes > 1 && compare_lanes(keylens[i], use_df, lanes) ) return 1;
+    rate[i] = benchmark_generate(keylens[i], use_df, total, request_size, threads, lanes);
+    if ( rate[i] < 0.0 ) return 1;
+
+    fprintf(stdout, "AES-%d:\t%12.0f bytes/s\t%8.2f MiB/s", keylens[i], rate[i], rate[i] / 1048576.0);
+    if ( i > 0 && rate[0] > 0.0 ) fprintf(stdout, "\t%5.1f%% of AES-128", 100.0 * rate[i] / rate[0]);
+    if ( lanes > 1 ) {
+      single_lane_rate = benchmark_generate(keylens[i], use_df, total, request_size, 1, 1);
+      if ( single_lane_rate < 0.0 ) return 1;
+      fprintf(stdout, "\tsingle lane %8.2f MiB/s (%5.1f%%)", single_lane_rate / 1048576.0, 100.0 * rate[i] / single_lane_rate);
+    }
+    fprintf(stdout, "\n");
+  }
+
+  return 0;
+}
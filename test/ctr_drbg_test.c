@@ -24,6 +24,9 @@ valgrind --track-origins=yes ./ctr_drbg_test -e 64dce30c15fece81516d766fedc62279
 
 ./ctr_drbg_test -d -l 128 -k 64 -e 7c0fe58f8f62c25eadbe24600b78426a -r 9df9a69cd131028a055e9ec1e483f37c -n d939ad1e08a80244
 => 3487018af191fa961fefac2854d96bf5
+
+./ctr_drbg_test -a 256 -l 384 -k 128 -e 0d15aa80b16c3a10906cfedb795dae0b5b81041c5c5bfacb373d4440d9120f7e3d6cf90986cf52d85d3e947d8c061f91 -r 6ee793a33955d72ad12fd80a8a3fcf95ed3b4dac5795fe25cf869f7c27573bbc56f1acae13a65042b340093c464a7a22
+=> 946f5182d54510b9461248f571ca06c9
 */
 
 /* {{{ Copyright notice
@@ -89,6 +92,7 @@ int main(int argc, char **argv) {
     "d", "use_df",               "0", "Use derive function. Default: do not use derive function",
     "l", "entropy_input_length", "1", "Entropy Input length in bits",
     "k", "nonce_length",         "1", "Nonce Input length in bits",
+    "a", "aes_key_length",       "1", "AES key length in bits: 128, 192 or 256. Default: 128",
     "h", "help",               "0", "This help"
   };
   static int nopts = sizeof(cmds)/(4*sizeof(char *));
@@ -104,9 +108,10 @@ int main(int argc, char **argv) {
   int entropy_input_length=0; //NIST_BLOCK_SEEDLEN_BYTES;
   int nonce_length = 0;
   int use_df=0; //False
-  unsigned char entropy_input[NIST_BLOCK_SEEDLEN_BYTES];
-  unsigned char entropy_reseed[NIST_BLOCK_SEEDLEN_BYTES];
-  unsigned char nonce[NIST_BLOCK_SEEDLEN_BYTES];
+  int keylen = NIST_BLOCK_KEYLEN;
+  unsigned char entropy_input[NIST_BLOCK_SEEDLEN_MAX_BYTES];
+  unsigned char entropy_reseed[NIST_BLOCK_SEEDLEN_MAX_BYTES];
+  unsigned char nonce[NIST_BLOCK_SEEDLEN_MAX_BYTES];
 
   strcpy(short_options,"");
   for(i=j=0;i<nopts;i++,j+=4) {
@@ -137,6 +142,10 @@ int main(int argc, char **argv) {
         entropy_input_length = atoi(optarg) / 8;
       case 'k':
         nonce_length = atoi(optarg) / 8;
+        break;
+      case 'a':
+        keylen = atoi(optarg);
+        break;
       case '?':
       case 'h':
         //usage(nopts, long_options, cmds);
@@ -225,32 +234,32 @@ nist_ctr_drbg_instantiate(NIST_CTR_DRBG* drbg,
 	const void* entropy_input, int entropy_input_length,
 	const void* nonce, int nonce_length,
 	const void* personalization_string, int personalization_string_length,
-        int derive_function)
+        int derive_function, int keylen)
 */
 
-  ctr_drbg = nist_ctr_drbg_instantiate(entropy_input,  entropy_input_length, nonce, nonce_length, NULL, 0, use_df);
+  ctr_drbg = nist_ctr_drbg_instantiate(entropy_input,  entropy_input_length, nonce, nonce_length, NULL, 0, use_df, keylen);
   if ( ctr_drbg == NULL ) {
     fprintf(stderr, "Error: nist_ctr_drbg_instantiate has returned %d\n",error);
     exit(error);
   }
 
-  dump_hex_byte_string ((unsigned char*) ctr_drbg->ctx.key.rd_key, NIST_BLOCK_KEYLEN_BYTES, "Key:\t\t");
+  dump_hex_byte_string ((unsigned char*) ctr_drbg->ctx.key.rd_key, ctr_drbg->keylen / 8, "Key:\t\t");
   dump_hex_byte_string ((unsigned char*) ctr_drbg->V, NIST_BLOCK_OUTLEN_BYTES, "Vector:\t\t");
 
   if (ctr_drbg->derive_function != 0) {
-	  fprintf(stderr,"CTR DRBG, AES128, no prediction resistance, with derive function.\n");
+	  fprintf(stderr,"CTR DRBG, AES%d, no prediction resistance, with derive function.\n", ctr_drbg->keylen);
   } else {
- 	  fprintf(stderr,"CTR DRBG, AES128, no prediction resistance, without derive function.\n");
+ 	  fprintf(stderr,"CTR DRBG, AES%d, no prediction resistance, without derive function.\n", ctr_drbg->keylen);
   }
   fprintf(stderr, "Reading entropy data from stdin and writing generating PRNG to stdout. For each 256 bits readed, 128*511=65408 bits will be generated.\n");
 
   nist_ctr_drbg_generate(ctr_drbg, output_string, 16, NULL, 0);
-  dump_hex_byte_string ((unsigned char*) ctr_drbg->ctx.key.rd_key, NIST_BLOCK_KEYLEN_BYTES, "Key:\t\t");
+  dump_hex_byte_string ((unsigned char*) ctr_drbg->ctx.key.rd_key, ctr_drbg->keylen / 8, "Key:\t\t");
   dump_hex_byte_string ((unsigned char*) ctr_drbg->V, NIST_BLOCK_OUTLEN_BYTES, "Vector:\t\t");
   dump_hex_byte_string(output_string, 16, "output_string: \t");
   dump_hex_byte_string(entropy_reseed, entropy_input_length, "entropy_reseed: \t");
   nist_ctr_drbg_reseed(ctr_drbg, entropy_reseed, entropy_input_length, NULL, 0);
-  dump_hex_byte_string ((unsigned char*) ctr_drbg->ctx.key.rd_key, NIST_BLOCK_KEYLEN_BYTES, "Key:\t\t");
+  dump_hex_byte_string ((unsigned char*) ctr_drbg->ctx.key.rd_key, ctr_drbg->keylen / 8, "Key:\t\t");
   dump_hex_byte_string ((unsigned char*) ctr_drbg->V, NIST_BLOCK_OUTLEN_BYTES, "Vector:\t\t");
   memset(output_string,0,16);
   dump_hex_byte_string(output_string, 16, "output_string: \t");
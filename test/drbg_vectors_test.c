@@ -0,0 +1,515 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/*
+gcc -O2 -I ../include -L../src/.libs -Wextra -Wall -DDRBG_TEST_VECTORS_DIR=\"../DRBG_TEST_VECTORS\" -o drbg_vectors_test drbg_vectors_test.c -lcsprng -lcrypto -lrt
+LD_LIBRARY_PATH=../src/.libs ./drbg_vectors_test
+LD_LIBRARY_PATH=../src/.libs ./drbg_vectors_test -t 0 ../DRBG_TEST_VECTORS/CTR_DRBG.rsp
+LD_LIBRARY_PATH=../src/.libs ./drbg_vectors_test -t 1
+
+Conformance and throughput of all DRBG backends. The NIST CAVS vectors of CTR_DRBG (AES, with and
+without DF, with and without prediction resistance), Hash_DRBG and HMAC_DRBG (SHA-256 and SHA-512)
+are loaded once and run against every CPU tier supported by this machine and every AES cipher
+(openssl, bitsliced, aesni) available on that tier. CTR_DRBG vectors are run once more through
+nist_ctr_drbg_generate_lanes with one lane to cover the multi-lane kernels.
+For each backend the number of failed vectors and the throughput of 64 KiB generate requests
+(AES-128 without DF, SHA-256) are reported. -t sets the time spent on each throughput measurement,
+-t 0 skips them. Exit code is 0 when all vectors pass. Run by make check.
+*/
+
+/* {{{ Copyright notice
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <csprng/nist_ctr_drbg.h>
+#include <csprng/nist_hash_drbg.h>
+#include <csprng/cpu_dispatch.h>
+
+#ifndef DRBG_TEST_VECTORS_DIR
+#define DRBG_TEST_VECTORS_DIR "../DRBG_TEST_VECTORS"
+#endif
+
+#define REQUEST_BYTES 65536
+#define MAX_OUTPUT_BYTES 512
+//Failures printed for one backend, the rest are only counted
+#define MAX_REPORTED_FAILURES 5
+
+typedef enum {
+  MECHANISM_CTR = 0,
+  MECHANISM_CTR_LANES,                //CTR_DRBG vectors through nist_ctr_drbg_generate_lanes
+  MECHANISM_HASH,
+  MECHANISM_HMAC,
+  MECHANISM_COUNT
+} mechanism_type;
+
+static const char* const mechanism_names[MECHANISM_COUNT] = { "CTR_DRBG", "CTR_DRBG lanes", "Hash_DRBG", "HMAC_DRBG" };
+
+typedef struct {
+  unsigned char* data;
+  int length;
+} field_type;
+
+typedef struct {
+  mechanism_type mechanism;           //MECHANISM_CTR, MECHANISM_HASH or MECHANISM_HMAC
+  int variant;                        //AES key length for CTR_DRBG, nist_hash_type otherwise
+  int derive_function;
+  int prediction_resistance;
+  const char* filename;
+  int line;
+  field_type entropy_input, nonce, personalization_string;
+  field_type entropy_input_reseed, additional_input_reseed;
+  field_type additional_input[2], entropy_input_pr[2];
+  field_type returned_bits;
+} test_vector_type;
+
+typedef struct {
+  test_vector_type* vector;
+  int count;
+  int allocated;
+  int per_mechanism[MECHANISM_COUNT];
+} test_vector_list_type;
+
+//{{{ Parsing
+static int parse_hex(const char* s, field_type* f) {
+  unsigned int byte;
+  int length = 0;
+
+  while ( s[length] && s[length] != '\r' && s[length] != '\n' ) ++length;
+  free(f->data);
+  f->data = NULL;
+  f->length = 0;
+  if ( length % 2 ) return 1;
+  if ( length == 0 ) return 0;
+
+  f->data = malloc(length / 2);
+  if ( f->data == NULL ) return 1;
+  while ( f->length < length / 2 ) {
+    if ( sscanf(s, "%2x", &byte) != 1 ) return 1;
+    f->data[f->length++] = (unsigned char) byte;
+    s += 2;
+  }
+  return 0;
+}
+
+static void free_vector(test_vector_type* t) {
+  free(t->entropy_input.data);
+  free(t->nonce.data);
+  free(t->personalization_string.data);
+  free(t->entropy_input_reseed.data);
+  free(t->additional_input_reseed.data);
+  free(t->additional_input[0].data);
+  free(t->additional_input[1].data);
+  free(t->entropy_input_pr[0].data);
+  free(t->entropy_input_pr[1].data);
+  free(t->returned_bits.data);
+}
+
+static int append_vector(test_vector_list_type* list, const test_vector_type* t) {
+  test_vector_type* p;
+
+  if ( list->count == list->allocated ) {
+    list->allocated = list->allocated ? 2 * list->allocated : 1024;
+    p = realloc(list->vector, list->allocated * sizeof(test_vector_type));
+    if ( p == NULL ) {
+      fprintf(stderr, "Error: Dynamic memory allocation failed\n");
+      return 1;
+    }
+    list->vector = p;
+  }
+  list->vector[list->count++] = *t;
+  ++list->per_mechanism[t->mechanism];
+  return 0;
+}
+
+/*
+ * The mechanism is taken from the header of the file. Sections with a block cipher other than AES
+ * and hash functions other than SHA-256 and SHA-512 are skipped.
+ */
+static int load_file(const char* filename, test_vector_list_type* list) {
+  FILE* fd;
+  char line[4096];
+  char* value;
+  test_vector_type t;
+  int mechanism = -1;
+  int variant = -1;
+  int derive_function = 0, prediction_resistance = 0;
+  int additional_input_count = 0, entropy_input_pr_count = 0;
+  int line_number = 0;
+  int loaded = 0;
+
+  fd = fopen(filename, "r");
+  if ( fd == NULL ) {
+    fprintf(stderr, "Error: cannot open %s\n", filename);
+    return 1;
+  }
+
+  memset(&t, 0, sizeof(t));
+
+  while ( fgets(line, sizeof(line), fd) ) {
+    ++line_number;
+    if ( line[0] == '#' ) {
+      if ( mechanism >= 0 ) continue;
+      if ( strstr(line, "CTR_DRBG") ) mechanism = MECHANISM_CTR;
+      else if ( strstr(line, "HMAC_DRBG") ) mechanism = MECHANISM_HMAC;
+      else if ( strstr(line, "Hash_DRBG") ) mechanism = MECHANISM_HASH;
+      continue;
+    }
+
+    if ( line[0] == '[' ) {
+      if ( strncmp(line, "[AES-", 5) == 0 ) {
+        variant = atoi(line + 5);
+        derive_function = strstr(line, "use df") != NULL;
+      } else if ( strncmp(line, "[3KeyTDEA", 9) == 0 ) {
+        variant = -1;
+      } else if ( strncmp(line, "[SHA-", 5) == 0 ) {
+        if ( strncmp(line, "[SHA-256]", 9) == 0 ) variant = NIST_HASH_SHA256;
+        else if ( strncmp(line, "[SHA-512]", 9) == 0 ) variant = NIST_HASH_SHA512;
+        else variant = -1;
+      } else if ( strstr(line, "PredictionResistance = True") ) {
+        prediction_resistance = 1;
+      } else if ( strstr(line, "PredictionResistance = False") ) {
+        prediction_resistance = 0;
+      }
+      continue;
+    }
+
+    value = strstr(line, " = ");
+    if ( variant < 0 || value == NULL ) continue;
+    value += 3;
+
+    if ( mechanism < 0 ) {
+      fprintf(stderr, "Error: %s does not look like CTR_DRBG, Hash_DRBG or HMAC_DRBG response file\n", filename);
+      goto error;
+    }
+
+    if ( strncmp(line, "COUNT", 5) == 0 ) {
+      free_vector(&t);
+      memset(&t, 0, sizeof(t));
+      t.mechanism = (mechanism_type) mechanism;
+      t.variant = variant;
+      t.derive_function = derive_function;
+      t.prediction_resistance = prediction_resistance;
+      t.filename = filename;
+      additional_input_count = 0;
+      entropy_input_pr_count = 0;
+      continue;
+    }
+
+    if ( strncmp(line, "EntropyInputReseed", 18) == 0 ) {
+      if ( parse_hex(value, &t.entropy_input_reseed) ) goto parse_error;
+    } else if ( strncmp(line, "EntropyInputPR", 14) == 0 ) {
+      if ( entropy_input_pr_count == 2 || parse_hex(value, &t.entropy_input_pr[entropy_input_pr_count++]) ) goto parse_error;
+    } else if ( strncmp(line, "EntropyInput", 12) == 0 ) {
+      if ( parse_hex(value, &t.entropy_input) ) goto parse_error;
+    } else if ( strncmp(line, "Nonce", 5) == 0 ) {
+      if ( parse_hex(value, &t.nonce) ) goto parse_error;
+    } else if ( strncmp(line, "PersonalizationString", 21) == 0 ) {
+      if ( parse_hex(value, &t.personalization_string) ) goto parse_error;
+    } else if ( strncmp(line, "AdditionalInputReseed", 21) == 0 ) {
+      if ( parse_hex(value, &t.additional_input_reseed) ) goto parse_error;
+    } else if ( strncmp(line, "AdditionalInput", 15) == 0 ) {
+      if ( additional_input_count == 2 || parse_hex(value, &t.additional_input[additional_input_count++]) ) goto parse_error;
+    } else if ( strncmp(line, "ReturnedBits", 12) == 0 ) {
+      if ( parse_hex(value, &t.returned_bits) || t.returned_bits.length > MAX_OUTPUT_BYTES ) goto parse_error;
+      t.line = line_number;
+      if ( append_vector(list, &t) ) goto error;
+      //Fields are owned by the list now
+      memset(&t, 0, sizeof(t));
+      t.mechanism = (mechanism_type) mechanism;
+      t.variant = variant;
+      t.filename = filename;
+      ++loaded;
+    }
+  }
+
+  free_vector(&t);
+  fclose(fd);
+  fprintf(stdout, "%s: %d %s vectors\n", filename, loaded, mechanism >= 0 ? mechanism_names[mechanism] : "DRBG");
+  return 0;
+
+parse_error:
+  fprintf(stderr, "Error: cannot parse %s line %d\n", filename, line_number);
+error:
+  free_vector(&t);
+  fclose(fd);
+  return 1;
+}
+//}}}
+
+//{{{ Uniform interface to the three mechanisms
+static const void* field_or_null(const field_type* f) {
+  return f->length ? f->data : NULL;
+}
+
+static void* drbg_instantiate(mechanism_type mechanism, int variant, int derive_function,
+    const field_type* entropy_input, const field_type* nonce, const field_type* personalization_string) {
+  switch ( mechanism ) {
+    case MECHANISM_CTR:
+    case MECHANISM_CTR_LANES:
+      return nist_ctr_drbg_instantiate(entropy_input->data, entropy_input->length, field_or_null(nonce), nonce->length,
+          field_or_null(personalization_string), personalization_string->length, derive_function, variant);
+    case MECHANISM_HASH:
+      return nist_hash_drbg_instantiate(entropy_input->data, entropy_input->length, field_or_null(nonce), nonce->length,
+          field_or_null(personalization_string), personalization_string->length, (nist_hash_type) variant);
+    case MECHANISM_HMAC:
+      return nist_hmac_drbg_instantiate(entropy_input->data, entropy_input->length, field_or_null(nonce), nonce->length,
+          field_or_null(personalization_string), personalization_string->length, (nist_hash_type) variant);
+    default:
+      return NULL;
+  }
+}
+
+static int drbg_reseed(mechanism_type mechanism, void* drbg, const field_type* entropy_input, const field_type* additional_input) {
+  switch ( mechanism ) {
+    case MECHANISM_CTR:
+    case MECHANISM_CTR_LANES:
+      return nist_ctr_drbg_reseed(drbg, entropy_input->data, entropy_input->length,
+          field_or_null(additional_input), additional_input->length);
+    case MECHANISM_HASH:
+      return nist_hash_drbg_reseed(drbg, entropy_input->data, entropy_input->length,
+          field_or_null(additional_input), additional_input->length);
+    case MECHANISM_HMAC:
+      return nist_hmac_drbg_reseed(drbg, entropy_input->data, entropy_input->length,
+          field_or_null(additional_input), additional_input->length);
+    default:
+      return 1;
+  }
+}
+
+static int drbg_generate(mechanism_type mechanism, void* drbg, unsigned char* output, int length, const field_type* additional_input) {
+  NIST_CTR_DRBG* lanes[1];
+
+  switch ( mechanism ) {
+    case MECHANISM_CTR:
+      return nist_ctr_drbg_generate(drbg, output, length, field_or_null(additional_input), additional_input->length);
+    case MECHANISM_CTR_LANES:
+      lanes[0] = drbg;
+      return nist_ctr_drbg_generate_lanes(lanes, 1, output, length, field_or_null(additional_input), additional_input->length);
+    case MECHANISM_HASH:
+      return nist_hash_drbg_generate(drbg, output, length, field_or_null(additional_input), additional_input->length);
+    case MECHANISM_HMAC:
+      return nist_hmac_drbg_generate(drbg, output, length, field_or_null(additional_input), additional_input->length);
+    default:
+      return 1;
+  }
+}
+
+static void drbg_destroy(mechanism_type mechanism, void* drbg) {
+  switch ( mechanism ) {
+    case MECHANISM_CTR:
+    case MECHANISM_CTR_LANES:
+      nist_ctr_drbg_destroy(drbg);
+      break;
+    case MECHANISM_HASH:
+      nist_hash_drbg_destroy(drbg);
+      break;
+    case MECHANISM_HMAC:
+      nist_hmac_drbg_destroy(drbg);
+      break;
+    default:
+      break;
+  }
+}
+//}}}
+
+//{{{ Run one vector. Returns 0 when ReturnedBits match
+/*
+ * Prediction resistance: instantiate, (reseed with EntropyInputPR and AdditionalInput, generate) twice
+ * Otherwise: instantiate, generate with AdditionalInput, reseed, generate with AdditionalInput
+ * The output of the second generate call is compared with ReturnedBits.
+ */
+static int run_vector(const test_vector_type* t, mechanism_type mechanism) {
+  static const field_type empty = { NULL, 0 };
+  unsigned char output[MAX_OUTPUT_BYTES];
+  void* drbg;
+  int i, error = 0;
+
+  drbg = drbg_instantiate(mechanism, t->variant, t->derive_function, &t->entropy_input, &t->nonce, &t->personalization_string);
+  if ( drbg == NULL ) return 1;
+
+  for ( i = 0; i < 2; ++i ) {
+    if ( t->prediction_resistance ) {
+      error |= drbg_reseed(mechanism, drbg, &t->entropy_input_pr[i], &t->additional_input[i]);
+      error |= drbg_generate(mechanism, drbg, output, t->returned_bits.length, &empty);
+    } else {
+      if ( i == 1 ) error |= drbg_reseed(mechanism, drbg, &t->entropy_input_reseed, &t->additional_input_reseed);
+      error |= drbg_generate(mechanism, drbg, output, t->returned_bits.length, &t->additional_input[i]);
+    }
+  }
+  drbg_destroy(mechanism, drbg);
+
+  if ( error ) return 1;
+  return memcmp(output, t->returned_bits.data, t->returned_bits.length) != 0;
+}
+//}}}
+
+//{{{ Throughput of 64 KiB generate requests in MiB/s, AES-128 without DF or SHA-256
+static double elapsed(const struct timespec* start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ( now.tv_sec - start->tv_sec ) + ( now.tv_nsec - start->tv_nsec ) / 1e9;
+}
+
+static double throughput(mechanism_type mechanism, double seconds) {
+  static unsigned char output[REQUEST_BYTES];
+  static const field_type empty = { NULL, 0 };
+  unsigned char seed[NIST_BLOCK_SEEDLEN_BYTES] = { 0 };
+  field_type entropy_input = { seed, sizeof(seed) };
+  struct timespec start;
+  double t;
+  long int requests;
+  void* drbg;
+
+  drbg = drbg_instantiate(mechanism, mechanism <= MECHANISM_CTR_LANES ? NIST_BLOCK_KEYLEN : NIST_HASH_SHA256, 0,
+      &entropy_input, &empty, &empty);
+  if ( drbg == NULL ) return 0.0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for ( requests = 0; ( t = elapsed(&start) ) < seconds; ++requests ) {
+    if ( drbg_generate(mechanism, drbg, output, REQUEST_BYTES, &empty) ) break;
+  }
+  drbg_destroy(mechanism, drbg);
+
+  return requests * (double) REQUEST_BYTES / t / 1048576.0;
+}
+//}}}
+
+//{{{ static int run_backend(const test_vector_list_type* list, mechanism_type mechanism, double seconds)
+/*
+ * Run all vectors of the mechanism with the currently bound kernels. Returns number of failed vectors
+ */
+static int run_backend(const test_vector_list_type* list, mechanism_type mechanism, double seconds) {
+  mechanism_type source = ( mechanism == MECHANISM_CTR_LANES ) ? MECHANISM_CTR : mechanism;
+  char kernel[64];
+  int i, passed = 0, failed = 0;
+
+  if ( list->per_mechanism[source] == 0 ) return 0;
+
+  for ( i = 0; i < list->count; ++i ) {
+    const test_vector_type* t = &list->vector[i];
+    if ( t->mechanism != source ) continue;
+    if ( run_vector(t, mechanism) == 0 ) {
+      ++passed;
+      continue;
+    }
+    if ( ++failed <= MAX_REPORTED_FAILURES ) {
+      fprintf(stderr, "FAIL: %s line %d %s %s%s PR=%d\n", t->filename, t->line, mechanism_names[mechanism],
+          source == MECHANISM_CTR ? "" : nist_hash_names[t->variant],
+          source == MECHANISM_CTR ? ( t->derive_function ? "use df" : "no df" ) : "", t->prediction_resistance);
+    }
+  }
+
+  switch ( mechanism ) {
+    case MECHANISM_CTR:
+      snprintf(kernel, sizeof(kernel), "%s", csprng_cpu_kernel_name(CSPRNG_KERNEL_AES_CTR));
+      break;
+    case MECHANISM_CTR_LANES:
+      snprintf(kernel, sizeof(kernel), "%s", csprng_cpu_kernel_name(CSPRNG_KERNEL_AES_CTR_LANES));
+      break;
+    case MECHANISM_HASH:
+      snprintf(kernel, sizeof(kernel), "%s, %s", csprng_cpu_kernel_name(CSPRNG_KERNEL_SHA256_MB),
+          csprng_cpu_kernel_name(CSPRNG_KERNEL_SHA512_MB));
+      break;
+    default:
+      snprintf(kernel, sizeof(kernel), "%s", csprng_cpu_kernel_name(CSPRNG_KERNEL_SHA256));
+      break;
+  }
+
+  fprintf(stdout, "%-8s %-15s %-24s %6d %6d", csprng_cpu_tier_names[csprng_cpu_tier()], mechanism_names[mechanism],
+      kernel, passed, failed);
+  if ( seconds > 0.0 ) fprintf(stdout, " %10.1f", throughput(mechanism, seconds));
+  fprintf(stdout, "\n");
+  fflush(stdout);
+
+  return failed;
+}
+//}}}
+
+int main(int argc, char **argv) {
+  static const char* const default_files[] = {
+    DRBG_TEST_VECTORS_DIR "/CTR_DRBG.rsp",
+    DRBG_TEST_VECTORS_DIR "/Hash_DRBG.rsp",
+    DRBG_TEST_VECTORS_DIR "/HMAC_DRBG.rsp"
+  };
+  static const nist_cipher_type ciphers[] = { NIST_CIPHER_OPENSSL, NIST_CIPHER_BITSLICED, NIST_CIPHER_AESNI };
+  test_vector_list_type list;
+  const csprng_cpu_features_type* features;
+  int c, i, tier, failed = 0;
+  double seconds = 0.1;
+
+  while ( ( c = getopt(argc, argv, "t:h") ) != -1 ) {
+    switch (c) {
+      case 't':
+        seconds = atof(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-t seconds] [CTR_DRBG.rsp|Hash_DRBG.rsp|HMAC_DRBG.rsp ...]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  memset(&list, 0, sizeof(list));
+  if ( optind == argc ) {
+    for ( i = 0; i < (int) ( sizeof(default_files) / sizeof(default_files[0]) ); ++i ) {
+      if ( load_file(default_files[i], &list) ) return 1;
+    }
+  } else {
+    for ( i = optind; i < argc; ++i ) {
+      if ( load_file(argv[i], &list) ) return 1;
+    }
+  }
+  if ( list.count == 0 ) {
+    fprintf(stderr, "Error: no test vectors found\n");
+    return 1;
+  }
+
+  if ( csprng_cpu_dispatch_initialize() ) return 1;
+  fprintf(stdout, "%s", dump_csprng_cpu_dispatch());
+  features = csprng_cpu_features();
+
+  fprintf(stdout, "%-8s %-15s %-24s %6s %6s%s\n", "TIER", "MECHANISM", "KERNEL", "PASSED", "FAILED", seconds > 0.0 ? "      MiB/s" : "");
+  for ( tier = CSPRNG_CPU_TIER_GENERIC; tier <= (int) csprng_cpu_detected_tier(); ++tier ) {
+    //OpenSSL AES is available on every tier
+    if ( nist_ctr_drbg_select_cipher(NIST_CIPHER_OPENSSL) || csprng_cpu_select_tier((csprng_cpu_tier_type) tier) ) {
+      fprintf(stderr, "Error: cannot select CPU tier %s\n", csprng_cpu_tier_names[tier]);
+      return 1;
+    }
+
+    for ( i = 0; i < (int) ( sizeof(ciphers) / sizeof(ciphers[0]) ); ++i ) {
+      if ( ciphers[i] == NIST_CIPHER_AESNI && ( tier < CSPRNG_CPU_TIER_SSE2 || !features->aesni ) ) continue;
+      if ( nist_ctr_drbg_select_cipher(ciphers[i]) ) return 1;
+      failed += run_backend(&list, MECHANISM_CTR, seconds);
+      failed += run_backend(&list, MECHANISM_CTR_LANES, seconds);
+    }
+
+    failed += run_backend(&list, MECHANISM_HASH, seconds);
+    failed += run_backend(&list, MECHANISM_HMAC, seconds);
+  }
+
+  for ( i = 0; i < list.count; ++i ) free_vector(&list.vector[i]);
+  free(list.vector);
+
+  fprintf(stdout, "%d vectors loaded, %d failures\n", list.count, failed);
+  return failed != 0;
+}
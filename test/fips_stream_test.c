@@ -0,0 +1,570 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/*
+gcc -O2 -I ../include -L../src/.libs -Wextra -Wall -o fips_stream_test fips_stream_test.c -lcsprng -lcrypto -lrt
+LD_LIBRARY_PATH=../src/.libs ./fips_stream_test
+
+Runs the FIPS 140-2 tests on the same data three ways:
+  - the original bit by bit implementation included below as the reference
+  - fips_run_rng_test on each FIPS_RNG_BUFFER_SIZE block
+  - fips_update with chunks of random size (1 Byte up to 3 blocks) and fips_block_ready
+and checks that the verdicts of all blocks and the statistics are identical, for every CPU tier
+supported by this machine. The data contain blocks failing each of the FIPS tests and runs
+of exactly 25 and 26 bits. The speed of the reference and of each tier is printed.
+A block starting with a transition must not count a run there: the original code counted it in
+runs[-1], which is poker[15], and passed a block whose poker statistic is just below the limit.
+Finally fips_approved_csprng_generate with the FIPS tests split between 2, 3 and 8 threads
+(fips_threads) has to give the same output and statistics as with one thread.
+*/
+
+/* {{{ Copyright notice
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <csprng/csprng.h>
+#include <csprng/fips.h>
+#include <csprng/nist_ctr_drbg.h>
+#include <csprng/cpu_dispatch.h>
+
+#define BLOCKS 400
+#define ROUNDS 20
+#define GENERATE_SIZE ( 16 << 20 )
+
+static uint64_t xorshift(uint64_t* x) {
+  *x ^= *x << 13;
+  *x ^= *x >> 7;
+  *x ^= *x << 17;
+  return *x;
+}
+
+static double elapsed(const struct timespec* start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double) ( now.tv_sec - start->tv_sec ) + 1.0e-9 * (double) ( now.tv_nsec - start->tv_nsec );
+}
+
+//{{{ Reference implementation
+/*
+ * The bit by bit FIPS 140-2 tests as they were before the vectorized kernels, results have to stay
+ * identical. fips_test_store and fips_run_rng_test of the original fips.c, copied verbatim apart from
+ * the names, the CPU time tracking and the split of fips_run_rng_test into reference_test and
+ * reference_finish. reference_ctx_t has the layout of the original fips_ctx_t, so the first transition
+ * of a block with rlength = -1 and bit 0 increments runs[-1], which is poker[15], and with bit 1 runs[5].
+ * With fixed set, reference_store skips that transition like fips_store does now.
+ */
+typedef struct {
+	int poker[16], runs[12];
+	int ones, rlength, current_bit, last_bit, longrun;
+	unsigned int last32;
+  fips_statistics_type fips_statistics;
+  int fixed;                                //Don't count a run at the first bit of a block
+} reference_ctx_t;
+
+static void reference_init(reference_ctx_t* ctx, unsigned int last32, int fixed) {
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->rlength = -1;
+  ctx->last32 = last32;
+  ctx->fixed = fixed;
+}
+
+static void reference_store(reference_ctx_t *ctx, unsigned int rng_data)
+{
+  int j;
+
+  /* Not in the original: a block starting with a transition continues the run of its first bit */
+  if (ctx->fixed && ctx->rlength == -1)
+    ctx->last_bit = (rng_data >> 7) & 1;
+
+  ctx->poker[rng_data >> 4]++;
+  ctx->poker[rng_data & 15]++;
+
+  /* Note in the loop below rlength is always one less than the actual
+     run length. This makes things easier. */
+  for (j = 7; j >= 0; j--) {
+    ctx->ones += ctx->current_bit = ((rng_data >> j) & 1);
+    if (ctx->current_bit != ctx->last_bit) {
+      /* If runlength is 1-6 count it in correct bucket. 0's go in
+         runs[0-5] 1's go in runs[6-11] hence the 6*current_bit below */
+      if (ctx->rlength < 5) {
+        ctx->runs[ctx->rlength +
+          (6 * ctx->current_bit)]++;
+      } else {
+        ctx->runs[5 + (6 * ctx->current_bit)]++;
+      }
+
+      /* Check if we just failed longrun test */
+      if (ctx->rlength >= 25)
+        ctx->longrun = 1;
+      ctx->rlength = 0;
+      /* flip the current run type */
+      ctx->last_bit = ctx->current_bit;
+    } else {
+      ctx->rlength++;
+    }
+  }
+}
+
+//Evaluates the block stored so far and starts a new one
+static int reference_finish(reference_ctx_t *ctx, int rng_test)
+{
+  int i, j;
+
+  /* add in the last (possibly incomplete) run */
+  if (ctx->rlength < 5)
+    ctx->runs[ctx->rlength + (6 * ctx->current_bit)]++;
+  else {
+    ctx->runs[5 + (6 * ctx->current_bit)]++;
+    if (ctx->rlength >= 25) {
+      rng_test |= FIPS_RNG_LONGRUN;
+    }
+  }
+
+  if (ctx->longrun) {
+    rng_test |= FIPS_RNG_LONGRUN;
+    ctx->longrun = 0;
+  }
+
+  /* Ones test */
+  if ((ctx->ones >= 10275) || (ctx->ones <= 9725)) {
+    rng_test |= FIPS_RNG_MONOBIT;
+    ++ ctx -> fips_statistics.fips_failures[0];
+  }
+  /* Poker calcs */
+  for (i = 0, j = 0; i < 16; i++)
+    j += ctx->poker[i] * ctx->poker[i];
+  /* 16/5000*1563176-5000 = 2.1632  */
+  /* 16/5000*1576928-5000 = 46.1696 */
+  if ((j > 1576928) || (j < 1563176)) {
+    rng_test |= FIPS_RNG_POKER;
+    ++ctx -> fips_statistics.fips_failures[1];
+  }
+
+  if ((ctx->runs[0] < 2315) || (ctx->runs[0] > 2685) ||
+      (ctx->runs[1] < 1114) || (ctx->runs[1] > 1386) ||
+      (ctx->runs[2] < 527) || (ctx->runs[2] > 723) ||
+      (ctx->runs[3] < 240) || (ctx->runs[3] > 384) ||
+      (ctx->runs[4] < 103) || (ctx->runs[4] > 209) ||
+      (ctx->runs[5] < 103) || (ctx->runs[5] > 209) ||
+      (ctx->runs[6] < 2315) || (ctx->runs[6] > 2685) ||
+      (ctx->runs[7] < 1114) || (ctx->runs[7] > 1386) ||
+      (ctx->runs[8] < 527) || (ctx->runs[8] > 723) ||
+      (ctx->runs[9] < 240) || (ctx->runs[9] > 384) ||
+      (ctx->runs[10] < 103) || (ctx->runs[10] > 209) ||
+      (ctx->runs[11] < 103) || (ctx->runs[11] > 209)) {
+    rng_test |= FIPS_RNG_RUNS;
+    ++ctx -> fips_statistics.fips_failures[2];
+  }
+
+  /* finally, clear out FIPS variables for start of next run */
+  memset (ctx->poker, 0, sizeof (ctx->poker));
+  memset (ctx->runs, 0, sizeof (ctx->runs));
+  ctx->ones = 0;
+  ctx->rlength = -1;
+  ctx->current_bit = 0;
+
+
+  if (rng_test) {
+    ctx -> fips_statistics.bad_fips_blocks++;
+    if (rng_test & FIPS_RNG_LONGRUN) ++ctx -> fips_statistics.fips_failures[3];
+  } else {
+    ctx -> fips_statistics.good_fips_blocks++;
+  }
+
+  return rng_test;
+}
+
+static int reference_test(reference_ctx_t *ctx, const unsigned char *rngdatabuf)
+{
+  int i;
+  int rng_test = 0;
+
+  for (i=0; i<FIPS_RNG_BUFFER_SIZE; i += 4) {
+    unsigned int new32 = rngdatabuf[i] | 
+      ( rngdatabuf[i+1] << 8 ) | 
+      ( rngdatabuf[i+2] << 16 ) | 
+      ( rngdatabuf[i+3] << 24 );
+    if (new32 == ctx->last32) { 
+      rng_test |= FIPS_RNG_CONTINUOUS_RUN;
+      ++ctx -> fips_statistics.fips_failures[4];
+    }
+
+    ctx->last32 = new32;
+    reference_store(ctx, rngdatabuf[i]);
+    reference_store(ctx, rngdatabuf[i+1]);
+    reference_store(ctx, rngdatabuf[i+2]);
+    reference_store(ctx, rngdatabuf[i+3]);
+  }
+
+  return reference_finish(ctx, rng_test);
+}
+
+//The counters of an incomplete block have to be the same as well
+static int compare_state(const reference_ctx_t* reference, const fips_ctx_t* ctx) {
+  if ( memcmp(reference->poker, ctx->poker, sizeof(ctx->poker)) || memcmp(reference->runs, ctx->runs, sizeof(ctx->runs)) ) return 1;
+  return reference->ones != ctx->ones || reference->rlength != ctx->rlength || reference->current_bit != ctx->current_bit ||
+    reference->last_bit != ctx->last_bit || reference->longrun != ctx->longrun;
+}
+//}}}
+
+//Random blocks, every 8th block is damaged in one of the ways below
+static void fill_data(unsigned char* data, uint64_t seed) {
+  static const unsigned char run25[5] = { 0x01, 0xff, 0xff, 0xff, 0x00 };
+  static const unsigned char run26[5] = { 0xfe, 0x00, 0x00, 0x00, 0x7f };
+  unsigned char* block;
+  int i, j;
+
+  for ( i = 0; i < BLOCKS * FIPS_RNG_BUFFER_SIZE; ++i ) data[i] = (unsigned char) ( xorshift(&seed) >> 32 );
+  for ( i = 3; i < BLOCKS; i += 8 ) {
+    block = data + i * FIPS_RNG_BUFFER_SIZE;
+    switch ( ( i / 8 ) % 8 ) {
+      case 0:   //Monobit and everything else
+        memset(block, 0, FIPS_RNG_BUFFER_SIZE);
+        break;
+      case 1:   //Long run in the middle of the block
+        memset(block + 1001, 0xff, 5);
+        break;
+      case 2:   //Continuous run, repeated word at an odd chunk offset is likely
+        memcpy(block + 1204, block + 1200, 4);
+        break;
+      case 3:   //Continuous run across the block boundary
+        memcpy(block, block - 4, 4);
+        break;
+      case 4:   //Poker and runs
+        for ( j = 0; j < FIPS_RNG_BUFFER_SIZE; ++j ) block[j] = ( block[j] & 0x0f ) | 0x50;
+        break;
+      case 5:   //Run of 25 bits passes, run of 26 bits at another bit offset fails
+        memcpy(block + 777, run25, sizeof(run25));
+        memcpy(block + 1777, run26, sizeof(run26));
+        break;
+      case 6:   //Run of 40 bits across the block boundary, counted separately in each block
+        memset(block - 3, 0, 5);
+        break;
+      case 7:   //Long run at the very end of the block
+        memset(block + FIPS_RNG_BUFFER_SIZE - 4, 0xff, 4);
+        break;
+    }
+  }
+}
+
+static int compare_statistics(const fips_statistics_type* a, const fips_statistics_type* b) {
+  int i;
+
+  if ( a->good_fips_blocks != b->good_fips_blocks || a->bad_fips_blocks != b->bad_fips_blocks ) return 1;
+  for ( i = 0; i < N_FIPS_TESTS; ++i ) {
+    if ( a->fips_failures[i] != b->fips_failures[i] ) return 1;
+  }
+  return 0;
+}
+
+//Returns number of errors
+static int run(const unsigned char* data, uint64_t seed) {
+  reference_ctx_t reference, shadow;
+  fips_ctx_t whole, stream;
+  int expected[BLOCKS];
+  int i, n, result, blocks = 0, errors = 0;
+  size_t pos = 0, len;
+
+  reference_init(&reference, 0x12345678, 1);
+  reference_init(&shadow, 0x12345678, 1);
+  fips_init(&whole, 0x12345678, 0);
+  fips_init(&stream, 0x12345678, 0);
+  for ( i = 0; i < BLOCKS; ++i ) {
+    expected[i] = reference_test(&reference, data + i * FIPS_RNG_BUFFER_SIZE);
+    result = fips_run_rng_test(&whole, data + i * FIPS_RNG_BUFFER_SIZE);
+    if ( result != expected[i] ) {
+      fprintf(stderr, "Error: block %d, reference result %#x, fips_run_rng_test result %#x\n", i, expected[i], result);
+      ++errors;
+    }
+  }
+
+  while ( pos < BLOCKS * FIPS_RNG_BUFFER_SIZE ) {
+    len = 1 + xorshift(&seed) % ( 3 * FIPS_RNG_BUFFER_SIZE );
+    if ( len > BLOCKS * FIPS_RNG_BUFFER_SIZE - pos ) len = BLOCKS * FIPS_RNG_BUFFER_SIZE - pos;
+    //Consume the chunk, fips_update stops at each block boundary
+    while ( len > 0 ) {
+      n = fips_update(&stream, data + pos, len);
+      if ( n <= 0 ) {
+        fprintf(stderr, "Error: fips_update has returned %d for %zu bytes at offset %zu\n", n, len, pos);
+        return errors + 1;
+      }
+      for ( i = 0; i < n; ++i ) reference_store(&shadow, data[pos + i]);
+      pos += n;
+      len -= n;
+      result = fips_block_ready(&stream);
+      if ( result < 0 ) {
+        if ( compare_state(&shadow, &stream) ) {
+          fprintf(stderr, "Error: block %d, counters differ from the reference at offset %zu\n", blocks, pos);
+          ++errors;
+        }
+        continue;
+      }
+      reference_finish(&shadow, 0);
+      if ( result != expected[blocks] ) {
+        fprintf(stderr, "Error: block %d, reference result %#x, streamed result %#x\n", blocks, expected[blocks], result);
+        ++errors;
+      }
+      ++blocks;
+    }
+  }
+
+  if ( blocks != BLOCKS ) {
+    fprintf(stderr, "Error: %d blocks completed, expected %d\n", blocks, BLOCKS);
+    ++errors;
+  }
+  if ( fips_block_ready(&stream) != -1 ) {
+    fprintf(stderr, "Error: fips_block_ready reports a block after the end of the data\n");
+    ++errors;
+  }
+  if ( compare_statistics(&reference.fips_statistics, &whole.fips_statistics) || reference.last32 != whole.last32 ||
+      compare_statistics(&reference.fips_statistics, &stream.fips_statistics) || reference.last32 != stream.last32 ) {
+    fprintf(stderr, "Error: statistics differ\n%s", dump_fips_statistics(&reference.fips_statistics));
+    fprintf(stderr, "%s", dump_fips_statistics(&whole.fips_statistics));
+    fprintf(stderr, "%s", dump_fips_statistics(&stream.fips_statistics));
+    ++errors;
+  }
+  return errors;
+}
+
+/*
+ * Block with the nibbles below in random order, starting with bit 0 after a block ending with bit 1.
+ * The sum of squares of the nibble counts is 1562704, 472 below the poker limit, so the block fails
+ * the poker test. The original code counted the first transition in poker[15] = 313, which added
+ * 2 * 313 + 1 and passed the block. The other tests pass
+ */
+static int check_first_transition(void) {
+  static const int nibbles[16] = { 317, 308, 317, 308, 316, 309, 316, 309, 316, 309, 316, 309, 316, 309, 312, 313 };
+  unsigned char nibble[2 * FIPS_RNG_BUFFER_SIZE], block[FIPS_RNG_BUFFER_SIZE], t;
+  uint64_t x = UINT64_C(0x9e3779b97f4a7c16);
+  reference_ctx_t original, fixed;
+  fips_ctx_t ctx;
+  int i, j, n = 0, result[3];
+
+  for ( i = 0; i < 16; ++i ) {
+    for ( j = 0; j < nibbles[i]; ++j ) nibble[n++] = (unsigned char) i;
+  }
+  for ( i = n - 1; i > 0; --i ) {
+    j = (int) ( xorshift(&x) % ( i + 1 ) );
+    t = nibble[i];
+    nibble[i] = nibble[j];
+    nibble[j] = t;
+  }
+  for ( i = 0; nibble[i] >= 8; ++i );
+  t = nibble[0];
+  nibble[0] = nibble[i];
+  nibble[i] = t;
+  for ( i = 0; i < FIPS_RNG_BUFFER_SIZE; ++i ) block[i] = (unsigned char) ( ( nibble[2 * i] << 4 ) | nibble[2 * i + 1] );
+
+  reference_init(&original, 0, 0);
+  reference_init(&fixed, 0, 1);
+  fips_init(&ctx, 0, 0);
+  original.last_bit = fixed.last_bit = ctx.last_bit = 1;
+  result[0] = reference_test(&original, block);
+  result[1] = reference_test(&fixed, block);
+  result[2] = fips_run_rng_test(&ctx, block);
+  if ( result[0] != 0 || result[1] != FIPS_RNG_POKER || result[2] != FIPS_RNG_POKER ) {
+    fprintf(stderr, "Error: block starting with a transition, original result %#x, fixed reference %#x, fips_run_rng_test %#x,"
+        " expected 0, %#x and %#x\n", result[0], result[1], result[2], FIPS_RNG_POKER, FIPS_RNG_POKER);
+    return 1;
+  }
+  fprintf(stdout, "Block starting with a transition: original code passed it, poker test fails now, OK\n");
+  return 0;
+}
+
+//Deterministic entropy file for the EXTERNAL source. Returns 0 on success
+static int write_entropy_file(const char* filename, int size) {
+  unsigned char buf[4096];
+  uint64_t x = UINT64_C(0x9e3779b97f4a7c15);
+  FILE* fd;
+  int i, written;
+
+  fd = fopen(filename, "w");
+  if ( fd == NULL ) {
+    fprintf(stderr, "Error: cannot open %s: %s\n", filename, strerror(errno));
+    return 1;
+  }
+  for ( written = 0; written < size; written += sizeof(buf) ) {
+    for ( i = 0; i < (int) sizeof(buf); ++i ) buf[i] = (unsigned char) ( xorshift(&x) >> 32 );
+    if ( fwrite(buf, 1, sizeof(buf), fd) != sizeof(buf) ) {
+      fprintf(stderr, "Error: cannot write %s: %s\n", filename, strerror(errno));
+      fclose(fd);
+      return 1;
+    }
+  }
+  return fclose(fd) ? 1 : 0;
+}
+
+//GENERATE_SIZE bytes of FIPS approved output with the tests running on fips_threads threads. Returns 0 on success
+static int generate(char* filename, int fips_threads, unsigned char* output, fips_statistics_type* statistics) {
+  mode_of_operation_type mode;
+  fips_state_type* fips_state;
+  const unsigned char* data;
+  unsigned int len;
+  int size, done = 0;
+
+  memset(&mode, 0, sizeof(mode));
+  mode.file_read_size = 16384;
+  mode.max_number_of_csprng_blocks = 65536;
+  mode.entropy_source = EXTERNAL;
+  mode.filename_for_entropy = filename;
+  mode.fips_threads = fips_threads;
+  fips_state = fips_approved_csprng_initialize(1, 0, &mode);
+  if ( fips_state == NULL || fips_approved_csprng_instantiate(fips_state) ) {
+    fprintf(stderr, "Error: cannot instantiate the generator with %d FIPS threads\n", fips_threads);
+    return 1;
+  }
+
+  while ( done < GENERATE_SIZE ) {
+    size = ( GENERATE_SIZE - done > ( 1 << 20 ) ) ? ( 1 << 20 ) : GENERATE_SIZE - done;
+    if ( fips_approved_csprng_generate(fips_state, output + done, size) != size ) {
+      fprintf(stderr, "Error: fips_approved_csprng_generate has failed after %d bytes\n", done);
+      fips_approved_csprng_destroy(fips_state);
+      return 1;
+    }
+    done += size;
+  }
+  //The threads test all complete blocks of a refill at once, borrowing the rest makes one thread test them as well
+  if ( csprng_borrow(fips_state, 1, UINT_MAX, &data, &len) ) {
+    fips_approved_csprng_destroy(fips_state);
+    return 1;
+  }
+  csprng_release(fips_state);
+  *statistics = fips_state->fips_ctx.fips_statistics;
+  return fips_approved_csprng_destroy(fips_state);
+}
+
+//Returns number of errors
+static int compare_fips_threads(void) {
+  static const int fips_threads[3] = { 2, 3, 8 };
+  char filename[] = "/tmp/fips_stream_test.XXXXXX";
+  unsigned char *reference, *output;
+  fips_statistics_type reference_statistics, statistics;
+  int i, fd, errors = 0;
+
+  reference = (unsigned char*) malloc(GENERATE_SIZE);
+  output = (unsigned char*) malloc(GENERATE_SIZE);
+  fd = mkstemp(filename);
+  if ( reference == NULL || output == NULL || fd < 0 ) {
+    fprintf(stderr, "Error: cannot allocate the buffers or the entropy file\n");
+    free(reference);
+    free(output);
+    return 1;
+  }
+  close(fd);
+
+  if ( write_entropy_file(filename, 1 << 20) || generate(filename, 1, reference, &reference_statistics) ) {
+    ++errors;
+  } else {
+    for ( i = 0; i < 3; ++i ) {
+      if ( generate(filename, fips_threads[i], output, &statistics) ) {
+        ++errors;
+        break;
+      }
+      if ( memcmp(reference, output, GENERATE_SIZE) || compare_statistics(&reference_statistics, &statistics) ) {
+        fprintf(stderr, "Error: output or statistics with %d FIPS threads differ from one thread\n", fips_threads[i]);
+        ++errors;
+      }
+    }
+    fprintf(stdout, "fips_threads 1, 2, 3 and 8: %" PRIu64 " blocks failed, %s\n", reference_statistics.bad_fips_blocks, errors ? "FAILED" : "OK");
+  }
+
+  unlink(filename);
+  free(reference);
+  free(output);
+  return errors;
+}
+
+//Throughput of the tests in MB/s
+static double speed(const unsigned char* data, int use_reference) {
+  reference_ctx_t reference;
+  fips_ctx_t ctx;
+  struct timespec start;
+  int i, r, rounds = use_reference ? 1 : 10;
+
+  reference_init(&reference, 0, 1);
+  fips_init(&ctx, 0, 0);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for ( r = 0; r < rounds; ++r ) {
+    for ( i = 0; i < BLOCKS; ++i ) {
+      if ( use_reference ) {
+        reference_test(&reference, data + i * FIPS_RNG_BUFFER_SIZE);
+      } else {
+        fips_run_rng_test(&ctx, data + i * FIPS_RNG_BUFFER_SIZE);
+      }
+    }
+  }
+  return (double) rounds * BLOCKS * FIPS_RNG_BUFFER_SIZE / elapsed(&start) / 1.0e6;
+}
+
+int main(void) {
+  unsigned char* data;
+  fips_ctx_t ctx;
+  unsigned char block[FIPS_RNG_BUFFER_SIZE];
+  int i, tier, tier_errors, errors = 0;
+
+  data = (unsigned char*) malloc(BLOCKS * FIPS_RNG_BUFFER_SIZE);
+  if ( data == NULL ) {
+    fprintf(stderr, "Error: malloc has failed\n");
+    return EXIT_FAILURE;
+  }
+
+  fill_data(data, UINT64_C(0x9e3779b97f4a7c15));
+  fprintf(stdout, "%-8s %-12s %7.1f MB/s\n", "", "reference", speed(data, 1));
+  for ( tier = CSPRNG_CPU_TIER_GENERIC; tier <= (int) csprng_cpu_detected_tier(); ++tier ) {
+    //OpenSSL AES is available on every tier
+    if ( nist_ctr_drbg_select_cipher(NIST_CIPHER_OPENSSL) || csprng_cpu_select_tier((csprng_cpu_tier_type) tier) ) {
+      fprintf(stderr, "Error: cannot select CPU tier %s\n", csprng_cpu_tier_names[tier]);
+      ++errors;
+      break;
+    }
+    for ( tier_errors = 0, i = 0; i < ROUNDS; ++i ) {
+      fill_data(data, UINT64_C(0x9e3779b97f4a7c15) + i);
+      tier_errors += run(data, UINT64_C(0x2545f4914f6cdd1d) * ( i + 1 ));
+    }
+    fprintf(stdout, "%-8s %-12s %7.1f MB/s %s\n", csprng_cpu_tier_names[tier], csprng_cpu_kernel_name(CSPRNG_KERNEL_FIPS),
+        speed(data, 0), tier_errors ? "FAILED" : "OK");
+    errors += tier_errors;
+  }
+
+  //Complete block waits for fips_block_ready, fips_run_rng_test refuses to run in the middle of a block
+  fips_init(&ctx, 0, 0);
+  memset(block, 0x5a, sizeof(block));
+  if ( fips_update(&ctx, block, 100) != 100 || fips_block_ready(&ctx) != -1 || fips_run_rng_test(&ctx, block) != -1 ) ++errors;
+  if ( fips_update(&ctx, block, sizeof(block)) != FIPS_RNG_BUFFER_SIZE - 100 || fips_update(&ctx, block, sizeof(block)) != 0 ) ++errors;
+  if ( fips_block_ready(&ctx) <= 0 || fips_block_ready(&ctx) != -1 || fips_run_rng_test(&ctx, block) <= 0 ) ++errors;
+
+  free(data);
+  fprintf(stdout, "%d rounds of %d blocks on each tier, %d errors\n", ROUNDS, BLOCKS, errors);
+  errors += check_first_transition();
+  errors += compare_fips_threads();
+  if ( errors ) {
+    fprintf(stdout, "FAILED\n");
+    return EXIT_FAILURE;
+  }
+  fprintf(stdout, "PASSED\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,245 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/*
+gcc -O2 -I ../include -L../src/.libs -Wextra -Wall -o hash_drbg_test hash_drbg_test.c -lcsprng -lcrypto -lrt
+LD_LIBRARY_PATH=../src/.libs ./hash_drbg_test ../DRBG_TEST_VECTORS/Hash_DRBG.rsp ../DRBG_TEST_VECTORS/HMAC_DRBG.rsp
+CSPRNG_CPU_TIER=generic LD_LIBRARY_PATH=../src/.libs ./hash_drbg_test -v ../DRBG_TEST_VECTORS/Hash_DRBG.rsp
+
+Runs the SHA-256 and SHA-512 NIST CAVS vectors of Hash_DRBG and HMAC_DRBG. The mechanism
+is taken from the header of the .rsp file, sections of other hash functions are skipped.
+Exit code is 0 when all vectors pass.
+*/
+
+/* {{{ Copyright notice
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <csprng/nist_hash_drbg.h>
+#include <csprng/cpu_dispatch.h>
+
+#define MAX_FIELD_BYTES 512
+
+typedef struct {
+  unsigned char data[MAX_FIELD_BYTES];
+  int length;
+} field_type;
+
+typedef struct {
+  int hmac;                           //0 => Hash_DRBG, 1 => HMAC_DRBG
+  int hash;                           //nist_hash_type or -1 when the section is skipped
+  int prediction_resistance;
+  field_type entropy_input, nonce, personalization_string;
+  field_type entropy_input_reseed, additional_input_reseed;
+  field_type additional_input[2], entropy_input_pr[2];
+  int additional_input_count, entropy_input_pr_count;
+  field_type returned_bits;
+} test_case_type;
+
+static int parse_hex(const char* s, field_type* f) {
+  unsigned int byte;
+
+  f->length = 0;
+  while ( s[0] && s[1] && s[0] != '\r' && s[0] != '\n' ) {
+    if ( f->length == MAX_FIELD_BYTES || sscanf(s, "%2x", &byte) != 1 ) return 1;
+    f->data[f->length++] = (unsigned char) byte;
+    s += 2;
+  }
+  return 0;
+}
+
+static const void* field_or_null(const field_type* f) {
+  return f->length ? f->data : NULL;
+}
+
+//{{{ Run one test case. Returns 0 when ReturnedBits match
+/*
+ * Prediction resistance: instantiate, (reseed with EntropyInputPR and AdditionalInput, generate) twice
+ * Otherwise: instantiate, generate with AdditionalInput, reseed, generate with AdditionalInput
+ * The output of the second generate call is compared with ReturnedBits.
+ */
+#define RUN_TEST_CASE(prefix, drbg_type) do {                                                                        \
+  drbg_type* drbg;                                                                                                  \
+  drbg = prefix##_instantiate(t->entropy_input.data, t->entropy_input.length, field_or_null(&t->nonce),              \
+      t->nonce.length, field_or_null(&t->personalization_string), t->personalization_string.length, hash);          \
+  if ( drbg == NULL ) return 1;                                                                                     \
+  for ( i = 0; i < 2; ++i ) {                                                                                       \
+    if ( t->prediction_resistance ) {                                                                               \
+      error |= prefix##_reseed(drbg, t->entropy_input_pr[i].data, t->entropy_input_pr[i].length,                    \
+          field_or_null(&t->additional_input[i]), t->additional_input[i].length);                                   \
+      error |= prefix##_generate(drbg, output, t->returned_bits.length, NULL, 0);                                   \
+    } else {                                                                                                        \
+      if ( i == 1 ) error |= prefix##_reseed(drbg, t->entropy_input_reseed.data, t->entropy_input_reseed.length,    \
+          field_or_null(&t->additional_input_reseed), t->additional_input_reseed.length);                           \
+      error |= prefix##_generate(drbg, output, t->returned_bits.length,                                             \
+          field_or_null(&t->additional_input[i]), t->additional_input[i].length);                                   \
+    }                                                                                                               \
+  }                                                                                                                 \
+  prefix##_destroy(drbg);                                                                                           \
+} while (0)
+
+static int run_test_case(const test_case_type* t) {
+  unsigned char output[MAX_FIELD_BYTES];
+  nist_hash_type hash = (nist_hash_type) t->hash;
+  int i, error = 0;
+
+  if ( t->hmac ) {
+    RUN_TEST_CASE(nist_hmac_drbg, NIST_HMAC_DRBG);
+  } else {
+    RUN_TEST_CASE(nist_hash_drbg, NIST_HASH_DRBG);
+  }
+
+  if ( error ) return 1;
+  return memcmp(output, t->returned_bits.data, t->returned_bits.length) != 0;
+}
+//}}}
+
+//{{{ Parse and run one .rsp file. Returns number of failed vectors or -1 on error
+static int run_file(const char* filename, int verbose, int* passed) {
+  FILE* fd;
+  char line[4 * MAX_FIELD_BYTES];
+  char* value;
+  test_case_type t;
+  int failed = 0;
+  int line_number = 0;
+
+  fd = fopen(filename, "r");
+  if ( fd == NULL ) {
+    fprintf(stderr, "Error: cannot open %s\n", filename);
+    return -1;
+  }
+
+  memset(&t, 0, sizeof(t));
+  t.hmac = -1;
+  t.hash = -1;
+
+  while ( fgets(line, sizeof(line), fd) ) {
+    ++line_number;
+    if ( line[0] == '#' ) {
+      if ( strstr(line, "HMAC_DRBG") ) t.hmac = 1;
+      else if ( strstr(line, "Hash_DRBG") ) t.hmac = 0;
+      continue;
+    }
+
+    if ( line[0] == '[' ) {
+      if ( strncmp(line, "[SHA-", 5) == 0 ) {
+        if ( strncmp(line, "[SHA-256]", 9) == 0 ) t.hash = NIST_HASH_SHA256;
+        else if ( strncmp(line, "[SHA-512]", 9) == 0 ) t.hash = NIST_HASH_SHA512;
+        else t.hash = -1;
+      } else if ( strstr(line, "PredictionResistance = True") ) {
+        t.prediction_resistance = 1;
+      } else if ( strstr(line, "PredictionResistance = False") ) {
+        t.prediction_resistance = 0;
+      }
+      continue;
+    }
+
+    value = strstr(line, " = ");
+    if ( t.hash < 0 || value == NULL ) continue;
+    value += 3;
+
+    if ( t.hmac < 0 ) {
+      fprintf(stderr, "Error: %s does not look like Hash_DRBG or HMAC_DRBG response file\n", filename);
+      fclose(fd);
+      return -1;
+    }
+
+    if ( strncmp(line, "COUNT", 5) == 0 ) {
+      t.additional_input_count = 0;
+      t.entropy_input_pr_count = 0;
+      t.personalization_string.length = 0;
+      t.nonce.length = 0;
+      t.entropy_input_reseed.length = 0;
+      t.additional_input_reseed.length = 0;
+      continue;
+    }
+
+    if ( strncmp(line, "EntropyInputReseed", 18) == 0 ) {
+      if ( parse_hex(value, &t.entropy_input_reseed) ) goto parse_error;
+    } else if ( strncmp(line, "EntropyInputPR", 14) == 0 ) {
+      if ( t.entropy_input_pr_count == 2 || parse_hex(value, &t.entropy_input_pr[t.entropy_input_pr_count++]) ) goto parse_error;
+    } else if ( strncmp(line, "EntropyInput", 12) == 0 ) {
+      if ( parse_hex(value, &t.entropy_input) ) goto parse_error;
+    } else if ( strncmp(line, "Nonce", 5) == 0 ) {
+      if ( parse_hex(value, &t.nonce) ) goto parse_error;
+    } else if ( strncmp(line, "PersonalizationString", 21) == 0 ) {
+      if ( parse_hex(value, &t.personalization_string) ) goto parse_error;
+    } else if ( strncmp(line, "AdditionalInputReseed", 21) == 0 ) {
+      if ( parse_hex(value, &t.additional_input_reseed) ) goto parse_error;
+    } else if ( strncmp(line, "AdditionalInput", 15) == 0 ) {
+      if ( t.additional_input_count == 2 || parse_hex(value, &t.additional_input[t.additional_input_count++]) ) goto parse_error;
+    } else if ( strncmp(line, "ReturnedBits", 12) == 0 ) {
+      if ( parse_hex(value, &t.returned_bits) ) goto parse_error;
+      if ( run_test_case(&t) ) {
+        ++failed;
+        fprintf(stderr, "FAIL: %s line %d %s %s PR=%d\n", filename, line_number, t.hmac ? "HMAC_DRBG" : "Hash_DRBG",
+            nist_hash_names[t.hash], t.prediction_resistance);
+      } else {
+        ++(*passed);
+        if ( verbose ) fprintf(stdout, "PASS: %s line %d\n", filename, line_number);
+      }
+    }
+  }
+
+  fclose(fd);
+  return failed;
+
+parse_error:
+  fprintf(stderr, "Error: cannot parse %s line %d\n", filename, line_number);
+  fclose(fd);
+  return -1;
+}
+//}}}
+
+int main(int argc, char **argv) {
+  int c, i, ret, verbose = 0;
+  int passed = 0, failed = 0;
+
+  while ( ( c = getopt(argc, argv, "vh") ) != -1 ) {
+    switch (c) {
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-v] Hash_DRBG.rsp|HMAC_DRBG.rsp ...\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if ( optind == argc ) {
+    fprintf(stderr, "Usage: %s [-v] Hash_DRBG.rsp|HMAC_DRBG.rsp ...\n", argv[0]);
+    return 1;
+  }
+
+  if ( csprng_cpu_dispatch_initialize() ) return 1;
+  fprintf(stdout, "%s", dump_csprng_cpu_dispatch());
+
+  for ( i = optind; i < argc; ++i ) {
+    ret = run_file(argv[i], verbose, &passed);
+    if ( ret < 0 ) return 1;
+    failed += ret;
+  }
+
+  fprintf(stdout, "%d vectors passed, %d vectors failed\n", passed, failed);
+  return failed != 0;
+}
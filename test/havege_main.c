@@ -73,12 +73,13 @@ dump_hex_byte_string (const unsigned char* data, const unsigned int size, const
 int main(void) {
   int rc;
   DATA_TYPE* buf;
+  havege_type* havege;
 
   buf = calloc(HAVEGE_NDSIZECOLLECT, sizeof(DATA_TYPE));
 
-  rc = havege_init( 0, 0, 0);
-  if ( rc ) {
-    fprintf(stderr, "ERROR: havege_init has returned %d\n",rc);
+  havege = havege_init( 0, 0, 0);
+  if ( havege == NULL ) {
+    fprintf(stderr, "ERROR: havege_init has failed.\n");
     return 1;
   }
 
@@ -99,7 +100,7 @@ int main(void) {
   }
   
   for(i=0;i<blocks;++i) {
-    rc = SHA1_Update(&c, ndrand_full_buffer(), sizeof(DATA_TYPE) * HAVEGE_NDSIZECOLLECT);
+    rc = SHA1_Update(&c, ndrand_full_buffer(havege), sizeof(DATA_TYPE) * HAVEGE_NDSIZECOLLECT);
     if ( rc != 1 ) {
       fprintf(stderr, "ERROR: SHA1_Update has returned %d\n",rc);
       return 1;
@@ -111,11 +112,11 @@ int main(void) {
     fprintf(stderr, "ERROR: SHA1_Final has returned %d\n",rc);
     return 1;
   }
-  havege_destroy();
+  havege_destroy(havege);
 
-  rc = havege_init( 0, 0, 0);
-  if ( rc ) {
-    fprintf(stderr, "ERROR: havege_init has returned %d\n",rc);
+  havege = havege_init( 0, 0, 0);
+  if ( havege == NULL ) {
+    fprintf(stderr, "ERROR: havege_init has failed.\n");
     return 1;
   }
 
@@ -131,7 +132,7 @@ int main(void) {
     } else {
       blocks_requested = random_in_range(1, blocks_to_generate);
     }
-    blocks_generated = generate_words_using_havege (buf, blocks_requested);
+    blocks_generated = generate_words_using_havege (havege, buf, blocks_requested);
     if ( blocks_generated != blocks_requested  ) {
       fprintf(stderr,  "ERROR: generate_words_using_havege has returned %zu blocks instead of %zu blocks requested.\n", blocks_generated, blocks_requested);
       return 1;
@@ -157,7 +158,7 @@ int main(void) {
   size_t blocks_requested, blocks_generated;
   while ( 1 ) {
     blocks_requested = random_in_range(1, HAVEGE_NDSIZECOLLECT);
-    blocks_generated = generate_words_using_havege (buf, blocks_requested);
+    blocks_generated = generate_words_using_havege (havege, buf, blocks_requested);
     if ( blocks_generated != blocks_requested  ) {
       fprintf(stderr,  "ERROR: generate_words_using_havege has returned %zu blocks instead of %zu blocks requested.\n", blocks_generated, blocks_requested);
       return 1;
@@ -166,12 +167,12 @@ int main(void) {
   }
 #else
   while ( 1 ) {
-    //memcpy(buf, ndrand_full_buffer(), HAVEGE_NDSIZECOLLECT * sizeof(DATA_TYPE) );
+    //memcpy(buf, ndrand_full_buffer(havege), HAVEGE_NDSIZECOLLECT * sizeof(DATA_TYPE) );
     //fwrite(buf, sizeof(DATA_TYPE), HAVEGE_NDSIZECOLLECT, stdout);
 
-    rc = fwrite(ndrand_full_buffer(), sizeof(DATA_TYPE), HAVEGE_NDSIZECOLLECT, stdout);
+    rc = fwrite(ndrand_full_buffer(havege), sizeof(DATA_TYPE), HAVEGE_NDSIZECOLLECT, stdout);
     if ( rc < HAVEGE_NDSIZECOLLECT ) {
-      havege_destroy();
+      havege_destroy(havege);
       free(buf);
       error(EXIT_FAILURE, errno, "ERROR: fwrite");
     }
@@ -180,7 +181,7 @@ int main(void) {
 #endif  
 #endif
 
-  havege_destroy();
+  havege_destroy(havege);
   free(buf);
   return 0;
 }
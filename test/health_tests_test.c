@@ -0,0 +1,401 @@
+/* vim: set expandtab cindent fdm=marker ts=2 sw=2: */
+
+/*
+gcc -O2 -I ../include -L../src/.libs -Wextra -Wall -o health_tests_test health_tests_test.c -lcsprng -lcrypto -lm -lrt
+LD_LIBRARY_PATH=../src/.libs ./health_tests_test
+
+Checks the SP 800-90B Repetition Count and Adaptive Proportion tests:
+  - the cutoffs against Table 2 of SP 800-90B (W = 512, alpha = 2^-20)
+  - health_test_run fed in chunks of random size against a sample by sample
+    implementation of SP 800-90B 4.4.1 and 4.4.2, on data with runs just below, at and above
+    the cutoff and with biased windows
+  - random data with the default cutoffs never fail
+  - fips_approved_csprng_generate with an EXTERNAL entropy file with stuck bytes, synchronous and
+    prefetched, counts the same failures as health_test_run on the bytes read from the file
+  - health_action: with one stuck run in the file warn and drop keep generating, drop and fail
+    discard the data, fail stops the generator. Drop gives up on a file of zeros
+*/
+
+/* {{{ Copyright notice
+
+Copyright (C) 2011-2013 Jirka Hladky <hladky DOT jiri AT gmail DOT com>
+
+This file is part of CSRNG http://code.google.com/p/csrng/
+
+CSRNG is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CSRNG is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
+}}} */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <csprng/csprng.h>
+#include <csprng/health_tests.h>
+
+#define DATA_SIZE ( 1 << 20 )
+#define ROUNDS 20
+#define FILE_SIZE ( 4 << 20 )
+
+static uint64_t xorshift(uint64_t* x) {
+  *x ^= *x << 13;
+  *x ^= *x >> 7;
+  *x ^= *x << 17;
+  return *x;
+}
+
+//{{{ Reference implementation
+/*
+ * SP 800-90B 4.4.1 and 4.4.2 sample by sample. Each run and each window fails once
+ */
+static void reference_run(const unsigned char* buf, size_t len, unsigned int rct_cutoff, unsigned int apt_cutoff,
+    uint64_t* rct_failures, uint64_t* apt_failures) {
+  unsigned int a = 0, b = 0, apt_a = 0, apt_b = 0, j;
+  size_t i;
+
+  *rct_failures = *apt_failures = 0;
+  for ( i = 0; i < len; ++i ) {
+    if ( i > 0 && buf[i] == a ) {
+      ++b;
+      if ( b == rct_cutoff ) ++*rct_failures;
+    } else {
+      a = buf[i];
+      b = 1;
+    }
+
+    j = i % HEALTH_TEST_APT_WINDOW;
+    if ( j == 0 ) {
+      apt_a = buf[i];
+      apt_b = 1;
+    } else if ( buf[i] == apt_a ) {
+      ++apt_b;
+      if ( apt_b == apt_cutoff ) ++*apt_failures;
+    }
+  }
+}
+//}}}
+
+/*
+ * Random bytes with runs of rct_cutoff - 1, rct_cutoff and rct_cutoff + 7 identical bytes
+ * and stretches where three bytes of four are the same, one defect per 16 kB
+ */
+static void fill_data(unsigned char* data, size_t len, uint64_t seed, unsigned int rct_cutoff) {
+  uint64_t x = seed;
+  size_t i, start, n;
+  unsigned int k;
+
+  for ( i = 0; i < len; ++i ) data[i] = (unsigned char) ( xorshift(&x) >> 32 );
+  for ( k = 0; k < len / 16384; ++k ) {
+    start = xorshift(&x) % ( len - 2048 );
+    switch ( k % 4 ) {
+      case 0: n = rct_cutoff - 1; break;
+      case 1: n = rct_cutoff; break;
+      case 2: n = rct_cutoff + 7; break;
+      default: n = 0;
+    }
+    if ( n ) {
+      memset(data + start, data[start], n);
+    } else {
+      for ( n = 0; n < 1024; ++n ) {
+        if ( n % 4 ) data[start + n] = data[start];
+      }
+    }
+  }
+}
+
+//Returns number of errors
+static int check_cutoffs(void) {
+  static const double min_entropy[5] = { 0.5, 1.0, 2.0, 4.0, 8.0 };
+  static const unsigned int rct[5] = { 41, 21, 11, 6, 4 };
+  static const unsigned int apt[5] = { 410, 311, 177, 62, 13 };
+  health_test_ctx_t ctx;
+  unsigned int rct_cutoff, apt_cutoff;
+  int i, errors = 0;
+
+  for ( i = 0; i < 5; ++i ) {
+    if ( health_test_cutoffs(min_entropy[i], 20, &rct_cutoff, &apt_cutoff) || rct_cutoff != rct[i] || apt_cutoff != apt[i] ) {
+      fprintf(stderr, "Error: H = %g: cutoffs RCT %u, APT %u, expected %u and %u\n", min_entropy[i], rct_cutoff, apt_cutoff, rct[i], apt[i]);
+      ++errors;
+    }
+  }
+  if ( health_test_init(&ctx, 0.0, 20) == 0 || health_test_init(&ctx, 8.5, 20) == 0 || health_test_init(&ctx, 8.0, 0) == 0 ) {
+    fprintf(stderr, "Error: health_test_init has accepted arguments out of range\n");
+    ++errors;
+  }
+  return errors;
+}
+
+//Returns number of errors
+static int compare_reference(unsigned char* data, double min_entropy, uint64_t seed) {
+  health_test_ctx_t ctx;
+  uint64_t x = seed, rct_failures, apt_failures;
+  size_t done, n;
+
+  if ( health_test_init(&ctx, min_entropy, HEALTH_TEST_ALPHA_LOG2) ) return 1;
+  fill_data(data, DATA_SIZE, seed, ctx.rct_cutoff);
+  reference_run(data, DATA_SIZE, ctx.rct_cutoff, ctx.apt_cutoff, &rct_failures, &apt_failures);
+
+  for ( done = 0; done < DATA_SIZE; done += n ) {
+    n = 1 + xorshift(&x) % ( 3 * HEALTH_TEST_APT_WINDOW );
+    if ( n > DATA_SIZE - done ) n = DATA_SIZE - done;
+    health_test_run(&ctx, data + done, n);
+  }
+
+  if ( ctx.statistics.samples != DATA_SIZE || ctx.statistics.rct_failures != rct_failures || ctx.statistics.apt_failures != apt_failures ||
+      rct_failures == 0 || apt_failures == 0 ) {
+    fprintf(stderr, "Error: H = %g: RCT failures %"PRIu64", APT failures %"PRIu64", reference %"PRIu64" and %"PRIu64"\n",
+        min_entropy, ctx.statistics.rct_failures, ctx.statistics.apt_failures, rct_failures, apt_failures);
+    return 1;
+  }
+  return 0;
+}
+
+//Returns number of errors
+static int random_data(unsigned char* data) {
+  health_test_ctx_t ctx;
+  uint64_t x = UINT64_C(0x853c49e6748fea9b);
+  int i, r;
+
+  if ( health_test_init(&ctx, 8.0, HEALTH_TEST_ALPHA_LOG2) ) return 1;
+  for ( r = 0; r < ROUNDS; ++r ) {
+    for ( i = 0; i < DATA_SIZE; ++i ) data[i] = (unsigned char) ( xorshift(&x) >> 32 );
+    if ( health_test_run(&ctx, data, DATA_SIZE) ) {
+      fprintf(stderr, "Error: random data have failed the health tests\n");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Generate from an entropy file with stuck bytes, the failures have to match the bytes read from the file.
+ * Returns number of errors
+ */
+static int generate(const char* filename, const unsigned char* file_data, int prefetch_watermark) {
+  mode_of_operation_type mode;
+  fips_state_type* fips_state;
+  health_test_ctx_t ctx;
+  unsigned char output[65536];
+  rng_buf_type* entropy_buf;
+  int i, errors = 0;
+
+  memset(&mode, 0, sizeof(mode));
+  mode.file_read_size = 16384;
+  mode.max_number_of_csprng_blocks = 16;
+  mode.entropy_source = EXTERNAL;
+  mode.filename_for_entropy = (char*) filename;
+  mode.prefetch_watermark = prefetch_watermark;
+  mode.health_min_entropy = 8.0;
+  fips_state = fips_approved_csprng_initialize(0, 0, &mode);
+  if ( fips_state == NULL || fips_approved_csprng_instantiate(fips_state) ) {
+    fprintf(stderr, "Error: cannot instantiate the generator\n");
+    return 1;
+  }
+  for ( i = 0; i < 16; ++i ) {
+    if ( fips_approved_csprng_generate(fips_state, output, sizeof(output)) != sizeof(output) ) {
+      fprintf(stderr, "Error: fips_approved_csprng_generate has failed\n");
+      ++errors;
+      break;
+    }
+  }
+  //Prefetch thread publishes the statistics of the refills it has finished
+  if ( prefetch_watermark ) sleep(1);
+
+  entropy_buf = fips_state->csprng_state->entropy_buf;
+  health_test_init(&ctx, 8.0, HEALTH_TEST_ALPHA_LOG2);
+  health_test_run(&ctx, file_data, entropy_buf->health_statistics.samples);
+  if ( entropy_buf->health == NULL || entropy_buf->health_statistics.samples == 0 ||
+      entropy_buf->health_statistics.rct_failures != ctx.statistics.rct_failures ||
+      entropy_buf->health_statistics.apt_failures != ctx.statistics.apt_failures || ctx.statistics.rct_failures == 0 ) {
+    fprintf(stderr, "Error: prefetch %d%%: %"PRIu64" bytes tested, RCT failures %"PRIu64", APT failures %"PRIu64", expected %"PRIu64" and %"PRIu64"\n",
+        prefetch_watermark, entropy_buf->health_statistics.samples, entropy_buf->health_statistics.rct_failures,
+        entropy_buf->health_statistics.apt_failures, ctx.statistics.rct_failures, ctx.statistics.apt_failures);
+    ++errors;
+  } else {
+    fprintf(stdout, "prefetch %3d%%: %"PRIu64" bytes tested, RCT failures %"PRIu64", APT failures %"PRIu64", OK\n",
+        prefetch_watermark, entropy_buf->health_statistics.samples, entropy_buf->health_statistics.rct_failures,
+        entropy_buf->health_statistics.apt_failures);
+  }
+  if ( fips_approved_csprng_destroy(fips_state) ) ++errors;
+  return errors;
+}
+
+//Returns number of errors
+static int check_entropy_buffer(void) {
+  char filename[] = "/tmp/health_tests_test.XXXXXX";
+  mode_of_operation_type mode;
+  unsigned char* file_data;
+  FILE* fp;
+  int fd, errors = 0;
+
+  file_data = (unsigned char*) malloc(FILE_SIZE);
+  fd = mkstemp(filename);
+  if ( file_data == NULL || fd < 0 ) {
+    fprintf(stderr, "Error: cannot allocate the entropy file\n");
+    free(file_data);
+    return 1;
+  }
+  fill_data(file_data, FILE_SIZE, UINT64_C(0x2545f4914f6cdd1d), 6);
+  fp = fdopen(fd, "wb");
+  if ( fp == NULL || fwrite(file_data, 1, FILE_SIZE, fp) != FILE_SIZE || fclose(fp) ) {
+    fprintf(stderr, "Error: cannot write the entropy file %s\n", filename);
+    ++errors;
+  } else {
+    errors += generate(filename, file_data, 0);
+    errors += generate(filename, file_data, 50);
+
+    memset(&mode, 0, sizeof(mode));
+    mode.file_read_size = 16384;
+    mode.max_number_of_csprng_blocks = 16;
+    mode.entropy_source = EXTERNAL;
+    mode.filename_for_entropy = filename;
+    mode.health_min_entropy = 9.0;
+    if ( fips_approved_csprng_initialize(0, 0, &mode) != NULL ) {
+      fprintf(stderr, "Error: health_min_entropy 9 has been accepted\n");
+      ++errors;
+    }
+  }
+
+  unlink(filename);
+  free(file_data);
+  return errors;
+}
+
+/*
+ * Generate 1 MiB from filename. Returns the bytes generated, -1 when the generator can't be instantiated.
+ * *rct_failures and *dropped get the statistics of the entropy buffer
+ */
+static int generate_with_action(const char* filename, health_action_type action, int prefetch_watermark,
+    uint64_t* rct_failures, uint64_t* dropped) {
+  mode_of_operation_type mode;
+  fips_state_type* fips_state;
+  unsigned char output[65536];
+  int i, bytes = 0;
+
+  memset(&mode, 0, sizeof(mode));
+  mode.file_read_size = 16384;
+  mode.max_number_of_csprng_blocks = 16;
+  mode.entropy_source = EXTERNAL;
+  mode.filename_for_entropy = (char*) filename;
+  mode.prefetch_watermark = prefetch_watermark;
+  mode.health_min_entropy = 8.0;
+  mode.health_action = action;
+  fips_state = fips_approved_csprng_initialize(0, 0, &mode);
+  if ( fips_state == NULL ) return -1;
+  if ( fips_approved_csprng_instantiate(fips_state) ) {
+    bytes = -1;
+  } else {
+    for ( i = 0; i < 16; ++i ) {
+      if ( fips_approved_csprng_generate(fips_state, output, sizeof(output)) != sizeof(output) ) break;
+      bytes += sizeof(output);
+    }
+  }
+  //Prefetch thread publishes the statistics of the refills it has finished
+  if ( prefetch_watermark ) sleep(1);
+  *rct_failures = fips_state->csprng_state->entropy_buf->health_statistics.rct_failures;
+  *dropped = fips_state->csprng_state->entropy_buf->health_dropped;
+  fips_approved_csprng_destroy(fips_state);
+  return bytes;
+}
+
+//Returns number of errors
+static int check_health_action(void) {
+  char defect_filename[] = "/tmp/health_tests_test.XXXXXX";
+  char zero_filename[] = "/tmp/health_tests_test.XXXXXX";
+  const size_t size = 1 << 20;
+  unsigned char* file_data;
+  uint64_t x = UINT64_C(0x6a09e667f3bcc909);
+  uint64_t rct_failures, dropped;
+  FILE* fp;
+  size_t i;
+  int fd[2], action, prefetch, bytes, errors = 0;
+
+  file_data = (unsigned char*) malloc(size);
+  fd[0] = mkstemp(defect_filename);
+  fd[1] = mkstemp(zero_filename);
+  if ( file_data == NULL || fd[0] < 0 || fd[1] < 0 ) {
+    fprintf(stderr, "Error: cannot allocate the entropy files\n");
+    if ( fd[0] >= 0 ) unlink(defect_filename);
+    if ( fd[1] >= 0 ) unlink(zero_filename);
+    free(file_data);
+    return 1;
+  }
+
+  //Random bytes with one run of 32 equal bytes, read after the first reseeds
+  for ( i = 0; i < size; ++i ) file_data[i] = (unsigned char) ( xorshift(&x) >> 32 );
+  memset(file_data + 65636, file_data[65636], 32);
+  fp = fdopen(fd[0], "wb");
+  if ( fp == NULL || fwrite(file_data, 1, size, fp) != size || fclose(fp) ) ++errors;
+  memset(file_data, 0, size);
+  fp = fdopen(fd[1], "wb");
+  if ( fp == NULL || fwrite(file_data, 1, size, fp) != size || fclose(fp) ) ++errors;
+  if ( errors ) fprintf(stderr, "Error: cannot write the entropy files\n");
+
+  for ( prefetch = 0; prefetch <= 50 && ! errors; prefetch += 50 ) {
+    for ( action = HEALTH_WARN; action < HEALTH_ACTIONS_COUNT; ++action ) {
+      bytes = generate_with_action(defect_filename, (health_action_type) action, prefetch, &rct_failures, &dropped);
+      if ( rct_failures != 1 || ( action == HEALTH_WARN ) != ( dropped == 0 ) || ( action == HEALTH_FAIL ) != ( bytes < 16 * 65536 ) ) {
+        fprintf(stderr, "Error: health_action %s, prefetch %d%%: %d bytes generated, RCT failures %"PRIu64", %"PRIu64" bytes dropped\n",
+            health_action_names[action], prefetch, bytes, rct_failures, dropped);
+        ++errors;
+      } else {
+        fprintf(stdout, "health_action %s, prefetch %3d%%: %d bytes generated, %"PRIu64" bytes dropped, OK\n",
+            health_action_names[action], prefetch, bytes, dropped);
+      }
+    }
+  }
+
+  if ( ! errors ) {
+    bytes = generate_with_action(zero_filename, HEALTH_DROP, 0, &rct_failures, &dropped);
+    if ( bytes != -1 || dropped == 0 ) {
+      fprintf(stderr, "Error: health_action drop has not given up on zeros: %d bytes generated, %"PRIu64" bytes dropped\n",
+          bytes, dropped);
+      ++errors;
+    }
+  }
+
+  unlink(defect_filename);
+  unlink(zero_filename);
+  free(file_data);
+  return errors;
+}
+
+int main(void) {
+  static const double min_entropy[4] = { 1.0, 4.0, 7.0, 8.0 };
+  unsigned char* data;
+  int i, r, errors = 0;
+
+  data = (unsigned char*) malloc(DATA_SIZE);
+  if ( data == NULL ) {
+    fprintf(stderr, "Error: malloc has failed\n");
+    return EXIT_FAILURE;
+  }
+
+  errors += check_cutoffs();
+  for ( i = 0; i < 4; ++i ) {
+    for ( r = 0; r < ROUNDS; ++r ) errors += compare_reference(data, min_entropy[i], UINT64_C(0x9e3779b97f4a7c15) * ( r + 1 ) + i);
+  }
+  fprintf(stdout, "%d rounds against the reference, %d errors\n", 4 * ROUNDS, errors);
+  errors += random_data(data);
+  free(data);
+  errors += check_entropy_buffer();
+  errors += check_health_action();
+
+  if ( errors ) {
+    fprintf(stdout, "FAILED\n");
+    return EXIT_FAILURE;
+  }
+  fprintf(stdout, "PASSED\n");
+  return EXIT_SUCCESS;
+}
@@ -56,6 +56,7 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <csprng/csprng.h>
 #include <csprng/helper_utils.h>
+#include <csprng/cpu_dispatch.h>
 
 
 #include <error.h>
@@ -71,6 +72,8 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+//writev
+#include <sys/uio.h>
 
 
 #include "config.h"
@@ -78,6 +81,9 @@ along with CSRNG.  If not, see <http://www.gnu.org/licenses/>.
 /* Value added to key to get the key of the opposite option*/
 #define OPP 256
 
+/* Maximum number of segments borrowed from the library in one step*/
+#define IOV_COUNT 16
+
 /* HTTP_RNG rate in Bytes/s */
 const long double  HTTP_RNG_RATE = 200;
 
@@ -255,6 +261,20 @@ struct arguments {
   char unlimited;                     //1=> unlimited stream, 0=>limited stream
   int fips_test;                      //FIPS validation
   int derivation_function;            //Use DERIVATION FUNCTION?                         1=>true, 0=false
+  int aes_key_length;                 //AES key length of CTR_DRBG in bits: 128, 192 or 256
+  drbg_mechanism_type drbg_mechanism; //CTR_DRBG, Hash_DRBG, HMAC_DRBG or AUTO
+  nist_hash_type drbg_hash;           //Hash function of Hash_DRBG and HMAC_DRBG
+  int generate_threads;               //Threads sharing one large CTR_DRBG generate request
+  int ctr_drbg_lanes;                 //Independent CTR_DRBG instances interleaved block by block
+  int fips_threads;                   //Threads running the FIPS tests of one refill
+  double health_min_entropy;          //Claimed min-entropy of the noise sources for the SP 800-90B health tests. 0 => disabled
+  health_action_type health_action;   //What happens with data failing the health tests
+  int producer_buffers;               //Buffers of the background producer thread. 0 => no background thread
+  int producer_low_watermark;         //Background thread resumes when the ready buffers drop to this level
+  int producer_high_watermark;        //Background thread pauses at this number of ready buffers. 0 => not set
+  int prefetch_watermark;             //Entropy and additional input are read ahead by background threads. 0 => disabled
+  int autotune;                       //Choose the buffer sizes by a measurement at startup. 0 => disabled
+  char *autotune_profile;             //File with the results of the earlier measurements. NULL => always measure
   uint64_t max_num_of_blocks;         //Maximum number MAX of CTR_DRBG blocks produced before reseed is performed
   int randomize_num_of_blocks;        //Randomize number of CTR_DRBG blocks produced before reseed is performed. 1=>true, 0=false
   int havege_data_cache_size;         //CPU data cache SIZE in KiB for HAVEGE. Default 0 (auto-detected)
@@ -278,6 +298,20 @@ static struct arguments arguments = {
   .unlimited = 1,
   .size_string = NULL,
   .derivation_function = 0,
+  .aes_key_length = NIST_BLOCK_KEYLEN,
+  .drbg_mechanism = DRBG_CTR,
+  .drbg_hash = NIST_HASH_SHA256,
+  .generate_threads = 1,
+  .ctr_drbg_lanes = 1,
+  .fips_threads = 1,
+  .health_min_entropy = 0.0,
+  .health_action = HEALTH_WARN,
+  .producer_buffers = 0,
+  .producer_low_watermark = 0,
+  .producer_high_watermark = 0,
+  .prefetch_watermark = 0,
+  .autotune = 0,
+  .autotune_profile = NULL,
   .max_num_of_blocks = 512,
   .randomize_num_of_blocks = 0,
   .havege_data_cache_size = 0,
@@ -309,20 +343,59 @@ static struct argp_option options[] = {
                                                       "to compensate for the low speed of the HTTP_RNG (approximately 200B/s). Default: HAVEGE"},
   {"entropy_file",                  802, "FILE",  0,  "Use FILE as the source of random bytes for CTR_DRBG entropy input. "
                                                       "It implies --entropy-source=EXTERNAL"},
+  {"health_min_entropy",            710, "H",     0,  "Run the SP 800-90B Repetition Count and Adaptive Proportion tests on the data of HAVEGE, HTTP_RNG, "
+                                                      "STDIN and EXTERNAL sources before they are buffered. H is the claimed min-entropy in bits "
+                                                      "per byte (0 < H <= 8), the cutoffs are derived from it. What happens on a failure is set by "
+                                                      "--health_action. Default: disabled"},
+  {"health_action",                 711, "ACTION", 0, "What to do with data failing the health tests: warn reports the failures and uses the "
+                                                      "data, drop discards the data and reads the source again, giving up after 4 failing reads "
+                                                      "in a row, fail discards the data and stops using the source. Default: warn"},
   {"number",                        'n', "BYTES", 0,  "Number of output BYTES, prefixes [k|m|g|t] for kibi, mebi, gibi and tebi are supported. Default: unlimited stream"},
   { 0,                                0, 0,       0,  UNDERLINE "FIPS 140-2 validation:" NORMAL },
   {"fips",                          'f', 0,       0,  "Only data validated by FIPS 140-2 random number tests are written out. "
                                                       "Default: no FIPS 140-2 tests are performed. Please note that this parameter has "
-                                                      "big impact on the performance. On test system performance went down 10 times from 170MB/s "
-                                                      "to 17 MB/s after enabling FIPS validation."},
+                                                      "big impact on the performance. The tests run at about 100-230 MB/s on one CPU with generic "
+                                                      "and SSE2 code and 300-600 MB/s with AVX2 and AVX-512, usually well below the speed of the "
+                                                      "generator. --fips_threads spreads them over several CPUs."},
   {"no-fips",                   'f'+OPP, 0, OPTION_HIDDEN,  "No FIPS 140-2 tests are performed"},
   {"output-fips-init",              602, 0,       0,  "Write-out 32-bits used to initialize FIPS 140-2 tests. This is to sync with rngtest tool. "
                                                       "Default: do not write out these bits"},
+  {"fips_threads",                  709, "N",     0,  "Number of threads (1-64) running the FIPS 140-2 tests. The blocks of each refill of the "
+                                                      "output buffer are split between the threads and approved in their original order, "
+                                                      "the output does not depend on N. Default: 1"},
   { 0,                                0, 0,       0,  UNDERLINE "Mode of operation of CTR_DRBG:" NORMAL },
   {"derivation_function",           'd', 0,       0,  "Use DERIVATION FUNCTION. It will process entropy "
                                                       "and - when enabled - also additional input through DERIVATION FUNCTION "
                                                       "before reseed/change the state of CTR_DRBG. Default: DERIVATION FUNCTION is not used"},
   {"no-derivation_function",    'd'+OPP, 0, OPTION_HIDDEN,  "Do not use DERIVATION FUNCTION"},
+  {"drbg",                          701, "MECHANISM", 0, "DRBG mechanism: CTR_DRBG, Hash_DRBG, HMAC_DRBG, ChaCha20 or AUTO. ChaCha20 is the fastest "
+                                                      "without AES instructions but it is not a NIST SP 800-90A mechanism. AUTO selects "
+                                                      "CTR_DRBG when the CPU has AES instructions and Hash_DRBG when it has SIMD or SHA instructions only. "
+                                                      "Default: CTR_DRBG"},
+  {"drbg_hash",                     702, "HASH",  0,  "Hash function of Hash_DRBG and HMAC_DRBG: SHA-256 or SHA-512. Default: SHA-256"},
+  {"generate_threads",              703, "N",     0,  "Number of threads (1-64) sharing one CTR_DRBG generate request. Each thread computes "
+                                                      "its own range of counter blocks, the output does not depend on N. Only requests of at "
+                                                      "least 1024 blocks are split, see --max_num_of_blocks. Default: 1"},
+  {"ctr_drbg_lanes",                704, "N",     0,  "Number of independent CTR_DRBG instances (1-8), each with its own entropy input and "
+                                                      "reseed counter. Output block i comes from instance i mod N. The instances are "
+                                                      "encrypted together, which keeps the AES units busy also for short requests. "
+                                                      "Cannot be combined with --generate_threads. Default: 1"},
+  {"producer_buffers",              705, "K",     0,  "Generate and FIPS test the output in a background thread which keeps up to K buffers "
+                                                      "of 64 KiB ready (2-1024). Generation then overlaps with writing out the data. "
+                                                      "0 disables the background thread. Default: 0"},
+  {"producer_watermarks",           706, "LOW:HIGH", 0, "Background thread pauses when HIGH buffers are ready and resumes when they are "
+                                                      "drained to LOW buffers. 0 <= LOW < HIGH <= K. Default: K/2:K"},
+  {"prefetch",                      707, "PERCENT", OPTION_ARG_OPTIONAL, "Read entropy and additional input in background threads "
+                                                      "whenever their buffers are less than PERCENT % full (1-100), so reseeds do not wait "
+                                                      "for the sources. Without PERCENT 50 is used. Default: disabled"},
+  {"autotune",                      708, "PROFILE", OPTION_ARG_OPTIONAL, "Measure the generator for about 0.3 s at startup and choose the sizes "
+                                                      "of the buffers which fit the caches of this host. With PROFILE the sizes are read from "
+                                                      "that file if it has an entry for this host and these options, otherwise the measured "
+                                                      "sizes are added to it. Default: fixed sizes"},
+  {"aes_key_length",                'k', "BITS",  0,  "AES key length of CTR_DRBG in bits: 128, 192 or 256. Longer keys give "
+                                                      "192/256-bit security strength at the cost of 2 or 4 more AES rounds per block. "
+                                                      "With DERIVATION FUNCTION and additional input, the entropy input grows to the key length. "
+                                                      "Default: 128"},
   { 0,                                0, 0,       0,  "" },
   {"additional_source",              851,"SOURCE",0,  "Use additional input. Specify SOURCE of the random bytes for CTR_DRBG additional input. "
                                                       "One of the following can be used: NONE|HAVEGE|SHA1_RNG|HTTP_RNG|MT_RNG|STDIN|EXTERNAL. "
@@ -373,6 +446,109 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
     case 'd'+OPP:
       arguments->derivation_function = 0;
       break;
+    case 'k':{
+      long int n;
+      char *p;
+      n = strtol(arg, &p, 10);
+      if ((p == arg) || (*p != 0) || ! NIST_KEYLEN_VALID(n) )
+       argp_error(state, "AES key length has to be 128, 192 or 256 bits. Got \"%s\".", arg);
+      else
+        arguments->aes_key_length = n;
+      break;
+    }
+    case 701:
+      if ( strcmp("CTR_DRBG", arg) == 0 ) {
+        arguments->drbg_mechanism = DRBG_CTR;
+      } else if ( strcmp("Hash_DRBG", arg) == 0 ) {
+        arguments->drbg_mechanism = DRBG_HASH;
+      } else if ( strcmp("HMAC_DRBG", arg) == 0 ) {
+        arguments->drbg_mechanism = DRBG_HMAC;
+      } else if ( strcmp("ChaCha20", arg) == 0 ) {
+        arguments->drbg_mechanism = DRBG_CHACHA20;
+      } else if ( strcmp("AUTO", arg) == 0 ) {
+        arguments->drbg_mechanism = DRBG_AUTO;
+      } else {
+        argp_error(state, "drbg can be one of CTR_DRBG|Hash_DRBG|HMAC_DRBG|ChaCha20|AUTO. Got '%s'", arg);
+      }
+      break;
+    case 702:
+      if ( strcmp("SHA-256", arg) == 0 ) {
+        arguments->drbg_hash = NIST_HASH_SHA256;
+      } else if ( strcmp("SHA-512", arg) == 0 ) {
+        arguments->drbg_hash = NIST_HASH_SHA512;
+      } else {
+        argp_error(state, "drbg_hash can be one of SHA-256|SHA-512. Got '%s'", arg);
+      }
+      break;
+    case 703:{
+      char *p;
+      long int n;
+      n = strtol(arg, &p, 10);
+      if ((p == arg) || (*p != 0) || n < 1 || n > 64 )
+        argp_error(state, "generate_threads has to be in range 1-64. Got \"%s\".", arg);
+      else
+        arguments->generate_threads = n;
+      break;
+    }
+    case 709:{
+      char *p;
+      long int n;
+      n = strtol(arg, &p, 10);
+      if ((p == arg) || (*p != 0) || n < 1 || n > 64 )
+        argp_error(state, "fips_threads has to be in range 1-64. Got \"%s\".", arg);
+      else
+        arguments->fips_threads = n;
+      break;
+    }
+    case 704:{
+      char *p;
+      long int n;
+      n = strtol(arg, &p, 10);
+      if ((p == arg) || (*p != 0) || n < 1 || n > NIST_CTR_DRBG_MAX_LANES )
+        argp_error(state, "ctr_drbg_lanes has to be in range 1-%d. Got \"%s\".", NIST_CTR_DRBG_MAX_LANES, arg);
+      else
+        arguments->ctr_drbg_lanes = n;
+      break;
+    }
+    case 705:{
+      char *p;
+      long int n;
+      n = strtol(arg, &p, 10);
+      if ((p == arg) || (*p != 0) || n == 1 || n < 0 || n > CSPRNG_PRODUCER_MAX_BUFFERS )
+        argp_error(state, "producer_buffers has to be 0 or in range 2-%d. Got \"%s\".", CSPRNG_PRODUCER_MAX_BUFFERS, arg);
+      else
+        arguments->producer_buffers = n;
+      break;
+    }
+    case 706:{
+      int low, high;
+      char c;
+      if ( sscanf(arg, "%d:%d%c", &low, &high, &c) != 2 || low < 0 || low >= high )
+        argp_error(state, "producer_watermarks has to be LOW:HIGH with 0 <= LOW < HIGH. Got \"%s\".", arg);
+      else {
+        arguments->producer_low_watermark = low;
+        arguments->producer_high_watermark = high;
+      }
+      break;
+    }
+    case 707:{
+      char *p;
+      long int n;
+      if ( arg == NULL ) {
+        arguments->prefetch_watermark = 50;
+        break;
+      }
+      n = strtol(arg, &p, 10);
+      if ((p == arg) || (*p != 0) || n < 1 || n > 100 )
+        argp_error(state, "prefetch has to be in range 1-100. Got \"%s\".", arg);
+      else
+        arguments->prefetch_watermark = n;
+      break;
+    }
+    case 708:
+      arguments->autotune = 1;
+      arguments->autotune_profile = arg;
+      break;
     case 'r':
       arguments->randomize_num_of_blocks = 1;
       break;
@@ -409,6 +585,28 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
     case 802:
       arguments->entropy_file = arg;
       break;
+    case 710:{
+      double d;
+      char *p;
+      errno = 0;
+      d = strtod(arg, &p);
+      if ((p == arg) || (*p != 0) || errno == ERANGE || !(d > 0.0) || (d > 8.0))
+        argp_error(state, "Value H for --health_min_entropy=H has to be in range 0 < H <= 8. Got \"%s\".", arg);
+      else
+        arguments->health_min_entropy = d;
+      break;
+    }
+    case 711:
+      if ( strcmp("warn", arg) == 0 ) {
+        arguments->health_action = HEALTH_WARN;
+      } else if ( strcmp("drop", arg) == 0 ) {
+        arguments->health_action = HEALTH_DROP;
+      } else if ( strcmp("fail", arg) == 0 ) {
+        arguments->health_action = HEALTH_FAIL;
+      } else {
+        argp_error(state, "health_action can be one of warn|drop|fail. Got '%s'", arg);
+      }
+      break;
     case 851:
       if ( strcmp("NONE", arg) == 0) {
         arguments->add_input_source = NONE;
@@ -528,6 +726,13 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
       break;
 
     case ARGP_KEY_END:
+      if ( arguments->producer_high_watermark == 0 ) {
+        arguments->producer_high_watermark = arguments->producer_buffers;
+        arguments->producer_low_watermark = arguments->producer_buffers / 2;
+      } else if ( arguments->producer_high_watermark > arguments->producer_buffers ) {
+        argp_error(state, "HIGH value of --producer_watermarks can be at most --producer_buffers=%d.\n", arguments->producer_buffers);
+      }
+
       if (arguments->output_fips_init_bits) {
         if (arguments->fips_test == 0 ) {
           argp_error(state, "Argument output-fips-init can be used only when fips validation (--fips option) is enabled.\n");
@@ -678,6 +883,35 @@ void print_statistics(uint64_t number_of_bytes, char unlimited, uint64_t remaini
 } 
 //}}}
 
+//{{{ int write_segments(int fd, struct iovec* iov, int count)
+// Writes count segments to fd, continues after partial writes and EINTR
+// Returns number of bytes written. Less than the size of the segments means an error, errno is set
+
+int write_segments(int fd, struct iovec* iov, int count) {
+  ssize_t rc;
+  int total = 0;
+
+  while ( count > 0 ) {
+    rc = writev(fd, iov, count);
+    if ( rc < 0 ) {
+      if ( errno == EINTR ) continue;
+      break;
+    }
+    total += rc;
+    while ( count > 0 && (size_t) rc >= iov->iov_len ) {
+      rc -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if ( count > 0 ) {
+      iov->iov_base = (unsigned char*) iov->iov_base + rc;
+      iov->iov_len -= rc;
+    }
+  }
+  return total;
+}
+//}}}
+
 //{{{ int main(int argc, char **argv)
 int main(int argc, char **argv) {
 
@@ -690,11 +924,11 @@ int main(int argc, char **argv) {
   fips_state_type*  fips_state;
   mode_of_operation_type mode_of_operation;
 
-  unsigned char *output_buffer;
-
-  unsigned int output_buffer_size = 8192 ;
+  struct iovec iov[IOV_COUNT];
+  int segments, i;
+  unsigned int max_bytes;
   int bytes_to_write;
-  uint64_t remaining_bytes, total_bytes_written, bytes_generated;
+  uint64_t remaining_bytes, total_bytes_written;
 
   struct timespec start_time;
   struct itimerval alarm_value;
@@ -717,6 +951,10 @@ int main(int argc, char **argv) {
     } else {
       fprintf (stderr, "ENTROPY SOURCE = %s\n", source_names[arguments.entropy_source]);
     }
+    if ( arguments.health_min_entropy > 0.0 ) {
+      fprintf (stderr, "SP 800-90B HEALTH TESTS MIN-ENTROPY = %g bits per byte\n", arguments.health_min_entropy);
+      fprintf (stderr, "SP 800-90B HEALTH TESTS ON FAILURE = %s\n", health_action_names[arguments.health_action]);
+    }
 
     fprintf( stderr, "USE ADDITIONAL INPUT = %s\n", (arguments.add_input_source != NONE ) ? "yes" : "no" );
     if ( arguments.add_input_source != NONE ) {
@@ -727,17 +965,29 @@ int main(int argc, char **argv) {
       }
     }
 
+    fprintf (stderr, "DRBG MECHANISM = %s\n", drbg_mechanism_names[arguments.drbg_mechanism]);
+    if ( arguments.drbg_mechanism == DRBG_HASH || arguments.drbg_mechanism == DRBG_HMAC ) fprintf (stderr, "DRBG HASH = %s\n", nist_hash_names[arguments.drbg_hash]);
+    if ( arguments.drbg_mechanism == DRBG_CTR ) fprintf (stderr, "GENERATE THREADS = %d\n", arguments.generate_threads);
+    if ( arguments.drbg_mechanism == DRBG_CTR ) fprintf (stderr, "CTR_DRBG LANES = %d\n", arguments.ctr_drbg_lanes);
+    if ( arguments.producer_buffers ) fprintf (stderr, "BACKGROUND PRODUCER BUFFERS = %d, WATERMARKS = %d:%d\n",
+        arguments.producer_buffers, arguments.producer_low_watermark, arguments.producer_high_watermark);
+    if ( arguments.prefetch_watermark ) fprintf (stderr, "PREFETCH WATERMARK = %d %%\n", arguments.prefetch_watermark);
+    if ( arguments.autotune ) fprintf (stderr, "AUTOTUNE BUFFER SIZES = yes, PROFILE = %s\n", arguments.autotune_profile ? arguments.autotune_profile : "none");
+
     fprintf (stderr, 
         "USE DERIVATION FUNCTION = %s\n"
+        "AES KEY LENGTH = %d bits\n"
         "MAXIMUM NUMBER OF CTR_DRBG BLOCKS PRODUCED BETWEEN RESEEDs = %" PRIu64 "\n"
         "RANDOMIZE NUMBER OF CTR_DRBG BLOCKS PRODUCED BETWEEN RESEEDs = %s\n"
         "FIPS 140-2 VALIDATION = %s\n",
         arguments.derivation_function      ? "yes" : "no",
+        arguments.aes_key_length,
         arguments.max_num_of_blocks,
         arguments.randomize_num_of_blocks  ? "yes" : "no",
         arguments.fips_test                ? "yes" : "no");
 
     if ( arguments.fips_test ) fprintf(stderr, "OUTPUT FIPS INIT BITS = %s\n", arguments.output_fips_init_bits ? "yes" : "no");
+    if ( arguments.fips_test ) fprintf(stderr, "FIPS THREADS = %d\n", arguments.fips_threads);
 
     if ( arguments.output_file == NULL ) {
       fprintf(stderr, "OUTPUT_FILE = STDOUT\n");
@@ -766,6 +1016,7 @@ int main(int argc, char **argv) {
     
     if ( arguments.write_statistics ) fprintf (stderr, "WRITE OUT STATISTICS EVERY = %ld seconds\n",  arguments.write_statistics);
     fprintf (stderr, "VERBOSE = %s, LEVEL = %d\n",  arguments.verbose ? "yes" : "no", arguments.verbose);
+    fprintf (stderr, "%s", dump_csprng_cpu_dispatch());
     fprintf (stderr, "===================================================================\n");
   }
 //}}}  
@@ -819,12 +1070,16 @@ int main(int argc, char **argv) {
     remaining_bytes = 0;
   } 
 
-  output_buffer	= (unsigned char*) malloc ( output_buffer_size * sizeof(unsigned char) );
-  if ( output_buffer ==NULL ) {
-    error(EXIT_FAILURE, errno,"Dynamic memory allocation failed\n");
-  } 
-
   mode_of_operation.use_df                        = arguments.derivation_function;
+  mode_of_operation.aes_key_length                = arguments.aes_key_length;
+  mode_of_operation.drbg_mechanism                = arguments.drbg_mechanism;
+  mode_of_operation.drbg_hash                     = arguments.drbg_hash;
+  mode_of_operation.generate_threads              = arguments.generate_threads;
+  mode_of_operation.ctr_drbg_lanes                = arguments.ctr_drbg_lanes;
+  mode_of_operation.fips_threads                  = arguments.fips_threads;
+  mode_of_operation.health_min_entropy            = arguments.health_min_entropy;
+  mode_of_operation.health_action                 = arguments.health_action;
+  mode_of_operation.prefetch_watermark            = arguments.prefetch_watermark;
   mode_of_operation.havege_debug_flags            = 0;
   mode_of_operation.havege_status_flag            = ( arguments.verbose == 2 ) ? 1 : 0;
   mode_of_operation.havege_data_cache_size        = arguments.havege_data_cache_size;        
@@ -834,6 +1089,10 @@ int main(int argc, char **argv) {
   mode_of_operation.random_length_of_csprng_generated_bytes = arguments.randomize_num_of_blocks;
   mode_of_operation.http_random_verbosity         = arguments.verbose;
 
+  if ( arguments.autotune && csprng_autotune(&mode_of_operation, arguments.fips_test, arguments.autotune_profile, fileno(fd_out)) ) {
+    error(EXIT_FAILURE, 0, "ERROR: csprng_autotune has failed.\n");
+  }
+
   fips_state = fips_approved_csprng_initialize(arguments.fips_test, 0, &mode_of_operation);
 
   if ( fips_state == NULL ) {
@@ -844,7 +1103,7 @@ int main(int argc, char **argv) {
 
   //{{{ Expected size of the entropy and additional input
   if ( arguments.verbose > 1 || arguments.entropy_source == HTTP_RNG || arguments.add_input_source == HTTP_RNG ) {
-    uint64_t output_buffer_size = fips_state->raw_buf->total_size + fips_state->out_buf->total_size;
+    uint64_t output_buffer_size = fips_state->raw_buf->total_size;
     long double target_rate = arguments.fips_test ? CSPRNG_RATE_WITH_FIPS : CSPRNG_RATE;
     csprng_estimate_bytes_needed ( fips_state->csprng_state, arguments.unlimited, arguments.size, output_buffer_size,
         arguments.verbose, HTTP_REASONABLE_LENGTH, HTTP_RNG_RATE, target_rate);
@@ -872,6 +1131,20 @@ int main(int argc, char **argv) {
       }
     }
   }
+  //Data are written with writev directly from the library buffer
+  if ( fflush(fd_out) ) {
+    error(EXIT_FAILURE, errno, "ERROR: fflush '%s'", arguments.output_file == NULL ? "stdout" : arguments.output_file);
+  }
+  //}}}
+
+  //{{{ Start the background producer
+  if ( arguments.producer_buffers ) {
+    return_code = fips_approved_csprng_start_producer(fips_state, arguments.producer_buffers,
+        arguments.producer_low_watermark, arguments.producer_high_watermark);
+    if ( return_code ) {
+      error(EXIT_FAILURE, 0, "ERROR: fips_approved_csprng_start_producer has failed.\n");
+    }
+  }
   //}}}
 
   //{{{ Signal handling
@@ -901,40 +1174,38 @@ int main(int argc, char **argv) {
   }
   
   while( arguments.unlimited || remaining_bytes > 0 ) {
-    bytes_generated = fips_approved_csprng_generate(fips_state, output_buffer, output_buffer_size);
-
-    if ( bytes_generated < output_buffer_size ) {
-      if (arguments.unlimited || remaining_bytes > bytes_generated ) {
-        fprintf( stderr, "ERROR: fips_approved_csprng_generate has returned %" PRIu64 " Bytes instead of %u Bytes requested.\n", 
-            bytes_generated, output_buffer_size);
-        if ( bytes_generated == 0 ) break;
-      }
+    if ( ! arguments.unlimited && remaining_bytes < UINT32_MAX ) {
+      max_bytes = remaining_bytes;
+    } else {
+      max_bytes = UINT32_MAX;
     }
 
-    if ( arguments.unlimited || remaining_bytes > bytes_generated ) {
-      bytes_to_write = bytes_generated;
-    } else {
-      bytes_to_write = remaining_bytes;
+    segments = csprng_borrow_iov(fips_state, 
+        max_bytes < (unsigned int) fips_state->max_bytes_to_get_from_raw_buf ? max_bytes : (unsigned int) fips_state->max_bytes_to_get_from_raw_buf,
+        max_bytes, iov, IOV_COUNT);
+    if ( segments < 0 ) {
+      fprintf( stderr, "ERROR: csprng_borrow_iov has failed.\n");
+      break;
     }
 
-    return_code = fwrite (output_buffer, sizeof(unsigned char), bytes_to_write, fd_out);
+    bytes_to_write = 0;
+    for ( i = 0; i < segments; ++i ) bytes_to_write += iov[i].iov_len;
+
+    return_code = write_segments(fileno(fd_out), iov, segments);
+    csprng_release(fips_state);
 
     if ( return_code <  bytes_to_write )  {
-      fprintf(stderr, "ERROR: fwrite '%s' - bytes written %d, bytes to write %d, errno %d\n", 
+      fprintf(stderr, "ERROR: writev '%s' - bytes written %d, bytes to write %d, errno %d\n", 
           arguments.output_file == NULL ? "stdout" : arguments.output_file,
           return_code, bytes_to_write, errno);
       exit_status = EXIT_FAILURE;
-      error(0, errno, "ERROR: fwrite '%s'", arguments.output_file == NULL ? "stdout" : arguments.output_file );
+      error(0, errno, "ERROR: writev '%s'", arguments.output_file == NULL ? "stdout" : arguments.output_file );
       break;
     }
 
     total_bytes_written += bytes_to_write;
     if ( ! arguments.unlimited ) { 
       remaining_bytes -= bytes_to_write;
-    } else {
-      if ( bytes_generated < output_buffer_size ) {
-        break;
-      }
     }
 
     if ( gotsigusr1 ) {
@@ -957,6 +1228,8 @@ int main(int argc, char **argv) {
 
   //{{{ END of program - print final summary and do cleaning
 
+  if ( fips_state->producer != NULL ) fips_approved_csprng_stop_producer(fips_state);
+
   if ( arguments.output_file != NULL ) {
     return_code = fclose(fd_out);
     if ( return_code ) {
@@ -992,8 +1265,6 @@ int main(int argc, char **argv) {
     error(EXIT_FAILURE, errno, "ERROR: fips_approved_csprng_destroy has returned %d\n",return_code);
   }
 
-  free(output_buffer);
-
   return(exit_status);
   //}}}
 
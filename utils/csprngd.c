@@ -65,6 +65,7 @@ mpstat -P ALL 2
 
 #include <csprng/csprng.h>
 #include <csprng/helper_utils.h>
+#include <csprng/cpu_dispatch.h>
 
 
 #include <error.h>
@@ -263,6 +264,8 @@ static struct argp_option options[] = {
   {"pidfile",                       'p', "file",  0,  "Path to the PID file for daemon mode." },
   {"no-fips",                       604,      0,  0,  "Turn off FIPS 140-2 random number tests validation. "
     "Default: only data passing FIPS 140-2 random number tests are sent to the kernel entropy pool."},
+  {"fips_threads",                  709,    "N",  0,  "Number of threads (1-64) running the FIPS 140-2 tests. The blocks of each refill "
+    "are split between the threads and approved in their original order. Default: 1"},
   {"write_statistics",              605,    "N",  0,  "Write statistics about the number of provided bytes & entropy "
     "and results of FIPS tests every \"N\" seconds. 0 to disable. Default: 3600s. Output of statistics can be forced anytime by sending SIGUSR1 signal." },
   { 0,                                0,      0,  0,  UNDERLINE "Cryptographically secure pseudo random number generator options" NORMAL},
@@ -275,11 +278,46 @@ static struct argp_option options[] = {
                                                       "Default: HAVEGE."},
   {"entropy_file",                  802, "FILE",  0,  "Use FILE as the source of the RANDOM bytes for CTR_DRBG entropy input. "
                                                       "It implies --entropy-source=EXTERNAL"},  
+  {"health_min_entropy",            710, "H",     0,  "Run the SP 800-90B Repetition Count and Adaptive Proportion tests on the data of HAVEGE, HTTP_RNG, "
+                                                      "STDIN and EXTERNAL sources before they are buffered. H is the claimed min-entropy in bits "
+                                                      "per byte (0 < H <= 8), the cutoffs are derived from it. What happens on a failure is set by "
+                                                      "--health_action. Default: disabled"},
+  {"health_action",                 711, "ACTION", 0, "What to do with data failing the health tests: warn reports the failures and uses the "
+                                                      "data, drop discards the data and reads the source again, giving up after 4 failing reads "
+                                                      "in a row, fail discards the data and stops using the source. Default: warn"},
   { 0,                                0, 0,       0,  "" },
   {"derivation_function",           'd', 0,       0,  "Use DERIVATION FUNCTION. It will process entropy "
                                                       "and - when enabled - also additional input through DERIVATION FUNCTION "
                                                       "before reseed/change the state of CTR_DRBG. Default: DERIVATION FUNCTION is not used"},
   {"no-derivation_function",    'd'+OPP, 0, OPTION_HIDDEN,  "Do not use DERIVATION FUNCTION."},
+  {"drbg",                          701, "MECHANISM", 0, "DRBG mechanism: CTR_DRBG, Hash_DRBG, HMAC_DRBG, ChaCha20 or AUTO. ChaCha20 is the fastest "
+                                                      "without AES instructions but it is not a NIST SP 800-90A mechanism. AUTO selects "
+                                                      "CTR_DRBG when the CPU has AES instructions and Hash_DRBG when it has SIMD or SHA instructions only. "
+                                                      "Default: CTR_DRBG"},
+  {"drbg_hash",                     702, "HASH",  0,  "Hash function of Hash_DRBG and HMAC_DRBG: SHA-256 or SHA-512. Default: SHA-256"},
+  {"generate_threads",              703, "N",     0,  "Number of threads (1-64) sharing one CTR_DRBG generate request. Each thread computes "
+                                                      "its own range of counter blocks, the output does not depend on N. Only requests of at "
+                                                      "least 1024 blocks are split, see --max_num_of_blocks. Default: 1"},
+  {"ctr_drbg_lanes",                704, "N",     0,  "Number of independent CTR_DRBG instances (1-8), each with its own entropy input and "
+                                                      "reseed counter. Output block i comes from instance i mod N. The instances are "
+                                                      "encrypted together, which keeps the AES units busy also for short requests. "
+                                                      "Cannot be combined with --generate_threads. Default: 1"},
+  {"producer_buffers",              705, "K",     0,  "Generate and FIPS test the output in a background thread which keeps up to K buffers "
+                                                      "of 64 KiB ready (2-1024). Generation then overlaps with writing out the data. "
+                                                      "0 disables the background thread. Default: 0"},
+  {"producer_watermarks",           706, "LOW:HIGH", 0, "Background thread pauses when HIGH buffers are ready and resumes when they are "
+                                                      "drained to LOW buffers. 0 <= LOW < HIGH <= K. Default: K/2:K"},
+  {"prefetch",                      707, "PERCENT", OPTION_ARG_OPTIONAL, "Read entropy and additional input in background threads "
+                                                      "whenever their buffers are less than PERCENT % full (1-100), so reseeds do not wait "
+                                                      "for the sources. Without PERCENT 50 is used. Default: disabled"},
+  {"autotune",                      708, "PROFILE", OPTION_ARG_OPTIONAL, "Measure the generator for about 0.3 s at startup and choose the sizes "
+                                                      "of the buffers which fit the caches of this host. With PROFILE the sizes are read from "
+                                                      "that file if it has an entry for this host and these options, otherwise the measured "
+                                                      "sizes are added to it. Default: fixed sizes"},
+  {"aes_key_length",                'k', "BITS",  0,  "AES key length of CTR_DRBG in bits: 128, 192 or 256. Longer keys give "
+                                                      "192/256-bit security strength at the cost of 2 or 4 more AES rounds per block. "
+                                                      "With DERIVATION FUNCTION and additional input, the entropy input grows to the key length. "
+                                                      "Default: 128"},
   { 0,                                0, 0,       0,  "" },
   {"additional_source",              851,"SOURCE",0,  "Use additional input and specify the SOURCE of the RANDOM bytes for CTR_DRBG additional input. "
                                                       "One of the following can be used: NONE|HAVEGE|SHA1_RNG|MT_RNG|STDIN|EXTERNAL. "
@@ -327,6 +365,20 @@ struct arguments {
   int pid_file_spec;                  //Was -p used? -p has no meaning when -f is specified.
   int fips_test;                      //Run fips tests?
   int derivation_function;            //Use DERIVATION FUNCTION?                         1=>true, 0=false
+  int aes_key_length;                 //AES key length of CTR_DRBG in bits: 128, 192 or 256
+  drbg_mechanism_type drbg_mechanism; //CTR_DRBG, Hash_DRBG, HMAC_DRBG or AUTO
+  nist_hash_type drbg_hash;           //Hash function of Hash_DRBG and HMAC_DRBG
+  int generate_threads;               //Threads sharing one large CTR_DRBG generate request
+  int ctr_drbg_lanes;                 //Independent CTR_DRBG instances interleaved block by block
+  int fips_threads;                   //Threads running the FIPS tests of one refill
+  double health_min_entropy;          //Claimed min-entropy of the noise sources for the SP 800-90B health tests. 0 => disabled
+  health_action_type health_action;   //What happens with data failing the health tests
+  int producer_buffers;               //Buffers of the background producer thread. 0 => no background thread
+  int producer_low_watermark;         //Background thread resumes when the ready buffers drop to this level
+  int producer_high_watermark;        //Background thread pauses at this number of ready buffers. 0 => not set
+  int prefetch_watermark;             //Entropy and additional input are read ahead by background threads. 0 => disabled
+  int autotune;                       //Choose the buffer sizes by a measurement at startup. 0 => disabled
+  char *autotune_profile;             //File with the results of the earlier measurements. NULL => always measure
   int max_num_of_blocks;              //Maximum number MAX of CTR_DRBG blocks produced before reseed is performed
   int randomize_num_of_blocks;        //Randomize number of CTR_DRBG blocks produced before reseed is performed. 1=>true, 0=false
   int havege_data_cache_size;         //CPU data cache SIZE in KiB for HAVEGE. Default 0 (autodetected)
@@ -356,6 +408,20 @@ static struct arguments arguments = {
   .fips_test = 1,
   .entropy_per_bit = 1.0,
   .derivation_function = 0,
+  .aes_key_length = NIST_BLOCK_KEYLEN,
+  .drbg_mechanism = DRBG_CTR,
+  .drbg_hash = NIST_HASH_SHA256,
+  .generate_threads = 1,
+  .ctr_drbg_lanes = 1,
+  .fips_threads = 1,
+  .health_min_entropy = 0.0,
+  .health_action = HEALTH_WARN,
+  .producer_buffers = 0,
+  .producer_low_watermark = 0,
+  .producer_high_watermark = 0,
+  .prefetch_watermark = 0,
+  .autotune = 0,
+  .autotune_profile = NULL,
   .max_num_of_blocks = 512,
   .randomize_num_of_blocks = 1,
   .havege_data_cache_size = 0,
@@ -394,6 +460,109 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
     case 'd'+OPP:
       arguments->derivation_function = 0;
       break;
+    case 'k':{
+      long int n;
+      char *p;
+      n = strtol(arg, &p, 10);
+      if ((p == arg) || (*p != 0) || ! NIST_KEYLEN_VALID(n) )
+       argp_error(state, "AES key length has to be 128, 192 or 256 bits. Got \"%s\".", arg);
+      else
+        arguments->aes_key_length = n;
+      break;
+    }
+    case 701:
+      if ( strcmp("CTR_DRBG", arg) == 0 ) {
+        arguments->drbg_mechanism = DRBG_CTR;
+      } else if ( strcmp("Hash_DRBG", arg) == 0 ) {
+        arguments->drbg_mechanism = DRBG_HASH;
+      } else if ( strcmp("HMAC_DRBG", arg) == 0 ) {
+        arguments->drbg_mechanism = DRBG_HMAC;
+      } else if ( strcmp("ChaCha20", arg) == 0 ) {
+        arguments->drbg_mechanism = DRBG_CHACHA20;
+      } else if ( strcmp("AUTO", arg) == 0 ) {
+        arguments->drbg_mechanism = DRBG_AUTO;
+      } else {
+        argp_error(state, "drbg can be one of CTR_DRBG|Hash_DRBG|HMAC_DRBG|ChaCha20|AUTO. Got '%s'", arg);
+      }
+      break;
+    case 702:
+      if ( strcmp("SHA-256", arg) == 0 ) {
+        arguments->drbg_hash = NIST_HASH_SHA256;
+      } else if ( strcmp("SHA-512", arg) == 0 ) {
+        arguments->drbg_hash = NIST_HASH_SHA512;
+      } else {
+        argp_error(state, "drbg_hash can be one of SHA-256|SHA-512. Got '%s'", arg);
+      }
+      break;
+    case 703:{
+      char *p;
+      long int n;
+      n = strtol(arg, &p, 10);
+      if ((p == arg) || (*p != 0) || n < 1 || n > 64 )
+        argp_error(state, "generate_threads has to be in range 1-64. Got \"%s\".", arg);
+      else
+        arguments->generate_threads = n;
+      break;
+    }
+    case 709:{
+      char *p;
+      long int n;
+      n = strtol(arg, &p, 10);
+      if ((p == arg) || (*p != 0) || n < 1 || n > 64 )
+        argp_error(state, "fips_threads has to be in range 1-64. Got \"%s\".", arg);
+      else
+        arguments->fips_threads = n;
+      break;
+    }
+    case 704:{
+      char *p;
+      long int n;
+      n = strtol(arg, &p, 10);
+      if ((p == arg) || (*p != 0) || n < 1 || n > NIST_CTR_DRBG_MAX_LANES )
+        argp_error(state, "ctr_drbg_lanes has to be in range 1-%d. Got \"%s\".", NIST_CTR_DRBG_MAX_LANES, arg);
+      else
+        arguments->ctr_drbg_lanes = n;
+      break;
+    }
+    case 705:{
+      char *p;
+      long int n;
+      n = strtol(arg, &p, 10);
+      if ((p == arg) || (*p != 0) || n == 1 || n < 0 || n > CSPRNG_PRODUCER_MAX_BUFFERS )
+        argp_error(state, "producer_buffers has to be 0 or in range 2-%d. Got \"%s\".", CSPRNG_PRODUCER_MAX_BUFFERS, arg);
+      else
+        arguments->producer_buffers = n;
+      break;
+    }
+    case 706:{
+      int low, high;
+      char c;
+      if ( sscanf(arg, "%d:%d%c", &low, &high, &c) != 2 || low < 0 || low >= high )
+        argp_error(state, "producer_watermarks has to be LOW:HIGH with 0 <= LOW < HIGH. Got \"%s\".", arg);
+      else {
+        arguments->producer_low_watermark = low;
+        arguments->producer_high_watermark = high;
+      }
+      break;
+    }
+    case 707:{
+      char *p;
+      long int n;
+      if ( arg == NULL ) {
+        arguments->prefetch_watermark = 50;
+        break;
+      }
+      n = strtol(arg, &p, 10);
+      if ((p == arg) || (*p != 0) || n < 1 || n > 100 )
+        argp_error(state, "prefetch has to be in range 1-100. Got \"%s\".", arg);
+      else
+        arguments->prefetch_watermark = n;
+      break;
+    }
+    case 708:
+      arguments->autotune = 1;
+      arguments->autotune_profile = arg;
+      break;
       
     case 801:
       if ( strcmp("HAVEGE", arg) == 0 ) {
@@ -418,6 +587,29 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
       arguments->entropy_file = arg;
       break;
 
+    case 710:{
+      double d;
+      char *p;
+      errno = 0;
+      d = strtod(arg, &p);
+      if ((p == arg) || (*p != 0) || errno == ERANGE || !(d > 0.0) || (d > 8.0))
+        argp_error(state, "Value H for --health_min_entropy=H has to be in range 0 < H <= 8. Got \"%s\".", arg);
+      else
+        arguments->health_min_entropy = d;
+      break;
+    }
+    case 711:
+      if ( strcmp("warn", arg) == 0 ) {
+        arguments->health_action = HEALTH_WARN;
+      } else if ( strcmp("drop", arg) == 0 ) {
+        arguments->health_action = HEALTH_DROP;
+      } else if ( strcmp("fail", arg) == 0 ) {
+        arguments->health_action = HEALTH_FAIL;
+      } else {
+        argp_error(state, "health_action can be one of warn|drop|fail. Got '%s'", arg);
+      }
+      break;
+
     case 851:
       if ( strcmp("NONE", arg) == 0) {
         arguments->add_input_source = NONE;
@@ -578,6 +770,13 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
       break;
 
     case ARGP_KEY_END:
+      if ( arguments->producer_high_watermark == 0 ) {
+        arguments->producer_high_watermark = arguments->producer_buffers;
+        arguments->producer_low_watermark = arguments->producer_buffers / 2;
+      } else if ( arguments->producer_high_watermark > arguments->producer_buffers ) {
+        argp_error(state, "HIGH value of --producer_watermarks can be at most --producer_buffers=%d.\n", arguments->producer_buffers);
+      }
+
 
       //{{{ Are entropy sources input options consistent?
       if ( arguments->entropy_source == EXTERNAL &&  arguments->entropy_file == NULL ) {
@@ -999,6 +1198,10 @@ int main(int argc, char **argv) {
     } else {
       fprintf (stderr, "ENTROPY SOURCE = %s\n", source_names[arguments.entropy_source]);
     }
+    if ( arguments.health_min_entropy > 0.0 ) {
+      fprintf (stdout, "SP 800-90B HEALTH TESTS MIN-ENTROPY = %g bits per byte\n", arguments.health_min_entropy);
+      fprintf (stdout, "SP 800-90B HEALTH TESTS ON FAILURE = %s\n", health_action_names[arguments.health_action]);
+    }
 
     fprintf( stdout, "USE ADDITIONAL INPUT = %s\n", (arguments.add_input_source != NONE ) ? "yes" : "no" );
     if ( arguments.add_input_source != NONE ) {
@@ -1009,8 +1212,17 @@ int main(int argc, char **argv) {
       }
     }
 
+    fprintf( stdout, "DRBG MECHANISM = %s\n", drbg_mechanism_names[arguments.drbg_mechanism]);
+    if ( arguments.drbg_mechanism == DRBG_HASH || arguments.drbg_mechanism == DRBG_HMAC ) fprintf( stdout, "DRBG HASH = %s\n", nist_hash_names[arguments.drbg_hash]);
+    if ( arguments.drbg_mechanism == DRBG_CTR ) fprintf( stdout, "GENERATE THREADS = %d\n", arguments.generate_threads);
+    if ( arguments.drbg_mechanism == DRBG_CTR ) fprintf( stdout, "CTR_DRBG LANES = %d\n", arguments.ctr_drbg_lanes);
+    if ( arguments.producer_buffers ) fprintf( stdout, "BACKGROUND PRODUCER BUFFERS = %d, WATERMARKS = %d:%d\n",
+        arguments.producer_buffers, arguments.producer_low_watermark, arguments.producer_high_watermark);
+    if ( arguments.prefetch_watermark ) fprintf (stdout, "PREFETCH WATERMARK = %d %%\n", arguments.prefetch_watermark);
+    if ( arguments.autotune ) fprintf (stdout, "AUTOTUNE BUFFER SIZES = yes, PROFILE = %s\n", arguments.autotune_profile ? arguments.autotune_profile : "none");
     fprintf( stdout, "USE DERIVATION FUNCTION = %s\n",
         arguments.derivation_function      ? "yes" : "no");
+    fprintf( stdout, "AES KEY LENGTH = %d bits\n", arguments.aes_key_length);
 
     fprintf( stdout, "MAXIMUM NUMBER OF CTR_DRBG BLOCKS PRODUCED BETWEEN RESEEDs = %d\n",
         arguments.max_num_of_blocks);
@@ -1019,6 +1231,7 @@ int main(int argc, char **argv) {
         
     fprintf( stdout, "FIPS 140-2 VALIDATION = %s\n",
         arguments.fips_test                ? "yes" : "no");
+    if ( arguments.fips_test ) fprintf( stdout, "FIPS THREADS = %d\n", arguments.fips_threads);
 
     fprintf( stdout, "ENTROPY PER BIT = %g \n",
         arguments.entropy_per_bit );
@@ -1040,6 +1253,7 @@ int main(int argc, char **argv) {
     fprintf( stdout, "VERBOSE = %s, LEVEL = %d\n", 
         arguments.verbose                  ? "yes" : "no",
         arguments.verbose);
+    fprintf (stdout, "%s", dump_csprng_cpu_dispatch());
 
     fprintf (stdout, "===================================================================\n");
   }
@@ -1099,6 +1313,15 @@ int main(int argc, char **argv) {
 
 
   mode_of_operation.use_df                        = arguments.derivation_function;
+  mode_of_operation.aes_key_length                = arguments.aes_key_length;
+  mode_of_operation.drbg_mechanism                = arguments.drbg_mechanism;
+  mode_of_operation.drbg_hash                     = arguments.drbg_hash;
+  mode_of_operation.generate_threads              = arguments.generate_threads;
+  mode_of_operation.ctr_drbg_lanes                = arguments.ctr_drbg_lanes;
+  mode_of_operation.fips_threads                  = arguments.fips_threads;
+  mode_of_operation.health_min_entropy            = arguments.health_min_entropy;
+  mode_of_operation.health_action                 = arguments.health_action;
+  mode_of_operation.prefetch_watermark            = arguments.prefetch_watermark;
   mode_of_operation.havege_debug_flags            = 0;
   mode_of_operation.havege_status_flag            = ( arguments.verbose == 2 ) ? 1 : 0;           
   mode_of_operation.havege_data_cache_size        = arguments.havege_data_cache_size; 
@@ -1108,6 +1331,11 @@ int main(int argc, char **argv) {
   mode_of_operation.random_length_of_csprng_generated_bytes = arguments.randomize_num_of_blocks;
   mode_of_operation.http_random_verbosity         = arguments.verbose; 
 
+  if ( arguments.autotune && csprng_autotune(&mode_of_operation, arguments.fips_test, arguments.autotune_profile, -1) ) {
+    fprintf( stderr, "ERROR: csprng_autotune has failed.\n");
+    die(EXIT_FAILURE);
+  }
+
   fips_state = fips_approved_csprng_initialize(arguments.fips_test, 0, &mode_of_operation);
   if ( fips_state == NULL ) {
     fprintf( stderr, "ERROR: fips_approved_csprng_initialize has failed.\n");
@@ -1133,7 +1361,7 @@ int main(int argc, char **argv) {
 
   //{{{ Expected size of the entropy and additional input
   if ( arguments.verbose > 1 || arguments.entropy_source == HTTP_RNG || arguments.add_input_source == HTTP_RNG ) {
-    uint64_t output_buffer_size = fips_state->raw_buf->total_size + fips_state->out_buf->total_size;
+    uint64_t output_buffer_size = fips_state->raw_buf->total_size;
     long double target_rate = arguments.fips_test ? CSPRNG_RATE_WITH_FIPS : CSPRNG_RATE;
     csprng_estimate_bytes_needed ( fips_state->csprng_state, 1, 0, output_buffer_size,
         arguments.verbose, HTTP_REASONABLE_LENGTH, HTTP_RNG_RATE, target_rate);
@@ -1148,6 +1376,17 @@ int main(int argc, char **argv) {
   }
   //}}}
 
+  //{{{ Start the background producer
+  if ( arguments.producer_buffers ) {
+    return_code = fips_approved_csprng_start_producer(fips_state, arguments.producer_buffers,
+        arguments.producer_low_watermark, arguments.producer_high_watermark);
+    if ( return_code ) {
+      fprintf(stderr, "ERROR: fips_approved_csprng_start_producer has failed.\n");
+      die(EXIT_FAILURE);
+    }
+  }
+  //}}}
+
 //{{{ Signal handling
   sigemptyset( &sigact.sa_mask );
   sigact.sa_flags = 0;
@@ -1259,6 +1498,7 @@ int main(int argc, char **argv) {
       //fprintf ( stdout, "Total number of bytes sent to kernel's random device: \t%" PRIu64 "\n", total_bytes_generated);
       print_statistics(total_bytes_generated, stdout, &start_time);
       if ( arguments.fips_test) fprintf ( stdout, "%s", dump_fips_statistics ( &fips_state->fips_ctx.fips_statistics ) );
+      if ( arguments.health_min_entropy > 0.0 ) fips_approved_csprng_statistics(fips_state);
     }
   }
 
@@ -1266,10 +1506,12 @@ int main(int argc, char **argv) {
 
   //{{{ END of program - print final summary and do cleaning
   if ( gotsigterm ) fprintf ( stderr, "Received signal number %d\n", gotsigterm);
+  if ( fips_state->producer != NULL ) fips_approved_csprng_stop_producer(fips_state);
 
   //fprintf ( stdout, "Total number of bytes sent to kernel's random device: \t%" PRIu64 "\n", total_bytes_generated);
   print_statistics(total_bytes_generated, stdout, &start_time);
   if ( arguments.fips_test)  fprintf( stdout, "%s", dump_fips_statistics ( &fips_state->fips_ctx.fips_statistics ) );
+  if ( arguments.health_min_entropy > 0.0 ) fips_approved_csprng_statistics(fips_state);
   return_code = fips_approved_csprng_destroy(fips_state);
   if ( return_code ) {
     fprintf(stderr, "ERROR: fips_approved_csprng_destroy has failed.\n");
@@ -375,6 +375,7 @@ int main(int argc, char **argv) {
   int exit_status = EXIT_SUCCESS;
   int rc;
   char havege_buf[2048];
+  havege_type* havege;
   const DATA_TYPE* buf;
 
   int bytes_to_write;
@@ -427,14 +428,14 @@ int main(int argc, char **argv) {
 //}}}  
 
 // {{{ Init
-  rc = havege_init( arguments.havege_inst_cache_size, arguments.havege_data_cache_size, 0);
-  if ( rc ) {
-    fprintf(stderr, "ERROR: havege_init has returned %d\n",rc);
+  havege = havege_init( arguments.havege_inst_cache_size, arguments.havege_data_cache_size, 0);
+  if ( havege == NULL ) {
+    fprintf(stderr, "ERROR: havege_init has failed.\n");
     return 1;
   }
 
   if ( arguments.verbose > 1 ) {
-    havege_status(havege_buf, 2048);
+    havege_status(havege, havege_buf, 2048);
     fprintf(stderr,"================HAVEGE STATUS REPORT================\n");
     fprintf(stderr, "%s\n", havege_buf);
     fprintf(stderr,"====================================================\n");
@@ -507,7 +508,7 @@ int main(int argc, char **argv) {
 
   while( arguments.unlimited || remaining_bytes > 0 ) {
 
-    buf = ndrand_full_buffer();
+    buf = ndrand_full_buffer(havege);
     if ( arguments.unlimited || remaining_bytes > bytes_generated ) {
       bytes_to_write = bytes_generated;
     } else {
@@ -578,7 +579,7 @@ int main(int argc, char **argv) {
 
 
 
-  havege_destroy();
+  havege_destroy(havege);
   
   return(exit_status);
 